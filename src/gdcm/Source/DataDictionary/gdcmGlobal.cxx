@@ -18,6 +18,7 @@
 
 #include <limits.h> // PATH_MAX
 #include <string.h> // strcpy
+#include <mutex> // std::call_once
 #ifdef _WIN32
 #include <windows.h> // MAX_PATH
 #endif
@@ -29,6 +30,10 @@ namespace gdcm
 // necessary.
 unsigned int GlobalCount;
 
+// The default dicts are filled in on first use, so programs that never
+// touch a DICOM file do not pay for building them
+static std::once_flag GlobalDictsOnce;
+
 class GlobalInternal
 {
 public:
@@ -79,10 +84,8 @@ Global::Global()
     assert( Internals == nullptr ); // paranoid
     Internals = new GlobalInternal;
     assert( Internals->GlobalDicts.IsEmpty() );
-    // Fill in with default values now !
-    // at startup time is safer as later call might be from different thread
-    // thus initialization of std::map would be all skrew up
-    Internals->GlobalDicts.LoadDefaults();
+    // Default values are filled in by the first GetDicts(). std::call_once
+    // makes that safe when the first call comes from different threads
     assert( Internals->GlobalDefs.IsEmpty() );
     // Same goes for GlobalDefs:
     //Internals->GlobalDefs.LoadDefaults();
@@ -171,12 +174,14 @@ const char *Global::Locate(const char *resfile) const
 
 Dicts const &Global::GetDicts() const
 {
+  std::call_once( GlobalDictsOnce, [](){ Internals->GlobalDicts.LoadDefaults(); } );
   assert( !Internals->GlobalDicts.IsEmpty() );
   return Internals->GlobalDicts;
 }
 
 Dicts &Global::GetDicts()
 {
+  std::call_once( GlobalDictsOnce, [](){ Internals->GlobalDicts.LoadDefaults(); } );
   assert( !Internals->GlobalDicts.IsEmpty() );
   return Internals->GlobalDicts;
 }
@@ -37,6 +37,77 @@
 #include <iostream>
 #include <SmtpMime>
 
+
+/* ---------------------------------------------------------- */
+/* --------- RunClusterSubmodule ---------------------------- */
+/* ---------------------------------------------------------- */
+/* the cluster submodules run for every check-in and result   */
+/* from every cluster job, so they skip the command line      */
+/* parser and only load the config and connect. returns -1 if */
+/* the arguments aren't simple enough, and the full parser    */
+/* handles them instead                                       */
+/* ---------------------------------------------------------- */
+int RunClusterSubmodule(int argc, char *argv[]) {
+
+	/* short and long names of the options that take a value */
+	static const QHash<QString, QString> names = {
+		{"-u", "u"}, {"--submodule", "u"}, {"-a", "a"}, {"--analysisid", "a"},
+		{"-s", "s"}, {"--status", "s"}, {"-m", "m"}, {"--message", "m"}, {"-c", "c"}, {"--command", "c"},
+		{"-t", "t"}, {"--text", "t"}, {"-n", "n"}, {"--number", "n"}, {"-f", "f"}, {"--file", "f"},
+		{"-i", "i"}, {"--image", "i"}, {"-e", "e"}, {"--desc", "e"}, {"--unit", "unit"} };
+
+	QHash<QString, QString> opt;
+	bool debug(false);
+	for (int i=2; i<argc; i++) {
+		QString arg = QString::fromLocal8Bit(argv[i]);
+		if ((arg == "-d") || (arg == "--debug"))
+			debug = true;
+		else if ((arg == "-q") || (arg == "--quiet"))
+			continue;
+		else if (names.contains(arg) && (i+1 < argc))
+			opt[names[arg]] = QString::fromLocal8Bit(argv[++i]).trimmed();
+		else
+			return -1;
+	}
+
+	QString submodule = opt["u"];
+	QStringList submodules = { "pipelinecheckin", "resultinsert", "resultinsertbulk", "updateanalysis", "checkcompleteanalysis", "reconcileanalysis", "startup" };
+	if (!submodules.contains(submodule))
+		return -1;
+
+	/* load the config file and connect to the database */
+	nidb *n = new nidb("cluster", true);
+	if (debug)
+		n->cfg["debug"] = "1";
+	n->DatabaseConnect(true);
+	moduleCluster *m = new moduleCluster(n);
+
+	bool ret = true;
+	QString msg;
+	if (submodule == "pipelinecheckin")
+		ret = m->PipelineCheckin(opt["a"], opt["s"], opt["m"], opt["c"], msg);
+	else if (submodule == "resultinsert")
+		ret = m->ResultInsert(opt["a"], opt["t"], opt["n"], opt["f"], opt["i"], opt["e"], opt["unit"], msg);
+	else if (submodule == "resultinsertbulk")
+		ret = m->ResultInsertBulk(opt["a"], opt["f"], msg);
+	else if (submodule == "updateanalysis")
+		ret = m->UpdateAnalysis(opt["a"], msg);
+	else if (submodule == "checkcompleteanalysis")
+		ret = m->CheckCompleteAnalysis(opt["a"], msg);
+	else if (submodule == "reconcileanalysis")
+		ret = m->ReconcileAnalysis(opt["a"], true, true, msg);
+
+	/* if the operation failed, let the user know. the exit code lets the job script act on it */
+	if (!ret)
+		std::cout << "Error: " << msg.toStdString().c_str() << std::endl;
+
+	delete m;
+	delete n;
+
+	return ret ? 0 : 1;
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- main ------------------------------------------- */
 /* ---------------------------------------------------------- */
@@ -44,6 +115,13 @@ int main(int argc, char *argv[])
 {
 	QCoreApplication a(argc, argv);
 
+	/* the cluster submodules take the short way */
+	if ((argc > 2) && (QString(argv[1]) == "cluster")) {
+		int ret = RunClusterSubmodule(argc, argv);
+		if (ret >= 0)
+			return ret;
+	}
+
 	/* this whole section reads the command line parameters */
 	a.setApplicationVersion(QString("%1.%2.%3").arg(VERSION_MAJ).arg(VERSION_MIN).arg(BUILD_NUM));
 	a.setApplicationName("Neuroinformatics Database (NiDB)");
@@ -64,14 +142,14 @@ int main(int argc, char *argv[])
 	p.addOption(optQuiet);
 
 	/* command line options that take values */
-	QCommandLineOption optSubModule(QStringList() << "u" <<"submodule", "For running on cluster. Sub-modules [ resultinsert, pipelinecheckin, updateanalysis, checkcompleteanalysis ]", "submodule");
+	QCommandLineOption optSubModule(QStringList() << "u" <<"submodule", "For running on cluster. Sub-modules [ resultinsert, resultinsertbulk, pipelinecheckin, updateanalysis, checkcompleteanalysis, reconcileanalysis, startup ]", "submodule");
 	QCommandLineOption optAnalysisID(QStringList() << "a" << "analysisid", "resultinsert -or- pipelinecheckin submodules only", "analysisid");
 	QCommandLineOption optStatus(QStringList() << "s" << "status", "pipelinecheckin submodule", "status");
 	QCommandLineOption optMessage(QStringList() << "m" << "message", "pipelinecheckin submodule", "message");
 	QCommandLineOption optCommand(QStringList() << "c" << "command", "pipelinecheckin submodule", "command");
 	QCommandLineOption optResultText(QStringList() << "t" << "text", "Insert text result (resultinsert submodule)", "text");
 	QCommandLineOption optResultNumber(QStringList() << "n" << "number", "Insert numerical result (resultinsert submodule)", "number");
-	QCommandLineOption optResultFile(QStringList() << "f" << "file", "Insert file result (resultinsert submodule)", "filepath");
+	QCommandLineOption optResultFile(QStringList() << "f" << "file", "Insert file result (resultinsert submodule), or the .csv/.tsv/.json file of results (resultinsertbulk submodule)", "filepath");
 	QCommandLineOption optResultImage(QStringList() << "i" << "image", "Insert image result (resultinsert submodule)", "imagepath");
 	QCommandLineOption optResultDesc(QStringList() << "e" <<"desc", "Result description (resultinsert submodule)", "desc");
 	QCommandLineOption optResultUnit(QStringList() << "unit", "Result unit (resultinsert submodule)", "unit");
@@ -112,7 +190,7 @@ int main(int argc, char *argv[])
 	QString paramResultUnit = p.value(optResultUnit).trimmed();
 
     QStringList modules = { "export", "fileio", "qc", "mriqa", "modulemanager", "import", "pipeline", "importuploaded", "upload", "cluster", "minipipeline" };
-	QStringList submodules = { "pipelinecheckin", "resultinsert", "updateanalysis", "checkcompleteanalysis"};
+	QStringList submodules = { "pipelinecheckin", "resultinsert", "resultinsertbulk", "updateanalysis", "checkcompleteanalysis", "reconcileanalysis", "startup" };
 
 	/* now check the command line parameters passed in, to see if they are calling a valid module */
 	if (!modules.contains(module)) {
@@ -130,11 +208,14 @@ int main(int argc, char *argv[])
 
 	/* we've gotten this far, so let's create the nidb object */
 	nidb *n;
+	int exitcode = 0;
 
 	/* check if this is being run from the cluster or locally */
 	if (module == "cluster") {
 		/* load the config file and connect to the database */
 		n = new nidb(module, true);
+		if (debug)
+			n->cfg["debug"] = "1";
 		n->DatabaseConnect(true);
 		moduleCluster *m = new moduleCluster(n);
 
@@ -144,14 +225,22 @@ int main(int argc, char *argv[])
 			ret = m->PipelineCheckin(paramAnalysisID, paramStatus, paramMessage, paramCommand, msg);
 		else if (paramSubModule == "resultinsert")
 			ret = m->ResultInsert(paramAnalysisID, paramResultText, paramResultNumber, paramResultFile, paramResultImage, paramResultDesc, paramResultUnit, msg);
+		else if (paramSubModule == "resultinsertbulk")
+			ret = m->ResultInsertBulk(paramAnalysisID, paramResultFile, msg);
 		else if (paramSubModule == "updateanalysis")
 			ret = m->UpdateAnalysis(paramAnalysisID, msg);
 		else if (paramSubModule == "checkcompleteanalysis")
 			ret = m->CheckCompleteAnalysis(paramAnalysisID, msg);
+		else if (paramSubModule == "reconcileanalysis")
+			ret = m->ReconcileAnalysis(paramAnalysisID, true, true, msg);
+		else if (paramSubModule == "startup")
+			ret = true; /* only loads the config and connects, to time the startup */
 
 		/* if the operation failed, let the user know */
-		if (!ret)
+		if (!ret) {
 			std::cout << "Error: " << msg.toStdString().c_str() << std::endl;
+			exitcode = 1;
+		}
 
 		delete m;
 	}
@@ -276,6 +365,6 @@ int main(int argc, char *argv[])
 	/* exit the event loop */
 	a.exit();
 
-	/* assume everything is happy! */
-	return 0;
+	/* assume everything is happy, unless a cluster submodule failed */
+	return exitcode;
 }
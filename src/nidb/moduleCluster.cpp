@@ -21,6 +21,9 @@
   ------------------------------------------------------------------------------ */
 
 #include <QSqlQuery>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QJsonObject>
 #include "moduleCluster.h"
 #include "analysis.h"
 
@@ -132,6 +135,136 @@ bool moduleCluster::PipelineCheckin(QString analysisid, QString status, QString
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- ApplyCheckinSpool ------------------------------ */
+/* ---------------------------------------------------------- */
+/* apply the check-ins that cluster jobs have written to the  */
+/* spool directory, instead of each one starting nidb and     */
+/* connecting to the database. each file is one check-in:     */
+/* time(ns) analysisid status hostname message, tab separated */
+/* each analysis gets one update (for its last check-in) and  */
+/* the history is written with multi-row inserts. the files  */
+/* are deleted once the updates are committed. returns the    */
+/* number of check-ins applied                                */
+/* ---------------------------------------------------------- */
+int moduleCluster::ApplyCheckinSpool(QString dir, int max) {
+
+	QDir d(dir);
+	if ((dir == "") || (!d.exists()))
+		return 0;
+
+	/* the file names start with the time, so this is the order they were written in */
+	QStringList files = d.entryList(QStringList() << "*.chk", QDir::Files, QDir::Name);
+	if (files.size() > max)
+		files = files.mid(0, max);
+	if (files.size() < 1)
+		return 0;
+
+	struct checkin {
+		qint64 analysisid;
+		qint64 time;
+		QString status;
+		QString hostname;
+		QString message;
+	};
+	QList<checkin> checkins;
+	QMap<qint64, QList<int>> byanalysis;
+	QStringList applied;
+	foreach (QString f, files) {
+		QFile file(dir + "/" + f);
+		if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+			continue;
+		QStringList parts = QString(file.readAll()).trimmed().split('\t');
+		file.close();
+
+		if ((parts.size() < 5) || (!n->IsInt(parts[1]))) {
+			n->WriteLog("Invalid check-in [" + f + "]");
+			file.remove();
+			continue;
+		}
+		applied << file.fileName();
+		checkin c;
+		c.analysisid = parts[1].toLongLong();
+		c.time = parts[0].toLongLong()/1000000000;
+		c.status = parts[2];
+		c.hostname = parts[3];
+		c.message = parts.mid(4).join(' ');
+		byanalysis[c.analysisid].append(checkins.size());
+		checkins.append(c);
+	}
+
+	n->db.transaction();
+	QSqlQuery q;
+	for (QMap<qint64, QList<int>>::const_iterator it = byanalysis.constBegin(); it != byanalysis.constEnd(); ++it) {
+		/* the last check-in sets the status, same as PipelineCheckin(). the start and end times come from whichever check-ins had them */
+		qint64 started(0), complete(0);
+		foreach (int i, it.value()) {
+			if (checkins[i].status == "started") started = checkins[i].time;
+			if (checkins[i].status == "complete") complete = checkins[i].time;
+		}
+		const checkin &last = checkins[it.value().last()];
+
+		QStringList set;
+		bool full(true);
+		if (last.status == "completererun") {
+			set << "analysis_status = 'complete'" << "analysis_rerunresults = 0";
+			full = false;
+		}
+		else if (last.status == "completesupplement") {
+			set << "analysis_status = 'complete'" << "analysis_rerunresults = 0" << "analysis_runsupplement = 0";
+			full = false;
+		}
+		else {
+			set << "analysis_status = :status" << "analysis_statusdatetime = from_unixtime(:time)" << "analysis_hostname = :hostname";
+			if ((!last.status.startsWith("started")) && (last.status != "complete"))
+				set << "analysis_rerunresults = 0";
+		}
+		set << "analysis_statusmessage = :message";
+		if (started > 0)
+			set << QString("analysis_clusterstartdate = from_unixtime(%1)").arg(started);
+		if (complete > 0)
+			set << QString("analysis_clusterenddate = from_unixtime(%1)").arg(complete);
+
+		q.prepare("update analysis set " + set.join(", ") + " where analysis_id = :analysisid");
+		if (full) {
+			q.bindValue(":status", last.status);
+			q.bindValue(":time", last.time);
+			q.bindValue(":hostname", last.hostname);
+		}
+		q.bindValue(":message", last.message);
+		q.bindValue(":analysisid", it.key());
+		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	}
+
+	/* the history, in chunks */
+	for (int start=0; start<checkins.size(); start+=500) {
+		int end = qMin(start+500, checkins.size());
+		QStringList rows;
+		for (int i=start; i<end; i++)
+			rows << "(?, ?, ?, ?, from_unixtime(?))";
+		q.prepare("insert into analysis_history (analysis_id, analysis_event, analysis_hostname, event_message, event_datetime) values " + rows.join(", "));
+		for (int i=start; i<end; i++) {
+			q.addBindValue(checkins[i].analysisid);
+			q.addBindValue(checkins[i].status);
+			q.addBindValue(checkins[i].hostname);
+			q.addBindValue(checkins[i].message);
+			q.addBindValue(checkins[i].time);
+		}
+		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	}
+	if (!n->db.commit()) {
+		n->WriteLog("Unable to commit the spooled check-ins [" + n->db.lastError().text() + "]. They will be applied on the next run");
+		return 0;
+	}
+
+	/* a check-in is only removed from the spool after it is in the database */
+	foreach (QString f, applied)
+		QFile::remove(f);
+
+	return checkins.size();
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- ResultInsert ----------------------------------- */
 /* ---------------------------------------------------------- */
@@ -266,50 +399,199 @@ bool moduleCluster::ResultInsert(QString paramAnalysisID, QString paramResultTex
 
 
 /* ---------------------------------------------------------- */
-/* --------- UpdateAnalysis --------------------------------- */
+/* --------- ResultInsertBulk ------------------------------- */
 /* ---------------------------------------------------------- */
-bool moduleCluster::UpdateAnalysis(QString analysisid, QString &m) {
+/* insert all of the results in a .csv, .tsv, or .json file. */
+/* the csv/tsv must have a header row with a desc column and  */
+/* number, text, file, image, or unit columns. the json is an */
+/* array of objects with the same keys, or one object of      */
+/* desc:value pairs. names and units are resolved in sets and */
+/* the results go in with a few multi-row inserts, in one     */
+/* transaction. rows that aren't valid are skipped and listed */
+/* in m, and the rest are still inserted                      */
+/* ---------------------------------------------------------- */
+bool moduleCluster::ResultInsertBulk(QString paramAnalysisID, QString paramResultFile, QString &m) {
 
 	m = "";
-
 	QSqlQuery q;
-	qint64 id;
 
 	/* check if the analysis ID is valid */
-	if (n->IsInt(analysisid)) {
-		id = analysisid.toInt();
-		q.prepare("select * from analysis where analysis_id = :analysisid");
-		q.bindValue(":analysisid",id);
-		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-		if (q.size() != 1) {
-			m = QString("analysisID string[%1]  int[%2] not found. q.size() [%3]").arg(analysisid).arg(analysisid.toInt()).arg(q.size());
+	if (!n->IsInt(paramAnalysisID)) {
+		m = "analysisID is not an integer";
+		return false;
+	}
+	qint64 id = paramAnalysisID.toLongLong();
+	q.prepare("select analysis_id from analysis where analysis_id = :analysisid");
+	q.bindValue(":analysisid", id);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.size() != 1) {
+		m = QString("analysisID [%1] not found").arg(paramAnalysisID);
+		return false;
+	}
+
+	QFile f(paramResultFile);
+	if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		m = QString("Unable to open results file [%1]").arg(paramResultFile);
+		return false;
+	}
+	QByteArray contents = f.readAll();
+	f.close();
+
+	/* read the file into rows of column:value */
+	QList<QHash<QString, QString>> rows;
+	QStringList errs;
+	QString ext = QFileInfo(paramResultFile).suffix().toLower();
+	if (ext == "json") {
+		QJsonParseError err;
+		QJsonDocument doc = QJsonDocument::fromJson(contents, &err);
+		if (doc.isNull()) {
+			m = QString("Unable to parse [%1]: %2").arg(paramResultFile).arg(err.errorString());
 			return false;
 		}
+		if (doc.isArray()) {
+			foreach (QJsonValue v, doc.array()) {
+				QJsonObject o = v.toObject();
+				QHash<QString, QString> row;
+				for (QJsonObject::const_iterator it = o.constBegin(); it != o.constEnd(); it++)
+					row[it.key().toLower()] = it.value().isDouble() ? QString::number(it.value().toDouble(), 'g', 17) : it.value().toString();
+				rows.append(row);
+			}
+		}
+		else {
+			QJsonObject o = doc.object();
+			for (QJsonObject::const_iterator it = o.constBegin(); it != o.constEnd(); it++) {
+				QHash<QString, QString> row;
+				row["desc"] = it.key();
+				if (it.value().isDouble())
+					row["number"] = QString::number(it.value().toDouble(), 'g', 17);
+				else
+					row["text"] = it.value().toString();
+				rows.append(row);
+			}
+		}
+	}
+	else if (ext == "tsv") {
+		QStringList lines = QString::fromUtf8(contents).split("\n", Qt::SkipEmptyParts);
+		QStringList cols;
+		if (lines.size() > 0)
+			cols = lines.takeFirst().trimmed().toLower().split("\t");
+		for (int i=0; i<lines.size(); i++) {
+			QStringList parts = lines[i].split("\t");
+			QHash<QString, QString> row;
+			for (int j=0; (j<cols.size()) && (j<parts.size()); j++)
+				row[cols[j].trimmed()] = parts[j].trimmed();
+			rows.append(row);
+		}
 	}
 	else {
-		m = "analysisID is not an integer";
+		csvTable table;
+		QString csvmsg;
+		if (!n->ParseCSV(contents.constData(), contents.size(), table, csvmsg)) {
+			m = QString("Unable to parse [%1] [%2]").arg(paramResultFile).arg(csvmsg);
+			return false;
+		}
+		for (int i=0; i<table.numrows; i++) {
+			QHash<QString, QString> row;
+			for (int c=0; c<table.columns.size(); c++)
+				row[table.columns[c]] = table.data[c][i];
+			rows.append(row);
+		}
+	}
+
+	/* check the rows, and collect the names and units */
+	QStringList names, units;
+	QList<QHash<QString, QString>> valid;
+	for (int i=0; i<rows.size(); i++) {
+		QHash<QString, QString> row = rows[i];
+		QString desc = row.value("desc", row.value("name")).trimmed();
+		QString number = row.value("number", row.value("value")).trimmed();
+		QString text = row.value("text").trimmed();
+		QString file = row.value("file").trimmed();
+		QString image = row.value("image").trimmed();
+
+		int numtypes = (number != "") + (text != "") + (file != "") + (image != "");
+		if (desc == "")
+			errs << QString("Row [%1] has a blank description").arg(i+1);
+		else if (numtypes != 1)
+			errs << QString("Row [%1] [%2] must have exactly one of number, text, file, or image").arg(i+1).arg(desc);
+		else if ((number != "") && (!n->IsNumber(number)))
+			errs << QString("Row [%1] [%2] number is not an integer or floating point value [%3]").arg(i+1).arg(desc).arg(number);
+		else {
+			QHash<QString, QString> r;
+			r["desc"] = desc;
+			if (number != "") {
+				r["type"] = "v";
+				r["value"] = number;
+				r["unit"] = row.value("unit").trimmed();
+				units << r["unit"];
+			}
+			else if (text != "") {
+				r["type"] = "t";
+				r["value"] = text;
+			}
+			else if (file != "") {
+				r["type"] = "f";
+				r["value"] = file;
+			}
+			else {
+				r["type"] = "i";
+				r["value"] = image;
+			}
+			names << desc;
+			valid.append(r);
+		}
+	}
+
+	if (valid.size() < 1) {
+		errs.prepend(QString("No valid results found in [%1]").arg(paramResultFile));
+		m = errs.join("\n");
 		return false;
 	}
 
-	/* get the analysis info. Also checks if the analysis directory exists, and returns it if it does */
-	analysis a(id, n);
-	if (!a.isValid) {
-		m = "Analysis was not valid: [" + a.msg + "]";
+	n->db.transaction();
+
+	n->ResolveIDs("analysis_resultnames", "resultname_id", "result_name", names, resultnameids);
+	n->ResolveIDs("analysis_resultunit", "resultunit_id", "result_unit", units, resultunitids);
+
+	/* multi-row upserts, same as the single ResultInsert */
+	int chunk = 500;
+	for (int i=0; i<valid.size(); i+=chunk) {
+		int end = std::min(i+chunk, valid.size());
+		QStringList placeholders;
+		for (int j=i; j<end; j++)
+			placeholders << "(?, ?, ?, ?, ?, ?, ?)";
+		q.prepare("insert ignore into analysis_results (analysis_id, result_type, result_nameid, result_unitid, result_value, result_text, result_filename) values " + placeholders.join(",") + " on duplicate key update result_count=result_count+1");
+		for (int j=i; j<end; j++) {
+			QString type = valid[j]["type"];
+			q.addBindValue(id);
+			q.addBindValue(type);
+			q.addBindValue(resultnameids.value(valid[j]["desc"].toLower()));
+			q.addBindValue((type == "v") ? QVariant(resultunitids.value(valid[j]["unit"].toLower())) : QVariant());
+			q.addBindValue((type == "v") ? QVariant(valid[j]["value"].toDouble()) : QVariant());
+			q.addBindValue((type == "t") ? QVariant(valid[j]["value"]) : QVariant());
+			q.addBindValue(((type == "f") || (type == "i")) ? QVariant(valid[j]["value"]) : QVariant());
+		}
+		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	}
+
+	if (!n->db.commit()) {
+		m = QString("Unable to commit the results from [%1] [%2]").arg(paramResultFile).arg(n->db.lastError().text());
+		n->db.rollback();
 		return false;
 	}
 
-    m = "Getting directory size for [" + a.analysispath + "]";
-	int c;
-	qint64 b;
-	n->GetDirSizeAndFileCount(a.analysispath, c, b, true);
+	errs.prepend(QString("Inserted [%1] of [%2] results from [%3]").arg(valid.size()).arg(rows.size()).arg(paramResultFile));
+	m = errs.join("\n");
 
-	q.prepare("update analysis set analysis_disksize = :disksize, analysis_numfiles = :numfiles where analysis_id = :analysisid");
-	q.bindValue(":disksize", b);
-	q.bindValue(":numfiles", c);
-	q.bindValue(":analysisid", id);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	return (valid.size() == rows.size());
+}
 
-	return true;
+
+/* ---------------------------------------------------------- */
+/* --------- UpdateAnalysis --------------------------------- */
+/* ---------------------------------------------------------- */
+bool moduleCluster::UpdateAnalysis(QString analysisid, QString &m) {
+	return ReconcileAnalysis(analysisid, true, false, m);
 }
 
 
@@ -317,6 +599,21 @@ bool moduleCluster::UpdateAnalysis(QString analysisid, QString &m) {
 /* --------- CheckCompleteAnalysis -------------------------- */
 /* ---------------------------------------------------------- */
 bool moduleCluster::CheckCompleteAnalysis(QString analysisid, QString &m) {
+	return ReconcileAnalysis(analysisid, false, true, m);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ReconcileAnalysis ------------------------------ */
+/* ---------------------------------------------------------- */
+/* record the size and number of files of an analysis, and/or */
+/* whether it is complete, from one walk of its directory.    */
+/* the walk reads several subdirectories at once, and matches */
+/* every path against all of the pipeline_completefiles globs */
+/* together, instead of checking each file separately. returns */
+/* false if the pipeline modified its linked archive inputs   */
+/* ---------------------------------------------------------- */
+bool moduleCluster::ReconcileAnalysis(QString analysisid, bool updatesize, bool checkcomplete, QString &m) {
 
 	m = "";
 
@@ -346,34 +643,90 @@ bool moduleCluster::CheckCompleteAnalysis(QString analysisid, QString &m) {
 		return false;
 	}
 
-	/* Check the analysispath to see if the required file(s) exist.
-	 * Get a list of expected files from the database */
-	q.prepare("select pipeline_completefiles from pipelines a left join analysis b on a.pipeline_id = b.pipeline_id where b.analysis_id = :analysisid");
-	q.bindValue(":analysisid", analysisid);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	q.first();
-	QString completefiles = q.value("pipeline_completefiles").toString().trimmed();
-	QStringList filelist = completefiles.split(',');
-
-    n->Print("Checking if analysis should be marked successful, based on the successful file list");
-    int iscomplete = 1;
-	for(int i=0; i<filelist.size(); i++) {
-		QString filepath = a.analysispath + "/" + filelist[i];
-		QFile f(filepath);
-		if (!f.exists()) {
-            n->Print("[" + filepath + "] exists");
-            iscomplete = 0;
-			break;
+	/* get the list of expected files, which can be globs, from the database */
+	QStringList patterns;
+	if (checkcomplete) {
+		q.prepare("select pipeline_completefiles from pipelines a left join analysis b on a.pipeline_id = b.pipeline_id where b.analysis_id = :analysisid");
+		q.bindValue(":analysisid", id);
+		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+		if (q.first()) {
+			foreach (QString f, q.value("pipeline_completefiles").toString().split(',')) {
+				if (f.trimmed() != "")
+					patterns << f.trimmed();
+			}
 		}
-        else {
-            n->Print("[" + filepath + "] does not exist");
-        }
 	}
 
-	q.prepare("update analysis set analysis_iscomplete = :iscomplete where analysis_id = :analysisid");
-	q.bindValue(":iscomplete", iscomplete);
-	q.bindValue(":analysisid", analysisid);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	int c(0);
+	qint64 b(0);
+	QVector<bool> found;
+	if ((updatesize) || (patterns.size() > 0))
+		n->GetDirSizeAndMatches(a.analysispath, patterns, c, b, found, true);
+
+	QStringList set;
+	QString statusmsg;
+	if (updatesize)
+		set << "analysis_disksize = :disksize" << "analysis_numfiles = :numfiles";
+
+	if (checkcomplete) {
+		n->Print("Checking if analysis should be marked successful, based on the successful file list");
+		int iscomplete = 1;
+		for (int i=0; i<patterns.size(); i++) {
+			if (found[i])
+				n->Print("[" + a.analysispath + "/" + patterns[i] + "] exists");
+			else {
+				n->Print("[" + a.analysispath + "/" + patterns[i] + "] does not exist");
+				iscomplete = 0;
+			}
+		}
+		set << QString("analysis_iscomplete = %1").arg(iscomplete);
+
+		/* inputs linked to the archive (hardlinks or symlinks) must not be changed by the pipeline,
+		   so compare them against the size and mtime recorded when they were staged */
+		QFile lf(a.analysispath + "/pipeline/linkedinputs.txt");
+		if (lf.open(QIODevice::ReadOnly | QIODevice::Text)) {
+			QStringList modified;
+			QTextStream in(&lf);
+			while (!in.atEnd()) {
+				QStringList parts = in.readLine().split('\t');
+				if (parts.size() < 4)
+					continue;
+				QFileInfo fi(parts[1]);
+				if ((!fi.exists()) || (fi.size() != parts[2].toLongLong()) || (fi.lastModified().toMSecsSinceEpoch() != parts[3].toLongLong()))
+					modified << parts[1];
+			}
+			lf.close();
+
+			/* the archive data is no longer what was imported, so the analysis is an error */
+			if (modified.size() > 0) {
+				n->Print(QString("[%1] archive files linked as inputs were modified in place: [%2]").arg(modified.size()).arg(modified.join(", ")));
+				set << "analysis_status = 'error'" << "analysis_statusmessage = :msg";
+				statusmsg = QString("Pipeline modified [%1] linked input files in the archive in place").arg(modified.size());
+				n->InsertAnalysisEvent(id, a.pipelineid, a.pipelineversion, a.studyid, "analysiserror", statusmsg + " [" + modified.join(", ") + "]");
+			}
+		}
+	}
+
+	/* the size, count, and completeness are recorded together */
+	if (set.size() > 0) {
+		q.prepare("update analysis set " + set.join(", ") + " where analysis_id = :analysisid");
+		if (updatesize) {
+			q.bindValue(":disksize", b);
+			q.bindValue(":numfiles", c);
+		}
+		if (statusmsg != "")
+			q.bindValue(":msg", statusmsg);
+		q.bindValue(":analysisid", id);
+		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	}
+
+	m = QString("Analysis [%1] has [%2] files, [%3] bytes").arg(id).arg(c).arg(b);
+
+	/* the job script checks in as an error instead of complete when this fails */
+	if (statusmsg != "") {
+		m += ". " + statusmsg;
+		return false;
+	}
 
 	return true;
 }
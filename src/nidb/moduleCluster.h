@@ -32,12 +32,18 @@ public:
 	~moduleCluster();
 
 	bool PipelineCheckin(QString analysisid, QString status, QString message, QString command, QString &m);
+	int ApplyCheckinSpool(QString dir, int max=5000);
 	bool ResultInsert(QString paramAnalysisID, QString paramResultText, QString paramResultNumber, QString paramResultFile, QString paramResultImage, QString paramResultDesc, QString paramResultUnit, QString &m);
+	bool ResultInsertBulk(QString paramAnalysisID, QString paramResultFile, QString &m);
 	bool UpdateAnalysis(QString analysisid, QString &m);
 	bool CheckCompleteAnalysis(QString analysisid, QString &m);
+	bool ReconcileAnalysis(QString analysisid, bool updatesize, bool checkcomplete, QString &m);
 
 private:
+
 	nidb *n;
+	QHash<QString, qint64> resultnameids; /* analysis_resultnames, by lowercase name */
+	QHash<QString, qint64> resultunitids; /* analysis_resultunit, by lowercase unit */
 };
 
 #endif // MODULECLUSTER_H
@@ -48,8 +48,10 @@ moduleExport::~moduleExport()
 int moduleExport::Run() {
 	n->WriteLog("Entering the export module");
 
-	/* get list of things to delete */
-	QSqlQuery q("select * from exports where status = 'submitted'");
+	/* get list of exports to perform. exports left in 'processing' by a process on this host that no longer exists are resumed */
+	QSqlQuery q;
+	q.prepare("select * from exports where status = 'submitted' or (status = 'processing' and checkpoint_hostname = :hostname)");
+	q.bindValue(":hostname", QHostInfo::localHostName());
 	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 
 	if (q.size() > 0) {
@@ -91,7 +93,10 @@ int moduleExport::Run() {
 
 			/* get the current status of this fileio request, make sure no one else is processing it, and mark it as being processed if not */
 			QString status = GetExportStatus(exportid);
-			if (status == "submitted") {
+			if ((status == "submitted") || ((status == "processing") && IsStaleExport(exportid))) {
+				if (status == "processing")
+					n->WriteLog(QString("Export [%1] was interrupted. Resuming from the last checkpoint").arg(exportid));
+
 				/* set the status. if something is wrong, skip this request */
 				if (!SetExportStatus(exportid, "processing")) {
 					n->WriteLog(QString("Unable to set export status to [%1]").arg(status));
@@ -184,7 +189,17 @@ QString moduleExport::GetExportStatus(int exportid) {
 /* ---------------------------------------------------------- */
 bool moduleExport::SetExportStatus(int exportid, QString status, QString msg) {
 
-	if (((status == "pending") || (status == "deleting") || (status == "complete") || (status == "error") || (status == "processing") || (status == "cancelled") || (status == "canceled")) && (exportid > 0)) {
+	if (((status == "submitted") || (status == "pending") || (status == "deleting") || (status == "complete") || (status == "error") || (status == "processing") || (status == "cancelled") || (status == "canceled")) && (exportid > 0)) {
+		/* record which process owns this export, so it can be resumed if the process dies */
+		if (status == "processing") {
+			QSqlQuery q;
+			q.prepare("update exports set checkpoint_hostname = :hostname, checkpoint_pid = :pid where export_id = :id");
+			q.bindValue(":id", exportid);
+			q.bindValue(":hostname", QHostInfo::localHostName());
+			q.bindValue(":pid", QCoreApplication::applicationPid());
+			n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+		}
+
 		if (msg.trimmed() == "") {
 			QSqlQuery q;
 			q.prepare("update exports set status = :status where export_id = :id");
@@ -253,6 +268,8 @@ bool moduleExport::GetExportSeriesList(int exportid) {
 			int seriesid = q.value("series_id").toInt();
 			int exportseriesid = q.value("exportseries_id").toInt();
 			QString status = q.value("status").toString();
+			QString checkpoint = q.value("checkpoint").toString();
+			qint64 zipoffset = q.value("checkpoint_zipoffset").toLongLong();
 
 			QSqlQuery q2;
 			q2.prepare(QString("select a.*, b.*, c.enrollment_id, d.project_name, e.uid, e.subject_id from %1_series a left join studies b on a.study_id = b.study_id left join enrollment c on b.enrollment_id = c.enrollment_id left join projects d on c.project_id = d.project_id left join subjects e on e.subject_id = c.subject_id where a.%1series_id = :seriesid order by uid, study_num, series_num").arg(modality));
@@ -288,6 +305,9 @@ bool moduleExport::GetExportSeriesList(int exportid) {
 					QString qcdir = QString("%1/%2/%3/%4/qa").arg(n->cfg["archivedir"]).arg(uid).arg(studynum).arg(seriesnum);
 
 					s[uid][studynum][seriesnum]["exportseriesid"] = QString("%1").arg(exportseriesid);
+					s[uid][studynum][seriesnum]["status"] = status;
+					s[uid][studynum][seriesnum]["checkpoint"] = checkpoint;
+					s[uid][studynum][seriesnum]["zipoffset"] = QString("%1").arg(zipoffset);
 					s[uid][studynum][seriesnum]["seriesid"] = QString("%1").arg(seriesid);
 					s[uid][studynum][seriesnum]["subjectid"] = QString("%1").arg(subjectid);
 					s[uid][studynum][seriesnum]["studyid"] = QString("%1").arg(studyid);
@@ -374,6 +394,192 @@ bool moduleExport::GetExportSeriesList(int exportid) {
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- GetExportCheckpointDir ------------------------- */
+/* ---------------------------------------------------------- */
+/* returns the output directory used by a previous attempt at
+   this export, or records defaultdir if this is the first try */
+QString moduleExport::GetExportCheckpointDir(int exportid, QString defaultdir) {
+	QSqlQuery q;
+	q.prepare("select checkpoint_dir from exports where export_id = :id");
+	q.bindValue(":id", exportid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.size() > 0) {
+		q.first();
+		QString dir = q.value("checkpoint_dir").toString().trimmed();
+		if (dir != "") {
+			n->WriteLog("Resuming export in existing directory [" + dir + "]");
+			return dir;
+		}
+	}
+
+	q.prepare("update exports set checkpoint_dir = :dir where export_id = :id");
+	q.bindValue(":id", exportid);
+	q.bindValue(":dir", defaultdir);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+
+	return defaultdir;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- SetExportSeriesCheckpoint ---------------------- */
+/* ---------------------------------------------------------- */
+bool moduleExport::SetExportSeriesCheckpoint(int exportseriesid, QString checkpoint, qint64 zipoffset) {
+
+	if (exportseriesid < 1)
+		return false;
+
+	QSqlQuery q;
+	if (zipoffset < 0) {
+		q.prepare("update exportseries set checkpoint = :checkpoint, checkpoint_date = now() where exportseries_id = :id");
+	}
+	else {
+		q.prepare("update exportseries set checkpoint = :checkpoint, checkpoint_zipoffset = :zipoffset, checkpoint_date = now() where exportseries_id = :id");
+		q.bindValue(":zipoffset", zipoffset);
+	}
+	q.bindValue(":id", exportseriesid);
+	q.bindValue(":checkpoint", checkpoint);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- CheckpointRank --------------------------------- */
+/* ---------------------------------------------------------- */
+/* stages are completed in this order, so a series at a later
+   stage has also completed all of the earlier stages */
+int moduleExport::CheckpointRank(QString checkpoint) {
+	if (checkpoint == "staged") return 1;
+	else if (checkpoint == "converted") return 2;
+	else if (checkpoint == "anonymized") return 3;
+	else if (checkpoint == "zipped") return 4;
+
+	return 0;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- IsStaleExport ---------------------------------- */
+/* ---------------------------------------------------------- */
+/* an export is stale if it is marked as processing by a
+   process on this host which is no longer running */
+bool moduleExport::IsStaleExport(int exportid) {
+	QSqlQuery q;
+	q.prepare("select checkpoint_hostname, checkpoint_pid from exports where export_id = :id");
+	q.bindValue(":id", exportid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.size() < 1)
+		return false;
+
+	q.first();
+	QString hostname = q.value("checkpoint_hostname").toString();
+	qint64 pid = q.value("checkpoint_pid").toLongLong();
+
+	if (hostname != QHostInfo::localHostName())
+		return false;
+	if (pid == QCoreApplication::applicationPid())
+		return false;
+	if ((pid > 0) && (QFile::exists(QString("/proc/%1").arg(pid))))
+		return false;
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ExportInterrupted ------------------------------ */
+/* ---------------------------------------------------------- */
+/* checked between series. If the module has been disabled the
+   export stops, and is resumed later from its checkpoints */
+bool moduleExport::ExportInterrupted() {
+	n->ModuleRunningCheckIn();
+	if (n->ModuleCheckIfActive())
+		return false;
+
+	n->WriteLog("Module is now inactive, stopping the export. It will be resumed from the last completed series");
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- VerifyZipCheckpoint ---------------------------- */
+/* ---------------------------------------------------------- */
+/* zipoffset is the size of the zip file after the last series
+   was successfully appended. If the file is a different size,
+   an append was interrupted and the central directory is
+   rebuilt before any more series are added */
+bool moduleExport::VerifyZipCheckpoint(QString zipfile, qint64 zipoffset, QStringList &msgs) {
+
+	if (zipoffset <= 0) {
+		/* nothing was appended yet, so start with a fresh zip file */
+		if (QFile::exists(zipfile)) {
+			QFile::remove(zipfile);
+			msgs << n->WriteLog("Removed partial zip file [" + zipfile + "]");
+		}
+		return true;
+	}
+
+	QFileInfo fi(zipfile);
+	if (fi.exists() && (fi.size() == zipoffset)) {
+		msgs << n->WriteLog(QString("Zip file [%1] matches checkpoint offset [%2 bytes]").arg(zipfile).arg(zipoffset));
+		return true;
+	}
+
+	if (!fi.exists()) {
+		msgs << n->WriteLog(QString("Zip file [%1] is missing, expected [%2 bytes]").arg(zipfile).arg(zipoffset));
+		return false;
+	}
+
+	msgs << n->WriteLog(QString("Zip file [%1] is [%2 bytes], but checkpoint offset is [%3 bytes]. Repairing").arg(zipfile).arg(fi.size()).arg(zipoffset));
+	QString fixedzip = zipfile + ".fixed";
+	n->WriteLog(n->SystemCommand(QString("zip -FF %1 --out %2").arg(zipfile).arg(fixedzip), true));
+	if (!QFile::exists(fixedzip))
+		return false;
+
+	QFile::remove(zipfile);
+	return QFile::rename(fixedzip, zipfile);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- AppendToZip ------------------------------------ */
+/* ---------------------------------------------------------- */
+/* append paths (relative to basedir) to the zip file, and return
+   the size of the zip stream afterwards as the new offset */
+bool moduleExport::AppendToZip(QString zipfile, QString basedir, QStringList paths, qint64 &zipoffset, QStringList &msgs) {
+
+	QStringList existing;
+	foreach (QString p, paths) {
+		if (QFileInfo::exists(basedir + "/" + p))
+			existing << "'" + p + "'";
+	}
+
+	if (existing.size() > 0) {
+		QString pwd = QDir::currentPath();
+		QDir::setCurrent(basedir);
+		QString systemstring;
+		if (QFile::exists(zipfile))
+			systemstring = "zip -1grq " + zipfile + " " + existing.join(" ");
+		else
+			systemstring = "zip -1rq " + zipfile + " " + existing.join(" ");
+		n->WriteLog(n->SystemCommand(systemstring, true));
+		QDir::setCurrent(pwd);
+	}
+
+	QFileInfo fi(zipfile);
+	if (!fi.exists()) {
+		msgs << n->WriteLog("Unable to create zip file [" + zipfile + "]");
+		return false;
+	}
+	zipoffset = fi.size();
+
+	return true;
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- ExportLocal ------------------------------------ */
 /* ---------------------------------------------------------- */
@@ -385,12 +591,39 @@ bool moduleExport::ExportLocal(int exportid, QString exporttype, QString nfsdir,
 		return false;
 	}
 
-	QString tmpexportdir = n->cfg["tmpdir"] + "/" + n->GenerateRandomString(20);
+	QString tmpexportdir = GetExportCheckpointDir(exportid, n->cfg["tmpdir"] + "/" + n->GenerateRandomString(20));
 
 	exportstatus = "complete";
 	int laststudynum = 0;
 	QString newseriesnum = "1";
 
+	/* web and public downloads are appended to the zip file one series at a time. Find where the last completed series left the zip stream */
+	bool zipexport = ((exporttype == "web") || (exporttype == "publicdownload"));
+	QString zipfile;
+	if (exporttype == "web")
+		zipfile = QString("%1/NIDB-%2.zip").arg(n->cfg["webdownloaddir"]).arg(exportid);
+	else if (exporttype == "publicdownload")
+		zipfile = QString("%1/NiDB-%2.zip").arg(n->cfg["webdownloaddir"]).arg(exportid);
+
+	qint64 zipoffset = 0;
+	if (zipexport) {
+		for(QMap<QString, QMap<int, QMap<int, QMap<QString, QString>>>>::iterator a = s.begin(); a != s.end(); ++a)
+			for(QMap<int, QMap<int, QMap<QString, QString>>>::iterator b = a.value().begin(); b != a.value().end(); ++b)
+				for(QMap<int, QMap<QString, QString>>::iterator c = b.value().begin(); c != b.value().end(); ++c)
+					if (c.value()["checkpoint"] == "zipped")
+						zipoffset = qMax(zipoffset, c.value()["zipoffset"].toLongLong());
+
+		if (!VerifyZipCheckpoint(zipfile, zipoffset, msgs)) {
+			msgs << n->WriteLog("Unable to verify zip file [" + zipfile + "]. All series will be exported again");
+			QFile::remove(zipfile);
+			zipoffset = 0;
+			for(QMap<QString, QMap<int, QMap<int, QMap<QString, QString>>>>::iterator a = s.begin(); a != s.end(); ++a)
+				for(QMap<int, QMap<int, QMap<QString, QString>>>::iterator b = a.value().begin(); b != a.value().end(); ++b)
+					for(QMap<int, QMap<QString, QString>>::iterator c = b.value().begin(); c != b.value().end(); ++c)
+						c.value()["checkpoint"] = "";
+		}
+	}
+
 	/* iterate through the UIDs */
 	for(QMap<QString, QMap<int, QMap<int, QMap<QString, QString>>>>::iterator a = s.begin(); a != s.end(); ++a) {
 		QString uid = a.key();
@@ -403,8 +636,15 @@ bool moduleExport::ExportLocal(int exportid, QString exporttype, QString nfsdir,
 			for(QMap<int, QMap<QString, QString>>::iterator c = s[uid][studynum].begin(); c != s[uid][studynum].end(); ++c) {
 				int seriesnum = c.key();
 
+				if (ExportInterrupted()) {
+					exportstatus = "submitted";
+					msgs << "Export interrupted, will be resumed from the last checkpoint";
+					msg = msgs.join("\n");
+					return false;
+				}
+
 				int exportseriesid = s[uid][studynum][seriesnum]["exportseriesid"].toInt();
-				SetExportSeriesStatus(exportseriesid, "processing");
+				QString checkpoint = s[uid][studynum][seriesnum]["checkpoint"];
 
 				QString seriesstatus = "complete";
 				QString statusmessage;
@@ -476,6 +716,14 @@ bool moduleExport::ExportLocal(int exportid, QString exporttype, QString nfsdir,
 				else
 					rootoutdir = QString("%1/%2").arg(tmpexportdir).arg(subjectdir);
 
+				/* skip series which were completed by a previous attempt at this export */
+				if (CheckpointRank(checkpoint) >= CheckpointRank(zipexport ? "zipped" : "anonymized")) {
+					msgs << n->WriteLog(QString("Series [%1%2-%3] was completed by a previous attempt [%4]. Skipping").arg(uid).arg(studynum).arg(seriesnum).arg(checkpoint));
+					laststudynum = studynum;
+					continue;
+				}
+				SetExportSeriesStatus(exportseriesid, "processing");
+
 				/* make the output directory */
 				QDir d;
                 if (d.mkpath(rootoutdir)) {
@@ -514,147 +762,159 @@ bool moduleExport::ExportLocal(int exportid, QString exporttype, QString nfsdir,
 
                 n->WriteLog(QString("Export type is '%1'. rootoutdir [%2], outdir [%3], qcoutdir [%4], behoutdir [%5]").arg(exporttype).arg(rootoutdir).arg(outdir).arg(qcoutdir).arg(behoutdir));
 
-				/* export the imaging data */
-				if (downloadimaging) {
-                    n->WriteLog("Downloading imaging data");
-					if (numfiles > 0) {
-                        n->WriteLog(QString("Series contains [%1] files").arg(numfiles));
-						if (datadirexists) {
-                            n->WriteLog("Series data directory [" + indir + "] exists");
-                            if (!datadirempty) {
-                                n->WriteLog("Data directory is empty");
-								// output the correct file type
-								if ((modality != "mr") || (filetype == "dicom") || ((datatype != "dicom") && (datatype != "parrec"))) {
-									// use rsync instead of cp because of the number of files limit
-									QString systemstring = QString("rsync %1/* %2/").arg(indir).arg(outdir);
-									n->WriteLog(n->SystemCommand(systemstring));
-									msgs << "Copying raw data from [" + indir + "] to [" + outdir + "]";
-								}
-								else if (filetype == "qc") {
-									/* copy only the qc data */
-									QString systemstring = QString("cp -R %1/qa %2").arg(indir).arg(qcoutdir);
-									n->WriteLog(n->SystemCommand(systemstring));
-									msgs << "Copying QC data from [" + indir + "/qa] to [" + qcoutdir + "]";
-
-									/* write the series info to a text file */
-									QString seriesfile = outdir + "seriesinfo.txt";
-									QFile f(seriesfile);
-									if (f.open(QIODevice::WriteOnly | QIODevice::Text)) {
-										QTextStream fs(&f);
-										QSqlQuery q;
-										q.prepare("select * from mr_series where mrseries_id = :seriesid");
-										q.bindValue(":seriesid",seriesid);
-										n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-										if (q.size() > 0) {
-											QSqlRecord r(q.record());
-											QStringList fields;
-											for (int v = 0; v < r.count(); ++v)
-												fields << r.fieldName(v);
-
-											q.first();
-											foreach (QString field, fields) {
-												fs << QString("%1: %2").arg(field).arg(q.value(field).toString());
+				/* stage the imaging, beh, and qc data, unless a previous attempt already did */
+				bool converted = false;
+				if (CheckpointRank(checkpoint) < CheckpointRank("staged")) {
+					/* export the imaging data */
+					if (downloadimaging) {
+	                    n->WriteLog("Downloading imaging data");
+						if (numfiles > 0) {
+	                        n->WriteLog(QString("Series contains [%1] files").arg(numfiles));
+							if (datadirexists) {
+	                            n->WriteLog("Series data directory [" + indir + "] exists");
+	                            if (!datadirempty) {
+	                                n->WriteLog("Data directory is empty");
+									// output the correct file type
+									if ((modality != "mr") || (filetype == "dicom") || ((datatype != "dicom") && (datatype != "parrec"))) {
+										// use rsync instead of cp because of the number of files limit
+										QString systemstring = QString("rsync %1/* %2/").arg(indir).arg(outdir);
+										n->WriteLog(n->SystemCommand(systemstring));
+										msgs << "Copying raw data from [" + indir + "] to [" + outdir + "]";
+									}
+									else if (filetype == "qc") {
+										/* copy only the qc data */
+										QString systemstring = QString("cp -R %1/qa %2").arg(indir).arg(qcoutdir);
+										n->WriteLog(n->SystemCommand(systemstring));
+										msgs << "Copying QC data from [" + indir + "/qa] to [" + qcoutdir + "]";
+
+										/* write the series info to a text file */
+										QString seriesfile = outdir + "seriesinfo.txt";
+										QFile f(seriesfile);
+										if (f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+											QTextStream fs(&f);
+											QSqlQuery q;
+											q.prepare("select * from mr_series where mrseries_id = :seriesid");
+											q.bindValue(":seriesid",seriesid);
+											n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+											if (q.size() > 0) {
+												QSqlRecord r(q.record());
+												QStringList fields;
+												for (int v = 0; v < r.count(); ++v)
+													fields << r.fieldName(v);
+
+												q.first();
+												foreach (QString field, fields) {
+													fs << QString("%1: %2").arg(field).arg(q.value(field).toString());
+												}
 											}
+											f.close();
+										}
+										else {
+											msgs << "Unable to create series info file [" + seriesfile + "]";
 										}
-										f.close();
 									}
 									else {
-										msgs << "Unable to create series info file [" + seriesfile + "]";
+										QString tmpdir = n->cfg["tmpdir"] + "/" + n->GenerateRandomString(10);
+										QString m1;
+										if (n->MakePath(tmpdir, m1)) {
+											msgs << "Created tmpdir [" + tmpdir + "]";
+											QString m2;
+											int numfilesconv(0), numfilesrenamed(0);
+											if (!n->ConvertDicom(filetype, indir, tmpdir, gzip, uid, QString("%1").arg(studynum), QString("%1").arg(seriesnum), datatype, numfilesconv, numfilesrenamed, m2))
+												msgs << "Error converting files [" + m2 + "]";
+											n->WriteLog("About to copy files from " + tmpdir + " to " + outdir);
+											QString systemstring = "rsync " + tmpdir + "/* " + outdir + "/";
+											n->WriteLog(n->SystemCommand(systemstring));
+											n->WriteLog("Done copying files...");
+											QString m3;
+											if (!n->RemoveDir(tmpdir, m3))
+												msgs << "Error [" + m3 + "] while removing path [" + tmpdir + "]";
+											msgs << "Converted DICOM/parrec data into " + filetype + " using tmpdir [" + tmpdir + "]. Final directory [" + outdir + "]";
+											converted = true;
+										}
+										else
+											msgs << "Error [" + m1 + "]. Unable to create path [" + tmpdir + "]";
 									}
 								}
 								else {
-									QString tmpdir = n->cfg["tmpdir"] + "/" + n->GenerateRandomString(10);
-									QString m1;
-									if (n->MakePath(tmpdir, m1)) {
-										msgs << "Created tmpdir [" + tmpdir + "]";
-										QString m2;
-										int numfilesconv(0), numfilesrenamed(0);
-										if (!n->ConvertDicom(filetype, indir, tmpdir, gzip, uid, QString("%1").arg(studynum), QString("%1").arg(seriesnum), datatype, numfilesconv, numfilesrenamed, m2))
-											msgs << "Error converting files [" + m2 + "]";
-										n->WriteLog("About to copy files from " + tmpdir + " to " + outdir);
-										QString systemstring = "rsync " + tmpdir + "/* " + outdir + "/";
-										n->WriteLog(n->SystemCommand(systemstring));
-										n->WriteLog("Done copying files...");
-										QString m3;
-										if (!n->RemoveDir(tmpdir, m3))
-											msgs << "Error [" + m3 + "] while removing path [" + tmpdir + "]";
-										msgs << "Converted DICOM/parrec data into " + filetype + " using tmpdir [" + tmpdir + "]. Final directory [" + outdir + "]";
-									}
-									else
-										msgs << "Error [" + m1 + "]. Unable to create path [" + tmpdir + "]";
+									seriesstatus = "error";
+									exportstatus = "error";
+									n->WriteLog("ERROR [" + indir + "] is empty");
+									msgs << "Directory [" + indir + "] is empty";
+									statusmessage = "Directory [" + indir + "] is empty. Data missing from disk";
 								}
 							}
 							else {
 								seriesstatus = "error";
 								exportstatus = "error";
-								n->WriteLog("ERROR [" + indir + "] is empty");
-								msgs << "Directory [" + indir + "] is empty";
-								statusmessage = "Directory [" + indir + "] is empty. Data missing from disk";
+								n->WriteLog("ERROR indir [" + indir + "] does not exist");
+								msgs << "Directory [" + indir + "] does not exist";
+								statusmessage = "Directory [" + indir + "] does not exist. Data missing from disk";
 							}
 						}
 						else {
-							seriesstatus = "error";
-							exportstatus = "error";
-							n->WriteLog("ERROR indir [" + indir + "] does not exist");
-							msgs << "Directory [" + indir + "] does not exist";
-							statusmessage = "Directory [" + indir + "] does not exist. Data missing from disk";
+							n->WriteLog("numfiles is 0");
+							msgs << "Series contains 0 files";
 						}
 					}
-					else {
-						n->WriteLog("numfiles is 0");
-						msgs << "Series contains 0 files";
-					}
-				}
-                else {
-                    n->WriteLog("Imaging data not selected for download");
-                }
+	                else {
+	                    n->WriteLog("Imaging data not selected for download");
+	                }
 
-				/* export the beh data */
-				if (downloadbeh) {
-					if (behdirexists) {
-						QString m;
-						if (n->MakePath(behoutdir, m)) {
-							QString systemstring = "cp -R " + behindir + "/* " + behoutdir;
-							n->WriteLog(n->SystemCommand(systemstring, true));
-							systemstring = "chmod -Rf 777 " + behoutdir;
-							n->WriteLog(n->SystemCommand(systemstring, true));
-							msgs << "Copying behavioral data from [" + behindir + "] to [" + behoutdir + "]";
+					/* export the beh data */
+					if (downloadbeh) {
+						if (behdirexists) {
+							QString m;
+							if (n->MakePath(behoutdir, m)) {
+								QString systemstring = "cp -R " + behindir + "/* " + behoutdir;
+								n->WriteLog(n->SystemCommand(systemstring, true));
+								systemstring = "chmod -Rf 777 " + behoutdir;
+								n->WriteLog(n->SystemCommand(systemstring, true));
+								msgs << "Copying behavioral data from [" + behindir + "] to [" + behoutdir + "]";
+							}
+							else
+								msgs << "Error [" + m + "] while creating path [" + behoutdir + "]";
+						}
+						else {
+							n->WriteLog("WARNING behindir [" + behindir + "] does not exist");
+							msgs << "Directory [" + behindir + "] does not exist";
 						}
-						else
-							msgs << "Error [" + m + "] while creating path [" + behoutdir + "]";
 					}
 					else {
-						n->WriteLog("WARNING behindir [" + behindir + "] does not exist");
-						msgs << "Directory [" + behindir + "] does not exist";
+						n->WriteLog("Not downloading beh data");
+						msgs << "Not downloading beh data\n";
 					}
-				}
-				else {
-					n->WriteLog("Not downloading beh data");
-					msgs << "Not downloading beh data\n";
-				}
 
-				/* copy the QC data */
-				if (downloadqc) {
-					if (qcdirexists) {
-						QString m;
-						if (n->MakePath(qcoutdir, m)) {
-							QString systemstring = "cp -R " + qcindir + "/* " + qcoutdir;
-							n->WriteLog(n->SystemCommand(systemstring, true));
-							systemstring = "chmod -Rf 777 " + qcoutdir;
-							n->WriteLog(n->SystemCommand(systemstring, true));
-							msgs << "Copying QC data from [" + qcindir + "] to [" + qcoutdir + "]";
+					/* copy the QC data */
+					if (downloadqc) {
+						if (qcdirexists) {
+							QString m;
+							if (n->MakePath(qcoutdir, m)) {
+								QString systemstring = "cp -R " + qcindir + "/* " + qcoutdir;
+								n->WriteLog(n->SystemCommand(systemstring, true));
+								systemstring = "chmod -Rf 777 " + qcoutdir;
+								n->WriteLog(n->SystemCommand(systemstring, true));
+								msgs << "Copying QC data from [" + qcindir + "] to [" + qcoutdir + "]";
+							}
+							else
+								msgs << "Error [" + m + "] while creating path [" + behoutdir + "]";
+						}
+						else {
+							seriesstatus = "error";
+							exportstatus = "error";
+							n->WriteLog("ERROR qcindir [" + qcindir + "] does not exist");
+							msgs << "Directory [" + qcindir + "] does not exist";
+							statusmessage = "Directory [" + qcindir + "] does not exist";
 						}
-						else
-							msgs << "Error [" + m + "] while creating path [" + behoutdir + "]";
-					}
-					else {
-						seriesstatus = "error";
-						exportstatus = "error";
-						n->WriteLog("ERROR qcindir [" + qcindir + "] does not exist");
-						msgs << "Directory [" + qcindir + "] does not exist";
-						statusmessage = "Directory [" + qcindir + "] does not exist";
 					}
 				}
+				else {
+					msgs << n->WriteLog(QString("Data for series [%1%2-%3] already staged [%4]").arg(uid).arg(studynum).arg(seriesnum).arg(checkpoint));
+				}
+				if ((seriesstatus != "error") && (CheckpointRank(checkpoint) < CheckpointRank("staged"))) {
+					checkpoint = converted ? "converted" : "staged";
+					SetExportSeriesCheckpoint(exportseriesid, checkpoint);
+				}
 
 				/* give full permissions to the files that were downloaded */
 				if (exporttype == "nfs") {
@@ -662,8 +922,41 @@ bool moduleExport::ExportLocal(int exportid, QString exporttype, QString nfsdir,
 					n->WriteLog(n->SystemCommand(systemstring, true));
 				}
 
-				if (filetype == "dicom")
-					n->AnonymizeDir(outdir,anonlevel,"Anonymous","Anonymous");
+				if (CheckpointRank(checkpoint) < CheckpointRank("anonymized")) {
+					if (filetype == "dicom")
+						n->AnonymizeDir(outdir,anonlevel,"Anonymous","Anonymous");
+					if (seriesstatus != "error") {
+						checkpoint = "anonymized";
+						SetExportSeriesCheckpoint(exportseriesid, checkpoint);
+					}
+				}
+
+				/* append this series to the zip file, and record where the zip stream ends */
+				if (zipexport) {
+					QStringList zippaths;
+					zippaths << QDir(tmpexportdir).relativeFilePath(outdir);
+					if (downloadbeh && behdirexists && !behoutdir.startsWith(outdir)) {
+						foreach (QString f, QDir(behindir).entryList(QDir::NoDotAndDotDot | QDir::AllEntries))
+							zippaths << QDir(tmpexportdir).relativeFilePath(behoutdir + "/" + f);
+					}
+
+					if (AppendToZip(zipfile, tmpexportdir, zippaths, zipoffset, msgs)) {
+						if (seriesstatus != "error") {
+							checkpoint = "zipped";
+							SetExportSeriesCheckpoint(exportseriesid, checkpoint, zipoffset);
+						}
+
+						/* the series is in the zip file now, so the staged copy is no longer needed */
+						QString m;
+						if (!n->RemoveDir(outdir, m))
+							n->WriteLog("Unable to remove staged series directory [" + outdir + "] because [" + m + "]");
+					}
+					else {
+						seriesstatus = "error";
+						exportstatus = "error";
+						statusmessage = "Unable to append series to zip file [" + zipfile + "]";
+					}
+				}
 
 				SetExportSeriesStatus(exportseriesid,seriesstatus,statusmessage);
 				msgs << QString("Series [%1%2-%3 (%4)] complete").arg(uid).arg(studynum).arg(seriesnum).arg(seriesdesc);
@@ -673,35 +966,13 @@ bool moduleExport::ExportLocal(int exportid, QString exporttype, QString nfsdir,
 		}
 	}
 
-	/* extra steps for web download */
+	/* extra steps for web download. each series was already appended to the zip file */
 	if (exporttype == "web") {
-		QString zipfile = QString("%1/NIDB-%2.zip").arg(n->cfg["webdownloaddir"]).arg(exportid);
-		QString outdir;
-		n->WriteLog("Final zip file will be [" + zipfile + "]");
+		n->WriteLog("Final zip file is [" + zipfile + "]");
 		n->WriteLog("tmpexportdir: [" + tmpexportdir + "]");
-		outdir = tmpexportdir;
-
-		QString pwd = QDir::currentPath();
-		n->WriteLog("Current directory is [" + pwd + "], changing directory to [" + outdir + "]");
-		QDir d;
-		if (d.exists(outdir)) {
-			QString systemstring;
-			QDir::setCurrent(outdir);
-			if (QFile::exists(zipfile))
-				systemstring = "zip -1grv " + zipfile + " .";
-			else
-				systemstring = "zip -1rv " + zipfile + " .";
-			n->WriteLog("Beginning zipping...");
-			n->WriteLog(n->SystemCommand(systemstring, true));
-			n->WriteLog("Finished zipping...");
-			n->WriteLog("Changing directory to [" + pwd + "]");
-			QDir::setCurrent(pwd);
-		}
-		else {
-			n->WriteLog("outdir [" + outdir + "] does not exist");
-		}
 
 		/* delete the tmp dir, if it exists */
+		QDir d;
 		if (d.exists(tmpexportdir)) {
 			n->WriteLog("Temporary export dir [" + tmpexportdir + "] exists and will be deleted");
 			QString m;
@@ -727,23 +998,10 @@ bool moduleExport::ExportLocal(int exportid, QString exporttype, QString nfsdir,
 			int expiredays = q.value("pd_expiredays").toInt();
 
 			QString filename = QString("NiDB-%1.zip").arg(exportid);
-			QString zipfile = n->cfg["webdownloaddir"] + "/" + filename;
-			QString outdir = tmpexportdir;
-
-			QString pwd = QDir::currentPath();
-			n->WriteLog("Current directory is [" + pwd + "], changing directory to [" + outdir + "]");
-			QDir d;
-			if (d.exists(outdir)) {
-				QString systemstring;
-				QDir::setCurrent(outdir);
-				if (QFile::exists(zipfile))
-					systemstring = "zip -1grq " + zipfile + " .";
-				else
-					systemstring = "zip -1rq " + zipfile + " .";
-				n->WriteLog(n->SystemCommand(systemstring, true));
-				n->WriteLog("Changing directory to [" + pwd + "]");
-				QDir::setCurrent(pwd);
-				systemstring = "unzip -vl " + zipfile;
+
+			/* each series was already appended to the zip file */
+			if (QFile::exists(zipfile)) {
+				QString systemstring = "unzip -vl " + zipfile;
 				QString filecontents = n->SystemCommand(systemstring, false);
 				QStringList lines = filecontents.split("\n");
 				QString lastline = lines.last().trimmed();
@@ -768,8 +1026,8 @@ bool moduleExport::ExportLocal(int exportid, QString exporttype, QString nfsdir,
 			}
 			else {
 				exportstatus = "error";
-				n->WriteLog("ERROR directory [" + outdir + "] does not exist");
-				msgs << "Outdir [" + zipfile + "] does not exist";
+				n->WriteLog("ERROR zip file [" + zipfile + "] does not exist");
+				msgs << "Zip file [" + zipfile + "] does not exist";
 			}
 
 			if (QFile::exists(zipfile)) {
@@ -808,7 +1066,7 @@ bool moduleExport::ExportNDAR(int exportid, bool csvonly, QString &exportstatus,
 		return false;
 	}
 
-	QString rootoutdir = n->cfg["ftpdir"] + "/NiDB-NDAR-" + n->CreateLogDate();
+	QString rootoutdir = GetExportCheckpointDir(exportid, n->cfg["ftpdir"] + "/NiDB-NDAR-" + n->CreateLogDate());
 	QString headerfile = rootoutdir + "/ndar.csv";
 
 	msgs << "ExportNDAR() rootoutdir [" + rootoutdir + "]";
@@ -837,7 +1095,21 @@ bool moduleExport::ExportNDAR(int exportid, bool csvonly, QString &exportstatus,
 			for(QMap<int, QMap<QString, QString>>::iterator c = s[uid][studynum].begin(); c != s[uid][studynum].end(); ++c) {
 				int seriesnum = c.key();
 
+				if (ExportInterrupted()) {
+					exportstatus = "submitted";
+					msgs << "ExportNDAR() Export interrupted, will be resumed from the last checkpoint";
+					msg = msgs.join("\n");
+					return false;
+				}
+
 				int exportseriesid = s[uid][studynum][seriesnum]["exportseriesid"].toInt();
+				QString checkpoint = s[uid][studynum][seriesnum]["checkpoint"];
+
+				/* skip series which were completed by a previous attempt at this export */
+				if (CheckpointRank(checkpoint) >= CheckpointRank(csvonly ? "staged" : "zipped")) {
+					msgs << "ExportNDAR() " + n->WriteLog(QString("Series [%1%2-%3] was completed by a previous attempt [%4]. Skipping").arg(uid).arg(studynum).arg(seriesnum).arg(checkpoint));
+					continue;
+				}
 				SetExportSeriesStatus(exportseriesid, "processing");
 
 				QString seriesstatus = "complete";
@@ -860,39 +1132,61 @@ bool moduleExport::ExportNDAR(int exportid, bool csvonly, QString &exportstatus,
 				QStringList logs;
 
 				if (datadirexists) {
-					WriteNDARHeader(headerfile, modality, logs);
-					msgs << logs;
-
 					QString behzipfile;
 					QString behdesc;
 
-					/* write the header, find out if the data is valid and should copied to the output */
-					bool validData = WriteNDARSeries(headerfile, QString("%1-%2-%3.zip").arg(uid).arg(studynum).arg(seriesnum), behzipfile, behdesc, seriesid, modality, indir, logs);
-					msgs << logs;
+					/* write the header, find out if the data is valid and should copied to the output. A series which was
+					   already staged by a previous attempt has its .csv row written */
+					bool validData = true;
+					if (CheckpointRank(checkpoint) < CheckpointRank("staged")) {
+						WriteNDARHeader(headerfile, modality, logs);
+						msgs << logs;
+
+						validData = WriteNDARSeries(headerfile, QString("%1-%2-%3.zip").arg(uid).arg(studynum).arg(seriesnum), behzipfile, behdesc, seriesid, modality, indir, logs);
+						msgs << logs;
+					}
+
+					if (csvonly && validData) {
+						checkpoint = "staged";
+						SetExportSeriesCheckpoint(exportseriesid, checkpoint);
+					}
 
 					if (!csvonly && validData) {
-						QString tmpdir = n->cfg["tmpdir"] + "/" + n->GenerateRandomString(10);
+						/* the staging directory is named after the series, so a resumed export finds the data staged by a previous attempt */
+						QString tmpdir = QString("%1/NiDB-NDAR-%2/%3-%4-%5").arg(n->cfg["tmpdir"]).arg(exportid).arg(uid).arg(studynum).arg(seriesnum);
 						m = "";
 						if (n->MakePath(tmpdir, m)) {
 							QString systemstring;
-							if ((modality == "mr") && (datatype == "dicom")) {
-								systemstring = "find " + indir + " -iname '*.dcm' -exec cp {} " + tmpdir + " \\;";
-								msgs << "ExportNDAR() " + n->WriteLog(n->SystemCommand(systemstring, true));
-								n->AnonymizeDir(tmpdir,2,"","");
-							}
-							else if ((modality == "mr") && (datatype == "parrec")) {
-								systemstring = "find " + indir + " -iname '*.par' -exec cp {} " + tmpdir + " \\;";
-								msgs << "ExportNDAR() " + n->WriteLog(n->SystemCommand(systemstring, true));
-								systemstring = "find " + indir + " -iname '*.rec' -exec cp {} " + tmpdir + " \\;";
-								msgs << "ExportNDAR() " + n->WriteLog(n->SystemCommand(systemstring, true));
+							if (CheckpointRank(checkpoint) < CheckpointRank("staged")) {
+								if ((modality == "mr") && (datatype == "dicom")) {
+									systemstring = "find " + indir + " -iname '*.dcm' -exec cp {} " + tmpdir + " \\;";
+									msgs << "ExportNDAR() " + n->WriteLog(n->SystemCommand(systemstring, true));
+								}
+								else if ((modality == "mr") && (datatype == "parrec")) {
+									systemstring = "find " + indir + " -iname '*.par' -exec cp {} " + tmpdir + " \\;";
+									msgs << "ExportNDAR() " + n->WriteLog(n->SystemCommand(systemstring, true));
+									systemstring = "find " + indir + " -iname '*.rec' -exec cp {} " + tmpdir + " \\;";
+									msgs << "ExportNDAR() " + n->WriteLog(n->SystemCommand(systemstring, true));
+								}
+								else {
+									systemstring = "rsync " + indir + "/* " + tmpdir + "/";
+									msgs << "ExportNDAR() " + n->WriteLog(n->SystemCommand(systemstring, true));
+								}
+								checkpoint = "staged";
+								SetExportSeriesCheckpoint(exportseriesid, checkpoint);
 							}
-							else {
-								systemstring = "rsync " + indir + "/* " + tmpdir + "/";
-								msgs << "ExportNDAR() " + n->WriteLog(n->SystemCommand(systemstring, true));
+
+							if (CheckpointRank(checkpoint) < CheckpointRank("anonymized")) {
+								if ((modality == "mr") && (datatype == "dicom"))
+									n->AnonymizeDir(tmpdir,2,"","");
+								checkpoint = "anonymized";
+								SetExportSeriesCheckpoint(exportseriesid, checkpoint);
 							}
 
-							/* zip the data to the output directory */
+							/* zip the data to the output directory. remove any partial zip left by an interrupted attempt */
 							QString zipfile = QString("%1/%2-%3-%4.zip").arg(rootoutdir).arg(uid).arg(studynum).arg(seriesnum);
+							if (QFile::exists(zipfile))
+								QFile::remove(zipfile);
 							systemstring = "zip -vjrq1 " + zipfile + " " + tmpdir;
 							msgs << "ExportNDAR() " + n->WriteLog(n->SystemCommand(systemstring, true));
 							msgs << "ExportNDAR() " + n->WriteLog("Done zipping image files...");
@@ -900,16 +1194,28 @@ bool moduleExport::ExportNDAR(int exportid, bool csvonly, QString &exportstatus,
 							/* create a behavioral data zip file if there is beh data */
 							if (numfilesbeh > 0) {
 								behzipfile = QString("%1-%2-%3-beh.zip").arg(uid).arg(studynum).arg(seriesnum);
+								if (QFile::exists(rootoutdir + "/" + behzipfile))
+									QFile::remove(rootoutdir + "/" + behzipfile);
 								systemstring = QString("zip -vjrq1 %1/%2 %3").arg(rootoutdir).arg(behzipfile).arg(behindir);
 								msgs << "ExportNDAR() " + n->WriteLog(n->SystemCommand(systemstring, true));
 								msgs << "ExportNDAR() " + n->WriteLog("Done zipping beh files...");
 
 								behdesc = "Behavioral/design data file";
 							}
-							if (modality == "mr") {
-								if (!n->RemoveDir(tmpdir,m))
-									msgs << "ExportNDAR() Unable to remove tmpdir [" + tmpdir + "] because [" + m + "]";
+
+							QFileInfo zfi(zipfile);
+							if (zfi.exists()) {
+								checkpoint = "zipped";
+								SetExportSeriesCheckpoint(exportseriesid, checkpoint, zfi.size());
+							}
+							else {
+								seriesstatus = "error";
+								statusmessage = "Unable to create zip file [" + zipfile + "]";
+								msgs << "ExportNDAR() " + statusmessage;
 							}
+
+							if (!n->RemoveDir(tmpdir,m))
+								msgs << "ExportNDAR() Unable to remove tmpdir [" + tmpdir + "] because [" + m + "]";
 						}
 						else {
 							seriesstatus = "error";
@@ -951,7 +1257,7 @@ bool moduleExport::ExportBIDS(int exportid, QString bidsreadme, QString &exports
 		return false;
 	}
 
-	QString rootoutdir = n->cfg["ftpdir"] + "/NiDB-BIDS-" + n->CreateLogDate();
+	QString rootoutdir = GetExportCheckpointDir(exportid, n->cfg["ftpdir"] + "/NiDB-BIDS-" + n->CreateLogDate());
 
 	QString m;
 	if (n->MakePath(rootoutdir, m)) {
@@ -977,7 +1283,20 @@ bool moduleExport::ExportBIDS(int exportid, QString bidsreadme, QString &exports
 			for(QMap<int, QMap<QString, QString>>::iterator c = s[uid][studynum].begin(); c != s[uid][studynum].end(); ++c) {
 				int seriesnum = c.key();
 
+				if (ExportInterrupted()) {
+					exportstatus = "submitted";
+					msgs << "Export interrupted, will be resumed from the last checkpoint";
+					msg = msgs.join("\n");
+					return false;
+				}
+
 				int exportseriesid = s[uid][studynum][seriesnum]["exportseriesid"].toInt();
+
+				/* skip series which were converted by a previous attempt at this export */
+				if (CheckpointRank(s[uid][studynum][seriesnum]["checkpoint"]) >= CheckpointRank("converted")) {
+					n->WriteLog(QString("Series [%1%2-%3] was converted by a previous attempt. Skipping").arg(uid).arg(studynum).arg(seriesnum));
+					continue;
+				}
 				SetExportSeriesStatus(exportseriesid, "processing");
 
 				QString seriesstatus = "complete";
@@ -1079,6 +1398,8 @@ bool moduleExport::ExportBIDS(int exportid, QString bidsreadme, QString &exports
 					n->WriteLog(n->SystemCommand(systemstring, true));
 				}
 
+				if (seriesstatus == "complete")
+					SetExportSeriesCheckpoint(exportseriesid, "converted");
 				SetExportSeriesStatus(exportseriesid, seriesstatus);
 			}
 		}
@@ -44,6 +44,15 @@ public:
 
 	bool GetExportSeriesList(int exportid);
 
+	/* checkpoints, so an interrupted export can resume from the last completed series */
+	QString GetExportCheckpointDir(int exportid, QString defaultdir);
+	bool SetExportSeriesCheckpoint(int exportseriesid, QString checkpoint, qint64 zipoffset=-1);
+	int CheckpointRank(QString checkpoint);
+	bool IsStaleExport(int exportid);
+	bool ExportInterrupted();
+	bool VerifyZipCheckpoint(QString zipfile, qint64 zipoffset, QStringList &msgs);
+	bool AppendToZip(QString zipfile, QString basedir, QStringList paths, qint64 &zipoffset, QStringList &msgs);
+
 	bool ExportLocal(int exportid, QString exporttype, QString nfsdir, int publicdownloadid, bool downloadimaging, bool downloadbeh, bool downloadqc, QString filetype, QString dirformat, int preserveseries, bool gzip, int anonymize, QString behformat, QString behdirrootname, QString behdirseriesname, QString &status, QString &msg);
 	bool ExportNDAR(int exportid, bool csvonly, QString &exportstatus, QString &msg);
 	bool ExportBIDS(int exportid, QString bidsreadme, QString &exportstatus, QString &msg);
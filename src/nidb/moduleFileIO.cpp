@@ -60,6 +60,7 @@ int moduleFileIO::Run() {
 			i++;
 
 			int requestid = q.value("fileiorequest_id").toInt();
+			currentrequestid = requestid;
 			QString fileio_operation = q.value("fileio_operation").toString().trimmed();
 			QString data_type = q.value("data_type").toString().trimmed();
 			int data_id = q.value("data_id").toInt();
@@ -164,9 +165,14 @@ int moduleFileIO::Run() {
             n->WriteLog("File IO operation finished, with message from function [" + msg + "]");
         }
         n->WriteLog("Finished performing file IO");
+
+		/* remove the data from delete requests, now that the queue is empty */
+		ReapDeleted();
 	}
 	else {
 		n->WriteLog("Nothing to do");
+		if (ReapDeleted() > 0)
+			return 1;
 		return 0;
 	}
 
@@ -217,6 +223,65 @@ bool moduleFileIO::SetIORequestStatus(int requestid, QString status, QString msg
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- SetIORequestProgress --------------------------- */
+/* ---------------------------------------------------------- */
+/* called periodically during long copies, which also keeps the
+   module checked in while the copy threads are running */
+void moduleFileIO::SetIORequestProgress(qint64 bytesdone, qint64 bytestotal) {
+	n->ModuleRunningCheckIn();
+
+	if (currentrequestid < 1)
+		return;
+
+	QSqlQuery q;
+	q.prepare("update fileio_requests set request_bytesdone = :bytesdone, request_bytestotal = :bytestotal where fileiorequest_id = :id");
+	q.bindValue(":id", currentrequestid);
+	q.bindValue(":bytesdone", bytesdone);
+	q.bindValue(":bytestotal", bytestotal);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetCopyThreads --------------------------------- */
+/* ---------------------------------------------------------- */
+int moduleFileIO::GetCopyThreads() {
+	int numthreads = n->cfg["modulefileiocopythreads"].toInt();
+	if (numthreads < 1)
+		numthreads = 4;
+
+	return numthreads;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetReapThreads --------------------------------- */
+/* ---------------------------------------------------------- */
+int moduleFileIO::GetReapThreads() {
+	int numthreads = n->cfg["modulefileioreapthreads"].toInt();
+	if (numthreads < 1)
+		numthreads = 2;
+
+	return numthreads;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetRetentionDays ------------------------------- */
+/* ---------------------------------------------------------- */
+/* deleted subjects, studies, and series were previously kept in
+   the deleteddir indefinitely, and still are unless a retention
+   period is set. Returns -1 to keep them indefinitely */
+int moduleFileIO::GetRetentionDays() {
+	int days = n->cfg["modulefileioretentiondays"].toInt();
+	if (days < 1)
+		return -1;
+
+	return days;
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- RecheckSuccess --------------------------------- */
 /* ---------------------------------------------------------- */
@@ -310,9 +375,12 @@ bool moduleFileIO::CopyAnalysis(qint64 analysisid, QString destination, QString
 
 	destination = QString("%1/%2%3").arg(destination).arg(a.uid).arg(a.studynum);
 	if (n->MakePath(destination, msg)) {
-		QString systemstring = QString("rsync -az %1/* %2").arg(a.analysispath).arg(destination);
-        n->WriteLog(QString("About to run the following command[" + systemstring + "]"));
-		n->WriteLog(n->SystemCommand(systemstring));
+		n->WriteLog(QString("Copying [%1] to [%2] using [%3] threads").arg(a.analysispath).arg(destination).arg(GetCopyThreads()));
+		if (!n->CopyDir(a.analysispath, destination, GetCopyThreads(), msg, [this](qint64 done, qint64 total) { SetIORequestProgress(done, total); })) {
+			n->WriteLog(msg);
+			return false;
+		}
+		n->WriteLog(msg);
 		n->InsertAnalysisEvent(analysisid, a.pipelineid, a.pipelineversion, a.studyid, "analysiscopy", "Analysis copied");
 		return true;
 	}
@@ -323,6 +391,147 @@ bool moduleFileIO::CopyAnalysis(qint64 analysisid, QString destination, QString
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- MoveToDeleted ---------------------------------- */
+/* ---------------------------------------------------------- */
+/* first phase of a delete. The directory is renamed into the
+   deleteddir, or renamed in place if the deleteddir is on a
+   different filesystem, so it disappears without copying. Data
+   which is kept indefinitely must end up in the deleteddir, so
+   that fails as it did before, rather than being hidden in the
+   archive where nothing will ever remove it */
+bool moduleFileIO::MoveToDeleted(QString path, QString name, bool keep, QString &newpath, QString &msg) {
+	QString deleteddir = n->cfg["deleteddir"];
+	if ((deleteddir != "") && n->IsSameFilesystem(path, deleteddir))
+		newpath = QString("%1/%2-%3").arg(deleteddir).arg(name).arg(n->GenerateRandomString(10));
+	else if (keep) {
+		msg = QString("Error in moving [%1] to the deleted directory [%2]. It is on a different filesystem, and deleted data is kept indefinitely unless modulefileioretentiondays is set").arg(path).arg(deleteddir);
+		n->WriteLog(msg);
+		return false;
+	}
+	else
+		newpath = QString("%1/.deleted-%2-%3").arg(QFileInfo(path).absolutePath()).arg(name).arg(n->GenerateRandomString(10));
+
+	QDir d;
+	if (d.rename(path, newpath)) {
+		msg = n->WriteLog(QString("Moved [%1] to [%2]").arg(path).arg(newpath));
+		return true;
+	}
+	else {
+		msg = QString("Error in moving [%1] to [%2]").arg(path).arg(newpath);
+		n->WriteLog(msg);
+		return false;
+	}
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- QueueDeletedPath ------------------------------- */
+/* ---------------------------------------------------------- */
+/* a negative retention keeps the path indefinitely. it has no reap_after date, so the reaper never picks it up */
+void moduleFileIO::QueueDeletedPath(QString datatype, qint64 dataid, QString originalpath, QString deletedpath, int retentiondays) {
+	QSqlQuery q;
+	if (retentiondays < 0)
+		q.prepare("insert into fileio_deleted (fileiorequest_id, data_type, data_id, original_path, deleted_path, reap_status, deletedate, reap_after) values (:requestid, :datatype, :dataid, :originalpath, :deletedpath, 'pending', now(), null)");
+	else {
+		q.prepare("insert into fileio_deleted (fileiorequest_id, data_type, data_id, original_path, deleted_path, reap_status, deletedate, reap_after) values (:requestid, :datatype, :dataid, :originalpath, :deletedpath, 'pending', now(), date_add(now(), interval :days day))");
+		q.bindValue(":days", retentiondays);
+	}
+	q.bindValue(":requestid", currentrequestid);
+	q.bindValue(":datatype", datatype);
+	q.bindValue(":dataid", dataid);
+	q.bindValue(":originalpath", originalpath);
+	q.bindValue(":deletedpath", deletedpath);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ReapDeleted ------------------------------------ */
+/* ---------------------------------------------------------- */
+/* second phase of a delete. Remove the directories moved aside by
+   delete requests, at a limited rate. Reaping stops when new
+   requests are waiting, and continues the next time the module
+   runs with an empty queue. Returns the number of paths removed */
+int moduleFileIO::ReapDeleted() {
+	QSqlQuery q;
+	/* module_procs has no hostname, so only claims made on this host can be checked for a process that is no longer running */
+	q.prepare("select deleted_id, deleted_path from fileio_deleted where (reap_status = 'pending' or (reap_status = 'reaping' and reap_hostname = :hostname and reap_pid not in (select process_id from module_procs where module_name = 'fileio'))) and reap_after <= now() order by deleted_id");
+	q.bindValue(":hostname", QHostInfo::localHostName());
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.size() < 1)
+		return 0;
+
+	int maxrate = 500;
+	if (n->cfg["modulefileioreaprate"] != "")
+		maxrate = n->cfg["modulefileioreaprate"].toInt();
+	int numreaped = 0;
+	while (q.next() && KeepReaping()) {
+		int deletedid = q.value("deleted_id").toInt();
+		QString deletedpath = q.value("deleted_path").toString();
+
+		/* claim this path, in case another fileio process is also reaping */
+		QSqlQuery q2;
+		q2.prepare("update fileio_deleted set reap_status = 'reaping', reap_pid = :pid, reap_hostname = :hostname where deleted_id = :id and (reap_status = 'pending' or (reap_status = 'reaping' and reap_hostname = :hostname and reap_pid not in (select process_id from module_procs where module_name = 'fileio')))");
+		q2.bindValue(":id", deletedid);
+		q2.bindValue(":pid", QCoreApplication::applicationPid());
+		q2.bindValue(":hostname", QHostInfo::localHostName());
+		n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
+		if (q2.numRowsAffected() < 1)
+			continue;
+
+		n->WriteLog(QString("Reaping [%1] at [%2] files/sec").arg(deletedpath).arg(maxrate));
+		QString m;
+		QString status;
+		if (!QFileInfo::exists(deletedpath)) {
+			m = "Path [" + deletedpath + "] no longer exists";
+			status = "complete";
+		}
+		else if (n->RemoveDirThrottled(deletedpath, GetReapThreads(), maxrate, m, [this]() { return KeepReaping(); })) {
+			status = "complete";
+			numreaped++;
+		}
+		else if (KeepReaping()) {
+			status = "error";
+		}
+		else {
+			status = "pending";
+		}
+		n->WriteLog(m);
+
+		q2.prepare("update fileio_deleted set reap_status = :status, reap_message = :msg, reapdate = now() where deleted_id = :id");
+		q2.bindValue(":id", deletedid);
+		q2.bindValue(":status", status);
+		q2.bindValue(":msg", m.left(255));
+		n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
+
+		if (status == "pending") {
+			n->WriteLog("New fileio requests are waiting, or the module was disabled. Stopping the reaper");
+			break;
+		}
+	}
+
+	return numreaped;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- KeepReaping ------------------------------------ */
+/* ---------------------------------------------------------- */
+/* reaping yields to any requests which were queued after it started */
+bool moduleFileIO::KeepReaping() {
+	n->ModuleRunningCheckIn();
+	if (!n->ModuleCheckIfActive())
+		return false;
+
+	QSqlQuery q("select count(*) 'count' from fileio_requests where request_status = 'pending'");
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	q.first();
+
+	return (q.value("count").toInt() == 0);
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- DeleteAnalysis --------------------------------- */
 /* ---------------------------------------------------------- */
@@ -343,65 +552,53 @@ bool moduleFileIO::DeleteAnalysis(qint64 analysisid, QString &msg) {
 
 	n->WriteLog("Analysispath: [" + a.analysispath + "]");
 
-	bool okToDeleteDBEntries = false;
-
+	/* move the analysis directory out of the way. The files are removed later by ReapDeleted() */
+	QString deletedpath;
 	if (QDir(a.analysispath).exists()) {
-		int c;
-		qint64 b;
-		n->GetDirSizeAndFileCount(a.analysispath, c, b, true);
-
-		n->WriteLog(QString("Going to remove [%1] files and directories from [%2]").arg(c).arg(a.analysispath));
-		if (n->RemoveDir(a.analysispath, msg)) {
-			/* QDir.remove worked */
-			n->WriteLog("Analysispath removed");
-			okToDeleteDBEntries = true;
-		}
-		else {
-			QString systemstring = QString("sudo rm -rfv %1").arg(a.analysispath);
-			n->WriteLog("Not all files deleted. Deleting remaining files using sudo.");
-			n->WriteLog(n->SystemCommand(systemstring));
-
-			QDir d(a.analysispath);
-			if (d.exists()) {
-				n->WriteLog("Datapath [" + a.analysispath + "] still exists, even after sudo rm -rf");
-
-				QSqlQuery q;
-				q.prepare("update analysis set analysis_statusmessage = 'Analysis directory not deleted. Manually delete the directory and then delete from this webpage again' where analysis_id = :analysisid");
-				q.bindValue(":analysisid", analysisid);
-				n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+		if (!MoveToDeleted(a.analysispath, QString("analysis-%1").arg(analysisid), false, deletedpath, msg)) {
+			QSqlQuery q;
+			q.prepare("update analysis set analysis_statusmessage = 'Analysis directory not deleted. Manually delete the directory and then delete from this webpage again' where analysis_id = :analysisid");
+			q.bindValue(":analysisid", analysisid);
+			n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 
-				n->InsertAnalysisEvent(analysisid, a.pipelineid, a.pipelineversion, a.studyid, "analysisdeleteerror", "Analysis directory not deleted. Probably because permissions have changed and NiDB does not have permission to delete the directory [" + a.analysispath + "]");
-				return false;
-			}
-			else {
-				okToDeleteDBEntries = true;
-			}
+			n->InsertAnalysisEvent(analysisid, a.pipelineid, a.pipelineversion, a.studyid, "analysisdeleteerror", "Analysis directory not deleted. Probably because permissions have changed and NiDB does not have permission to move the directory [" + a.analysispath + "]");
+			return false;
 		}
 	}
 	else {
 		n->WriteLog("Path [" + a.analysispath + "] did not exist. Did not attempt to delete");
-		okToDeleteDBEntries = true;
 	}
 
-	if (okToDeleteDBEntries) {
-		/* remove the database entries */
-		QSqlQuery q;
-		q.prepare("delete from analysis_data where analysis_id = :analysisid");
-		q.bindValue(":analysisid", analysisid);
-		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	/* remove the database entries */
+	n->db.transaction();
+	QSqlQuery q;
+	q.prepare("delete from analysis_data where analysis_id = :analysisid");
+	q.bindValue(":analysisid", analysisid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 
-		q.prepare("delete from analysis_results where analysis_id = :analysisid");
-		q.bindValue(":analysisid", analysisid);
-		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	q.prepare("delete from analysis_results where analysis_id = :analysisid");
+	q.bindValue(":analysisid", analysisid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 
-		q.prepare("delete from analysis_history where analysis_id = :analysisid");
-		q.bindValue(":analysisid", analysisid);
-		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	q.prepare("delete from analysis_history where analysis_id = :analysisid");
+	q.bindValue(":analysisid", analysisid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 
-		q.prepare("delete from analysis where analysis_id = :analysisid");
-		q.bindValue(":analysisid", analysisid);
-		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	}
+	q.prepare("delete from analysis where analysis_id = :analysisid");
+	q.bindValue(":analysisid", analysisid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+
+	/* the study matched this pipeline before, so the pipeline module can pick it up again */
+	q.prepare("insert ignore into pipeline_candidates (pipeline_id, study_id) values (:pipelineid, :studyid)");
+	q.bindValue(":pipelineid", a.pipelineid);
+	q.bindValue(":studyid", a.studyid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+
+	/* analyses can be regenerated, so they are reaped right away */
+	if (deletedpath != "")
+		QueueDeletedPath("analysis", analysisid, a.analysispath, deletedpath, 0);
+	n->RemoveFromDirSizeIndex(a.analysispath);
+	n->db.commit();
 
 	return true;
 }
@@ -437,6 +634,14 @@ bool moduleFileIO::DeletePipeline(int pipelineid, QString &msg) {
 	q.bindValue(":pipelineid", pipelineid);
 	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 
+	q.prepare("delete from pipeline_candidates where pipeline_id = :pipelineid");
+	q.bindValue(":pipelineid", pipelineid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+
+	q.prepare("delete from pipeline_candidatescan where pipeline_id = :pipelineid");
+	q.bindValue(":pipelineid", pipelineid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+
 	return 1;
 }
 
@@ -454,19 +659,13 @@ bool moduleFileIO::DeleteSubject(int subjectid, QString username, QString &msg)
 
     n->WriteLog("Checkpoint B");
 
-	QString newpath = QString("%1/%2-%3").arg(n->cfg["deleteddir"]).arg(s.uid).arg(n->GenerateRandomString(10));
+	QString newpath;
 	QDir d;
 
 	if (s.subjectpath != "") {
 		if (d.exists(s.subjectpath)) {
-			if (d.rename(s.subjectpath, newpath)) {
-				msg = n->WriteLog(QString("Moved [%1] to [%2]").arg(s.subjectpath).arg(newpath));
-			}
-			else {
-				msg = QString("Error in moving [%1] to [%2]").arg(s.subjectpath).arg(newpath);
-				n->WriteLog(msg);
+			if (!MoveToDeleted(s.subjectpath, s.uid, (GetRetentionDays() < 0), newpath, msg))
 				return false;
-			}
 		}
 		else {
 			n->WriteLog(QString("Subject path on disk [" + s.subjectpath + "] does not exist"));
@@ -477,6 +676,8 @@ bool moduleFileIO::DeleteSubject(int subjectid, QString username, QString &msg)
 	}
     n->WriteLog("Checkpoint C");
 
+	n->db.transaction();
+
 	/* remove all database entries about this subject:
 	   TABLES: subjects, subject_altuid, subject_relation, studies, *_series, enrollment, family_members, mostrecent */
 	q.prepare("delete from mostrecent where subject_id = :subjectid");
@@ -545,6 +746,12 @@ bool moduleFileIO::DeleteSubject(int subjectid, QString username, QString &msg)
 	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
     n->WriteLog(QString("Checkpoint C.10 - [%1] rows deleted").arg(q.numRowsAffected()));
 
+	if (newpath != "")
+		QueueDeletedPath("subject", subjectid, s.subjectpath, newpath, GetRetentionDays());
+	if (s.subjectpath != "")
+		n->RemoveFromDirSizeIndex(s.subjectpath);
+	n->db.commit();
+
 	n->InsertSubjectChangeLog(username, s.uid, "", "obliterate", msg);
 
     n->WriteLog("Checkpoint D");
@@ -564,12 +771,10 @@ bool moduleFileIO::DeleteStudy(int studyid, QString &msg) {
 	if (!s.isValid) { msg = "Study was not valid: [" + s.msg + "]"; return false; }
     QString modality = s.modality.toLower();
 
-	QString newpath = QString("%1/%2-%3-%4").arg(n->cfg["deleteddir"]).arg(s.uid).arg(s.studynum).arg(n->GenerateRandomString(10));
-	QDir d;
-	if(d.rename(s.studypath, newpath)) {
-		n->WriteLog(QString("Moved [%1] to [%2]").arg(s.studypath).arg(newpath));
+	QString newpath;
+	if (MoveToDeleted(s.studypath, QString("%1-%2").arg(s.uid).arg(s.studynum), (GetRetentionDays() < 0), newpath, msg)) {
+		n->db.transaction();
 
-		// move all archive data to the deleted directory
 		// delete all series
         q.prepare(QString("delete from %1_series where study_id = :studyid").arg(modality));
 		q.bindValue(":studyid", studyid);
@@ -579,10 +784,12 @@ bool moduleFileIO::DeleteStudy(int studyid, QString &msg) {
 		q.prepare("delete from studies where study_id = :studyid");
 		q.bindValue(":studyid", studyid);
 		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+
+		QueueDeletedPath("study", studyid, s.studypath, newpath, GetRetentionDays());
+		n->RemoveFromDirSizeIndex(s.studypath);
+		n->db.commit();
 	}
 	else {
-		msg = QString("Error in moving [%1] to [%2]").arg(s.studypath).arg(newpath);
-		n->WriteLog(msg);
 		return false;
 	}
 	return true;
@@ -600,20 +807,20 @@ bool moduleFileIO::DeleteSeries(int seriesid, QString modality, QString &msg) {
 	series s(seriesid, modality, n); /* get the series info */
 	if (!s.isValid) { msg = "Series was not valid: [" + s.msg + "]"; return false; }
 
-	QString newpath = QString("%1/%2-%3-%4-%5").arg(n->cfg["deleteddir"]).arg(s.uid).arg(s.studynum).arg(s.seriesnum).arg(n->GenerateRandomString(10));
-	QDir d;
-	if(d.rename(s.seriespath, newpath)) {
-		n->WriteLog(QString("Moved [%1] to [%2]").arg(s.seriespath).arg(newpath));
+	QString newpath;
+	if (MoveToDeleted(s.seriespath, QString("%1-%2-%3").arg(s.uid).arg(s.studynum).arg(s.seriesnum), (GetRetentionDays() < 0), newpath, msg)) {
+		n->db.transaction();
 
 		QString sqlstring = QString("delete from %1_series where %1series_id = :seriesid").arg(modality);
 		q.prepare(sqlstring);
 		q.bindValue(":seriesid", seriesid);
 		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 
+		QueueDeletedPath("series", seriesid, s.seriespath, newpath, GetRetentionDays());
+		n->RemoveFromDirSizeIndex(s.seriespath);
+		n->db.commit();
 	}
 	else {
-		msg = QString("Error in moving series [%1] to [%2]").arg(s.seriespath).arg(newpath);
-		n->WriteLog(msg);
 		return false;
 	}
 	return true;
@@ -885,14 +1092,6 @@ bool moduleFileIO::MoveStudyToSubject(int studyid, QString newuid, int newsubjec
 		n->WriteLog(QString("Highest studynum for subject [%1], New studynum [%2]").arg(q.value("maxstudynum").toInt()).arg(newstudynum));
 	}
 
-	/* change the enrollment_id associated with the studyid */
-	q.prepare("update studies set enrollment_id = :enrollmentid, study_num = :newstudynum where study_id = :studyid");
-	q.bindValue(":enrollmentid", newenrollmentid);
-	q.bindValue(":newstudynum", newstudynum);
-	q.bindValue(":studyid", studyid);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-
-	/* copy the data, don't move in case there is a problem */
 	QString oldpath = thestudy.studypath;
 	QString newpath = QString("%1/%2").arg(newsubject->subjectpath).arg(newstudynum);
 	if (!newsubject->dataPathExists) {
@@ -903,14 +1102,45 @@ bool moduleFileIO::MoveStudyToSubject(int studyid, QString newuid, int newsubjec
 	}
 
 	QDir d;
-	d.mkpath(newpath);
-	//d.mkpath(oldpath);
-	if (!d.exists(newpath)) msgs << "Error creating newpath [" + newpath + "]";
 	if (!d.exists(oldpath)) msgs << "Error: oldpath [" + oldpath + "] does not exist";
 
-	n->WriteLog("Moving data within archive directory");
-	QString systemstring = QString("rsync -rtu %1/* %2").arg(oldpath).arg(newpath);
-	msgs << n->WriteLog(n->SystemCommand(systemstring));
+	/* within the same filesystem the study directory is renamed. Otherwise copy the data, don't move in case there is a problem */
+	bool renamed = false;
+	if (d.exists(oldpath) && !d.exists(newpath) && n->IsSameFilesystem(oldpath, newsubject->subjectpath)) {
+		n->WriteLog("Renaming study directory within archive directory");
+		renamed = d.rename(oldpath, newpath);
+		if (renamed)
+			msgs << n->WriteLog("Renamed [" + oldpath + "] to [" + newpath + "]");
+		else
+			n->WriteLog("Unable to rename [" + oldpath + "] to [" + newpath + "]. Copying instead");
+	}
+
+	if ((!renamed) && (d.exists(oldpath))) {
+		d.mkpath(newpath);
+		if (!d.exists(newpath)) msgs << "Error creating newpath [" + newpath + "]";
+
+		n->WriteLog("Copying data within archive directory");
+		QString m;
+		bool copied = n->CopyDir(oldpath, newpath, GetCopyThreads(), m, [this](qint64 done, qint64 total) { SetIORequestProgress(done, total); });
+		msgs << n->WriteLog(m);
+
+		/* the study still points to the old path, so leave the database alone and keep the original data */
+		if (!copied) {
+			msgs << n->WriteLog("Error copying [" + oldpath + "] to [" + newpath + "]. The study was not moved");
+			msg = msgs.join(" | ");
+			delete newsubject;
+			return false;
+		}
+	}
+
+	/* change the enrollment_id associated with the studyid */
+	q.prepare("update studies set enrollment_id = :enrollmentid, study_num = :newstudynum where study_id = :studyid");
+	q.bindValue(":enrollmentid", newenrollmentid);
+	q.bindValue(":newstudynum", newstudynum);
+	q.bindValue(":studyid", studyid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+
+	n->RemoveFromDirSizeIndex(oldpath);
 
 	msg = msgs.join(" | ");
 	q.prepare("insert into changelog (affected_projectid1, affected_projectid2, affected_subjectid1, affected_subjectid2, affected_enrollmentid1, affected_enrollmentid2, affected_studyid1, affected_studyid2, change_datetime, change_event, change_desc) values (:oldprojectid, :oldprojectid, :oldsubjectid, :newsubjectid, :oldenrollmentid, :newenrollmentid, :studyid, :studyid, now(), 'MoveStudyToSubject', :msg)");
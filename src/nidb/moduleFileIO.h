@@ -38,6 +38,10 @@ public:
 	bool CreateLinks(qint64 analysisid, QString destination, QString &msg);
 	QString GetAnalyisRootPath(qint64 analysisid, QString &msg);
 	bool CopyAnalysis(qint64 analysisid, QString destination, QString &msg);
+	bool MoveToDeleted(QString path, QString name, bool keep, QString &newpath, QString &msg);
+	void QueueDeletedPath(QString datatype, qint64 dataid, QString originalpath, QString deletedpath, int retentiondays);
+	int ReapDeleted();
+	bool KeepReaping();
 	bool DeleteAnalysis(qint64 analysisid, QString &msg);
 	bool DeletePipeline(int pipelineid, QString &msg);
 	bool DeleteSubject(int subjectid, QString username, QString &msg);
@@ -50,9 +54,14 @@ public:
     bool MergeStudies(int studyid, QString mergeIDs, QString mergeMethod, QString &msg);
 	QString GetIORequestStatus(int requestid);
 	bool SetIORequestStatus(int requestid, QString status, QString msg = "");
+	void SetIORequestProgress(qint64 bytesdone, qint64 bytestotal);
+	int GetCopyThreads();
+	int GetReapThreads();
+	int GetRetentionDays();
 
 private:
 	nidb *n;
+	int currentrequestid = 0;
 };
 
 #endif // MODULEFILEIO_H
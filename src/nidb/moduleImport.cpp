@@ -1501,6 +1501,7 @@ bool moduleImport::InsertDICOMSeries(int importid, QStringList files, QString &m
 	qint64 dirsize = 0;
 	int nfiles;
 	n->GetDirSizeAndFileCount(outdir, nfiles, dirsize);
+	n->UpdateDirSizeIndex(outdir, nfiles, dirsize);
 	msgs << n->WriteLog(QString("output directory [%1] is size [%2] and contains nfiles [%3]").arg(outdir).arg(dirsize).arg(nfiles));
 
 	/* check if its an EPI sequence, but not a perfusion sequence */
@@ -2236,6 +2237,7 @@ bool moduleImport::InsertParRec(int importid, QString file, QString &msg) {
 	qint64 dirsize(0);
 	int nfiles(0);
 	n->GetDirSizeAndFileCount(outdir, nfiles, dirsize);
+	n->UpdateDirSizeIndex(outdir, nfiles, dirsize);
 
 	/* update the database with the correct number of files/BOLD reps */
 	if (Modality == "mr") {
@@ -2633,6 +2635,7 @@ bool moduleImport::InsertEEG(int importid, QString file, QString &msg) {
 	qint64 dirsize(0);
 	int nfiles(0);
 	n->GetDirSizeAndFileCount(outdir, nfiles, dirsize);
+	n->UpdateDirSizeIndex(outdir, nfiles, dirsize);
 	q2.prepare(QString("update %1_series set series_size = :dirsize where %1series_id = :seriesRowID").arg(Modality.toLower()));
 	q2.bindValue(":dirsize", dirsize);
 	q2.bindValue(":seriesRowID", seriesRowID);
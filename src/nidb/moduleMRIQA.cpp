@@ -22,6 +22,13 @@
 
 #include "moduleMRIQA.h"
 #include <QSqlQuery>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <complex>
+#include <atomic>
+#include <cmath>
 
 /* ---------------------------------------------------------- */
 /* --------- moduleMRIQA ----------------------------------- */
@@ -44,101 +51,234 @@ moduleMRIQA::~moduleMRIQA()
 /* ---------------------------------------------------------- */
 /* --------- Run -------------------------------------------- */
 /* ---------------------------------------------------------- */
+/* the main thread claims series and writes results to the    */
+/* database, a pool of workers runs the QA itself. the        */
+/* workers don't touch the database                           */
+/* ---------------------------------------------------------- */
 int moduleMRIQA::Run() {
 	n->WriteLog("Entering the mriqa module");
 
-	int ret(0);
+	/* the workers read the config from this copy, so they never touch the shared one */
+	cfg = n->cfg;
+	int numworkers = GetNumWorkers();
+	int instances = std::max(n->GetNumThreads(), 1);
+	statsthreads = std::max(QThread::idealThreadCount()/(instances*numworkers), 1);
+	n->WriteLog(QString("Using [%1] QA workers, with [%2] threads each for the image statistics").arg(numworkers).arg(statsthreads));
+
+	n->ModuleRunningCheckIn();
+	ReleaseStaleClaims();
+
+	std::deque<mrqaJob> todo, done;
+	std::mutex mtx;
+	std::condition_variable workready, jobdone;
+	bool finished(false);
+	int numbusy(0);
+
+	auto worker = [&]() {
+		while (true) {
+			mrqaJob job;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				workready.wait(lock, [&]{ return finished || !todo.empty(); });
+				if (todo.empty())
+					return;
+				job = todo.front();
+				todo.pop_front();
+				numbusy++;
+			}
+			QA(job);
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				done.push_back(job);
+				numbusy--;
+			}
+			jobdone.notify_one();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int i=0; i<numworkers; i++)
+		workers.emplace_back(worker);
+
+	int numClaimed(0), numSaved(0);
+	bool claiming(true);
+	while (true) {
+		/* keep a few series queued, so the workers never wait on the database */
+		int numqueued;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			numqueued = int(todo.size()) + numbusy;
+		}
+		if ((claiming) && (numqueued < numworkers*2)) {
+			QList<mrqaJob> jobs;
+			ClaimSeries(numworkers*2 - numqueued, jobs);
+			if (jobs.size() > 0) {
+				{
+					std::lock_guard<std::mutex> lock(mtx);
+					for (int i=0; i<jobs.size(); i++)
+						todo.push_back(jobs[i]);
+				}
+				numClaimed += jobs.size();
+				workready.notify_all();
+			}
+			else
+				claiming = false;
+		}
 
-	/* look through DB for all series that don't have an associated mr_qa row */
-	QString sqlstring = "SELECT a.mrseries_id FROM mr_series a LEFT JOIN mr_qa b ON a.mrseries_id = b.mrseries_id WHERE b.mrqa_id IS NULL and a.lastupdate < date_sub(now(), interval 3 minute) order by a.mrseries_id desc";
+		/* save whatever has finished */
+		std::deque<mrqaJob> finishedjobs;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			finishedjobs.swap(done);
+		}
+		for (auto &job : finishedjobs) {
+			SaveQA(job);
+			numSaved++;
+			n->WriteLog(QString("***** Finished MR QA [%1] of [%2] claimed *****").arg(numSaved).arg(numClaimed));
+		}
 
-	QSqlQuery q;
-	q.prepare(sqlstring);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	if (q.size() > 0) {
-		int numProcessed(0);
-		int numToDo = q.size();
-		while (q.next()) {
-			n->WriteLog(QString("***** Working on MR QA [%1] of [%2] *****").arg(numProcessed).arg(numToDo));
-			n->ModuleRunningCheckIn();
-			int mrseriesid = q.value("mrseries_id").toInt();
-			QA(mrseriesid);
-
-			/* only process 10 series before exiting the script. Since the script always starts with the newest when it first runs,
-			   this will allow newly collect studies a chance to be QA'd if there is a backlog of old studies */
-			numProcessed++;
-			if (numProcessed > 10) {
-				n->WriteLog("Processed 10 QC jobs, exiting");
-				break;
-			}
+		n->ModuleRunningCheckIn();
 
-			/* check if this module should be running now or not */
-			if (!n->ModuleCheckIfActive()) {
-				n->WriteLog("Not supposed to be running right now. Exiting module");
-				break;
-			}
+		/* check if this module should be running now or not. finish what has been claimed, but don't claim more */
+		if ((claiming) && (!n->ModuleCheckIfActive())) {
+			n->WriteLog("Not supposed to be running right now. Finishing the claimed series and exiting module");
+			claiming = false;
+		}
 
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if ((!claiming) && (todo.empty()) && (numbusy == 0) && (done.empty()))
+				break;
+			jobdone.wait_for(lock, std::chrono::seconds(10), [&]{ return !done.empty(); });
 		}
-		n->WriteLog(QString("Finished MRI-QA [%1] of [%2]").arg(numProcessed).arg(numToDo));
-		ret = 1;
 	}
-	else {
-		n->WriteLog("Nothing to do");
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		finished = true;
+	}
+	workready.notify_all();
+	for (auto &th : workers)
+		th.join();
+
+	if (numSaved > 0) {
+		n->WriteLog(QString("Finished MRI-QA on [%1] series").arg(numSaved));
+		return 1;
 	}
 
-	return ret;
+	n->WriteLog("Nothing to do");
+	return 0;
 }
 
 
 /* ---------------------------------------------------------- */
-/* --------- QA --------------------------------------------- */
+/* --------- GetNumWorkers ---------------------------------- */
 /* ---------------------------------------------------------- */
-bool moduleMRIQA::QA(int seriesid) {
+int moduleMRIQA::GetNumWorkers() {
+	int numworkers = n->cfg["modulemriqaworkers"].toInt();
+	if (numworkers < 1)
+		numworkers = std::max(QThread::idealThreadCount()/std::max(n->GetNumThreads(), 1), 1);
+	return numworkers;
+}
 
-	QStringList msgs;
 
-	/* get the series info */
-	series s(seriesid, "MR", n);
-	if (!s.isValid) {
-		n->WriteLog("Series was not valid: [" + s.msg + "]");
-		return false;
-	}
+/* ---------------------------------------------------------- */
+/* --------- ReleaseStaleClaims ----------------------------- */
+/* ---------------------------------------------------------- */
+/* series claimed by an mriqa process on this host that is no */
+/* longer running go back into the queue                      */
+/* ---------------------------------------------------------- */
+void moduleMRIQA::ReleaseStaleClaims() {
+	QSqlQuery q;
+	q.prepare("delete from mr_qa where status = 'processing' and qa_hostname = :hostname and qa_pid not in (select process_id from module_procs where module_name = 'mriqa')");
+	q.bindValue(":hostname", QHostInfo::localHostName());
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.numRowsAffected() > 0)
+		n->WriteLog(QString("Released [%1] series claimed by mriqa processes that are no longer running").arg(q.numRowsAffected()));
+}
 
-	int seriesnum = s.seriesnum;
-	int studynum = s.studynum;
-	int isderived = s.isderived;
-	QString uid = s.uid;
-	QString datatype = s.datatype;
-	int mrqaid(0);
 
-	QString indir = s.datapath;
-	n->WriteLog("======================== Working on ["+indir+"] ========================");
+/* ---------------------------------------------------------- */
+/* --------- ClaimSeries ------------------------------------ */
+/* ---------------------------------------------------------- */
+/* claim up to max series that don't have an mr_qa row. the   */
+/* claim is the insert of the mr_qa row, and mrseries_id is a */
+/* unique key, so only one process can claim a series         */
+/* ---------------------------------------------------------- */
+int moduleMRIQA::ClaimSeries(int max, QList<mrqaJob> &jobs) {
 
-	/* check if this mr_qa row exists */
 	QSqlQuery q;
-	q.prepare("select * from mr_qa where mrseries_id = :seriesid");
-	q.bindValue(":seriesid",seriesid);
+	q.prepare("SELECT a.mrseries_id FROM mr_series a LEFT JOIN mr_qa b ON a.mrseries_id = b.mrseries_id WHERE b.mrqa_id IS NULL and a.lastupdate < date_sub(now(), interval 3 minute) order by a.mrseries_id desc limit :limit");
+	/* other instances are claiming from the same list, so look a little further ahead */
+	q.bindValue(":limit", max*4);
 	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	if (q.size() > 0) {
-		/* if a row does exist, go onto the next row */
-		msgs << n->WriteLog("Another instance of this module is working on [" + indir + "]");
-		return false;
-	}
-	else {
-		/* insert a blank row for this mr_qa and get the row ID */
+
+	while ((q.next()) && (jobs.size() < max)) {
+		int seriesid = q.value("mrseries_id").toInt();
+
 		QSqlQuery q2;
-		q2.prepare("insert into mr_qa (mrseries_id) values (:seriesid)");
-		q2.bindValue(":seriesid",seriesid);
+		q2.prepare("insert ignore into mr_qa (mrseries_id, status, qa_hostname, qa_pid, qa_startdate) values (:seriesid, 'processing', :hostname, :pid, now())");
+		q2.bindValue(":seriesid", seriesid);
+		q2.bindValue(":hostname", QHostInfo::localHostName());
+		q2.bindValue(":pid", QCoreApplication::applicationPid());
 		n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
-		mrqaid = q2.lastInsertId().toInt();
+		if (q2.numRowsAffected() < 1)
+			continue; /* another instance got it first */
+
+		mrqaJob job;
+		job.seriesid = seriesid;
+		job.mrqaid = q2.lastInsertId().toInt();
+
+		/* get the series info */
+		series s(seriesid, "MR", n);
+		if (!s.isValid) {
+			n->WriteLog("Series was not valid: [" + s.msg + "]");
+			QSqlQuery q3;
+			q3.prepare("update mr_qa set status = 'error' where mrqa_id = :mrqaid");
+			q3.bindValue(":mrqaid", job.mrqaid);
+			n->SQLQuery(q3, __FUNCTION__, __FILE__, __LINE__);
+			continue;
+		}
+		job.uid = s.uid;
+		job.studynum = s.studynum;
+		job.seriesnum = s.seriesnum;
+		job.isderived = s.isderived;
+		job.datatype = s.datatype;
+		job.datapath = s.datapath;
+		job.seriespath = s.seriespath;
+
+		n->WriteLog(QString("Claimed series [%1] [%2]").arg(seriesid).arg(job.datapath));
+		jobs.append(job);
 	}
 
-	msgs << n->WriteLog("Setting current directory to ["+indir+"]");
-	QDir::setCurrent(indir);
+	return jobs.size();
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- QA --------------------------------------------- */
+/* ---------------------------------------------------------- */
+/* runs on a worker thread. no database access, and no        */
+/* changing the current directory                             */
+/* ---------------------------------------------------------- */
+bool moduleMRIQA::QA(mrqaJob &job) {
+
+	QStringList msgs;
+	QElapsedTimer timer;
+	timer.start();
+
+	int seriesnum = job.seriesnum;
+	int studynum = job.studynum;
+	int isderived = job.isderived;
+	QString uid = job.uid;
+	QString datatype = job.datatype;
 
-	/* unfortunately, for now, this tmpdir must match the tmpdir in the nii_qa.sh script */
-	QString tmpdir = n->cfg["tmpdir"] + "/" + n->GenerateRandomString(10);
-	QString qapath = QString("%1/%2/%3/%4/qa").arg(n->cfg["archivedir"]).arg(uid).arg(studynum).arg(seriesnum);
+	QString indir = job.datapath;
+	n->WriteLog("======================== Working on ["+indir+"] ========================");
+
+	/* working directory for the converted 4D file and the motion corrected series */
+	QString tmpdir = QString("%1/mriqa-%2-%3").arg(cfg.value("tmpdir")).arg(QCoreApplication::applicationPid()).arg(job.seriesid);
+	QString qapath = QString("%1/%2/%3/%4/qa").arg(cfg.value("archivedir")).arg(uid).arg(studynum).arg(seriesnum);
 
 	/* create the tmp and out paths */
 	QString m;
@@ -154,133 +294,109 @@ bool moduleMRIQA::QA(int seriesid) {
 		return false;
 	}
 
-	if ((isderived) || (datatype == "nifti")) {
-		QString systemstring = QString("cp -v %1/%2/%3/%4/nifti/* %5").arg(n->cfg["archivedir"]).arg(uid).arg(studynum).arg(seriesnum).arg(tmpdir);
-		msgs << n->WriteLog(n->SystemCommand(systemstring));
+	/* the series as a 3D or 4D image. DICOM series are assembled in memory, so there is no conversion to NIfTI first */
+	nifti img;
+	QString filepath4d;
+	QString systemstring;
+	if ((!isderived) && (datatype == "dicom")) {
+		QStringList dcms = n->FindAllFiles(indir, "*.dcm");
+		if (img.ReadDicom(dcms, statsthreads, m))
+			msgs << n->WriteLog(QString("Read [%1] DICOM files from [%2] into memory").arg(dcms.size()).arg(indir));
+		else
+			msgs << n->WriteLog("Unable to read the DICOM files directly [" + m + "], converting to NIfTI instead");
 	}
-	else {
-		QString systemstring;
 
-		/* create a 4D file to pass to the SNR program and run the SNR program on it */
-		if (datatype == "dicom")
-            systemstring = QString("pwd; %1/bin/./dcm2niix -g y -o '%2' %3").arg(n->cfg["nidbdir"]).arg(tmpdir).arg(indir);
+	if (!img.isValid) {
+		if ((isderived) || (datatype == "nifti")) {
+			systemstring = QString("cp -v %1/%2/%3/%4/nifti/* %5").arg(cfg.value("archivedir")).arg(uid).arg(studynum).arg(seriesnum).arg(tmpdir);
+			msgs << n->WriteLog(n->SystemCommand(systemstring));
+		}
+		else {
+			/* create a 4D file to pass to the SNR program and run the SNR program on it */
+			systemstring = QString("%1/bin/./dcm2niix -g y -o '%2' %3").arg(cfg.value("nidbdir")).arg(tmpdir).arg(indir);
+			msgs << n->WriteLog(n->SystemCommand(systemstring));
+		}
+
+		msgs << n->WriteLog("Done attempting to convert files... now trying to copy out the first valid Nifti file");
+
+		int c(0);
+		qint64 b(0);
+		n->GetDirSizeAndFileCount(tmpdir, c, b);
+		if ((c == 0) | (b == 0)) {
+			msgs << n->WriteLog(QString("No files found in ["+tmpdir+"] after copying or converting. dircount [%1] dirsize [%2]").arg(c).arg(b));
+			WriteQALog(qapath, msgs.join("\n"));
+			return false;
+		}
 		else
-            systemstring = QString("pwd; %1/bin/./dcm2niix -g y -o '%2' %3").arg(n->cfg["nidbdir"]).arg(tmpdir).arg(indir);
+			msgs << n->WriteLog(QString("Found files in ["+tmpdir+"] after copying or converting. dircount [%1] dirsize [%2]").arg(c).arg(b));
 
+		systemstring = "cd " + tmpdir + "; find . -name '*.nii.gz' | head -1 | xargs -i cp -v {} 4D.nii.gz";
+		msgs << n->WriteLog(n->SystemCommand(systemstring));
+		systemstring = "cd " + tmpdir + "; find . -name '*.nii' | head -1 | xargs -i cp -v {} 4D.nii";
 		msgs << n->WriteLog(n->SystemCommand(systemstring));
-	}
-	QString systemstring;
 
-	msgs << n->WriteLog("Done attempting to convert files... now trying to copy out the first valid Nifti file");
-	QDir::setCurrent(tmpdir);
+		/* check if any 4D file was created */
+		if (QFile::exists(tmpdir + "/4D.nii"))
+			filepath4d = tmpdir + "/4D.nii";
+		else if (QFile::exists(tmpdir + "/4D.nii.gz"))
+			filepath4d = tmpdir + "/4D.nii.gz";
 
-	int c(0);
-	qint64 b(0);
-	n->GetDirSizeAndFileCount(tmpdir, c, b);
-	if ((c == 0) | (b == 0)) {
-		msgs << n->WriteLog(QString("No files found in ["+tmpdir+"] after copying or converting. dircount [%1] dirsize [%2]").arg(c).arg(b));
-		WriteQALog(qapath, msgs.join("\n"));
-		return false;
+		msgs << n->WriteLog("4D file path [" + filepath4d + "]");
+		if ((filepath4d != "") && (!img.Read(filepath4d, m)))
+			msgs << n->WriteLog("Unable to read 4D file: [" + m + "]");
 	}
-	else
-		msgs << n->WriteLog(QString("Found files in ["+tmpdir+"] after copying or converting. dircount [%1] dirsize [%2]").arg(c).arg(b));
-
-	systemstring = "find . -name '*.nii.gz' | head -1 | xargs -i cp -v {} 4D.nii.gz";
-	msgs << n->WriteLog(n->SystemCommand(systemstring));
-	systemstring = "find . -name '*.nii' | head -1 | xargs -i cp -v {} 4D.nii";
-	msgs << n->WriteLog(n->SystemCommand(systemstring));
-
-	/* check if any 4D file was created */
-	QString filepath4d;
-	if (QFile::exists(tmpdir + "/4D.nii"))
-		filepath4d = tmpdir + "/4D.nii";
-	else if (QFile::exists(tmpdir + "/4D.nii.gz"))
-		filepath4d = tmpdir + "/4D.nii.gz";
 
-	msgs << n->WriteLog("4D file path [" + filepath4d + "]");
+	/* image dimensions */
+	if (img.isValid) {
+		job.dimN = int(img.dim[0]);
+		job.dimX = int(img.dim[1]);
+		job.dimY = int(img.dim[2]);
+		job.dimZ = int(img.dim[3]);
+		job.dimT = int(img.dim[4]);
+		job.voxX = img.pixdim[1];
+		job.voxY = img.pixdim[2];
+		job.voxZ = img.pixdim[3];
+		msgs << n->WriteLog(QString("Image dimensions [%1] [%2 x %3 x %4 x %5] voxel size [%6 x %7 x %8]").arg(job.dimN).arg(job.dimX).arg(job.dimY).arg(job.dimZ).arg(job.dimT).arg(job.voxX).arg(job.voxY).arg(job.voxZ));
+	}
+	else
+		msgs << n->WriteLog("Unable to read image dimensions");
 
     /* any program that calls FSL must export the paths and source the fsl.sh script, the following must be prepended to any commands that need FSL */
-    QString fsl = QString("export FSLDIR=%1; source ${FSLDIR}/etc/fslconf/fsl.sh; export PATH=$PATH:%1/bin; ").arg(n->cfg["fsldir"]);
-
-	n->WriteLog("Starting the nii_qa script. Will return to logging after the script is finished");
-	/* create a 4D file to pass to the SNR program and run the SNR program on it */
-    systemstring = QString(fsl + "%1/bin/./nii_qa.sh -i " + filepath4d + " -o %2/qa.txt -v 2 -t %3").arg(n->cfg["nidbdir"]).arg(qapath).arg(tmpdir);
-	msgs << n->WriteLog(n->SystemCommand(systemstring));
+    QString fsl = QString("export FSLDIR=%1; source ${FSLDIR}/etc/fslconf/fsl.sh; export PATH=$PATH:%1/bin; ").arg(cfg.value("fsldir"));
 
-	/* move the realignment file(s) from the tmp to the archive directory */
-	systemstring = QString("mv -v %1/*.par %2/").arg(tmpdir).arg(qapath);
-	msgs << n->WriteLog(n->SystemCommand(systemstring));
-
-	/* rename the realignment file to something meaningful */
-	systemstring = QString("mv -v %1/*.par %1/MotionCorrection.txt").arg(qapath);
-	msgs << n->WriteLog(n->SystemCommand(systemstring));
-
-	/* move and rename the mean,sigma,variance volumes from the tmp to the archive directory */
-	systemstring = QString("mv -v %1/*mcvol_meanvol.nii.gz %2/Tmean.nii.gz").arg(tmpdir).arg(qapath);
-	msgs << n->WriteLog(n->SystemCommand(systemstring));
-	systemstring = QString("mv -v %1/*mcvol_sigma.nii.gz %2/Tsigma.nii.gz").arg(tmpdir).arg(qapath);
-	msgs << n->WriteLog(n->SystemCommand(systemstring));
-	systemstring = QString("mv -v %1/*mcvol_variance.nii.gz %2/Tvariance.nii.gz").arg(tmpdir).arg(qapath);
-	msgs << n->WriteLog(n->SystemCommand(systemstring));
-	systemstring = QString("mv -v %1/*mcvol.nii.gz %1/mc4D.nii.gz").arg(tmpdir);
-	msgs << n->WriteLog(n->SystemCommand(systemstring));
+	/* SNR, motion correction, and the Tmean/Tsigma/Tvariance volumes */
+	nifti mc4d;
+	if (img.isValid)
+		TemporalQA(img, filepath4d, tmpdir, qapath, fsl, mc4d, job.iosnr, job.pvsnr, msgs);
 
 	/* create thumbnails (try 4 different ways before giving up) */
-	QString thumbfile = s.seriespath + "/thumb.png";
-	if (!QFile::exists(thumbfile)) {
+	QString thumbfile = job.seriespath + "/thumb.png";
+	if ((!QFile::exists(thumbfile)) && ((img.isValid) || (filepath4d != ""))) {
 		msgs << n->WriteLog(thumbfile + " does not exist, attempting to create it (method 1)");
+		/* slicer needs a file, so an image read from DICOM is written out first */
+		if (filepath4d == "") {
+			filepath4d = tmpdir + "/4D.nii";
+			if (!img.Write(filepath4d, m))
+				msgs << n->WriteLog(m);
+		}
         systemstring = QString(fsl + "slicer %1 -a %2").arg(filepath4d).arg(thumbfile);
 		msgs << n->WriteLog(n->SystemCommand(systemstring));
 	}
 	if (!QFile::exists(thumbfile)) {
         msgs << n->WriteLog(thumbfile + " does not exist, attempting to create it (method 2)");
-        systemstring = QString(fsl + "slicer %1/*.nii.gz -a %1").arg(s.datapath).arg(thumbfile);
+        systemstring = QString(fsl + "slicer %1/*.nii.gz -a %1").arg(job.datapath).arg(thumbfile);
 		msgs << n->WriteLog(n->SystemCommand(systemstring));
 	}
 	if (!QFile::exists(thumbfile)) {
         msgs << n->WriteLog(thumbfile + " does not exist, attempting to create it (method 3)");
-        systemstring = QString(fsl + "slicer %1/*.nii -a %2").arg(s.datapath).arg(thumbfile);
+        systemstring = QString(fsl + "slicer %1/*.nii -a %2").arg(job.datapath).arg(thumbfile);
 		msgs << n->WriteLog(n->SystemCommand(systemstring));
 	}
 
-	/* get image dimensions */
-	int dimN(0), dimX(0), dimY(0), dimZ(0), dimT(0);
-	double voxX(0.0), voxY(0.0), voxZ(0.0);
-	if (filepath4d != "") {
-		QString s;
-        s = QString(fsl + "fslval %1 dim0").arg(filepath4d);
-		n->WriteLog(n->SystemCommand(s));
-		dimN = n->SystemCommand(s, false).trimmed().toInt();
-
-        s = QString(fsl + "fslval %1 dim1").arg(filepath4d);
-        n->WriteLog(n->SystemCommand(s));
-		dimX = n->SystemCommand(s, false).trimmed().toInt();
-
-        s = QString(fsl + "fslval %1 dim2").arg(filepath4d);
-        n->WriteLog(n->SystemCommand(s));
-		dimY = n->SystemCommand(s, false).trimmed().toInt();
-
-        s = QString(fsl + "fslval %1 dim3").arg(filepath4d);
-        n->WriteLog(n->SystemCommand(s));
-		dimZ = n->SystemCommand(s, false).trimmed().toInt();
-
-        s = QString(fsl + "fslval %1 dim4").arg(filepath4d);
-        n->WriteLog(n->SystemCommand(s));
-		dimT = n->SystemCommand(s, false).trimmed().toInt();
-
-        s = QString(fsl + "fslval %1").arg(filepath4d);
-        n->WriteLog(n->SystemCommand(s + " pixdim1"));
-		voxX = n->SystemCommand(s + " pixdim1", false).trimmed().toDouble();
-		n->WriteLog(n->SystemCommand(s + " pixdim2"));
-		voxY = n->SystemCommand(s + " pixdim2", false).trimmed().toDouble();
-		n->WriteLog(n->SystemCommand(s + " pixdim3"));
-		voxZ = n->SystemCommand(s + " pixdim3", false).trimmed().toDouble();
-	}
-
 	/* get min/max intensity in the mean/variance/stdev volumes and create thumbnails of the mean, sigma, and varaiance images */
 	if (QFile::exists(qapath + "/Tmean.nii.gz")) {
-        systemstring = QString(fsl + "fslstats %1/Tmean.nii.gz -R > %1/minMaxMean.txt").arg(qapath);
-		msgs << n->WriteLog(n->SystemCommand(systemstring));
+		if (!WriteRange(qapath + "/Tmean.nii.gz", qapath + "/minMaxMean.txt", m))
+			msgs << n->WriteLog(m);
         systemstring = QString(fsl + "slicer %1/Tmean.nii.gz -a %1/Tmean.png").arg(qapath);
 		msgs << n->WriteLog(n->SystemCommand(systemstring));
 	}
@@ -288,8 +404,8 @@ bool moduleMRIQA::QA(int seriesid) {
 		msgs << n->WriteLog(qapath + "/Tmean.nii.gz does not exist");
 
 	if (QFile::exists(qapath + "/Tsigma.nii.gz")) {
-        systemstring = QString(fsl + "fslstats %1/Tsigma.nii.gz -R > %1/minMaxSigma.txt").arg(qapath);
-		msgs << n->WriteLog(n->SystemCommand(systemstring));
+		if (!WriteRange(qapath + "/Tsigma.nii.gz", qapath + "/minMaxSigma.txt", m))
+			msgs << n->WriteLog(m);
         systemstring = QString(fsl + "slicer %1/Tsigma.nii.gz -a %1/Tsigma.png").arg(qapath);
         msgs << n->WriteLog(n->SystemCommand(systemstring));
 	}
@@ -297,42 +413,27 @@ bool moduleMRIQA::QA(int seriesid) {
 		msgs << n->WriteLog(qapath + "/Tsigma.nii.gz does not exist");
 
 	if (QFile::exists(qapath + "/Tvariance.nii.gz")) {
-        systemstring = QString(fsl + "fslstats %1/Tvariance.nii.gz -R > %1/minMaxVariance.txt").arg(qapath);
-		msgs << n->WriteLog(n->SystemCommand(systemstring));
+		if (!WriteRange(qapath + "/Tvariance.nii.gz", qapath + "/minMaxVariance.txt", m))
+			msgs << n->WriteLog(m);
         systemstring = QString(fsl + "slicer %1/Tvariance.nii.gz -a %1/Tvariance.png").arg(qapath);
 		msgs << n->WriteLog(n->SystemCommand(systemstring));
 	}
 	else
 		msgs << n->WriteLog(qapath + "/Tvariance.nii.gz does not exist");
 
-	if (QFile::exists(tmpdir + "/mc4D.nii.gz")) {
-		/* get mean/stdev in intensity over time */
-        systemstring = QString(fsl + "fslstats -t %1/mc4D -m > %2/meanIntensityOverTime.txt").arg(tmpdir).arg(qapath);
-        msgs << n->WriteLog(n->SystemCommand(systemstring));
-        systemstring = QString(fsl + "fslstats -t %1/mc4D -s > %2/stdevIntensityOverTime.txt").arg(tmpdir).arg(qapath);
-		msgs << n->WriteLog(n->SystemCommand(systemstring));
-        systemstring = QString(fsl + "fslstats -t %1/mc4D -e > %2/entropyOverTime.txt").arg(tmpdir).arg(qapath);
-		msgs << n->WriteLog(n->SystemCommand(systemstring));
-        systemstring = QString(fsl + "fslstats -t %1/mc4D -c > %2/centerOfGravityOverTimeMM.txt").arg(tmpdir).arg(qapath);
-		msgs << n->WriteLog(n->SystemCommand(systemstring));
-        systemstring = QString(fsl + "fslstats -t %1/mc4D -C > %2/centerOfGravityOverTimeVox.txt").arg(tmpdir).arg(qapath);
-		msgs << n->WriteLog(n->SystemCommand(systemstring));
-        systemstring = QString(fsl + "fslstats -t %1/mc4D -h 100 > %2/histogramOverTime.txt").arg(tmpdir).arg(qapath);
-		msgs << n->WriteLog(n->SystemCommand(systemstring));
+	if (mc4d.isValid) {
+		/* get mean/stdev/entropy/center of gravity/histogram of intensity over time, all from one read of the file */
+		if (WriteStatsOverTime(mc4d, qapath, m))
+			msgs << n->WriteLog("Wrote intensity statistics over time to [" + qapath + "]");
+		else
+			msgs << n->WriteLog(m);
 	}
 	else
 		msgs << n->WriteLog(tmpdir + "/mc4D.nii.gz does not exist");
 
-	/* parse the QA output file */
-	double pvsnr(0.0), iosnr(0.0);
-	QString m2;
-	GetQAStats(qapath + "/qa.txt", pvsnr, iosnr, m2);
-	msgs << m2;
-
 	/* parse the movement correction file */
-	double maxrx(0.0), maxry(0.0), maxrz(0.0), maxtx(0.0), maxty(0.0), maxtz(0.0), maxax(0.0), maxay(0.0), maxaz(0.0), minrx(0.0), minry(0.0), minrz(0.0), mintx(0.0), minty(0.0), mintz(0.0), minax(0.0), minay(0.0), minaz(0.0);
 	QString m3;
-	GetMovementStats(qapath + "/MotionCorrection.txt", maxrx, maxry, maxrz, maxtx, maxty, maxtz, maxax, maxay, maxaz, minrx, minry, minrz, mintx, minty, mintz, minax, minay, minaz, m3);
+	GetMovementStats(qapath + "/MotionCorrection.txt", job.maxrx, job.maxry, job.maxrz, job.maxtx, job.maxty, job.maxtz, job.maxax, job.maxay, job.maxaz, job.minrx, job.minry, job.minrz, job.mintx, job.minty, job.mintz, job.minax, job.minay, job.minaz, m3);
 	msgs << m3;
 
 	/* if there is no still thumbnail, create one, or replace the original */
@@ -349,123 +450,263 @@ bool moduleMRIQA::QA(int seriesid) {
 		n->SystemCommand("convert --version");
 
 		/* get the middle slice from the dicom files */
-		QStringList dcms = n->FindAllFiles(s.datapath, "*.dcm");
+		QStringList dcms = n->FindAllFiles(job.datapath, "*.dcm");
 		QString dcmfile = dcms[int(dcms.size()/2)];
 		systemstring = "convert -normalize " + dcmfile + " " + thumbfile;
 		msgs << n->WriteLog(n->SystemCommand(systemstring));
 	}
 
-	/* run the motion detection program (for 3D volumes only) */
-	double motion_rsq(0.0);
-	if (dimT == 1) {
-        systemstring = "python " + n->cfg["nidbdir"] + "/bin/StructuralMRIQA.py " + s.seriespath;
+	/* structural motion (for 3D volumes only) */
+	if ((job.dimT == 1) && (img.isValid)) {
 		msgs << n->WriteLog("Running structural motion calculation");
-		QString rsq = n->SystemCommand(systemstring, false);
-		if (rsq == "")
-			motion_rsq = 0.0;
+		if (StructuralMotion(img, statsthreads, job.motion_rsq, m))
+			msgs << n->WriteLog(QString("Structural motion R^2 [%1]").arg(job.motion_rsq));
+		else
+			msgs << n->WriteLog("Unable to calculate structural motion: [" + m + "]");
 	}
 
 	/* delete the 4D file and temp directory */
 	if (!n->RemoveDir(tmpdir, m))
 		msgs << n->WriteLog("Unable to remove directory ["+tmpdir+"] because of error ["+m+"]");
 
-	/* insert this row into the DB */
-	q.prepare("update mr_qa set mrseries_id = :seriesid, io_snr = :iosnr, pv_snr = :pvsnr, move_minx = :mintx, move_miny = :minty, move_minz = :mintz, move_maxx = :maxtx, move_maxy = :maxty, move_maxz = :maxtz, acc_minx = :minax, acc_miny = :minay, acc_minz = :minaz, acc_maxx = :maxax, acc_maxy = :maxay, acc_maxz = :maxaz, rot_minp = :minrx, rot_minr = :minry, rot_miny = :minrz, rot_maxp = :maxrx, rot_maxr = :maxry, rot_maxy = :maxrz, motion_rsq = :motion_rsq, cputime = 0.0 where mrqa_id = :mrqaid");
-	q.bindValue(":seriesid",seriesid);
-	q.bindValue(":iosnr",iosnr);
-	q.bindValue(":pvsnr",pvsnr);
-	q.bindValue(":maxrx",maxrx);
-	q.bindValue(":maxry",maxry);
-	q.bindValue(":maxrz",maxrz);
-	q.bindValue(":maxtx",maxtx);
-	q.bindValue(":maxty",maxty);
-	q.bindValue(":maxtz",maxtz);
-	q.bindValue(":maxax",maxax);
-	q.bindValue(":maxay",maxay);
-	q.bindValue(":maxaz",maxaz);
-	q.bindValue(":minrx",minrx);
-	q.bindValue(":minry",minry);
-	q.bindValue(":minrz",minrz);
-	q.bindValue(":mintx",mintx);
-	q.bindValue(":minty",minty);
-	q.bindValue(":mintz",mintz);
-	q.bindValue(":minax",minax);
-	q.bindValue(":minay",minay);
-	q.bindValue(":minaz",minaz);
-	q.bindValue(":motion_rsq",motion_rsq);
-	q.bindValue(":mrqaid",mrqaid);
+	job.cputime = timer.elapsed()/1000.0;
+	job.success = true;
+
+	msgs << n->WriteLog("======================== Finished [" + indir + "] ========================");
+
+	WriteQALog(qapath, msgs.join("\n"));
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- SaveQA ----------------------------------------- */
+/* ---------------------------------------------------------- */
+/* write the results of a QA job to the database. runs on the */
+/* main thread                                                */
+/* ---------------------------------------------------------- */
+void moduleMRIQA::SaveQA(const mrqaJob &job) {
+
+	QSqlQuery q;
+	if (!job.success) {
+		q.prepare("update mr_qa set status = 'error', cputime = :cputime where mrqa_id = :mrqaid");
+		q.bindValue(":cputime", job.cputime);
+		q.bindValue(":mrqaid", job.mrqaid);
+		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+		return;
+	}
+
+	/* update this series' mr_qa row */
+	q.prepare("update mr_qa set status = 'complete', mrseries_id = :seriesid, io_snr = :iosnr, pv_snr = :pvsnr, move_minx = :mintx, move_miny = :minty, move_minz = :mintz, move_maxx = :maxtx, move_maxy = :maxty, move_maxz = :maxtz, acc_minx = :minax, acc_miny = :minay, acc_minz = :minaz, acc_maxx = :maxax, acc_maxy = :maxay, acc_maxz = :maxaz, rot_minp = :minrx, rot_minr = :minry, rot_miny = :minrz, rot_maxp = :maxrx, rot_maxr = :maxry, rot_maxy = :maxrz, motion_rsq = :motion_rsq, cputime = :cputime where mrqa_id = :mrqaid");
+	q.bindValue(":seriesid", job.seriesid);
+	q.bindValue(":iosnr", job.iosnr);
+	q.bindValue(":pvsnr", job.pvsnr);
+	q.bindValue(":maxrx", job.maxrx);
+	q.bindValue(":maxry", job.maxry);
+	q.bindValue(":maxrz", job.maxrz);
+	q.bindValue(":maxtx", job.maxtx);
+	q.bindValue(":maxty", job.maxty);
+	q.bindValue(":maxtz", job.maxtz);
+	q.bindValue(":maxax", job.maxax);
+	q.bindValue(":maxay", job.maxay);
+	q.bindValue(":maxaz", job.maxaz);
+	q.bindValue(":minrx", job.minrx);
+	q.bindValue(":minry", job.minry);
+	q.bindValue(":minrz", job.minrz);
+	q.bindValue(":mintx", job.mintx);
+	q.bindValue(":minty", job.minty);
+	q.bindValue(":mintz", job.mintz);
+	q.bindValue(":minax", job.minax);
+	q.bindValue(":minay", job.minay);
+	q.bindValue(":minaz", job.minaz);
+	q.bindValue(":motion_rsq", job.motion_rsq);
+	q.bindValue(":cputime", job.cputime);
+	q.bindValue(":mrqaid", job.mrqaid);
 	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__,true);
 
+    /* the series directory was indexed when it was archived */
     qint64 dirsize = 0;
-    int nfiles;
-    n->GetDirSizeAndFileCount(indir, nfiles, dirsize);
+    int nfiles = 0;
+    n->GetIndexedDirSize(job.datapath, nfiles, dirsize);
 
 	/* update the mr_series table with the image dimensions */
     q.prepare("update mr_series set dimN = :n, dimX = :x, dimY = :y, dimZ = :z, dimT = :t, series_spacingx = :voxX, series_spacingy = :voxY, series_spacingz = :voxZ, bold_reps = :t, numfiles = :numfiles, series_size = :seriessize where mrseries_id = :seriesid");
-	q.bindValue(":seriesid",seriesid);
-	q.bindValue(":n", dimN);
-	q.bindValue(":x", dimX);
-	q.bindValue(":y", dimY);
-	q.bindValue(":z", dimZ);
-	q.bindValue(":t", dimT);
-
-	q.bindValue(":voxX", voxX);
-	q.bindValue(":voxY", voxY);
-	q.bindValue(":voxZ", voxZ);
+	q.bindValue(":seriesid", job.seriesid);
+	q.bindValue(":n", job.dimN);
+	q.bindValue(":x", job.dimX);
+	q.bindValue(":y", job.dimY);
+	q.bindValue(":z", job.dimZ);
+	q.bindValue(":t", job.dimT);
+
+	q.bindValue(":voxX", job.voxX);
+	q.bindValue(":voxY", job.voxY);
+	q.bindValue(":voxZ", job.voxZ);
     q.bindValue(":numfiles", nfiles);
     q.bindValue(":seriessize", dirsize);
 
 	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__, true);
-
-	msgs << n->WriteLog("======================== Finished [" + indir + "] ========================");
-
-	WriteQALog(qapath, msgs.join("\n"));
-
-	return true;
 }
 
 
 /* ---------------------------------------------------------- */
-/* --------- GetQAStats ------------------------------------- */
+/* --------- TemporalQA ------------------------------------- */
+/* ---------------------------------------------------------- */
+/* native replacement for the nii_qa.sh script. computes the  */
+/* inside/outside and per-voxel SNR of the series, motion     */
+/* corrects it with mcflirt, and writes the Tmean, Tsigma,    */
+/* and Tvariance volumes of the motion corrected series.      */
+/* filepath4d is empty if img was read from DICOM, and is set */
+/* if the image has to be written out for mcflirt. img is     */
+/* closed before the motion corrected series is read          */
 /* ---------------------------------------------------------- */
-bool moduleMRIQA::GetQAStats(QString f, double &pvsnr, double &iosnr, QString &msg) {
+bool moduleMRIQA::TemporalQA(nifti &img, QString &filepath4d, QString tmpdir, QString qapath, QString fsl, nifti &mc4d, double &iosnr, double &pvsnr, QStringList &msgs) {
 
-	QStringList msgs;
+	QString m;
+	iosnr = 0.0;
+	pvsnr = 0.0;
 
-	if (!QFile::exists(f)) {
-		msgs << n->WriteLog("SNR file [" + f + "] does not exist");
-		msg = msgs.join("\n");
+	/* temporal mean and variance of the uncorrected series */
+	QVector<float> mean, variance;
+	if (!img.GetTemporalStats(mean, variance, statsthreads, m)) {
+		msgs << n->WriteLog(m);
 		return false;
 	}
+
+	/* brain mask from the mean volume */
+	QVector<float> mask;
+	if (img.Write(tmpdir + "/tmean.nii.gz", mean.data(), 1, m)) {
+		QString systemstring = QString(fsl + "bet %1/tmean %1/tmean_brain").arg(tmpdir);
+		msgs << n->WriteLog(n->SystemCommand(systemstring));
+
+		nifti brain;
+		if (brain.Read(tmpdir + "/tmean_brain.nii.gz", m)) {
+			mask.resize(mean.size());
+			if (!brain.GetVolume(0, mask.data()))
+				mask.clear();
+		}
+		else
+			msgs << n->WriteLog("Unable to read brain mask: [" + m + "]");
+	}
 	else
-		msgs << n->WriteLog("Opening SNR file [" + f + "]");
+		msgs << n->WriteLog(m);
 
-	pvsnr = 0.0;
-	iosnr = 0.0;
+	/* SNR. per-voxel SNR only means something for a timeseries */
+	qint64 nvol = img.NumVolumes();
+	if (mask.size() == mean.size()) {
+		CalculateSNR(img, mean, variance, mask, nvol > 3, iosnr, pvsnr);
+		msgs << n->WriteLog(QString("Inside/Outside SNR [%1]  Per-voxel SNR [%2]").arg(iosnr).arg(pvsnr));
+	}
+	else
+		msgs << n->WriteLog("No brain mask, unable to calculate SNR");
 
-	QFile df(f);
-	if (df.open(QIODevice::ReadOnly | QIODevice::Text)) {
+	QFile f(qapath + "/qa.txt");
+	if (f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+		QTextStream fs(&f);
+		fs << "image_name\tpvsnr_brain\tiosnr_brain\n";
+		fs << QFileInfo((filepath4d == "") ? img.filename : filepath4d).fileName() << "\t" << ((nvol > 3) ? QString::number(pvsnr) : "N/A") << "\t" << QString::number(iosnr) << "\n";
+		f.close();
+	}
 
-		QTextStream in(&df);
-		while (!in.atEnd()) {
-			QString line = in.readLine().trimmed();
-			QStringList parts = line.split(QRegExp("\\t"));
-			bool ok1(false), ok2(false);
-			if (parts.size() > 1)
-				pvsnr = parts[1].toDouble(&ok1);
-			if (parts.size() > 2)
-				iosnr = parts[2].toDouble(&ok2);
-
-			if (ok1 || ok2) break;
+	if (nvol <= 3)
+		return true;
+
+	/* motion correction */
+	if (filepath4d == "") {
+		filepath4d = tmpdir + "/4D.nii";
+		if (!img.Write(filepath4d, m)) {
+			msgs << n->WriteLog(m);
+			return false;
 		}
-		df.close();
 	}
+	QString systemstring = QString(fsl + "mcflirt -in %1 -out %2/mc4D -plots").arg(filepath4d).arg(tmpdir);
+	msgs << n->WriteLog(n->SystemCommand(systemstring));
+	systemstring = QString("mv -v %1/mc4D.par %2/MotionCorrection.txt").arg(tmpdir).arg(qapath);
+	msgs << n->WriteLog(n->SystemCommand(systemstring));
+
+	img.Close();
+	if (!mc4d.Read(tmpdir + "/mc4D.nii.gz", m)) {
+		msgs << n->WriteLog("Unable to read motion corrected series: [" + m + "]");
+		return false;
+	}
+
+	/* mean, sigma, and variance volumes of the motion corrected series */
+	if (!mc4d.GetTemporalStats(mean, variance, statsthreads, m)) {
+		msgs << n->WriteLog(m);
+		return false;
+	}
+	QVector<float> sigma(variance.size());
+	for (int i=0; i<variance.size(); i++)
+		sigma[i] = sqrt(variance[i]);
+
+	if (!mc4d.Write(qapath + "/Tmean.nii.gz", mean.data(), 1, m))
+		msgs << n->WriteLog(m);
+	if (!mc4d.Write(qapath + "/Tsigma.nii.gz", sigma.data(), 1, m))
+		msgs << n->WriteLog(m);
+	if (!mc4d.Write(qapath + "/Tvariance.nii.gz", variance.data(), 1, m))
+		msgs << n->WriteLog(m);
 
-	msg = msgs.join("\n");
 	return true;
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- CalculateSNR ----------------------------------- */
+/* ---------------------------------------------------------- */
+/* inside/outside SNR is the mean intensity inside the brain  */
+/* divided by the mean of 10x10 voxel boxes in the four       */
+/* corners of each slice. per-voxel SNR is the mean of        */
+/* mean/stdev over the brain. both as computed by nii_qa.sh   */
+/* ---------------------------------------------------------- */
+void moduleMRIQA::CalculateSNR(const nifti &img, const QVector<float> &mean, const QVector<float> &variance, const QVector<float> &mask, bool timeseries, double &iosnr, double &pvsnr) {
+
+	qint64 nx = img.dim[1], ny = img.dim[2], nz = img.dim[3];
+	const int boxsize = 10;
+	qint64 boxx = std::max(nx - boxsize - 1, qint64(0));
+	qint64 boxy = std::max(ny - boxsize - 1, qint64(0));
+	qint64 cornerx[4] = {0, boxx, boxx, 0};
+	qint64 cornery[4] = {0, 0, boxy, boxy};
+
+	/* noise, from the corners of the mean volume */
+	double noise(0.0);
+	qint64 nnoise(0);
+	for (int c=0; c<4; c++)
+		for (qint64 k=0; k<nz; k++)
+			for (qint64 j=cornery[c]; j<std::min(cornery[c] + boxsize, ny); j++)
+				for (qint64 i=cornerx[c]; i<std::min(cornerx[c] + boxsize, nx); i++) {
+					noise += mean[int((k*ny + j)*nx + i)];
+					nnoise++;
+				}
+	if (nnoise > 0)
+		noise /= double(nnoise);
+
+	/* averages over the non-zero voxels of the masked SNR maps, like fslstats -M */
+	double iosum(0.0), pvsum(0.0);
+	qint64 ion(0), pvn(0);
+	for (int i=0; i<mean.size(); i++) {
+		if (mask[i] == 0.0f)
+			continue;
+		if (noise != 0.0) {
+			double io = mean[i]/noise;
+			if (io != 0.0) {
+				iosum += io;
+				ion++;
+			}
+		}
+		if ((timeseries) && (variance[i] > 0.0f)) {
+			double pv = mean[i]/sqrt(double(variance[i]));
+			if (pv != 0.0) {
+				pvsum += pv;
+				pvn++;
+			}
+		}
+	}
+
+	iosnr = (ion > 0) ? iosum/double(ion) : 0.0;
+	pvsnr = (pvn > 0) ? pvsum/double(pvn) : 0.0;
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- GetMovementStats ------------------------------- */
 /* ---------------------------------------------------------- */
@@ -553,6 +794,251 @@ bool moduleMRIQA::GetMovementStats(QString f, double &maxrx, double &maxry, doub
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- FFT -------------------------------------------- */
+/* ---------------------------------------------------------- */
+/* in-place radix-2 FFT. n must be a power of 2               */
+/* ---------------------------------------------------------- */
+static void FFT(std::complex<double> *a, int n) {
+	/* bit reversal permutation */
+	for (int i=1, j=0; i<n; i++) {
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
+			std::swap(a[i], a[j]);
+	}
+
+	for (int len=2; len<=n; len <<= 1) {
+		double ang = -2.0*M_PI/len;
+		std::complex<double> wlen(cos(ang), sin(ang));
+		for (int i=0; i<n; i+=len) {
+			std::complex<double> w(1.0, 0.0);
+			for (int j=0; j<len/2; j++) {
+				std::complex<double> u = a[i+j];
+				std::complex<double> v = a[i+j+len/2]*w;
+				a[i+j] = u + v;
+				a[i+j+len/2] = u - v;
+				w *= wlen;
+			}
+		}
+	}
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- StructuralMotion ------------------------------- */
+/* ---------------------------------------------------------- */
+/* motion in a structural image shows up as ringing, which    */
+/* breaks the power-law falloff of k-space energy with        */
+/* spatial frequency. the radially averaged power spectrum of */
+/* the slices is fit with a line in log-log space, and the    */
+/* R^2 of that fit is the metric. slices are FFT'd in         */
+/* parallel                                                   */
+/* ---------------------------------------------------------- */
+bool moduleMRIQA::StructuralMotion(const nifti &img, int numthreads, double &rsq, QString &m) {
+	rsq = 0.0;
+
+	qint64 nx = img.dim[1], ny = img.dim[2], nz = img.dim[3];
+	if ((nx < 8) || (ny < 8)) {
+		m = QString("Image is too small [%1 x %2] for the structural motion calculation").arg(nx).arg(ny);
+		return false;
+	}
+
+	std::vector<float> vol(static_cast<size_t>(nx*ny*nz));
+	if (!img.GetVolume(0, vol.data())) {
+		m = "Unable to read image data from [" + img.filename + "]";
+		return false;
+	}
+
+	/* zero pad each slice to a power of 2 */
+	int px(1), py(1);
+	while (px < nx) px <<= 1;
+	while (py < ny) py <<= 1;
+	int nbins = std::min(px, py)/2;
+
+	if (numthreads < 1) numthreads = 1;
+	if (numthreads > nz) numthreads = int(nz);
+
+	std::atomic<qint64> next(0);
+	std::mutex mtx;
+	std::vector<double> power(static_cast<size_t>(nbins), 0.0);
+	std::vector<qint64> count(static_cast<size_t>(nbins), 0);
+
+	auto worker = [&]() {
+		std::vector<std::complex<double>> k(static_cast<size_t>(px*py));
+		std::vector<std::complex<double>> col(static_cast<size_t>(py));
+		std::vector<double> p(static_cast<size_t>(nbins), 0.0);
+		std::vector<qint64> c(static_cast<size_t>(nbins), 0);
+		qint64 z;
+		while ((z = next++) < nz) {
+			const float *slice = vol.data() + z*nx*ny;
+
+			/* remove the slice mean, so the DC term doesn't leak into the low frequencies */
+			double mean(0.0);
+			for (qint64 i=0; i<nx*ny; i++)
+				mean += slice[i];
+			mean /= double(nx*ny);
+
+			std::fill(k.begin(), k.end(), std::complex<double>(0.0, 0.0));
+			bool empty = true;
+			for (qint64 y=0; y<ny; y++)
+				for (qint64 x=0; x<nx; x++) {
+					double v = slice[y*nx + x];
+					if (v != 0.0) empty = false;
+					k[size_t(y*px + x)] = std::complex<double>(v - mean, 0.0);
+				}
+			if (empty)
+				continue;
+
+			/* rows, then columns */
+			for (int y=0; y<py; y++)
+				FFT(&k[size_t(y*px)], px);
+			for (int x=0; x<px; x++) {
+				for (int y=0; y<py; y++)
+					col[size_t(y)] = k[size_t(y*px + x)];
+				FFT(col.data(), py);
+				for (int y=0; y<py; y++)
+					k[size_t(y*px + x)] = col[size_t(y)];
+			}
+
+			/* radial average, in cycles per voxel. the corners beyond the Nyquist circle are skipped */
+			for (int v=0; v<py; v++) {
+				double fv = double((v < py/2) ? v : v - py)/double(py);
+				for (int u=0; u<px; u++) {
+					double fu = double((u < px/2) ? u : u - px)/double(px);
+					int bin = int(sqrt(fu*fu + fv*fv)*2.0*nbins);
+					if (bin < nbins) {
+						p[size_t(bin)] += std::norm(k[size_t(v*px + u)]);
+						c[size_t(bin)]++;
+					}
+				}
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mtx);
+		for (int b=0; b<nbins; b++) {
+			power[size_t(b)] += p[size_t(b)];
+			count[size_t(b)] += c[size_t(b)];
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i=1; i<numthreads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &th : threads)
+		th.join();
+
+	/* least squares fit of log(power) against log(frequency), skipping the DC bin */
+	double sx(0.0), sy(0.0), sxx(0.0), syy(0.0), sxy(0.0);
+	int np(0);
+	for (int b=1; b<nbins; b++) {
+		if ((count[size_t(b)] == 0) || (power[size_t(b)] <= 0.0))
+			continue;
+		double x = log((b + 0.5)/(2.0*nbins));
+		double y = log(power[size_t(b)]/double(count[size_t(b)]));
+		sx += x; sy += y; sxx += x*x; syy += y*y; sxy += x*y;
+		np++;
+	}
+	if (np < 3) {
+		m = "Not enough non-zero frequency bins for the structural motion calculation";
+		return false;
+	}
+
+	double covxy = sxy - sx*sy/np;
+	double varx = sxx - sx*sx/np;
+	double vary = syy - sy*sy/np;
+	if ((varx <= 0.0) || (vary <= 0.0)) {
+		m = "Degenerate power spectrum in the structural motion calculation";
+		return false;
+	}
+	rsq = (covxy*covxy)/(varx*vary);
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- WriteRange ------------------------------------- */
+/* ---------------------------------------------------------- */
+/* write the min/max intensity of a volume, in the same       */
+/* format as fslstats -R                                      */
+/* ---------------------------------------------------------- */
+bool moduleMRIQA::WriteRange(QString niftifile, QString outfile, QString &m) {
+
+	nifti img;
+	if (!img.Read(niftifile, m))
+		return false;
+
+	double min(0.0), max(0.0);
+	if (!img.GetRange(min, max, statsthreads)) {
+		m = "Unable to read image data from [" + niftifile + "]";
+		return false;
+	}
+
+	QFile f(outfile);
+	if (!f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+		m = "Unable to write [" + outfile + "]";
+		return false;
+	}
+	QTextStream fs(&f);
+	fs << QString::number(min) << " " << QString::number(max) << " \n";
+	f.close();
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- WriteStatsOverTime ----------------------------- */
+/* ---------------------------------------------------------- */
+/* write the per-volume statistics files read by              */
+/* mrseriesqa.php, in the same format as fslstats -t          */
+/* ---------------------------------------------------------- */
+bool moduleMRIQA::WriteStatsOverTime(const nifti &img, QString qapath, QString &m) {
+
+	QVector<niftiStats> stats;
+	if (!img.GetStatsOverTime(stats, 100, statsthreads, m))
+		return false;
+
+	QString mean, stdev, entropy, cogmm, cogvox, hist;
+	for (int t=0; t<stats.size(); t++) {
+		niftiStats &s = stats[t];
+		mean += QString::number(s.mean) + " \n";
+		stdev += QString::number(s.stdev) + " \n";
+		entropy += QString::number(s.entropy) + " \n";
+		cogmm += QString("%1 %2 %3 \n").arg(QString::number(s.cogmm[0])).arg(QString::number(s.cogmm[1])).arg(QString::number(s.cogmm[2]));
+		cogvox += QString("%1 %2 %3 \n").arg(QString::number(s.cogvox[0])).arg(QString::number(s.cogvox[1])).arg(QString::number(s.cogvox[2]));
+		for (int b=0; b<s.histogram.size(); b++)
+			hist += QString::number(s.histogram[b]) + " ";
+		hist += "\n";
+	}
+
+	QMap<QString, QString> files;
+	files["meanIntensityOverTime.txt"] = mean;
+	files["stdevIntensityOverTime.txt"] = stdev;
+	files["entropyOverTime.txt"] = entropy;
+	files["centerOfGravityOverTimeMM.txt"] = cogmm;
+	files["centerOfGravityOverTimeVox.txt"] = cogvox;
+	files["histogramOverTime.txt"] = hist;
+
+	for (auto it = files.begin(); it != files.end(); it++) {
+		QFile f(qapath + "/" + it.key());
+		if (!f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+			m = "Unable to write [" + qapath + "/" + it.key() + "]";
+			return false;
+		}
+		QTextStream fs(&f);
+		fs << it.value();
+		f.close();
+	}
+
+	return true;
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- GetMinMax -------------------------------------- */
 /* ---------------------------------------------------------- */
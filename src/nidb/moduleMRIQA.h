@@ -24,6 +24,30 @@
 #define MODULEMRIQA_H
 #include "nidb.h"
 #include "series.h"
+#include "nifti.h"
+
+/* one series being QA'd. the series info is filled in when it is claimed, and the results by the worker */
+struct mrqaJob {
+	int seriesid = 0;
+	int mrqaid = 0;
+	QString uid;
+	int studynum = 0;
+	int seriesnum = 0;
+	bool isderived = false;
+	QString datatype;
+	QString datapath;
+	QString seriespath;
+
+	/* results */
+	bool success = false;
+	int dimN = 0, dimX = 0, dimY = 0, dimZ = 0, dimT = 0;
+	double voxX = 0.0, voxY = 0.0, voxZ = 0.0;
+	double iosnr = 0.0, pvsnr = 0.0;
+	double maxrx = 0.0, maxry = 0.0, maxrz = 0.0, maxtx = 0.0, maxty = 0.0, maxtz = 0.0, maxax = 0.0, maxay = 0.0, maxaz = 0.0;
+	double minrx = 0.0, minry = 0.0, minrz = 0.0, mintx = 0.0, minty = 0.0, mintz = 0.0, minax = 0.0, minay = 0.0, minaz = 0.0;
+	double motion_rsq = 0.0;
+	double cputime = 0.0;
+};
 
 class moduleMRIQA
 {
@@ -33,15 +57,25 @@ public:
 	~moduleMRIQA();
 
 	int Run();
-	bool QA(int seriesid);
-	bool GetQAStats(QString f, double &pvsnr, double &iosnr, QString &msg);
+	int GetNumWorkers();
+	void ReleaseStaleClaims();
+	int ClaimSeries(int max, QList<mrqaJob> &jobs);
+	bool QA(mrqaJob &job);
+	void SaveQA(const mrqaJob &job);
+	bool TemporalQA(nifti &img, QString &filepath4d, QString tmpdir, QString qapath, QString fsl, nifti &mc4d, double &iosnr, double &pvsnr, QStringList &msgs);
+	static bool StructuralMotion(const nifti &img, int numthreads, double &rsq, QString &m);
+	static void CalculateSNR(const nifti &img, const QVector<float> &mean, const QVector<float> &variance, const QVector<float> &mask, bool timeseries, double &iosnr, double &pvsnr);
 	bool GetMovementStats(QString f, double &maxrx, double &maxry, double &maxrz, double &maxtx, double &maxty, double &maxtz, double &maxax, double &maxay, double &maxaz, double &minrx, double &minry, double &minrz, double &mintx, double &minty, double &mintz, double &minax, double &minay, double &minaz, QString &msg);
+	bool WriteRange(QString niftifile, QString outfile, QString &m);
+	bool WriteStatsOverTime(const nifti &img, QString qapath, QString &m);
 	void GetMinMax(QVector<double> a, double &min, double &max);
 	QVector<double> Derivative(QVector<double> a);
 	void WriteQALog(QString dir, QString log);
 
 private:
 	nidb *n;
+	QHash<QString, QString> cfg; /* read-only copy of the config, for the worker threads */
+	int statsthreads = 1;
 };
 
 #endif // MODULEMRIQA_H
@@ -24,6 +24,10 @@
 #include "minipipeline.h"
 #include "series.h"
 #include <QSqlQuery>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 
 /* ---------------------------------------------------------- */
@@ -56,256 +60,485 @@ moduleMiniPipeline::~moduleMiniPipeline()
 /* ---------------------------------------------------------- */
 /* --------- Run -------------------------------------------- */
 /* ---------------------------------------------------------- */
+/* the main thread claims jobs, copies their data, and writes */
+/* the logs and results to the database. a pool of workers    */
+/* runs the sandboxes, so one slow script doesn't hold up the */
+/* rest of the queue. the workers don't touch the database    */
+/* ---------------------------------------------------------- */
 int moduleMiniPipeline::Run() {
 	n->WriteLog("Entering the pipeline module");
 
+	int numworkers = GetNumWorkers();
+	int timeoutsec = n->cfg["moduleminipipelinetimeout"].toInt()*60;
+	if (timeoutsec < 1)
+		timeoutsec = 300;
+	int maxmemmb = n->cfg["moduleminipipelinememory"].toInt();
+	n->WriteLog(QString("Using [%1] sandbox workers, limited to [%2] seconds and [%3] MB of memory per job").arg(numworkers).arg(timeoutsec).arg(maxmemmb));
+
 	n->ModuleRunningCheckIn();
 
-	int numJobsRun = 0;
-	QSqlQuery q;
+	std::deque<mpJob> todo, done;
+	std::mutex mtx;
+	std::condition_variable workready, jobdone;
+	bool finished(false);
+	int numbusy(0);
+
+	auto worker = [&]() {
+		while (true) {
+			mpJob job;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				workready.wait(lock, [&]{ return finished || !todo.empty(); });
+				if (todo.empty())
+					return;
+				job = todo.front();
+				todo.pop_front();
+				numbusy++;
+			}
+			job.success = n->SandboxedSystemCommandToLog(job.entrypoint, job.tmpdir, job.logfile, job.timeoutsec, job.maxmemmb, job.exitcode, job.msg);
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				done.push_back(job);
+				numbusy--;
+			}
+			jobdone.notify_one();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int i=0; i<numworkers; i++)
+		workers.emplace_back(worker);
+
+	int numJobsRun(0);
 	QList<int> mpjobs = GetMPJobList();
-	if (mpjobs.size() > 0) {
-		int i = 0;
-		foreach(int mpjobid, mpjobs) {
-			i++;
-			n->WriteLog(QString("Working on mini-pipeline job [%1] of [%2]").arg(i).arg(mpjobs.size()));
-			n->ModuleRunningCheckIn();
-			if (!n->ModuleCheckIfActive()) {
-				n->WriteLog("Module is now inactive, stopping the module");
-				if (numJobsRun > 0)
-					return 1;
-				else
-					return 0;
+	QMap<int, mpJob> active; /* claimed jobs that haven't finished, by job id */
+	bool claiming(true);
+	while (true) {
+		/* claim and set up jobs, keeping a few ready so the workers don't wait on the data copies */
+		while ((claiming) && (active.size() < numworkers*2)) {
+			/* pick up jobs queued since the list was read */
+			if (mpjobs.isEmpty())
+				mpjobs = GetMPJobList();
+			if (mpjobs.isEmpty()) {
+				claiming = false;
+				break;
 			}
 
-			/* check if the minipipeline job is still pending */
-			q.prepare("select minipipelinejob_id from minipipeline_jobs where mp_status = 'pending' and minipipelinejob_id = :mpjobid");
-			q.bindValue(":mpjobid", mpjobid);
-			n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-			if (q.size() < 1) {
-				n->WriteLog("This job's status is no longer 'pending'");
+			int mpjobid = mpjobs.takeFirst();
+			if (!ClaimJob(mpjobid))
+				continue;
+			numJobsRun++;
+
+			mpJob job;
+			if (!PrepareJob(mpjobid, job))
 				continue;
+			job.timeoutsec = timeoutsec;
+			job.maxmemmb = maxmemmb;
+			active[mpjobid] = job;
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				todo.push_back(job);
 			}
+			workready.notify_one();
+		}
 
-			/* set it to processing to prevent another instance from working on it too */
-			q.prepare("update minipipeline_jobs set mp_status = 'running', mp_startdate = now() where minipipelinejob_id = :mpjobid");
-			q.bindValue(":mpjobid", mpjobid);
-			n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+		/* finish the jobs whose sandboxes have exited */
+		std::deque<mpJob> finishedjobs;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			finishedjobs.swap(done);
+		}
+		for (auto &job : finishedjobs) {
+			job.logpos = active.take(job.mpjobid).logpos;
+			FinishJob(job);
+		}
 
-			numJobsRun++;
-			QStringList logs;
-			int enrollmentID = -1;
-			int numInserts = 0;
-
-			/* get the minipipeline details */
-			q.prepare("select * from minipipeline_jobs where minipipelinejob_id = :mpjobid");
-			q.bindValue(":mpjobid", mpjobid);
-			n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-			if (q.size() > 0) {
-				q.first();
-				int mpid = q.value("minipipeline_id").toInt();
-				QString modality = q.value("mp_modality").toString();
-				int seriesid = q.value("mp_seriesid").toInt();
-
-				minipipeline mp(mpid, n); /* get the analysis info */
-				if (!mp.isValid) {
-					AppendMiniPipelineLog(n->WriteLog("mini-pipeline was not valid: [" + mp.msg + "]"), mpjobid);
-					continue;
-				}
+		/* copy the output of the running sandboxes into their job logs */
+		for (auto it = active.begin(); it != active.end(); ++it)
+			TailSandboxLog(it.value(), false);
+
+		n->ModuleRunningCheckIn();
+
+		/* check if this module should be running now or not. finish what has been claimed, but don't claim more */
+		if ((claiming) && (!n->ModuleCheckIfActive())) {
+			n->WriteLog("Module is now inactive. Finishing the claimed jobs and exiting module");
+			claiming = false;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if ((!claiming) && (todo.empty()) && (numbusy == 0) && (done.empty()))
+				break;
+			jobdone.wait_for(lock, std::chrono::seconds(5), [&]{ return !done.empty(); });
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		finished = true;
+	}
+	workready.notify_all();
+	for (auto &th : workers)
+		th.join();
+
+	if (numJobsRun < 1)
+		n->WriteLog("Nothing to run");
+
+	n->WriteLog("Leaving the minipipeline module");
+
+	if (numJobsRun > 0)
+		return 1;
+	else
+		return 0;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetNumWorkers ---------------------------------- */
+/* ---------------------------------------------------------- */
+int moduleMiniPipeline::GetNumWorkers() {
+	int numworkers = n->cfg["moduleminipipelineworkers"].toInt();
+	if (numworkers < 1)
+		numworkers = std::max(QThread::idealThreadCount()/std::max(n->GetNumThreads(), 1), 1);
+	return numworkers;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ClaimJob --------------------------------------- */
+/* ---------------------------------------------------------- */
+/* the status only changes from pending to running for one    */
+/* process, so only one instance can claim a job              */
+/* ---------------------------------------------------------- */
+bool moduleMiniPipeline::ClaimJob(int mpjobid) {
+	QSqlQuery q;
+	q.prepare("update minipipeline_jobs set mp_status = 'running', mp_startdate = now() where minipipelinejob_id = :mpjobid and mp_status = 'pending'");
+	q.bindValue(":mpjobid", mpjobid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.numRowsAffected() < 1) {
+		n->WriteLog(QString("Job [%1] status is no longer 'pending'").arg(mpjobid));
+		return false;
+	}
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- PrepareJob ------------------------------------- */
+/* ---------------------------------------------------------- */
+/* create the sandbox directory for a claimed job, and write  */
+/* the scripts and copy the series data into it. a job that   */
+/* can't be set up is marked as an error                      */
+/* ---------------------------------------------------------- */
+bool moduleMiniPipeline::PrepareJob(int mpjobid, mpJob &job) {
+	job.mpjobid = mpjobid;
+
+	/* get the minipipeline details */
+	QSqlQuery q;
+	q.prepare("select * from minipipeline_jobs where minipipelinejob_id = :mpjobid");
+	q.bindValue(":mpjobid", mpjobid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.size() < 1) {
+		n->WriteLog(QString("Job [%1] was not found. Maybe it was deleted since it was claimed?").arg(mpjobid));
+		return false;
+	}
+	q.first();
+	int mpid = q.value("minipipeline_id").toInt();
+	QString modality = q.value("mp_modality").toString();
+	int seriesid = q.value("mp_seriesid").toInt();
+
+	minipipeline mp(mpid, n); /* get the analysis info */
+	if (!mp.isValid) {
+		AppendMiniPipelineLog(n->WriteLog("The pipeline specified was not found. Maybe it was deleted since this job was submitted? [" + mp.msg + "]"), mpjobid);
+		SetJobStatus(mpjobid, "error", 0);
+		return false;
+	}
+
+	series s(seriesid, modality, n); /* get the series info */
+	if (!s.isValid) {
+		AppendMiniPipelineLog(n->WriteLog("Series was not valid: [" + s.msg + "]"), mpjobid);
+		SetJobStatus(mpjobid, "error", 0);
+		return false;
+	}
+	job.name = mp.name;
+	job.entrypoint = mp.entrypoint;
+	job.enrollmentid = s.enrollmentid;
+	job.studyid = s.studyid;
+	job.seriesid = s.seriesid;
+
+	AppendMiniPipelineLog(n->WriteLog("Running mini-pipeline [" + mp.name + "] on [" + s.datapath + "]"), mpjobid);
+
+	/* (1) create a temp space. the sandbox output goes next to it, so the script can't see or change it */
+	QString m;
+	job.tmpdir = "/tmp/" + n->GenerateRandomString(10);
+	job.logfile = job.tmpdir + ".log";
+	if (!n->MakePath(job.tmpdir, m)) {
+		AppendMiniPipelineLog(n->WriteLog("Error creating directory [" + job.tmpdir + "] error message [" + m + "]"), mpjobid);
+		SetJobStatus(mpjobid, "error", 0);
+		return false;
+	}
+
+	/* (2) write the script files */
+	if (!mp.WriteScripts(job.tmpdir, m)) {
+		AppendMiniPipelineLog(n->WriteLog("Error. Unable to write scripts to [" + job.tmpdir + "] error message [" + m + "]"), mpjobid);
+		CleanupJob(job);
+		SetJobStatus(mpjobid, "error", 0);
+		return false;
+	}
+
+	/* (3) copy in all of the behavioral data */
+	int c = CopyAllSeriesData(modality, seriesid, job.tmpdir, m);
+	if (c > 0)
+		AppendMiniPipelineLog(n->WriteLog(QString("Copied [%1] files to [%2]").arg(c).arg(job.tmpdir)), mpjobid);
+	else
+		AppendMiniPipelineLog(n->WriteLog("Did not copy any series from data directory. Message from CopyAllSeriesData() [" + m + "]"), mpjobid);
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- TailSandboxLog --------------------------------- */
+/* ---------------------------------------------------------- */
+/* append the sandbox output written since the last call to   */
+/* the job log. while the sandbox is running only whole lines */
+/* are taken, so a line isn't split across two appends        */
+/* ---------------------------------------------------------- */
+void moduleMiniPipeline::TailSandboxLog(mpJob &job, bool final) {
+	QFile f(job.logfile);
+	if (!f.open(QIODevice::ReadOnly))
+		return;
+	if ((f.size() <= job.logpos) || (!f.seek(job.logpos)))
+		return;
+	QByteArray b = f.readAll();
+	f.close();
+
+	if (!final) {
+		int i = b.lastIndexOf('\n');
+		if (i < 0)
+			return;
+		b.truncate(i+1);
+	}
+	job.logpos += b.size();
+	AppendMiniPipelineLog(QString::fromUtf8(b), job.mpjobid);
+}
 
-				series s(seriesid, modality, n); /* get the series info */
-				if (!s.isValid) {
-					AppendMiniPipelineLog(n->WriteLog("Series was not valid: [" + s.msg + "]"), mpjobid);
-					return 0;
-				}
-				enrollmentID = s.enrollmentid;
 
-				AppendMiniPipelineLog(n->WriteLog("Running mini-pipeline [" + mp.name + "] on [" + s.datapath + "]"), mpjobid);
+/* ---------------------------------------------------------- */
+/* --------- FinishJob -------------------------------------- */
+/* ---------------------------------------------------------- */
+void moduleMiniPipeline::FinishJob(mpJob &job) {
+	TailSandboxLog(job, true);
+	AppendMiniPipelineLog("\n" + n->WriteLog(job.msg), job.mpjobid);
+
+	/* the sandbox only says whether the script ran to the end. it succeeded if it also exited with 0. a
+	   timeout or memory limit kills the script, which also gives a nonzero exit code */
+	if (job.success && (job.exitcode != 0)) {
+		job.success = false;
+		AppendMiniPipelineLog("\n" + n->WriteLog(QString("Error: script [%1] exited with code [%2]").arg(job.entrypoint).arg(job.exitcode)), job.mpjobid);
+	}
+	else if (!job.success)
+		AppendMiniPipelineLog("\n" + n->WriteLog(QString("Error: script [%1] did not finish").arg(job.entrypoint)), job.mpjobid);
+
+	int numInserts = ParseOutput(job);
+
+	CleanupJob(job);
+
+	/* done running the job - update the status and log */
+	if (job.success)
+		SetJobStatus(job.mpjobid, "complete", numInserts);
+	else
+		SetJobStatus(job.mpjobid, "error", numInserts);
+}
+
 
-				/* (1) create a temp space */
-				QString m;
-				QString tmpdir = "/tmp/" + n->GenerateRandomString(10);
-				if (!n->MakePath(tmpdir, m))
-					AppendMiniPipelineLog(n->WriteLog("Error creating directory [" + tmpdir + "] error message [" + m + "]"), mpjobid);
+/* ---------------------------------------------------------- */
+/* --------- ParseOutput ------------------------------------ */
+/* ---------------------------------------------------------- */
+/* read the output.csv the script wrote into its sandbox, and */
+/* insert the measures, vitals, and drugs it lists. the job   */
+/* is marked as failed if the inserts can't be committed      */
+/* ---------------------------------------------------------- */
+int moduleMiniPipeline::ParseOutput(mpJob &job) {
+	int numInserts = 0;
+	QString m;
+
+	QString outfilename = job.tmpdir + "/output.csv";
+	QFile f(outfilename);
+	if (f.exists())
+		AppendMiniPipelineLog(n->WriteLog("[" + outfilename + "] exists"), job.mpjobid);
+	else
+		AppendMiniPipelineLog(n->WriteLog("[" + outfilename + "] does not exist"), job.mpjobid);
+
+	if (f.open(QFile::ReadOnly)) {
+		QByteArray csvText = f.readAll();
+
+		AppendMiniPipelineLog("\nContents of .csv file:\n ----------\n" + QString::fromUtf8(csvText) + "\n ----------\n", job.mpjobid);
+
+		csvTable csv;
+		if (n->ParseCSV(csvText.constData(), csvText.size(), csv, m)) {
+			AppendMiniPipelineLog("\nParsed .csv file. Message(s) from parser [" + m + "]", job.mpjobid);
+			if (!csv.columns.contains("type"))
+				AppendMiniPipelineLog("\nError - csv header did not contain the [type] column header. This column is required", job.mpjobid);
+			if (!csv.columns.contains("variablename"))
+				AppendMiniPipelineLog("\nError - csv header did not contain the [variablename] column header. This column is required", job.mpjobid);
+			if (!csv.columns.contains("startdate"))
+				AppendMiniPipelineLog("\nError - csv header did not contain the [startdate] column header. This column is required", job.mpjobid);
+			if (!csv.columns.contains("enddate"))
+				AppendMiniPipelineLog("\ncsv header did not contain the [enddate] column header. The header is required, though the column values are optional", job.mpjobid);
+			if (!csv.columns.contains("duration"))
+				AppendMiniPipelineLog("\ncsv header did not contain the [duration] column header. The header is required, though the column values are optional", job.mpjobid);
+			if (!csv.columns.contains("value"))
+				AppendMiniPipelineLog("\nError - csv header did not contain the [value] column header. This column is required", job.mpjobid);
+			if (!csv.columns.contains("units"))
+				AppendMiniPipelineLog("\ncsv header did not contain the [units] column header. The header is required, though the column values are optional", job.mpjobid);
+			if (!csv.columns.contains("notes"))
+				AppendMiniPipelineLog("\ncsv header did not contain the [notes] column header. The header is required, though the column values are optional", job.mpjobid);
+			if (!csv.columns.contains("instrument"))
+				AppendMiniPipelineLog("\ncsv header did not contain the [instrument] column header. The header is required, though the column values are optional", job.mpjobid);
+
+			/* go through all the rows from the csv, collecting the values and the messages so they can be written all at once */
+			QList<mpRow> measures, vitals, drugs;
+			QStringList rowmsgs;
+			for (int i=0; i<csv.numrows; i++) {
+				QString csvType = csv.Value(i, "type");
+				QString csvVariableName = csv.Value(i, "variablename");
+				QString csvStartDate;
+				if (csv.Value(i, "startdate") == "") csvStartDate = csv.Value(i, "startdatetime");
+				else csvStartDate = csv.Value(i, "startdate");
+				QString csvEndDate = csv.Value(i, "enddate");
+				if (csv.Value(i, "enddate") == "") csvEndDate = csv.Value(i, "enddatetime");
+				else csvEndDate = csv.Value(i, "enddate");
+				QString csvDuration = csv.Value(i, "duration");
+				QString csvValue = csv.Value(i, "value");
+				QString csvUnits = csv.Value(i, "units");
+				QString csvNotes = csv.Value(i, "notes");
+				QString csvInstrument = csv.Value(i, "instrument");
+
+				/* check the variable name */
+				if (csvVariableName == "")
+					rowmsgs << n->WriteLog(QString("variablename was blank for line %1").arg(i));
+				/* check the value name */
+				if (csvValue == "")
+					rowmsgs << n->WriteLog(QString("value was blank for line %1").arg(i));
+
+				/* check and reformat the startDate */
+				QDateTime startDate;
+				if (csvStartDate == "")
+					rowmsgs << n->WriteLog(QString("startdate was blank for line %1").arg(i));
 				else {
-					/* (2) write the script files */
-					if (mp.WriteScripts(tmpdir, m)) {
-
-						/* (3) copy in all of the behavioral data */
-						QString m;
-						int c = CopyAllSeriesData(modality, seriesid, tmpdir, m);
-						if (c > 0)
-							AppendMiniPipelineLog(n->WriteLog(QString("Copied [%1] files to [%2]").arg(c).arg(tmpdir)), mpjobid);
+					QStringList sdparts = csvStartDate.split(" ");
+					if (sdparts.size() == 1)
+						if (sdparts[0].contains("T"))
+							startDate = QDateTime::fromString(sdparts[0],"yyyy-MM-ddThh:mm:ss");
 						else
-							AppendMiniPipelineLog(n->WriteLog("Did not copy any series from data directory. Message from CopyAllSeriesData() [" + m + "]"), mpjobid);
-
-						/* (4) execute the script (sandboxed to the tmp directory), and limit execution time to 5 minutes */
-						QString systemstring = mp.entrypoint;
-						QString output = "";
-						n->SandboxedSystemCommand(systemstring, tmpdir, output, "00:05:00", true, false);
-						AppendMiniPipelineLog(n->WriteLog(output), mpjobid);
-
-						/* (5) parse the output */
-						QString outfilename = tmpdir + "/output.csv";
-						QFile f(outfilename);
-						if (f.exists())
-							AppendMiniPipelineLog(n->WriteLog("[" + outfilename + "] exists"), mpjobid);
-						else
-							AppendMiniPipelineLog(n->WriteLog("[" + outfilename + "] does not exist"), mpjobid);
-
-						if (f.open(QFile::ReadOnly | QFile::Text)) {
-							QTextStream in(&f);
-							QString csvText = in.readAll();
-
-							AppendMiniPipelineLog("\nContents of .csv file:\n ----------\n" + csvText + "\n ----------\n", mpjobid);
-
-							indexedHash csv;
-							QStringList cols;
-							if (n->ParseCSV(csvText, csv, cols, m)) {
-								AppendMiniPipelineLog("\nParsed .csv file. Message(s) from parser [" + m + "]", mpjobid);
-								if (!cols.contains("type"))
-									AppendMiniPipelineLog("\nError - csv header did not contain the [type] column header. This column is required", mpjobid);
-								if (!cols.contains("variablename"))
-									AppendMiniPipelineLog("\nError - csv header did not contain the [variablename] column header. This column is required", mpjobid);
-								if (!cols.contains("startdate"))
-									AppendMiniPipelineLog("\nError - csv header did not contain the [startdate] column header. This column is required", mpjobid);
-								if (!cols.contains("enddate"))
-									AppendMiniPipelineLog("\ncsv header did not contain the [enddate] column header. The header is required, though the column values are optional", mpjobid);
-								if (!cols.contains("duration"))
-									AppendMiniPipelineLog("\ncsv header did not contain the [duration] column header. The header is required, though the column values are optional", mpjobid);
-								if (!cols.contains("value"))
-									AppendMiniPipelineLog("\nError - csv header did not contain the [value] column header. This column is required", mpjobid);
-								if (!cols.contains("units"))
-									AppendMiniPipelineLog("\ncsv header did not contain the [units] column header. The header is required, though the column values are optional", mpjobid);
-								if (!cols.contains("notes"))
-									AppendMiniPipelineLog("\ncsv header did not contain the [notes] column header. The header is required, though the column values are optional", mpjobid);
-								if (!cols.contains("instrument"))
-									AppendMiniPipelineLog("\ncsv header did not contain the [instrument] column header. The header is required, though the column values are optional", mpjobid);
-
-								/* go through all the rows from the csv */
-								for (int i=0; i<csv.size();i++) {
-									QString csvType = csv[i]["type"];
-									QString csvVariableName = csv[i]["variablename"];
-									QString csvStartDate;
-									if (csv[i]["startdate"] == "") csvStartDate = csv[i]["startdatetime"];
-									else csvStartDate = csv[i]["startdate"];
-									QString csvEndDate = csv[i]["enddate"];
-									if (csv[i]["enddate"] == "") csvEndDate = csv[i]["enddatetime"];
-									else csvEndDate = csv[i]["enddate"];
-									QString csvDuration = csv[i]["duration"];
-									QString csvValue = csv[i]["value"];
-									QString csvUnits = csv[i]["units"];
-									QString csvNotes = csv[i]["notes"];
-									QString csvInstrument = csv[i]["instrument"];
-
-									/* check the variable name */
-									if (csvVariableName == "")
-										AppendMiniPipelineLog(n->WriteLog(QString("variablename was blank for line %1").arg(i)), mpjobid);
-									/* check the value name */
-									if (csvValue == "")
-										AppendMiniPipelineLog(n->WriteLog(QString("value was blank for line %1").arg(i)), mpjobid);
-
-									/* check and reformat the startDate */
-									QDateTime startDate;
-									if (csvStartDate == "")
-										AppendMiniPipelineLog(n->WriteLog(QString("startdate was blank for line %1").arg(i)), mpjobid);
-									else {
-										QStringList sdparts = csvStartDate.split(" ");
-										if (sdparts.size() == 1)
-											if (sdparts[0].contains("T"))
-												startDate = QDateTime::fromString(sdparts[0],"yyyy-MM-ddThh:mm:ss");
-											else
-												startDate = QDateTime::fromString(sdparts[0],"yyyy-MM-dd");
-										else
-											if (sdparts[1].size() == 5)
-												startDate = QDateTime::fromString(sdparts[0] + " " + sdparts[1],"yyyy-MM-dd hh:mm");
-											else
-												startDate = QDateTime::fromString(sdparts[0] + " " + sdparts[1],"yyyy-MM-dd hh:mm:ss");
-									}
-
-									/* check and reformat the endDate */
-									QDateTime endDate;
-									if (csvEndDate != "") {
-										QStringList edparts = csvEndDate.split(" ");
-										if (edparts.size() == 1)
-											if (edparts[0].contains("T"))
-												endDate = QDateTime::fromString(edparts[0],"yyyy-MM-ddThh:mm:ss");
-											else
-												endDate = QDateTime::fromString(edparts[0],"yyyy-MM-dd");
-										else
-											if (edparts[1].size() == 5)
-												endDate = QDateTime::fromString(edparts[0] + " " + edparts[1],"yyyy-MM-dd hh:mm");
-											else
-												endDate = QDateTime::fromString(edparts[0] + " " + edparts[1],"yyyy-MM-dd hh:mm:ss");
-									}
-
-									/* check for valid dates */
-									if (!startDate.isValid())
-										AppendMiniPipelineLog(n->WriteLog("Error. Invalid start date [" + csvStartDate + "]"), mpjobid);
-									if (!endDate.isValid())
-										AppendMiniPipelineLog(n->WriteLog("Invalid end date [" + csvEndDate + "]"), mpjobid);
-
-									/* insert the value */
-									QSqlQuery q2;
-									if (csvType == "measure") {
-										int n=0;
-										QString m;
-										if (!InsertMeasure(enrollmentID, s.studyid, s.seriesid, csvVariableName, csvValue, csvInstrument, startDate, endDate, csvDuration.toInt(), "minipipeline-" + mp.name, n, m))
-											AppendMiniPipelineLog(m, mpjobid);
-										else
-											numInserts += n;
-									}
-									else if (csvType == "vital") {
-										numInserts += InsertVital(enrollmentID, csvVariableName, csvValue, csvNotes, csvInstrument, startDate);
-									}
-									else if (csvType == "drug") {
-										numInserts += InsertDrug(enrollmentID, startDate, endDate, csvValue, "", "", "", "", "", "", 0.0, "");
-									}
-									else {
-										AppendMiniPipelineLog(n->WriteLog("Error. Invalid value type [" + csvType + "]"), mpjobid);
-									}
-								}
-							}
-							else {
-								AppendMiniPipelineLog(n->WriteLog("Error. Unable to parse csv output file. Message(s) from parser [" + m + "]"), mpjobid);
-							}
-						}
-						else {
-							AppendMiniPipelineLog(n->WriteLog("Error. Unable to read .csv output file [" + outfilename + "]"), mpjobid);
-						}
-					}
+							startDate = QDateTime::fromString(sdparts[0],"yyyy-MM-dd");
 					else
-						AppendMiniPipelineLog(n->WriteLog("Error. Unable to write scripts to [" + tmpdir + "] error message [" + m + "]"), mpjobid);
+						if (sdparts[1].size() == 5)
+							startDate = QDateTime::fromString(sdparts[0] + " " + sdparts[1],"yyyy-MM-dd hh:mm");
+						else
+							startDate = QDateTime::fromString(sdparts[0] + " " + sdparts[1],"yyyy-MM-dd hh:mm:ss");
+				}
 
-					/* (6) cleanup */
-					if (!n->RemoveDir(tmpdir, m))
-						AppendMiniPipelineLog(n->WriteLog("Error deleting directory [" + tmpdir + "] error message [" + m + "]"), mpjobid);
+				/* check and reformat the endDate */
+				QDateTime endDate;
+				if (csvEndDate != "") {
+					QStringList edparts = csvEndDate.split(" ");
+					if (edparts.size() == 1)
+						if (edparts[0].contains("T"))
+							endDate = QDateTime::fromString(edparts[0],"yyyy-MM-ddThh:mm:ss");
+						else
+							endDate = QDateTime::fromString(edparts[0],"yyyy-MM-dd");
 					else
-						AppendMiniPipelineLog(n->WriteLog("Deleted temp directory [" + tmpdir + "]"), mpjobid);
+						if (edparts[1].size() == 5)
+							endDate = QDateTime::fromString(edparts[0] + " " + edparts[1],"yyyy-MM-dd hh:mm");
+						else
+							endDate = QDateTime::fromString(edparts[0] + " " + edparts[1],"yyyy-MM-dd hh:mm:ss");
 				}
+
+				/* check for valid dates */
+				if (!startDate.isValid())
+					rowmsgs << n->WriteLog("Error. Invalid start date [" + csvStartDate + "]");
+				if (!endDate.isValid())
+					rowmsgs << n->WriteLog("Invalid end date [" + csvEndDate + "]");
+
+				mpRow row;
+				row.name = csvVariableName;
+				row.value = csvValue;
+				row.instrument = csvInstrument;
+				row.notes = csvNotes;
+				row.startdate = startDate;
+				row.enddate = endDate;
+				row.duration = csvDuration.toInt();
+				if (csvType == "measure")
+					measures.append(row);
+				else if (csvType == "vital")
+					vitals.append(row);
+				else if (csvType == "drug")
+					drugs.append(row);
+				else
+					rowmsgs << n->WriteLog("Error. Invalid value type [" + csvType + "]");
 			}
+
+			if (rowmsgs.size() > 0)
+				AppendMiniPipelineLog("\n" + rowmsgs.join("\n"), job.mpjobid);
+
+			/* insert everything in one transaction */
+			if (job.enrollmentid < 0)
+				AppendMiniPipelineLog(n->WriteLog(QString("Invalid enrollmentID [%1]").arg(job.enrollmentid)), job.mpjobid);
 			else {
-				/* the minipipeline specified by this job was not found, set an error */
-				AppendMiniPipelineLog(n->WriteLog("The pipeline specified was not found. Maybe it was deleted since this job was submitted?"), mpjobid);
+				n->db.transaction();
+				numInserts += InsertMeasures(job, measures);
+				numInserts += InsertVitals(job, vitals);
+				numInserts += InsertDrugs(job, drugs);
+				if (!n->db.commit()) {
+					/* the IDs resolved in the transaction are gone, so they can't stay in the caches */
+					AppendMiniPipelineLog("\n" + n->WriteLog("Error. Unable to commit the inserts [" + n->db.lastError().text() + "]"), job.mpjobid);
+					n->db.rollback();
+					measurenameids.clear();
+					instrumentids.clear();
+					vitalnameids.clear();
+					drugnameids.clear();
+					numInserts = 0;
+					job.success = false;
+				}
 			}
-
-			/* done running the job - update the status and log */
-			q.prepare("update minipipeline_jobs set mp_status = 'complete', mp_numinserts = :numinserts, mp_enddate = now() where minipipelinejob_id = :mpjobid");
-			q.bindValue(":mpjobid", mpjobid);
-			q.bindValue(":numinserts", numInserts);
-			n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+		}
+		else {
+			AppendMiniPipelineLog(n->WriteLog("Error. Unable to parse csv output file. Message(s) from parser [" + m + "]"), job.mpjobid);
 		}
 	}
 	else {
-		n->WriteLog("Nothing to run");
+		AppendMiniPipelineLog(n->WriteLog("Error. Unable to read .csv output file [" + outfilename + "]"), job.mpjobid);
 	}
 
-	n->WriteLog("Leaving the minipipeline module");
+	return numInserts;
+}
 
-	if (numJobsRun > 0)
-		return 1;
+
+/* ---------------------------------------------------------- */
+/* --------- CleanupJob ------------------------------------- */
+/* ---------------------------------------------------------- */
+void moduleMiniPipeline::CleanupJob(const mpJob &job) {
+	QString m;
+	if (!n->RemoveDir(job.tmpdir, m))
+		AppendMiniPipelineLog(n->WriteLog("Error deleting directory [" + job.tmpdir + "] error message [" + m + "]"), job.mpjobid);
 	else
-		return 0;
+		AppendMiniPipelineLog(n->WriteLog("Deleted temp directory [" + job.tmpdir + "]"), job.mpjobid);
+	QFile::remove(job.logfile);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- SetJobStatus ----------------------------------- */
+/* ---------------------------------------------------------- */
+void moduleMiniPipeline::SetJobStatus(int mpjobid, QString status, int numInserts) {
+	QSqlQuery q;
+	q.prepare("update minipipeline_jobs set mp_status = :status, mp_numinserts = :numinserts, mp_enddate = now() where minipipelinejob_id = :mpjobid");
+	q.bindValue(":mpjobid", mpjobid);
+	q.bindValue(":status", status);
+	q.bindValue(":numinserts", numInserts);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 }
 
 
@@ -380,148 +613,125 @@ int moduleMiniPipeline::CopyAllSeriesData(QString modality, int seriesid, QStrin
 
 
 /* ---------------------------------------------------------- */
-/* --------- InsertMeasure ---------------------------------- */
+/* --------- InsertMeasures --------------------------------- */
 /* ---------------------------------------------------------- */
-bool moduleMiniPipeline::InsertMeasure(int enrollmentid, int studyid, int seriesid, QString measureName, QString value, QString instrument, QDateTime startDate, QDateTime endDate, int duration, QString rater, int &numInserts, QString &msg) {
-
-	QSqlQuery q;
-	numInserts = 0;
-	msg = "";
+/* upsert the measures from one output .csv, a few hundred    */
+/* rows per statement. the name and instrument IDs are cached */
+/* for the life of the module, so only new names cost a query */
+/* ---------------------------------------------------------- */
+int moduleMiniPipeline::InsertMeasures(const mpJob &job, const QList<mpRow> &rows) {
 
-	if (enrollmentid < 0) {
-		msg = QString("Invalid enrollmentID [%1]").arg(enrollmentid);
-		return false;
-	}
+	if (rows.size() < 1)
+		return 0;
 
-	/* get the measure name ID */
-	int measureNameID;
-	q.prepare("select measurename_id from measurenames where measure_name = :measurename");
-	q.bindValue(":measurename", measureName);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	if (q.size() > 0) {
-		q.first();
-		measureNameID = q.value("measurename_id").toInt();
-	}
-	else {
-		q.prepare("insert into measurenames (measure_name) values (:measurename)");
-		q.bindValue(":measurename", measureName);
-		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-		measureNameID = q.lastInsertId().toInt();
+	QStringList names, instruments;
+	for (int i=0; i<rows.size(); i++) {
+		names << rows[i].name;
+		instruments << rows[i].instrument;
 	}
+	n->ResolveIDs("measurenames", "measurename_id", "measure_name", names, measurenameids);
+	n->ResolveIDs("measureinstruments", "measureinstrument_id", "instrument_name", instruments, instrumentids);
 
-	/* get the instrument name ID */
-	int instrumentNameID;
-	q.prepare("select measureinstrument_id from measureinstruments where instrument_name = :instrument");
-	q.bindValue(":instrument", instrument);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	if (q.size() > 0) {
-		q.first();
-		instrumentNameID = q.value("measureinstrument_id").toInt();
-	}
-	else {
-		q.prepare("insert into measureinstruments (instrument_name) values (:instrument)");
-		q.bindValue(":instrument", instrument);
+	QString rater = "minipipeline-" + job.name;
+	QSqlQuery q;
+	int chunk = 500;
+	for (int i=0; i<rows.size(); i+=chunk) {
+		int end = std::min(i+chunk, rows.size());
+		QStringList placeholders;
+		for (int j=i; j<end; j++)
+			placeholders << "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, now(), now(), now())";
+		q.prepare("insert ignore into measures (enrollment_id, study_id, series_id, instrumentname_id, measurename_id, measure_value, measure_rater, measure_startdate, measure_enddate, measure_duration, measure_entrydate, measure_createdate, measure_modifydate) values " + placeholders.join(",") + " on duplicate key update study_id = values(study_id), series_id = values(series_id), measurename_id = values(measurename_id), measure_value = values(measure_value), instrumentname_id = values(instrumentname_id), measure_startdate = values(measure_startdate), measure_enddate = values(measure_enddate), measure_modifydate = now()");
+		for (int j=i; j<end; j++) {
+			q.addBindValue(job.enrollmentid);
+			q.addBindValue(job.studyid);
+			q.addBindValue(job.seriesid);
+			q.addBindValue(instrumentids.value(rows[j].instrument.toLower()));
+			q.addBindValue(measurenameids.value(rows[j].name.toLower()));
+			q.addBindValue(rows[j].value);
+			q.addBindValue(rater);
+			q.addBindValue(rows[j].startdate.toString(Qt::ISODate));
+			q.addBindValue(rows[j].enddate.toString(Qt::ISODate));
+			q.addBindValue(rows[j].duration);
+		}
 		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-		instrumentNameID = q.lastInsertId().toInt();
 	}
 
-	q.prepare("insert ignore into measures (enrollment_id, study_id, series_id, instrumentname_id, measurename_id, measure_value, measure_rater, measure_startdate, measure_enddate, measure_duration, measure_entrydate, measure_createdate, measure_modifydate) values (:enrollmentid, :studyid, :seriesid, :instrumentnameid, :measurenameid, :value, :measurerater, :startdate, :enddate, :duration, now(), now(), now()) on duplicate key update study_id = :studyid, series_id = :seriesid, measurename_id = :measurenameid, measure_value = :value, instrumentname_id = :instrumentnameid, measure_startdate = :startdate, measure_enddate = :enddate, measure_modifydate = now()");
-	q.bindValue(":enrollmentid", enrollmentid);
-	q.bindValue(":studyid", studyid);
-	q.bindValue(":seriesid", seriesid);
-	q.bindValue(":measurenameid", measureNameID);
-	q.bindValue(":value", value);
-	q.bindValue(":measurerater", rater);
-	q.bindValue(":instrumentnameid", instrumentNameID);
-	q.bindValue(":startdate", startDate.toString(Qt::ISODate));
-	q.bindValue(":enddate", endDate.toString(Qt::ISODate));
-	q.bindValue(":duration", duration);
-
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__, true);
-	numInserts = 1;
-
-	return true;
+	return rows.size();
 }
 
 
 /* ---------------------------------------------------------- */
-/* --------- InsertVital ------------------------------------ */
+/* --------- InsertVitals ----------------------------------- */
+/* ---------------------------------------------------------- */
+/* the instrument column of the .csv is the vital type        */
 /* ---------------------------------------------------------- */
-int moduleMiniPipeline::InsertVital(int enrollmentID, QString vitalName, QString value, QString notes, QString vitalType, QDateTime vitalDate) {
+int moduleMiniPipeline::InsertVitals(const mpJob &job, const QList<mpRow> &rows) {
 
-	QSqlQuery q;
+	if (rows.size() < 1)
+		return 0;
 
-	/* get the vital name ID */
-	int vitalNameID;
-	q.prepare("select vitalname_id from vitalnames where vital_name = :vitalname");
-	q.bindValue(":vitalname", vitalName);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	if (q.size() > 0) {
-		q.first();
-		vitalNameID = q.value("vitalname_id").toInt();
-	}
-	else {
-		q.prepare("insert into vitalnames (vital_name) values (:vitalname)");
-		q.bindValue(":vitalname", vitalName);
+	QStringList names;
+	for (int i=0; i<rows.size(); i++)
+		names << rows[i].name;
+	n->ResolveIDs("vitalnames", "vitalname_id", "vital_name", names, vitalnameids);
+
+	QSqlQuery q;
+	int chunk = 500;
+	for (int i=0; i<rows.size(); i+=chunk) {
+		int end = std::min(i+chunk, rows.size());
+		QStringList placeholders;
+		for (int j=i; j<end; j++)
+			placeholders << "(?, ?, ?, ?, ?, ?, now(), now())";
+		q.prepare("insert ignore into vitals (enrollment_id, vitalname_id, vital_value, vital_notes, vital_date, vital_type, vital_recordcreatedate, vital_recordmodifydate) values " + placeholders.join(",") + " on duplicate key update vitalname_id = values(vitalname_id), vital_value = values(vital_value), vital_type = values(vital_type), vital_notes = values(vital_notes), vital_date = values(vital_date), vital_recordmodifydate = now()");
+		for (int j=i; j<end; j++) {
+			q.addBindValue(job.enrollmentid);
+			q.addBindValue(vitalnameids.value(rows[j].name.toLower()));
+			q.addBindValue(rows[j].value);
+			q.addBindValue(rows[j].notes);
+			q.addBindValue(rows[j].startdate);
+			q.addBindValue(rows[j].instrument);
+		}
 		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-		vitalNameID = q.lastInsertId().toInt();
 	}
 
-	q.prepare("insert ignore into vitals (enrollment_id, vitalname_id, vital_value, vital_notes, vital_date, vital_type, vital_createdate, vital_modifydate) values (:enrollmentid, :vitalnameid, :value, :notes, :vitaldate, :vitaltype, now(), now()) on duplicate key update vitalname_id = :vitalnameid, vital_value = :value, vital_type = :vitaltype, vital_notes = :notes, vital_date = :vitaldate, vital_modifydate = now()");
-	q.bindValue(":enrollmentid", enrollmentID);
-	q.bindValue(":vitalnameid", vitalNameID);
-	q.bindValue(":value", value);
-	q.bindValue(":vitaltype", vitalType);
-	q.bindValue(":notes", notes);
-	q.bindValue(":vitaldate", vitalDate);
-
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-
-	return 1;
+	return rows.size();
 }
 
 
 /* ---------------------------------------------------------- */
-/* --------- InsertDrug ------------------------------------- */
+/* --------- InsertDrugs ------------------------------------ */
+/* ---------------------------------------------------------- */
+/* the value column of the .csv is the dose amount            */
 /* ---------------------------------------------------------- */
-int moduleMiniPipeline::InsertDrug(int enrollmentID, QDateTime startDate, QDateTime endDate, QString doseAmount, QString doseFreq, QString route, QString drugName, QString drugType, QString doseUnit, QString doseFreqModifier, double doseFreqValue, QString doseFreqUnit) {
+int moduleMiniPipeline::InsertDrugs(const mpJob &job, const QList<mpRow> &rows) {
 
-	doseFreq = "";
+	if (rows.size() < 1)
+		return 0;
 
-	QSqlQuery q;
+	QStringList names;
+	for (int i=0; i<rows.size(); i++)
+		names << rows[i].name;
+	n->ResolveIDs("drugnames", "drugname_id", "drug_name", names, drugnameids);
 
-	/* get the drug name ID */
-	int drugNameID;
-	q.prepare("select vitalname_id from vitalnames where vital_name = :vitalname");
-	q.bindValue(":vitalname", drugName);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	if (q.size() > 0) {
-		q.first();
-		drugNameID = q.value("vitalname_id").toInt();
-	}
-	else {
-		q.prepare("insert into vitalnames (vital_name) values (:vitalname)");
-		q.bindValue(":vitalname", drugName);
+	QSqlQuery q;
+	int chunk = 500;
+	for (int i=0; i<rows.size(); i+=chunk) {
+		int end = std::min(i+chunk, rows.size());
+		QStringList placeholders;
+		for (int j=i; j<end; j++)
+			placeholders << "(?, ?, ?, ?, ?, now(), now())";
+		q.prepare("insert ignore into drugs (enrollment_id, drug_startdate, drug_enddate, drug_doseamount, drugname_id, drug_recordcreatedate, drug_recordmodifydate) values " + placeholders.join(",") + " on duplicate key update drugname_id = values(drugname_id), drug_startdate = values(drug_startdate), drug_enddate = values(drug_enddate), drug_doseamount = values(drug_doseamount), drug_recordmodifydate = now()");
+		for (int j=i; j<end; j++) {
+			q.addBindValue(job.enrollmentid);
+			q.addBindValue(rows[j].startdate);
+			q.addBindValue(rows[j].enddate);
+			q.addBindValue(rows[j].value);
+			q.addBindValue(drugnameids.value(rows[j].name.toLower()));
+		}
 		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-		drugNameID = q.lastInsertId().toInt();
 	}
 
-	q.prepare("insert ignore into drugs (enrollment_id, drug_startdate, drug_enddate, drug_doseamount, drug_route, drugname_id, drug_type, drug_doseunit, drug_frequencymodifier, drug_frequencyvalue, drug_frequencyunit, vital_createdate, vital_modifydate) values (:enrollmentid, :startdate, :enddate, :doseamount, :route, :drugnameid, :drugtype, :doseunit, :freqmodifier, :freqvalue, :frequnit, now(), now()) on duplicate key update drugname_id = :drugnameid, drug_startdate = :startdate, drug_enddate = :enddate, drug_doseamount = :doseamount, drug_route = :route, drug_type = :drugtype, drug_doseunit = :doseunit, drug_frequencymodifier = :freqmodifier, drug_frequencyvalue = :freqvalue, drug_frequencyunit = :frequnit, drug_modifydate = now()");
-	q.bindValue(":enrollmentid", enrollmentID);
-	q.bindValue(":startdate", startDate);
-	q.bindValue(":enddate", endDate);
-	q.bindValue(":doseamount", doseAmount);
-	q.bindValue(":route", route);
-	q.bindValue(":drugnameid", drugNameID);
-	q.bindValue(":drugtype", drugType);
-	q.bindValue(":doseunit", doseUnit);
-	q.bindValue(":freqmodifier", doseFreqModifier);
-	q.bindValue(":freqvalue", doseFreqValue);
-	q.bindValue(":frequnit", doseFreqUnit);
-
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-
-	return 1;
+	return rows.size();
 }
 
 
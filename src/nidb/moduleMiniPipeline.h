@@ -3,6 +3,36 @@
 
 #include "nidb.h"
 
+/* one mini-pipeline job. the main thread claims it and sets up the sandbox, a worker runs the sandbox */
+struct mpJob {
+	int mpjobid = 0;
+	QString name;
+	QString entrypoint;
+	int enrollmentid = -1;
+	int studyid = 0;
+	int seriesid = 0;
+	QString tmpdir;
+	QString logfile;
+	qint64 logpos = 0; /* how much of the log file has been copied into mp_log */
+	int timeoutsec = 300;
+	int maxmemmb = 0;
+
+	/* results */
+	bool success = false;
+	int exitcode = -1;
+	QString msg;
+};
+
+/* one value from a mini-pipeline's output .csv */
+struct mpRow {
+	QString name;
+	QString value;
+	QString instrument;
+	QString notes;
+	QDateTime startdate;
+	QDateTime enddate;
+	int duration = 0;
+};
 
 class moduleMiniPipeline
 {
@@ -13,14 +43,26 @@ public:
 
 	int Run();
 	QList<int> GetMPJobList();
+	int GetNumWorkers();
+	bool ClaimJob(int mpjobid);
+	bool PrepareJob(int mpjobid, mpJob &job);
+	void TailSandboxLog(mpJob &job, bool final);
+	void FinishJob(mpJob &job);
+	int ParseOutput(mpJob &job);
+	void CleanupJob(const mpJob &job);
+	void SetJobStatus(int mpjobid, QString status, int numInserts);
 
 private:
 	nidb *n;
+	QHash<QString, qint64> measurenameids; /* measurenames, by lowercase name */
+	QHash<QString, qint64> instrumentids; /* measureinstruments, by lowercase name */
+	QHash<QString, qint64> vitalnameids; /* vitalnames, by lowercase name */
+	QHash<QString, qint64> drugnameids; /* drugnames, by lowercase name */
 
 	int CopyAllSeriesData(QString modality, int seriesid, QString destination, QString &msg, bool createDestDir=true, bool rwPerms=true);
-	bool InsertMeasure(int enrollmentid, int studyid, int seriesid, QString measureName, QString value, QString instrument, QDateTime startDate, QDateTime endDate, int duration, QString rater, int &numInserts, QString &msg);
-	int InsertVital(int enrollmentID, QString vitalName, QString value, QString notes, QString vitalType, QDateTime vitalDate);
-	int InsertDrug(int enrollmentID, QDateTime startDate, QDateTime endDate, QString doseAmount, QString doseFreq, QString route, QString drugName, QString drugType, QString doseUnit, QString doseFreqModifier, double doseFreqValue, QString doseFreqUnit);
+	int InsertMeasures(const mpJob &job, const QList<mpRow> &rows);
+	int InsertVitals(const mpJob &job, const QList<mpRow> &rows);
+	int InsertDrugs(const mpJob &job, const QList<mpRow> &rows);
 	void AppendMiniPipelineLog(QString log, int jobid);
 };
 
@@ -21,6 +21,7 @@
   ------------------------------------------------------------------------------ */
 
 #include "modulePipeline.h"
+#include "moduleCluster.h"
 #include <QSqlQuery>
 
 
@@ -59,16 +60,25 @@ int modulePipeline::Run() {
 	int numchecked = 0;
 	bool jobsWereSubmitted = false;
 	int totalSubmitted = 0;
+	QList<pipelineRun> runs;
 	QSqlQuery q;
 
 	/* update the start time */
 	SetPipelineProcessStatus("started",0,0);
 
-	/* get list of pipelines that are not currently running, sorted by the longest since last run
-	   we're only going to run 1 pipeline per instance of this module */
+	/* analyses completed after this are found by UpdateReadyStudies(), and their dependent studies queued during this run */
+	q.prepare("select max(analysishistory_id) 'maxid' from analysis_history");
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.first())
+		lasthistoryid = q.value("maxid").toLongLong();
+
+	/* get list of pipelines that are not currently running, sorted by the longest since last run.
+	   all of them are set up first, then their studies are submitted together */
 	q.prepare("select pipeline_id from pipelines where pipeline_status <> 'running' and (pipeline_enabled = 1 or pipeline_testing = 1) order by pipeline_laststart asc");
 	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 	if (q.size() < 1) {
+		/* no pipelines to run, but the jobs already submitted still check in through the spool */
+		ApplyCheckins();
 		n->WriteLog("No pipelines need to be run. Exiting module");
 		SetPipelineProcessStatus("complete",0,0);
 		return false;
@@ -220,7 +230,7 @@ int modulePipeline::Run() {
 			/* submit the cluster job file */
 			QString qm, qresult;
 			int jobid;
-			if (n->SubmitClusterJob(sgefilepath, p.submitHost, n->cfg["qsubpath"], n->cfg["queueuser"], p.queue, qm, jobid, qresult)) {
+			if (SubmitJob(p, sgefilepath, analysispath + "/pipeline/sge.job.log", analysisRowID, qm, jobid, qresult)) {
 				n->WriteLog("Successfully submitted job to cluster [" + qresult + "]");
 				UpdateAnalysisStatus(analysisRowID, "submitted", "Submitted to [" + p.queue + "]", jobid, -1, "", "", true, false, 0, 0);
 			}
@@ -236,7 +246,6 @@ int modulePipeline::Run() {
 		else if (p.level == 1) {
 
 			QString pipelinedirectory;
-			QSqlQuery q2;
 
 			/* fix the directory if its not the default or blank */
 			if (p.directory == "")
@@ -252,438 +261,1419 @@ int modulePipeline::Run() {
 			if (p.parentDependencyIDs.size() > 0)
 				pipelinedep = p.parentDependencyIDs[0];
 
-			QString modality;
-			modality = dataSteps[0].modality;
+			QString modality;
+			modality = dataSteps[0].modality;
+
+			/* get the list of studies which meet the criteria for being processed through the pipeline */
+			QList<int> studyids = GetStudyToDoList(pipelineid, modality, pipelinedep, n->JoinIntArray(p.groupIDs, ","));
+
+			/* the studies are submitted below, taking turns with the other pipelines */
+			pipelineRun r;
+			r.pipelineid = pipelineid;
+			r.p = p;
+			r.pipelinedep = pipelinedep;
+			r.pipelinedirectory = pipelinedirectory;
+			r.steps = steps;
+			r.dataSteps = dataSteps;
+			r.studyids = studyids;
+			runs.append(r);
+			n->WriteLog(QString("Pipeline [%1] has [%2] studies to check").arg(p.name).arg(studyids.size()));
+			continue;
+		}
+		/* ======================= LEVEL 2 ======================= */
+		/* level 2 was once implemented but never used, and fell out of maintenance in the Perl
+		 * version, so it's been deprecated and removed in the C++ version of NiDB */
+		else if (p.level == 2) {
+			n->WriteLog("Level 2 (group) pipelines are not yet implemented in the compiled version of NiDB");
+		}
+		else {
+			n->WriteLog(QString("Invalid pipeline level [%1]").arg(p.level));
+		}
+
+		n->WriteLog(QString("Done with pipeline [%1] - [%2]").arg(pipelineid).arg(p.name));
+		SetPipelineStatusMessage(pipelineid, "Finished submitting jobs");
+		SetPipelineStopped(pipelineid);
+	}
+
+	/* pipelines whose parent is also being run get new studies as the parent's analyses complete. they
+	   wait for the parent for up to modulepipelinedepwait minutes after running out of studies */
+	BuildDependencyGraph(runs);
+	int depwait = 30;
+	if (n->cfg["modulepipelinedepwait"] != "")
+		depwait = n->cfg["modulepipelinedepwait"].toInt();
+	depwaituntil = QDateTime::currentDateTime().addSecs(60*depwait);
+
+	/* the running counts depend on the check-ins, so apply any waiting in the spool first */
+	ApplyCheckins();
+
+	/* the running counts are read here once and then kept in memory. each submit adds one, and they
+	   are only read again from the analysis table when every pipeline is at its limit */
+	UpdateRunningCounts(runs);
+
+	/* the data for each study is copied by a pool of staging workers, and its job is submitted as
+	   soon as that study's data is ready. a study holds one of its pipeline's slots while staging */
+	StartStaging();
+
+	/* studies from the same pipeline are submitted together as array jobs of up to this many analyses */
+	arraysize = n->cfg["modulepipelinearraysize"].toInt();
+	if (arraysize < 1)
+		arraysize = 1;
+
+	/* pipelines with a cluster type of local run on this server, as many at a time as fit in the cpus and memory given to them */
+	localjobcpus = std::max(1, n->cfg["modulepipelinelocaljobcpus"].toInt());
+	localjobmem = n->cfg["modulepipelinelocaljobmemory"].toLongLong();
+	localmaxcpus = n->cfg["modulepipelinelocalcpus"].toInt();
+	if (localmaxcpus < 1)
+		localmaxcpus = QThread::idealThreadCount();
+	localmaxmem = n->cfg["modulepipelinelocalmemory"].toLongLong();
+	if (localmaxmem < 1)
+		localmaxmem = n->GetMemInfo("MemTotal")*9/10;
+
+	/* submit one study from each pipeline in turn, so a pipeline with a long list of studies, or
+	   one waiting on its concurrent limit, doesn't hold up the others */
+	bool moduleDisabled = false;
+	int numactive;
+	QElapsedTimer depcheck;
+	depcheck.start();
+	do {
+		numactive = 0;
+		bool checkedstudy = false;
+
+		/* queue the studies readied by parent analyses that completed since the last check */
+		if (depcheck.elapsed() > 10000) {
+			ApplyCheckins();
+			UpdateReadyStudies(runs);
+			depcheck.restart();
+		}
+
+		/* submit the studies whose data has been staged */
+		std::deque<stagingStudy*> staged = TakeStagedStudies();
+		for (stagingStudy *st : staged) {
+			for (int i=0; i<runs.size(); i++) {
+				pipelineRun &r = runs[i];
+				if (r.pipelineid != st->pipelineid)
+					continue;
+
+				r.numstaging--;
+				int ret = FinishStudy(r, *st);
+				if (ret == 1) {
+					totalSubmitted++;
+					jobsWereSubmitted = true;
+					if (r.pending.size() >= arraysize)
+						SubmitPending(r);
+				}
+				else {
+					r.numrunning--;
+					if (r.p.clusterType == "local")
+						localnumrunning--;
+				}
+				if (ret == -1)
+					r.stopmsg = QString("Parent pipeline [%1] does not exist!").arg(r.pipelinedep);
+				break;
+			}
+			delete st;
+			checkedstudy = true;
+		}
+
+		for (int i=0; i<runs.size(); i++) {
+			pipelineRun &r = runs[i];
+			if (r.done)
+				continue;
+
+			if ((!r.enabled) && (r.stopmsg == ""))
+				r.stopmsg = "Pipeline disabled while running. Normal stop.";
+
+			/* if numproc is 0, the pipeline may have disappeared, or someone set the concurrent limit to 0 */
+			if ((r.numproc < 1) && (r.stopmsg == "")) {
+				n->WriteLog(QString("Pipeline [%1] has a concurrent analysis limit of 0. Stopping").arg(r.p.name));
+				r.stopmsg = "Concurrent analysis limit is 0. Stopping.";
+			}
+
+			/* the pipeline is stopped once the studies it is staging have been submitted */
+			if ((r.stopmsg != "") || (r.next >= r.studyids.size())) {
+				if (r.numstaging > 0) {
+					numactive++;
+					continue;
+				}
+				SubmitPending(r);
+
+				/* more studies may be ready once the parent pipeline's analyses complete */
+				if (WaitingOnParent(runs, r)) {
+					if (!r.waiting)
+						SetPipelineStatusMessage(r.pipelineid, "Waiting for the parent pipeline's analyses to complete");
+					r.waiting = true;
+					numactive++;
+					continue;
+				}
+
+				if (r.stopmsg == "") {
+					n->WriteLog(QString("Done with pipeline [%1] - [%2]. Submitted [%3] jobs").arg(r.pipelineid).arg(r.p.name).arg(r.numsubmitted));
+					SetPipelineStatusMessage(r.pipelineid, "Finished submitting jobs");
+				}
+				else
+					SetPipelineStatusMessage(r.pipelineid, r.stopmsg);
+				SetPipelineStopped(r.pipelineid);
+				r.done = true;
+				continue;
+			}
+			numactive++;
+
+			/* this pipeline is full, so go on to the next one until a slot frees up */
+			if (r.numrunning >= r.numproc) {
+				if (!r.waiting)
+					SetPipelineStatusMessage(r.pipelineid, "Process quota reached. Waiting for running analyses to finish");
+				r.waiting = true;
+				continue;
+			}
+
+			/* local pipelines also wait for the cpus and memory on this server */
+			if ((r.p.clusterType == "local") && (!LocalSlotFree())) {
+				if (!r.waiting)
+					SetPipelineStatusMessage(r.pipelineid, "Local executor is full. Waiting for running analyses to finish");
+				r.waiting = true;
+				continue;
+			}
+			r.waiting = false;
+
+			int sid = r.studyids[r.next++];
+			numchecked++;
+			checkedstudy = true;
+
+			int ret = SubmitStudy(r, sid);
+			if (((ret == 1) || (ret == 2)) && (r.p.clusterType == "local"))
+				localnumrunning++;
+			if (ret == 1) {
+				r.numrunning++;
+				totalSubmitted++;
+				jobsWereSubmitted = true;
+				if (r.pending.size() >= arraysize)
+					SubmitPending(r);
+			}
+			else if (ret == 2) {
+				r.numrunning++;
+				r.numstaging++;
+			}
+			else if (ret == -1)
+				r.stopmsg = QString("Parent pipeline [%1] does not exist!").arg(r.pipelinedep);
+
+			if ((numchecked%1000) == 0) {
+				n->WriteLog(QString("[%1] studies checked").arg(numchecked));
+				n->ModuleRunningCheckIn();
+			}
+
+			/* check if this module should be running now or not. the studies already being staged are still submitted */
+			if ((!moduleDisabled) && (!n->ModuleCheckIfActive()))
+				moduleDisabled = true;
+
+			if (!IsPipelineEnabled(r.pipelineid))
+				r.enabled = false;
+		}
+
+		if (moduleDisabled) {
+			for (int i=0; i<runs.size(); i++)
+				if (runs[i].stopmsg == "")
+					runs[i].stopmsg = "Pipeline module disabled while running. Stopping.";
+		}
+
+		/* nothing could be started, so wait for studies to finish staging or for some analyses to finish */
+		if ((numactive > 0) && (!checkedstudy)) {
+			/* submit the partial array jobs first, so they aren't held up while waiting */
+			for (int i=0; i<runs.size(); i++)
+				SubmitPending(runs[i]);
+
+			if (!WaitForSlots(runs)) {
+				if (!moduleDisabled)
+					n->WriteLog("Module disabled. Finishing the studies being staged and exiting");
+				moduleDisabled = true;
+			}
+		}
+	} while (numactive > 0);
+
+	StopStaging();
+	for (int i=0; i<runs.size(); i++)
+		SubmitPending(runs[i]);
+
+	if (moduleDisabled) {
+		n->WriteLog("Module disabled. Exiting");
+		SetPipelineProcessStatus("complete",0,0);
+		return 1;
+	}
+
+	SetPipelineProcessStatus("complete",0,0);
+
+	if (jobsWereSubmitted) {
+		n->WriteLog(QString("Done with pipeline module. [%1] total jobs were submitted. jobsWereSubmitted [%2]").arg(totalSubmitted).arg(jobsWereSubmitted));
+		return true;
+	}
+	else
+		return false;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- SubmitStudy ------------------------------------ */
+/* ---------------------------------------------------------- */
+/* check one study for a level 1 pipeline. if it needs an     */
+/* analysis, find the data and submit the job to the cluster. */
+/* returns 1 if a job was submitted, 0 if not, -1 if the      */
+/* pipeline has been stopped, and 2 if the data was queued    */
+/* for the staging workers and FinishStudy() will submit it   */
+/* ---------------------------------------------------------- */
+int modulePipeline::SubmitStudy(pipelineRun &r, int sid) {
+
+	pipeline &p = r.p;
+	int pipelineid = r.pipelineid;
+	int pipelinedep = r.pipelinedep;
+	QList<dataDefinitionStep> &dataSteps = r.dataSteps;
+
+	int ret = 0;
+	qint64 analysisRowID = -1;
+	QStringList setuplog;
+	QString setupLogFile;
+	QSqlQuery q2;
+
+	SetPipelineProcessStatus("running", pipelineid, sid);
+
+	/* get information about the study */
+	study s(sid, n);
+	if (!s.isValid) {
+		n->WriteLog("Study was not valid: [" + s.msg + "]");
+		return 0;
+	}
+
+	n->WriteLog(QString("---------- Working on study [%1%2] (%3 of %4) for pipeline [%5] ----------").arg(s.uid).arg(s.studynum).arg(r.next).arg(r.studyids.size()).arg(p.name));
+
+	/* get the analysis info, if an analysis already exists for this study */
+	n->WriteLog(QString("Getting analysis info for pipelineID [%1] studyID [%2] pipelineVersion [%3]").arg(pipelineid).arg(sid).arg(p.version));
+	analysis a(pipelineid, sid, n);
+	if (a.exists)
+		analysisRowID = a.analysisid;
+	else
+		analysisRowID = -1;
+
+	setuplog << a.msg;
+
+	// ********************
+	// only continue through this section (and submit the analysis) if
+	// a) there is no existing analysis
+	// b) -OR- there is an existing analysis and it needs the results rerun
+	// c) -OR- there is an existing analysis and it needs a supplement run
+	// ********************
+	//n->WriteLog(QString("Checking if we need to submit this analysis to the cluster [%1] [%2] [%3]").arg(a.runSupplement).arg(a.rerunResults).arg(analysisRowID));
+	if ((a.runSupplement) || (a.rerunResults) || (analysisRowID == -1)) {
+		/* if the analysis doesn't yet exist, insert a temporary row, to be updated later, in the analysis table as a placeholder so that no other pipeline processes try to run it */
+		if (analysisRowID == -1) {
+			/* check if this analysis already exists (probably created by another instance of this program ) */
+			q2.prepare("select analysis_id from analysis where pipeline_id = :pipelineid and pipeline_version = :version and study_id = :studyid");
+			q2.bindValue(":pipelineid",pipelineid);
+			q2.bindValue(":version",p.version);
+			q2.bindValue(":studyid",sid);
+			n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
+			if (q2.size() > 0) {
+				q2.first();
+				analysisRowID = q2.value("analysis_id").toInt();
+			}
+			else {
+				q2.prepare("insert into analysis (pipeline_id, pipeline_version, pipeline_dependency, study_id, analysis_status, analysis_startdate, analysis_isbad) values (:pipelineid, :version, :pipelinedep, :studyid,'processing',now(), 0)");
+				q2.bindValue(":pipelineid",pipelineid);
+				q2.bindValue(":version",p.version);
+				q2.bindValue(":pipelinedep",pipelinedep);
+				q2.bindValue(":studyid",sid);
+				n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
+				analysisRowID = q2.lastInsertId().toInt();
+			}
+
+			n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysiscreated", "Analysis created");
+		}
+
+		QString datalog;
+
+		int dependencyanalysisid(0);
+
+		//n->WriteLog(QString("StudyDateTime: [%1], Working on: [%2%3]").arg(s.studydatetime.toString("yyyy-MM-dd hh:mm:ss")).arg(s.uid).arg(s.studynum));
+
+		QString analysispath = "";
+		if (p.dirStructure == "b")
+			analysispath = QString("%1/%2/%3/%4").arg(p.pipelineRootDir).arg(p.name).arg(s.uid).arg(s.studynum);
+		else
+			analysispath = QString("%1/%2/%3/%4").arg(p.pipelineRootDir).arg(s.uid).arg(s.studynum).arg(p.name);
+		n->WriteLog("analysispath is [" + analysispath + "]");
+
+		/* this file will record any events during setup */
+		QString setupLogFile = analysispath + "/pipeline/analysisSetup.log";
+		n->WriteLog("Should have created this analysis setup log [" + setupLogFile + "]");
+
+		/* get the nearest study for this subject that has the dependency */
+		int studyNumNearest(0);
+		q2.prepare("select analysis_id, study_num from analysis a left join studies b on a.study_id = b.study_id left join enrollment c on b.enrollment_id = c.enrollment_id where c.subject_id = :subjectid and a.pipeline_id = :pipelinedep and a.analysis_status = 'complete' and (a.analysis_isbad <> 1 or a.analysis_isbad is null) order by abs(datediff(b.study_datetime, :studydatetime)) limit 1");
+		q2.bindValue(":subjectid", s.subjectid);
+		q2.bindValue(":pipelinedep", pipelinedep);
+		q2.bindValue(":studydatetime", s.studydatetime.toString("yyyy-MM-dd hh:mm:ss"));
+		n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
+		if (q2.size() > 0) {
+			q2.first();
+			studyNumNearest = q2.value("study_num").toInt();
+			dependencyanalysisid = q2.value("analysis_id").toInt();
+		}
+		/* determine the dependency path */
+		if (pipelinedep != -1) {
+			if (p.depLevel == "subject") {
+				setuplog << n->WriteLog("Dependency is a subject level (will match dep for same subject, any study)");
+			}
+			else {
+				setuplog << n->WriteLog("Dependency is a study level (will match dep for same subject, same study)");
+
+				/* check the dependency and see if there's anything amiss about it */
+				QString depstatus = CheckDependency(sid, pipelinedep);
+				if (depstatus != "") {
+					UpdateAnalysisStatus(analysisRowID, "OddDependencyStatus", depstatus, -1, -1, setuplog.join("\n"), setuplog.join("\n"), false, false, -1, -1);
+					return 0;
+				}
+			}
+		}
+		setuplog << n->WriteLog("This analysis path is [" + analysispath + "]");
+
+		int numseriesdownloaded = 0;
+		std::vector<stagingItem> items;
+		/* get the data if we are not running a supplement, and not rerunning the results */
+		if ((!a.runSupplement) && (!a.rerunResults)) {
+			if (!GetData(sid, analysispath, s.uid, analysisRowID, pipelineid, pipelinedep, p.depLevel, dataSteps, numseriesdownloaded, datalog, items)) {
+				n->WriteLog("GetData() returned false");
+			}
+			else
+				n->WriteLog(QString("GetData() downloaded [%1] series").arg(numseriesdownloaded));
+		}
+		UpdateAnalysisStatus(analysisRowID, "", "", -1, numseriesdownloaded, "", datalog, false, false, -1, -1);
+
+		// again check if there are any series to actually run the pipeline on...
+		// ... but its ok to run if any of the following are true
+		//     a) rerunresults is true
+		//     b) runsupplement is true
+		//     c) this pipeline is dependent on another pipeline
+		bool okToRun = false;
+
+		if (numseriesdownloaded > 0) {
+			okToRun = true; // there is data to download from this study
+			setuplog << n->WriteLog(QString("Study [%1%2] has [%2] matching series downloaded. Beginning analysis.").arg(s.uid).arg(s.studynum).arg(numseriesdownloaded));
+		}
+		if (a.rerunResults) {
+			okToRun = true;
+			setuplog << n->WriteLog(QString("Study [%1%2] set to have results rerun. Beginning analysis.").arg(s.uid).arg(s.studynum));
+		}
+		if (a.runSupplement) {
+			okToRun = true;
+			setuplog << n->WriteLog(QString("Study [%1%2] set to have supplement run. Beginning analysis.").arg(s.uid).arg(s.studynum));
+		}
+		if ((pipelinedep != -1) && (p.depLevel == "study")) {
+			okToRun = true; // there is a parent pipeline and we're using the same study from the parent pipeline. may or may not have data to download
+			setuplog << n->WriteLog(QString("Study [%1%2] has a study-level parent pipeline. Beginning analysis.").arg(s.uid).arg(s.studynum));
+		}
+
+		/* one of the above criteria has been satisfied, so its ok to run the pipeline on this study and submit the cluster */
+		if (okToRun) {
+			stagingStudy *st = new stagingStudy;
+			st->pipelineid = pipelineid;
+			st->s = s;
+			st->rerunResults = a.rerunResults;
+			st->runSupplement = a.runSupplement;
+			st->analysisRowID = analysisRowID;
+			st->analysispath = analysispath;
+			st->setuplog = setuplog;
+			st->setupLogFile = setupLogFile;
+			st->studyNumNearest = studyNumNearest;
+			st->dependencyanalysisid = dependencyanalysisid;
+			st->numseriesdownloaded = numseriesdownloaded;
+			st->datalog = datalog;
+			st->items = items;
+
+			/* the job is submitted by Run() once the staging workers have copied the data */
+			if (st->items.size() > 0) {
+				n->WriteLog(QString("Staging [%1] series for study [%2%3]").arg(st->items.size()).arg(s.uid).arg(s.studynum));
+				QueueStaging(st);
+				return 2;
+			}
+
+			ret = FinishStudy(r, *st);
+			delete st;
+		}
+		else {
+			n->WriteLog("Not Ok to submit job");
+			/* update the analysis table with the datalog so people can check later on why something didn't process */
+			UpdateAnalysisStatus(analysisRowID, "", "", -1, -1, datalog, datalog, false, false, -1, -1);
+			n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysissetuperror", "No data found, 0 series returned from search");
+
+			/* save some database space, since most entries will be blank */
+			UpdateAnalysisStatus(analysisRowID, "NoMatchingSeries", "", -1, -1, "", "", false, false, -1, -1);
+			n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", "This study did not have any matching data");
+		}
+		n->WriteLog(QString("Submitted [%1] jobs so far").arg(r.numsubmitted));
+	}
+	else {
+		n->WriteLog(QString("This analysis [%1] already has an entry in the analysis table").arg(analysisRowID));
+		n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", "This analysis already has an entry in the analysis table");
+	}
+
+	return ret;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- FinishStudy ------------------------------------ */
+/* ---------------------------------------------------------- */
+/* once a study's data has been staged, copy the parent       */
+/* pipeline, write the job file and submit it. returns 1 if a */
+/* job was submitted, 0 if not, and -1 if the parent pipeline */
+/* doesn't exist                                              */
+/* ---------------------------------------------------------- */
+int modulePipeline::FinishStudy(pipelineRun &r, stagingStudy &st) {
+
+	pipeline &p = r.p;
+	int pipelineid = r.pipelineid;
+	int pipelinedep = r.pipelinedep;
+	QString pipelinedirectory = r.pipelinedirectory;
+	QList<pipelineStep> &steps = r.steps;
+	study &s = st.s;
+	int sid = s.studyid;
+	qint64 analysisRowID = st.analysisRowID;
+	QString analysispath = st.analysispath;
+	QStringList &setuplog = st.setuplog;
+	QString setupLogFile = st.setupLogFile;
+	int studyNumNearest = st.studyNumNearest;
+	int dependencyanalysisid = st.dependencyanalysisid;
+	int numseriesdownloaded = st.numseriesdownloaded;
+
+	int ret = 0;
+	bool submiterror = false;
+	QString deppath;
+	QSqlQuery q2;
+
+	/* record where the staged data went. the workers don't touch the database */
+	QStringList linked;
+	QStringList stageerrors;
+	if (st.items.size() > 0) {
+		QStringList dlog;
+		for (size_t i=0; i<st.items.size(); i++) {
+			stagingItem &item = st.items[i];
+			RecordDataDownload(item.datadownloadid, analysisRowID, item.modality, 1, 1, item.seriesid, item.outdir, item.step, "Data downloaded");
+			if (item.error != "")
+				stageerrors << item.error;
+			n->AddToDirSizeIndex(item.outdir, item.numfiles, item.numbytes);
+			if (item.behoutdir != "")
+				n->AddToDirSizeIndex(item.behoutdir, item.numbehfiles, item.numbehbytes);
+			dlog << item.log;
+			linked << item.linked;
+		}
+		st.datalog += "\n" + dlog.join("\n");
+		UpdateAnalysisStatus(analysisRowID, "", "", -1, -1, "", st.datalog, false, false, -1, -1);
+		n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysiscopydataend", QString("Finished copying data [%1] series downloaded").arg(numseriesdownloaded));
+	}
+
+	/* don't submit an analysis that is missing some of its data */
+	if (stageerrors.size() > 0) {
+		setuplog << n->WriteLog("Error staging data [" + stageerrors.join("] [") + "]. The analysis will not be submitted");
+		n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysiserror", "Error staging data [" + stageerrors.join("] [") + "]");
+		UpdateAnalysisStatus(analysisRowID, "error", stageerrors.join(", "), 0, -1, "", "", false, true, -1, -1);
+		n->AppendCustomLog(setupLogFile, setuplog.join("\n"));
+		return 0;
+	}
+
+	/* inputs linked to the archive, from this run or an earlier one, keep the archive's permissions */
+	QSet<QString> linkedpaths = ReadLinkedInputs(analysispath);
+	for (int i=0; i<linked.size(); i++)
+		linkedpaths.insert(linked[i].section('\t', 0, 0));
+
+	QString dependencyname;
+	/* this analysis is new and has not been written to disk before, so
+	 * the directory should not yet exist */
+	if ((!st.rerunResults) && (!st.runSupplement)) {
+		if (pipelinedep != -1) {
+			setuplog << n->WriteLog(QString("This pipeline depends on [%1]").arg(pipelinedep));
+			q2.prepare("select pipeline_name from pipelines where pipeline_id = :pipelinedep");
+			q2.bindValue(":pipelinedep", pipelinedep);
+			n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
+			if (q2.size() > 0) {
+				q2.first();
+				dependencyname = q2.value("pipeline_name").toString();
+				setuplog << n->WriteLog(QString("Found [%1] rows for parent pipeline [%2]").arg(q2.size()).arg(dependencyname));
+			}
+			else {
+				setuplog << n->WriteLog(QString("Parent pipeline [%1] does not exist!").arg(pipelinedep));
+				return -1;
+			}
+			n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", "This pipeline is dependent on [" + dependencyname + "]");
+		}
+		else {
+			setuplog << n->WriteLog(QString("This pipeline does not depend on any pipelines [%1]").arg(pipelinedep));
+		}
+
+		//QString analysispath = p.pipelineRootDir + "/" + p.name;
+		QString m;
+		if (!n->MakePath(analysispath + "/pipeline", m)) {
+			n->WriteLog("Error: unable to create directory [" + analysispath + "/pipeline] - B");
+			n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysiserror", "Unable to create directory [" + analysispath + "/pipeline]");
+			UpdateAnalysisStatus(analysisRowID, "error", "Unable to create directory [" + analysispath + "/pipeline]", 0, -1, "", "", false, true, -1, -1);
+			return 0;
+		}
+		else
+			n->WriteLog("Created directory [" + analysispath + "/pipeline] - B");
+
+        n->WriteLog(n->SystemCommand("chmod -Rf 777 " + analysispath + "/pipeline", true, true));
+		if (pipelinedep != -1) {
+			if (p.depLevel == "subject") {
+				if (p.dirStructure == "b")
+					deppath = QString("%1/%2/%3/%4").arg(pipelinedirectory).arg(dependencyname).arg(s.uid).arg(studyNumNearest);
+				else
+					deppath = QString("%1/%2/%3/%4").arg(pipelinedirectory).arg(s.uid).arg(studyNumNearest).arg(dependencyname);
+			}
+			else {
+				if (p.dirStructure == "b")
+					deppath = QString("%1/%2/%3/%4").arg(pipelinedirectory).arg(dependencyname).arg(s.uid).arg(s.studynum);
+				else
+					deppath = QString("%1/%2/%3/%4").arg(pipelinedirectory).arg(s.uid).arg(s.studynum).arg(dependencyname);
+			}
+
+			setuplog << n->WriteLog("Dependency path is [" + deppath + "]");
+
+			QString fulldeppath = deppath + "/" + dependencyname;
+			QDir d(fulldeppath);
+			if (d.exists())
+				setuplog << n->WriteLog("Full path to parent pipeline [" + fulldeppath + "] exists");
+			else
+				setuplog << n->WriteLog("Full path to parent pipeline [" + fulldeppath + "] does NOT exist");
+
+			setuplog << n->WriteLog(QString("This is a level [%1] pipeline. deplinktype [%2] depdir [%3]").arg(p.level).arg(p.depLinkType).arg(p.depDir));
+
+			n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", QString("Parent pipeline (dependency) will be copied to directory [%1] using method [%2]").arg(p.depDir).arg(p.depLinkType));
+
+			/* copy any parent pipelines */
+			QString systemstring;
+            if (p.depLinkType == "hardlink") systemstring = "cp -aulL "; /* L added to allow copying of softlinks */
+			else if (p.depLinkType == "softlink") systemstring = "cp -aus ";
+			else if (p.depLinkType == "regularcopy") systemstring = "cp -au ";
+			if (p.depDir == "subdir") {
+				setuplog << n->WriteLog("Parent pipeline will be copied to a subdir");
+				systemstring += deppath + " " + analysispath + "/";
+			}
+			else {
+				setuplog << n->WriteLog("Parent pipeline will be copied to the root dir");
+				systemstring += deppath + "/* " + analysispath + "/";
+			}
+			setuplog << n->WriteLog(n->SystemCommand(systemstring));
+
+			n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", "Parent pipeline copied by running [" + systemstring + "]");
+			n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysisdependencyid", QString("%1").arg(dependencyanalysisid));
+
+			/* delete any log files and SGE files that came with the dependency */
+			setuplog << n->WriteLog(n->SystemCommand(QString("rm --preserve-root %1/pipeline/* %1/origfiles.log %1/sge.job").arg(analysispath)));
+
+			/* make sure the whole tree is writeable */
+			MakeWritable(analysispath, linkedpaths);
+		}
+		else {
+			setuplog << n->WriteLog("This pipeline is not dependent on another pipeline");
+			n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", "This pipeline does not depend on other pipelines");
+		}
+
+		/* list the inputs that are shared with the archive, so they can be checked when the analysis completes */
+		if (linked.size() > 0) {
+			QFile f(analysispath + "/pipeline/linkedinputs.txt");
+			if (f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+				QTextStream fs(&f);
+				fs << linked.join("\n") << "\n";
+				f.close();
+			}
+			else
+				setuplog << n->WriteLog("Unable to write [" + f.fileName() + "]");
+		}
+
+		/* now safe to write out the setuplog */
+		n->AppendCustomLog(setupLogFile, setuplog.join("\n"));
+
+		/* however, if the setupLogFile does not exist, something is not writeable, and that is not good */
+		if (!QFile::exists(setupLogFile)) {
+			setuplog << n->WriteLog("setupLogFile [" + setupLogFile + "] does not exist.");
+		}
+	}
+	/* "realanalysispath" is now --> "clusteranalysispath" */
+	QString clusteranalysispath = analysispath;
+	if (p.clusterType != "local")
+		clusteranalysispath.replace("/mount","");
+
+	/* create the SGE job file */
+	QString localsgefilepath;
+	QString clustersgefilepath;
+	QString sgefilename;
+	if (st.rerunResults)
+		sgefilename = "sgererunresults.job";
+	else if (st.runSupplement)
+		sgefilename = "sge-supplement.job";
+	else
+		sgefilename = "sge.job";
+	localsgefilepath = analysispath + "/" + sgefilename;
+	clustersgefilepath = clusteranalysispath + "/" + sgefilename;
+
+	if (CreateClusterJobFile(localsgefilepath, p.clusterType, analysisRowID, s.uid, s.studynum, clusteranalysispath, p.useTmpDir, p.tmpDir, s.studydatetime.toString("yyyy-MM-dd hh:mm:ss"), p.name, pipelineid, p.resultScript, p.maxWallTime, steps, st.runSupplement)) {
+		n->WriteLog("Created (local path) sge job submit file [" + localsgefilepath + "]");
+	}
+	else {
+		UpdateAnalysisStatus(analysisRowID, "error", "Error creating cluster job file", 0, -1, "", "", false, true, -1, -1);
+		return 0;
+	}
+
+	MakeWritable(analysispath, linkedpaths);
+
+	/* batch it up with other studies from this pipeline, to be submitted as one array job. local jobs are started one at a time, as slots free up */
+	if ((arraysize > 1) && (p.clusterType != "local")) {
+		pendingSubmit ps;
+		ps.analysisid = analysisRowID;
+		ps.studyid = sid;
+		ps.numseries = numseriesdownloaded;
+		ps.jobfile = clustersgefilepath;
+		ps.logfile = clusteranalysispath + "/pipeline/" + sgefilename + ".log";
+		r.pending.append(ps);
+		n->WriteLog(QString("Queued [%1] for array job submission. [%2] queued").arg(clustersgefilepath).arg(r.pending.size()));
+		return 1;
+	}
+
+	/* submit the cluster job file */
+	QString qm, qresult;
+	int jobid;
+	if (SubmitJob(p, clustersgefilepath, clusteranalysispath + "/pipeline/" + sgefilename + ".log", analysisRowID, qm, jobid, qresult)) {
+		n->WriteLog("Successfully submitted job to cluster ["+qresult+"]");
+		UpdateAnalysisStatus(analysisRowID, "submitted", "Submitted to [" + p.queue + "]", jobid, numseriesdownloaded, "", "", false, true, 0, 0);
+		n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysissubmitted", qresult);
+	}
+	else {
+		n->WriteLog("Error submitting job to cluster [" + qresult + "]");
+		UpdateAnalysisStatus(analysisRowID, "error", "Submit error [" + qm + "]", 0, numseriesdownloaded, "", "", false, true, 0, 0);
+		n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysissubmiterror", "Analysis submitted to cluster, but was rejected with errors [" + qm + "]");
+		submiterror = true;
+	}
+
+	r.numsubmitted++;
+	if (!submiterror)
+		ret = 1;
+
+	SetPipelineStatusMessage(pipelineid, QString("Submitted %1%2").arg(s.uid).arg(s.studynum));
+
+	return ret;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- SubmitPending ---------------------------------- */
+/* ---------------------------------------------------------- */
+/* submit the job files queued by FinishStudy() as one array  */
+/* job. returns the number of analyses submitted              */
+/* ---------------------------------------------------------- */
+int modulePipeline::SubmitPending(pipelineRun &r) {
+	if (r.pending.size() < 1)
+		return 0;
+
+	QList<clusterArrayTask> tasks;
+	for (int i=0; i<r.pending.size(); i++) {
+		clusterArrayTask t;
+		t.id = r.pending[i].analysisid;
+		t.jobfile = r.pending[i].jobfile;
+		t.logfile = r.pending[i].logfile;
+		tasks.append(t);
+	}
+
+	/* the wrapper and manifest go in the pipeline directory, which the cluster can see */
+	QString localdir = QString("%1/arrayjobs/%2").arg(r.p.pipelineRootDir).arg(r.p.name);
+	QString clusterdir = localdir;
+	clusterdir.replace("/mount","");
+
+	QString qm, qresult;
+	int jobid;
+	bool ok = n->SubmitClusterArrayJob(tasks, r.p.clusterType, r.p.name, localdir, clusterdir, r.p.maxWallTime, r.p.submitHost, n->cfg["qsubpath"], n->cfg["queueuser"], r.p.queue, qm, jobid, qresult);
+	if (ok)
+		n->WriteLog(QString("Submitted [%1] analyses as array job [%2] [%3]").arg(tasks.size()).arg(jobid).arg(qresult));
+	else
+		n->WriteLog(QString("Error submitting [%1] analyses as an array job [%2] [%3]").arg(tasks.size()).arg(qm).arg(qresult));
+
+	n->db.transaction();
+	for (int i=0; i<r.pending.size(); i++) {
+		pendingSubmit &ps = r.pending[i];
+		if (ok) {
+			UpdateAnalysisStatus(ps.analysisid, "submitted", QString("Submitted to [%1] as task [%2] of array job").arg(r.p.queue).arg(i+1), jobid, ps.numseries, "", "", false, true, 0, 0);
+			n->InsertAnalysisEvent(ps.analysisid, r.pipelineid, r.p.version, ps.studyid, "analysissubmitted", QString("%1 task [%2]").arg(qresult).arg(i+1));
+
+			/* every task has the array's job id, so the task id tells the analyses apart */
+			QSqlQuery q;
+			q.prepare("update analysis set analysis_qsubtaskid = :taskid where analysis_id = :analysisid");
+			q.bindValue(":taskid", i+1);
+			q.bindValue(":analysisid", ps.analysisid);
+			n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+		}
+		else {
+			UpdateAnalysisStatus(ps.analysisid, "error", "Submit error [" + qm + "]", 0, ps.numseries, "", "", false, true, 0, 0);
+			n->InsertAnalysisEvent(ps.analysisid, r.pipelineid, r.p.version, ps.studyid, "analysissubmiterror", "Analysis submitted to cluster, but was rejected with errors [" + qm + "]");
+		}
+	}
+	n->db.commit();
+
+	/* the analyses were counted as running when they were queued */
+	int numsubmitted = ok ? r.pending.size() : 0;
+	if (!ok)
+		r.numrunning -= r.pending.size();
+	r.numsubmitted += r.pending.size();
+	r.pending.clear();
+
+	SetPipelineStatusMessage(r.pipelineid, QString("Submitted array job of %1 analyses").arg(tasks.size()));
+
+	return numsubmitted;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- UpdateRunningCounts ---------------------------- */
+/* ---------------------------------------------------------- */
+/* read the concurrent limit and the number of running        */
+/* analyses for all of the pipelines being submitted, in one  */
+/* query. returns the number of pipelines that can submit     */
+/* ---------------------------------------------------------- */
+int modulePipeline::UpdateRunningCounts(QList<pipelineRun> &runs) {
+
+	QHash<int, int> index;
+	QStringList ids;
+	for (int i=0; i<runs.size(); i++) {
+		/* a finished pipeline's running analyses can still ready studies for the pipelines that depend on it */
+		if ((runs[i].done) && (runs[i].children.size() < 1))
+			continue;
+		index[runs[i].pipelineid] = i;
+		ids << QString::number(runs[i].pipelineid);
+
+		/* stays 0 if the pipeline has disappeared */
+		runs[i].numproc = 0;
+	}
+	if (ids.size() < 1)
+		return 0;
+
+	for (int i=0; i<runs.size(); i++) {
+		if ((!runs[i].done) && (runs[i].p.clusterType == "local")) {
+			UpdateLocalJobs(runs);
+			break;
+		}
+	}
+
+	QSqlQuery q;
+	q.prepare(QString("select a.pipeline_id, a.pipeline_enabled, a.pipeline_testing, a.pipeline_numproc, count(b.analysis_id) 'count' from pipelines a left join analysis b on b.pipeline_id = a.pipeline_id and b.analysis_status in ('processing', 'started', 'submitted', 'pending') where a.pipeline_id in (%1) group by a.pipeline_id").arg(ids.join(",")));
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	while (q.next()) {
+		pipelineRun &r = runs[index[q.value("pipeline_id").toInt()]];
+		r.enabled = (q.value("pipeline_enabled").toBool() || q.value("pipeline_testing").toBool());
+		r.numproc = q.value("pipeline_numproc").toInt();
+		r.numrunning = q.value("count").toInt();
+	}
+
+	UpdateReadyStudies(runs);
+
+	int numfree = 0;
+	for (int i=0; i<runs.size(); i++) {
+		pipelineRun &r = runs[i];
+		if ((r.done) || (r.stopmsg != ""))
+			continue;
+
+		/* a pipeline that ran out of studies, and is no longer waiting on its parent, can be finished */
+		if (r.next >= r.studyids.size()) {
+			if ((r.numstaging < 1) && (!WaitingOnParent(runs, r)))
+				numfree++;
+			continue;
+		}
+
+		if ((!r.enabled) || (r.numproc < 1) || ((r.numrunning < r.numproc) && ((r.p.clusterType != "local") || LocalSlotFree())))
+			numfree++;
+	}
+
+	return numfree;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- WaitForSlots ----------------------------------- */
+/* ---------------------------------------------------------- */
+/* wait until one of the pipelines can submit again, or a     */
+/* study has finished staging. the check-ins come from the    */
+/* cluster jobs in other processes, so they are seen through  */
+/* the analysis table. returns false if the module was        */
+/* disabled while waiting                                     */
+/* ---------------------------------------------------------- */
+bool modulePipeline::WaitForSlots(QList<pipelineRun> &runs) {
+
+	bool logged = false;
+	for (int i=1; ; i++) {
+		/* a study finishing staging can be submitted right away */
+		if (WaitForStaging(1000))
+			return true;
+
+		ApplyCheckins();
+		if (UpdateRunningCounts(runs) > 0)
+			return true;
+
+		bool staging = false;
+		for (int j=0; j<runs.size(); j++)
+			if (runs[j].numstaging > 0)
+				staging = true;
+		if ((!logged) && (!staging)) {
+			n->WriteLog("All pipelines are at their concurrent analysis limit, or waiting on their parent pipelines. Waiting for running analyses to finish");
+			logged = true;
+		}
+
+		if ((i%30) == 0) {
+			n->ModuleRunningCheckIn();
+			if (!n->ModuleCheckIfActive())
+				return false;
+		}
+	}
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- BuildDependencyGraph --------------------------- */
+/* ---------------------------------------------------------- */
+/* link each pipeline being run to the one it depends on, if  */
+/* that one is being run too. a chain of pipelines can then   */
+/* be worked through in one run of this module, instead of    */
+/* one level per run                                          */
+/* ---------------------------------------------------------- */
+void modulePipeline::BuildDependencyGraph(QList<pipelineRun> &runs) {
+
+	QHash<int, int> index;
+	for (int i=0; i<runs.size(); i++) {
+		index[runs[i].pipelineid] = i;
+		for (int j=0; j<runs[i].studyids.size(); j++)
+			runs[i].queued.insert(runs[i].studyids[j]);
+	}
+
+	for (int i=0; i<runs.size(); i++) {
+		int dep = runs[i].pipelinedep;
+		if ((dep < 0) || (!index.contains(dep)) || (index[dep] == i))
+			continue;
+		runs[i].parent = index[dep];
+		runs[index[dep]].children.append(i);
+		n->WriteLog(QString("Pipeline [%1] depends on [%2], and will get its studies as the parent's analyses complete").arg(runs[i].p.name).arg(runs[index[dep]].p.name));
+	}
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- UpdateReadyStudies ----------------------------- */
+/* ---------------------------------------------------------- */
+/* queue the studies that became ready because an analysis of */
+/* the pipeline they depend on completed. completions are     */
+/* found from the analysis history added since the last call, */
+/* so each one is only looked at once. returns the number of  */
+/* studies queued                                             */
+/* ---------------------------------------------------------- */
+int modulePipeline::UpdateReadyStudies(QList<pipelineRun> &runs) {
+
+	/* parent pipeline -> the pipelines that can still take studies from it */
+	QHash<int, QList<int>> children;
+	for (int i=0; i<runs.size(); i++)
+		if ((!runs[i].done) && (runs[i].stopmsg == "") && (runs[i].pipelinedep >= 0))
+			children[runs[i].pipelinedep].append(i);
+	if (children.size() < 1)
+		return 0;
+
+	QSqlQuery q;
+	qint64 maxhistoryid(0);
+	q.prepare("select max(analysishistory_id) 'maxid' from analysis_history");
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.first())
+		maxhistoryid = q.value("maxid").toLongLong();
+	if (maxhistoryid <= lasthistoryid)
+		return 0;
+
+	QStringList parentids;
+	foreach (int pid, children.keys())
+		parentids << QString::number(pid);
+
+	q.prepare(QString("select distinct d.pipeline_id, d.study_id, e.subject_id from analysis_history h join analysis d on h.analysis_id = d.analysis_id join studies f on d.study_id = f.study_id join enrollment e on f.enrollment_id = e.enrollment_id where h.analysishistory_id > :lasthistoryid and h.analysishistory_id <= :maxhistoryid and d.pipeline_id in (%1) and d.analysis_status = 'complete' and (d.analysis_isbad <> 1 or d.analysis_isbad is null)").arg(parentids.join(",")));
+	q.bindValue(":lasthistoryid", lasthistoryid);
+	q.bindValue(":maxhistoryid", maxhistoryid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	lasthistoryid = maxhistoryid;
+
+	/* the subjects, and studies, each parent pipeline has completed */
+	QHash<int, QStringList> subjects, studies;
+	while (q.next()) {
+		int pid = q.value("pipeline_id").toInt();
+		subjects[pid] << q.value("subject_id").toString();
+		studies[pid] << q.value("study_id").toString();
+	}
+
+	int numqueued = 0;
+	foreach (int pid, subjects.keys()) {
+		subjects[pid].removeDuplicates();
+		foreach (int c, children[pid]) {
+			pipelineRun &r = runs[c];
+
+			/* a study level dependency readies the same study, a subject level one readies all of the subject's studies */
+			QString where;
+			if (r.p.depLevel == "study")
+				where = QString("a.study_id in (%1)").arg(studies[pid].join(","));
+			else
+				where = QString("c.subject_id in (%1)").arg(subjects[pid].join(","));
+
+			/* the same subject, age, and group checks as GetStudyToDoList() */
+			QString groupjoin, groupwhere;
+			if (r.p.groupIDs.size() > 0) {
+				groupjoin = " join group_data g on a.study_id = g.data_id";
+				groupwhere = QString(" and g.group_id in (%1)").arg(n->JoinIntArray(r.p.groupIDs, ","));
+			}
+
+			QSqlQuery q2;
+			q2.prepare(QString("select distinct a.study_id, a.study_datetime from studies a join enrollment c on a.enrollment_id = c.enrollment_id left join subjects d on c.subject_id = d.subject_id left join analysis x on x.pipeline_id = :pipelineid and x.study_id = a.study_id%1 where x.analysis_id is null and %2 and (a.study_datetime < date_sub(now(), interval 6 hour)) and (d.isactive = 1 or d.isactive is null)%3 order by a.study_datetime desc").arg(groupjoin).arg(where).arg(groupwhere));
+			q2.bindValue(":pipelineid", r.pipelineid);
+			n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
+
+			int num = 0;
+			while (q2.next()) {
+				int sid = q2.value("study_id").toInt();
+				if (r.queued.contains(sid))
+					continue;
+				r.queued.insert(sid);
+				r.studyids.append(sid);
+				num++;
+			}
+			if (num > 0)
+				n->WriteLog(QString("Queued [%1] studies for pipeline [%2] whose parent analyses just completed").arg(num).arg(r.p.name));
+			numqueued += num;
+		}
+	}
+
+	return numqueued;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- WaitingOnParent -------------------------------- */
+/* ---------------------------------------------------------- */
+/* check if a pipeline that has run out of studies should     */
+/* wait for more, because the pipeline it depends on is still */
+/* submitting, or has analyses that haven't finished yet      */
+/* ---------------------------------------------------------- */
+bool modulePipeline::WaitingOnParent(const QList<pipelineRun> &runs, const pipelineRun &r) {
+	if ((r.parent < 0) || (r.stopmsg != "") || (QDateTime::currentDateTime() > depwaituntil))
+		return false;
+
+	const pipelineRun &parent = runs[r.parent];
+	return ((!parent.done) || (parent.numrunning > 0));
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ApplyCheckins ---------------------------------- */
+/* ---------------------------------------------------------- */
+/* apply the check-ins the cluster jobs wrote to the spool    */
+/* ---------------------------------------------------------- */
+void modulePipeline::ApplyCheckins() {
+	if (n->cfg["clustercheckinspool"] == "")
+		return;
+
+	moduleCluster c(n);
+	int num = c.ApplyCheckinSpool(n->cfg["clustercheckinspool"]);
+	if (num > 0)
+		n->WriteLog(QString("Applied [%1] spooled check-ins").arg(num));
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- SubmitJob -------------------------------------- */
+/* ---------------------------------------------------------- */
+/* submit one analysis to the cluster, or run it on this      */
+/* server if the pipeline's cluster type is local. a local    */
+/* job leaves a pid file so later runs of this module can     */
+/* find it                                                    */
+/* ---------------------------------------------------------- */
+bool modulePipeline::SubmitJob(const pipeline &p, QString jobfile, QString logfile, qint64 analysisid, QString &msg, int &jobid, QString &result) {
+	if (p.clusterType != "local")
+		return n->SubmitClusterJob(jobfile, p.submitHost, n->cfg["qsubpath"], n->cfg["queueuser"], p.queue, msg, jobid, result);
+
+	if (!n->SubmitLocalJob(jobfile, logfile, analysisid, localjobcpus, localjobmem, p.maxWallTime, n->cfg["modulepipelinelocalcgroup"], msg, jobid, result))
+		return false;
+
+	QString piddir = n->cfg["tmpdir"] + "/nidblocaljobs";
+	QString m;
+	QFile f(QString("%1/%2.pid").arg(piddir).arg(analysisid));
+	if (n->MakePath(piddir, m) && f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+		QTextStream fs(&f);
+		fs << jobid << "\n";
+		f.close();
+	}
+	else
+		n->WriteLog("Unable to write [" + f.fileName() + "]. The local job will run, but will not be counted against the local executor's limits");
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- UpdateLocalJobs -------------------------------- */
+/* ---------------------------------------------------------- */
+/* count the local jobs that are still running, from their    */
+/* pid files. a job that exited while its analysis is still   */
+/* in a running state didn't get to check in as complete (it  */
+/* crashed, or hit its wall time), so its analysis is marked  */
+/* as an error                                                */
+/* ---------------------------------------------------------- */
+void modulePipeline::UpdateLocalJobs(const QList<pipelineRun> &runs) {
+
+	QString piddir = n->cfg["tmpdir"] + "/nidblocaljobs";
+	QHash<qint64, int> exited; /* analysis id -> pid */
+	int numrunning = 0;
+
+	QStringList pidfiles = QDir(piddir).entryList(QStringList() << "*.pid", QDir::Files);
+	foreach (QString pidfile, pidfiles) {
+		qint64 analysisid = QFileInfo(pidfile).baseName().toLongLong();
+		int pid = 0;
+		QFile f(piddir + "/" + pidfile);
+		if (f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+			pid = QString(f.readAll()).trimmed().toInt();
+			f.close();
+		}
+		if (n->LocalJobRunning(pid, analysisid))
+			numrunning++;
+		else
+			exited[analysisid] = pid;
+	}
+
+	/* studies being set up for local pipelines hold a slot too */
+	for (int i=0; i<runs.size(); i++)
+		if (runs[i].p.clusterType == "local")
+			numrunning += runs[i].numstaging;
+	localnumrunning = numrunning;
+
+	if (exited.size() < 1)
+		return;
+
+	/* the job's last check-in may still be in the spool */
+	ApplyCheckins();
+
+	QStringList runningstates = { "submitted", "started", "startedrerun", "startedsupplement", "processing" };
+	QSqlQuery q;
+	for (QHash<qint64, int>::const_iterator it = exited.constBegin(); it != exited.constEnd(); it++) {
+		q.prepare("select analysis_status, analysis_qsubid from analysis where analysis_id = :analysisid");
+		q.bindValue(":analysisid", it.key());
+		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+		if (q.first() && runningstates.contains(q.value("analysis_status").toString()) && (q.value("analysis_qsubid").toInt() == it.value())) {
+			n->WriteLog(QString("Local job [%1] for analysis [%2] exited without checking in as complete").arg(it.value()).arg(it.key()));
+			UpdateAnalysisStatus(it.key(), "error", QString("Local job [%1] exited without checking in as complete. See the job log in the pipeline directory").arg(it.value()), -1, -1, "", "", false, true, -1, -1);
+		}
+		QFile::remove(QString("%1/%2.pid").arg(piddir).arg(it.key()));
+	}
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- LocalSlotFree ---------------------------------- */
+/* ---------------------------------------------------------- */
+/* check if one more local job fits in the CPUs and memory    */
+/* given to the local executor. memory that something other   */
+/* than NiDB is using on this server is also checked          */
+/* ---------------------------------------------------------- */
+bool modulePipeline::LocalSlotFree() {
+	/* one job can always run, even if it asks for more than the executor has */
+	if (localnumrunning < 1)
+		return true;
+
+	if ((localnumrunning+1)*localjobcpus > localmaxcpus)
+		return false;
+
+	if (localjobmem > 0) {
+		if ((localnumrunning+1)*localjobmem > localmaxmem)
+			return false;
+		if (n->GetMemInfo("MemAvailable") < localjobmem)
+			return false;
+	}
 
-			/* get the list of studies which meet the criteria for being processed through the pipeline */
-			QList<int> studyids = GetStudyToDoList(pipelineid, modality, pipelinedep, n->JoinIntArray(p.groupIDs, ","));
+	return true;
+}
 
-			int i = 0;
-			int numsubmitted = 0;
-			foreach (int sid, studyids) {
-				i++;
-				qint64 analysisRowID = -1;
-				QStringList setuplog;
-				QString setupLogFile;
 
-				SetPipelineProcessStatus("running", pipelineid, sid);
+/* ---------------------------------------------------------- */
+/* --------- StartStaging ----------------------------------- */
+/* ---------------------------------------------------------- */
+/* start the pool of workers that copy the analysis data. the */
+/* workers only touch the filesystem, all of the database     */
+/* work stays on the main thread                              */
+/* ---------------------------------------------------------- */
+void modulePipeline::StartStaging() {
+	int numthreads = n->cfg["modulepipelinestagingthreads"].toInt();
+	if (numthreads < 1)
+		numthreads = 4;
+
+	stagestopping = false;
+	for (int i=0; i<numthreads; i++)
+		stageworkers.emplace_back(&modulePipeline::StagingWorker, this);
+	n->WriteLog(QString("Started [%1] data staging workers").arg(numthreads));
+}
 
-				numchecked++;
 
-				/* get information about the study */
-				study s(sid, n);
-				if (!s.isValid) {
-					n->WriteLog("Study was not valid: [" + s.msg + "]");
-					continue;
-				}
+/* ---------------------------------------------------------- */
+/* --------- StopStaging ------------------------------------ */
+/* ---------------------------------------------------------- */
+void modulePipeline::StopStaging() {
+	{
+		std::lock_guard<std::mutex> lock(stagemutex);
+		stagestopping = true;
+	}
+	stageready.notify_all();
+	for (size_t i=0; i<stageworkers.size(); i++)
+		stageworkers[i].join();
+	stageworkers.clear();
+}
 
-				n->WriteLog(QString("---------- Working on study [%1%2] (%3 of %4) for pipeline [%5] ----------").arg(s.uid).arg(s.studynum).arg(i).arg(studyids.size()).arg(p.name));
 
-				/* check if the number of concurrent jobs is reached. the function also checks if this pipeline module is enabled */
-				int filled;
-				do {
-					filled = IsQueueFilled(pipelineid);
+/* ---------------------------------------------------------- */
+/* --------- StagingWorker ---------------------------------- */
+/* ---------------------------------------------------------- */
+void modulePipeline::StagingWorker() {
+	while (true) {
+		std::pair<stagingStudy*, int> job;
+		{
+			std::unique_lock<std::mutex> lock(stagemutex);
+			stageready.wait(lock, [this]{ return stagestopping || !stagetodo.empty(); });
+			if (stagetodo.empty())
+				return;
+			job = stagetodo.front();
+			stagetodo.pop_front();
+		}
 
-					/* check if this pipeline is enabled */
-					if (!IsPipelineEnabled(pipelineid)) {
-						SetPipelineStatusMessage(pipelineid, "Pipeline disabled while running. Stopping at next iteration.");
-						SetPipelineStopped(pipelineid);
-						break;
-					}
+		StageItem(job.first->items[job.second]);
 
-					/* check if this module is still enabled */
-					if (!n->ModuleCheckIfActive()) {
-						n->WriteLog("Module disabled. Exiting");
-						SetPipelineStatusMessage(pipelineid, "Pipeline module disabled while running. Stopping.");
-						SetPipelineStopped(pipelineid);
-						SetPipelineProcessStatus("complete",0,0);
-						return 1;
-					}
+		/* the study is ready once its last series has been staged */
+		{
+			std::lock_guard<std::mutex> lock(stagemutex);
+			job.first->numleft--;
+			if (job.first->numleft == 0)
+				stagedone.push_back(job.first);
+		}
+		stagefinished.notify_all();
+	}
+}
 
-					/* otherwise check what to do, depending on how filled the queue is */
-					if (filled == 0)
-						break;
 
-					if (filled == 1) {
-						SetPipelineStatusMessage(pipelineid, "Process quota reached. Waiting 1 minute to resubmit");
-						n->WriteLog("Concurrent analysis quota reached, waiting 15 seconds");
-						n->ModuleRunningCheckIn();
-						QThread::sleep(15); /* sleep for 15 seconds */
-					}
-					if (filled == 2) {
-						return 1;
-					}
-				} while (filled == 1);
+/* ---------------------------------------------------------- */
+/* --------- QueueStaging ----------------------------------- */
+/* ---------------------------------------------------------- */
+void modulePipeline::QueueStaging(stagingStudy *st) {
+	{
+		std::lock_guard<std::mutex> lock(stagemutex);
+		st->numleft = int(st->items.size());
+		for (size_t i=0; i<st->items.size(); i++)
+			stagetodo.push_back(std::make_pair(st, int(i)));
+	}
+	stageready.notify_all();
+}
 
-				if (!IsPipelineEnabled(pipelineid)) {
-					SetPipelineStatusMessage(pipelineid, "Pipeline disabled while running. Stopping at this iteration.");
-					SetPipelineStopped(pipelineid);
-					break;
-				}
 
-				/* get the analysis info, if an analysis already exists for this study */
-				n->WriteLog(QString("Getting analysis info for pipelineID [%1] studyID [%2] pipelineVersion [%3]").arg(pipelineid).arg(sid).arg(p.version));
-				analysis a(pipelineid, sid, n);
-				if (a.exists)
-					analysisRowID = a.analysisid;
-				else
-					analysisRowID = -1;
-
-				setuplog << a.msg;
-
-				// ********************
-				// only continue through this section (and submit the analysis) if
-				// a) there is no existing analysis
-				// b) -OR- there is an existing analysis and it needs the results rerun
-				// c) -OR- there is an existing analysis and it needs a supplement run
-				// ********************
-				//n->WriteLog(QString("Checking if we need to submit this analysis to the cluster [%1] [%2] [%3]").arg(a.runSupplement).arg(a.rerunResults).arg(analysisRowID));
-				if ((a.runSupplement) || (a.rerunResults) || (analysisRowID == -1)) {
-					/* if the analysis doesn't yet exist, insert a temporary row, to be updated later, in the analysis table as a placeholder so that no other pipeline processes try to run it */
-					if (analysisRowID == -1) {
-						/* check if this analysis already exists (probably created by another instance of this program ) */
-						q2.prepare("select analysis_id from analysis where pipeline_id = :pipelineid and pipeline_version = :version and study_id = :studyid");
-						q2.bindValue(":pipelineid",pipelineid);
-						q2.bindValue(":version",p.version);
-						q2.bindValue(":studyid",sid);
-						n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
-						if (q2.size() > 0) {
-							q2.first();
-							analysisRowID = q2.value("analysis_id").toInt();
-						}
-						else {
-							q2.prepare("insert into analysis (pipeline_id, pipeline_version, pipeline_dependency, study_id, analysis_status, analysis_startdate, analysis_isbad) values (:pipelineid, :version, :pipelinedep, :studyid,'processing',now(), 0)");
-							q2.bindValue(":pipelineid",pipelineid);
-							q2.bindValue(":version",p.version);
-							q2.bindValue(":pipelinedep",pipelinedep);
-							q2.bindValue(":studyid",sid);
-							n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
-							analysisRowID = q2.lastInsertId().toInt();
-						}
-
-						n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysiscreated", "Analysis created");
-					}
+/* ---------------------------------------------------------- */
+/* --------- TakeStagedStudies ------------------------------ */
+/* ---------------------------------------------------------- */
+std::deque<stagingStudy*> modulePipeline::TakeStagedStudies() {
+	std::deque<stagingStudy*> staged;
+	std::lock_guard<std::mutex> lock(stagemutex);
+	staged.swap(stagedone);
+	return staged;
+}
 
-					QString datalog;
 
-					int dependencyanalysisid(0);
-					bool submiterror = false;
+/* ---------------------------------------------------------- */
+/* --------- WaitForStaging --------------------------------- */
+/* ---------------------------------------------------------- */
+/* wait up to ms milliseconds for a study to finish staging.  */
+/* returns true if one is ready                               */
+/* ---------------------------------------------------------- */
+bool modulePipeline::WaitForStaging(int ms) {
+	std::unique_lock<std::mutex> lock(stagemutex);
+	return stagefinished.wait_for(lock, std::chrono::milliseconds(ms), [this]{ return !stagedone.empty(); });
+}
 
-					//n->WriteLog(QString("StudyDateTime: [%1], Working on: [%2%3]").arg(s.studydatetime.toString("yyyy-MM-dd hh:mm:ss")).arg(s.uid).arg(s.studynum));
 
-					QString analysispath = "";
-					if (p.dirStructure == "b")
-						analysispath = QString("%1/%2/%3/%4").arg(p.pipelineRootDir).arg(p.name).arg(s.uid).arg(s.studynum);
-					else
-						analysispath = QString("%1/%2/%3/%4").arg(p.pipelineRootDir).arg(s.uid).arg(s.studynum).arg(p.name);
-					n->WriteLog("analysispath is [" + analysispath + "]");
-
-					/* this file will record any events during setup */
-					QString setupLogFile = analysispath + "/pipeline/analysisSetup.log";
-					n->WriteLog("Should have created this analysis setup log [" + setupLogFile + "]");
-
-					/* get the nearest study for this subject that has the dependency */
-					int studyNumNearest(0);
-					q2.prepare("select analysis_id, study_num from analysis a left join studies b on a.study_id = b.study_id left join enrollment c on b.enrollment_id = c.enrollment_id where c.subject_id = :subjectid and a.pipeline_id = :pipelinedep and a.analysis_status = 'complete' and (a.analysis_isbad <> 1 or a.analysis_isbad is null) order by abs(datediff(b.study_datetime, :studydatetime)) limit 1");
-					q2.bindValue(":subjectid", s.subjectid);
-					q2.bindValue(":pipelinedep", pipelinedep);
-					q2.bindValue(":studydatetime", s.studydatetime.toString("yyyy-MM-dd hh:mm:ss"));
-					n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
-					if (q2.size() > 0) {
-						q2.first();
-						studyNumNearest = q2.value("study_num").toInt();
-						dependencyanalysisid = q2.value("analysis_id").toInt();
-					}
-					/* determine the dependency path */
-					QString deppath;
-					if (pipelinedep != -1) {
-						if (p.depLevel == "subject") {
-							setuplog << n->WriteLog("Dependency is a subject level (will match dep for same subject, any study)");
-						}
-						else {
-							setuplog << n->WriteLog("Dependency is a study level (will match dep for same subject, same study)");
-
-							/* check the dependency and see if there's anything amiss about it */
-							QString depstatus = CheckDependency(sid, pipelinedep);
-							if (depstatus != "") {
-								UpdateAnalysisStatus(analysisRowID, "OddDependencyStatus", depstatus, -1, -1, setuplog.join("\n"), setuplog.join("\n"), false, false, -1, -1);
-								continue;
-							}
-						}
-					}
-					setuplog << n->WriteLog("This analysis path is [" + analysispath + "]");
-
-					int numseriesdownloaded = 0;
-					/* get the data if we are not running a supplement, and not rerunning the results */
-					if ((!a.runSupplement) && (!a.rerunResults)) {
-						if (!GetData(sid, analysispath, s.uid, analysisRowID, pipelineid, pipelinedep, p.depLevel, dataSteps, numseriesdownloaded, datalog)) {
-							n->WriteLog("GetData() returned false");
-						}
-						else
-							n->WriteLog(QString("GetData() downloaded [%1] series").arg(numseriesdownloaded));
-					}
-					UpdateAnalysisStatus(analysisRowID, "", "", -1, numseriesdownloaded, "", datalog, false, false, -1, -1);
-
-					// again check if there are any series to actually run the pipeline on...
-					// ... but its ok to run if any of the following are true
-					//     a) rerunresults is true
-					//     b) runsupplement is true
-					//     c) this pipeline is dependent on another pipeline
-					bool okToRun = false;
-
-					if (numseriesdownloaded > 0) {
-						okToRun = true; // there is data to download from this study
-						setuplog << n->WriteLog(QString("Study [%1%2] has [%2] matching series downloaded. Beginning analysis.").arg(s.uid).arg(s.studynum).arg(numseriesdownloaded));
-					}
-					if (a.rerunResults) {
-						okToRun = true;
-						setuplog << n->WriteLog(QString("Study [%1%2] set to have results rerun. Beginning analysis.").arg(s.uid).arg(s.studynum));
-					}
-					if (a.runSupplement) {
-						okToRun = true;
-						setuplog << n->WriteLog(QString("Study [%1%2] set to have supplement run. Beginning analysis.").arg(s.uid).arg(s.studynum));
-					}
-					if ((pipelinedep != -1) && (p.depLevel == "study")) {
-						okToRun = true; // there is a parent pipeline and we're using the same study from the parent pipeline. may or may not have data to download
-						setuplog << n->WriteLog(QString("Study [%1%2] has a study-level parent pipeline. Beginning analysis.").arg(s.uid).arg(s.studynum));
-					}
+/* ---------------------------------------------------------- */
+/* --------- StageItem -------------------------------------- */
+/* ---------------------------------------------------------- */
+/* copy (and convert if needed) one series into the analysis  */
+/* directory. runs on a staging worker, so no database access */
+/* ---------------------------------------------------------- */
+void modulePipeline::StageItem(stagingItem &item) {
+	QString m;
+	if (!n->MakePath(item.outdir, m, false)) {
+		item.log << n->WriteLog("   Error: unable to create directory [" + item.outdir + "] message [" + m + "]");
+		item.error = "Unable to create directory [" + item.outdir + "]";
+	}
+	else
+		item.log << n->WriteLog("   Created imaging data output directory [" + item.outdir + "]");
 
-					/* one of the above criteria has been satisfied, so its ok to run the pipeline on this study and submit the cluster */
-					if (okToRun) {
-
-						QString dependencyname;
-						/* this analysis is new and has not been written to disk before, so
-						 * the directory should not yet exist */
-						if ((!a.rerunResults) && (!a.runSupplement)) {
-							if (pipelinedep != -1) {
-								setuplog << n->WriteLog(QString("This pipeline depends on [%1]").arg(pipelinedep));
-								q2.prepare("select pipeline_name from pipelines where pipeline_id = :pipelinedep");
-								q2.bindValue(":pipelinedep", pipelinedep);
-								n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
-								if (q2.size() > 0) {
-									q2.first();
-									dependencyname = q2.value("pipeline_name").toString();
-									setuplog << n->WriteLog(QString("Found [%1] rows for parent pipeline [%2]").arg(q2.size()).arg(dependencyname));
-								}
-								else {
-									setuplog << n->WriteLog(QString("Parent pipeline [%1] does not exist!").arg(pipelinedep));
-									SetPipelineStatusMessage(pipelineid, QString("Parent pipeline [%1] does not exist!").arg(pipelinedep));
-									SetPipelineStopped(pipelineid);
-									continue;
-								}
-								n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", "This pipeline is dependent on [" + dependencyname + "]");
-							}
-							else {
-								setuplog << n->WriteLog(QString("This pipeline does not depend on any pipelines [%1]").arg(pipelinedep));
-							}
-
-							//QString analysispath = p.pipelineRootDir + "/" + p.name;
-							QString m;
-							if (!n->MakePath(analysispath + "/pipeline", m)) {
-								n->WriteLog("Error: unable to create directory [" + analysispath + "/pipeline] - B");
-								n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysiserror", "Unable to create directory [" + analysispath + "/pipeline]");
-								UpdateAnalysisStatus(analysisRowID, "error", "Unable to create directory [" + analysispath + "/pipeline]", 0, -1, "", "", false, true, -1, -1);
-								continue;
-							}
-							else
-								n->WriteLog("Created directory [" + analysispath + "/pipeline] - B");
-
-                            n->WriteLog(n->SystemCommand("chmod -Rf 777 " + analysispath + "/pipeline", true, true));
-							if (pipelinedep != -1) {
-								if (p.depLevel == "subject") {
-									if (p.dirStructure == "b")
-										deppath = QString("%1/%2/%3/%4").arg(pipelinedirectory).arg(dependencyname).arg(s.uid).arg(studyNumNearest);
-									else
-										deppath = QString("%1/%2/%3/%4").arg(pipelinedirectory).arg(s.uid).arg(studyNumNearest).arg(dependencyname);
-								}
-								else {
-									if (p.dirStructure == "b")
-										deppath = QString("%1/%2/%3/%4").arg(pipelinedirectory).arg(dependencyname).arg(s.uid).arg(s.studynum);
-									else
-										deppath = QString("%1/%2/%3/%4").arg(pipelinedirectory).arg(s.uid).arg(s.studynum).arg(dependencyname);
-								}
-
-								setuplog << n->WriteLog("Dependency path is [" + deppath + "]");
-
-								QString fulldeppath = deppath + "/" + dependencyname;
-								QDir d(fulldeppath);
-								if (d.exists())
-									setuplog << n->WriteLog("Full path to parent pipeline [" + fulldeppath + "] exists");
-								else
-									setuplog << n->WriteLog("Full path to parent pipeline [" + fulldeppath + "] does NOT exist");
-
-								setuplog << n->WriteLog(QString("This is a level [%1] pipeline. deplinktype [%2] depdir [%3]").arg(p.level).arg(p.depLinkType).arg(p.depDir));
-
-								n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", QString("Parent pipeline (dependency) will be copied to directory [%1] using method [%2]").arg(p.depDir).arg(p.depLinkType));
-
-								/* copy any parent pipelines */
-								QString systemstring;
-                                if (p.depLinkType == "hardlink") systemstring = "cp -aulL "; /* L added to allow copying of softlinks */
-								else if (p.depLinkType == "softlink") systemstring = "cp -aus ";
-								else if (p.depLinkType == "regularcopy") systemstring = "cp -au ";
-								if (p.depDir == "subdir") {
-									setuplog << n->WriteLog("Parent pipeline will be copied to a subdir");
-									systemstring += deppath + " " + analysispath + "/";
-								}
-								else {
-									setuplog << n->WriteLog("Parent pipeline will be copied to the root dir");
-									systemstring += deppath + "/* " + analysispath + "/";
-								}
-								setuplog << n->WriteLog(n->SystemCommand(systemstring));
-
-								n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", "Parent pipeline copied by running [" + systemstring + "]");
-								n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysisdependencyid", QString("%1").arg(dependencyanalysisid));
-
-								/* delete any log files and SGE files that came with the dependency */
-								setuplog << n->WriteLog(n->SystemCommand(QString("rm --preserve-root %1/pipeline/* %1/origfiles.log %1/sge.job").arg(analysispath)));
-
-								/* make sure the whole tree is writeable */
-                                setuplog << n->WriteLog(n->SystemCommand("chmod -Rf 777 " + analysispath, true, true));
-							}
-							else {
-								setuplog << n->WriteLog("This pipeline is not dependent on another pipeline");
-								n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", "This pipeline does not depend on other pipelines");
-							}
-
-							/* now safe to write out the setuplog */
-							n->AppendCustomLog(setupLogFile, setuplog.join("\n"));
-
-							/* however, if the setupLogFile does not exist, something is not writeable, and that is not good */
-							if (!QFile::exists(setupLogFile)) {
-								setuplog << n->WriteLog("setupLogFile [" + setupLogFile + "] does not exist.");
-							}
-						}
-						/* "realanalysispath" is now --> "clusteranalysispath" */
-						QString clusteranalysispath = analysispath;
-						clusteranalysispath.replace("/mount","");
-
-						/* create the SGE job file */
-						QString localsgefilepath;
-						QString clustersgefilepath;
-						QString sgefilename;
-						if (a.rerunResults)
-							sgefilename = "sgererunresults.job";
-						else if (a.runSupplement)
-							sgefilename = "sge-supplement.job";
-						else
-							sgefilename = "sge.job";
-						localsgefilepath = analysispath + "/" + sgefilename;
-						clustersgefilepath = clusteranalysispath + "/" + sgefilename;
-
-						if (CreateClusterJobFile(localsgefilepath, p.clusterType, analysisRowID, s.uid, s.studynum, clusteranalysispath, p.useTmpDir, p.tmpDir, s.studydatetime.toString("yyyy-MM-dd hh:mm:ss"), p.name, pipelineid, p.resultScript, p.maxWallTime, steps, a.runSupplement)) {
-							n->WriteLog("Created (local path) sge job submit file [" + localsgefilepath + "]");
-						}
-						else {
-							UpdateAnalysisStatus(analysisRowID, "error", "Error creating cluster job file", 0, -1, "", "", false, true, -1, -1);
-							continue;
-						}
-
-						n->SystemCommand("chmod -Rf 777 " + analysispath, true, true);
-
-						/* submit the cluster job file */
-						QString qm, qresult;
-						int jobid;
-						if (n->SubmitClusterJob(clustersgefilepath, p.submitHost, n->cfg["qsubpath"], n->cfg["queueuser"], p.queue, qm, jobid, qresult)) {
-							n->WriteLog("Successfully submitted job to cluster ["+qresult+"]");
-							UpdateAnalysisStatus(analysisRowID, "submitted", "Submitted to [" + p.queue + "]", jobid, numseriesdownloaded, "", "", false, true, 0, 0);
-							n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysissubmitted", qresult);
-						}
-						else {
-							n->WriteLog("Error submitting job to cluster [" + qresult + "]");
-							UpdateAnalysisStatus(analysisRowID, "error", "Submit error [" + qm + "]", 0, numseriesdownloaded, "", "", false, true, 0, 0);
-							n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysissubmiterror", "Analysis submitted to cluster, but was rejected with errors [" + qm + "]");
-							submiterror = true;
-						}
-
-						numsubmitted++;
-						totalSubmitted++;
-						jobsWereSubmitted = true;
-
-						SetPipelineStatusMessage(pipelineid, QString("Submitted %1%2").arg(s.uid).arg(s.studynum));
-
-						/* check if this module should be running now or not */
-						if (!n->ModuleCheckIfActive()) {
-							n->WriteLog("Module disabled. Exiting");
-							SetPipelineStatusMessage(pipelineid, "Pipeline module disabled while running. Stopping.");
-							SetPipelineStopped(pipelineid);
-							SetPipelineProcessStatus("complete",0,0);
-							return 1;
-						}
-						/* wait 10 seconds before submitting the next job */
-						QThread::sleep(10);
-					}
-					else {
-						n->WriteLog("Not Ok to submit job");
-						/* update the analysis table with the datalog so people can check later on why something didn't process */
-						UpdateAnalysisStatus(analysisRowID, "", "", -1, -1, datalog, datalog, false, false, -1, -1);
-						n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysissetuperror", "No data found, 0 series returned from search");
-					}
-					n->WriteLog(QString("Submitted [%1] jobs so far").arg(numsubmitted));
-
-					/* mark the study in the analysis table */
-					//n->WriteLog(QString("numseriesdownloaded [%1]  pipelinedep [%2]  deplevel [%3]  runSupplement [%4]  rerunResults [%5]").arg(numseriesdownloaded).arg(pipelinedep).arg(p.depLevel).arg(a.runSupplement).arg(a.rerunResults));
-					if (!submiterror) {
-						if ((numseriesdownloaded > 0) || ((pipelinedep != -1) && (p.depLevel == "study")) || (a.runSupplement) || (a.rerunResults)) {
-							/* do nothing right here... :) */
-						}
-						else {
-							/* save some database space, since most entries will be blank */
-							UpdateAnalysisStatus(analysisRowID, "NoMatchingSeries", "", -1, -1, "", "", false, false, -1, -1);
-							n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", "This study did not have any matching data");
-						}
-					}
-				}
-				else {
-					n->WriteLog(QString("This analysis [%1] already has an entry in the analysis table").arg(analysisRowID));
-					n->InsertAnalysisEvent(analysisRowID, pipelineid, p.version, sid, "analysismessage", "This analysis already has an entry in the analysis table");
-				}
+	if (!QDir(item.indir).exists()) {
+		item.log << n->WriteLog("   Error: input directory [" + item.indir + "] does not exist");
+		item.error = "Input directory [" + item.indir + "] does not exist";
+	}
 
-				if ((numchecked%1000) == 0)
-					n->WriteLog(QString("[%1] studies checked").arg(numchecked));
+	/* convert the data to a temp directory first, and copy from there */
+	QString srcdir = item.indir;
+	if (item.convert) {
+		if (!n->MakePath(item.tmpdir, m, false)) {
+			item.log << n->WriteLog("   Error: unable to create temp directory [" + item.tmpdir + "] message [" + m + "] for DICOM conversion");
+			item.error = "Unable to create directory [" + item.tmpdir + "]";
+		}
+		else
+			item.log << n->WriteLog("   Created temp directory [" + item.tmpdir + "] for DICOM conversion");
+		int numfilesconv(0);
+		int numfilesrenamed(0);
+		if (!n->ConvertDicom(item.dataformat, item.indir, item.tmpdir, item.gzip, item.uid, QString("%1").arg(item.studynum), QString("%1").arg(item.seriesnum), item.datatype, numfilesconv, numfilesrenamed, m, item.nidbdir)) {
+			item.log << n->WriteLog("   Error: unable to convert [" + item.indir + "] to [" + item.dataformat + "] message [" + m + "]");
+			item.error = "Unable to convert [" + item.indir + "]";
+		}
+		srcdir = item.tmpdir;
+	}
 
-				/* check if this pipeline is still enabled */
-				if (!IsPipelineEnabled(pipelineid)) {
-					SetPipelineStatusMessage(pipelineid, "Pipeline disabled while running. Normal stop.");
-					SetPipelineStopped(pipelineid);
-					break;
+	if (item.scpdest != "") {
+		int exitcode(0);
+		item.log << n->WriteLog(n->SystemCommand(QString("scp %1 %2/* %3").arg(item.sshoptions).arg(srcdir).arg(item.scpdest), true, true, exitcode));
+		if (exitcode != 0) {
+			item.log << n->WriteLog("   Error: unable to copy [" + srcdir + "] to [" + item.scpdest + "] exit code [" + QString("%1").arg(exitcode) + "]");
+			item.error = "Unable to copy [" + srcdir + "] to [" + item.scpdest + "]";
+		}
+		n->GetDirSizeAndFileCount(srcdir, item.numfiles, item.numbytes);
+	}
+	else {
+		item.numfiles = 0;
+		item.numbytes = 0;
+		QDir d(srcdir);
+		QFileInfoList files = d.entryInfoList(QDir::Files | QDir::NoDotAndDotDot);
+		for (int i=0; i<files.size(); i++) {
+			QString dst = QDir::cleanPath(item.outdir + "/" + files[i].fileName());
+			bool ok;
+			if (item.linkmethod == "")
+				ok = n->CopyFileNative(files[i].absoluteFilePath(), dst, m);
+			else if (item.convert) {
+				/* the converted files are ours, so move them instead of linking to the temp dir */
+				QFile::remove(dst);
+				ok = QFile::rename(files[i].absoluteFilePath(), dst);
+				if (!ok)
+					m = "Unable to move [" + files[i].absoluteFilePath() + "] to [" + dst + "]";
+			}
+			else {
+				/* the archive data is shared with the analysis, so record its size and mtime so
+				   CheckCompleteAnalysis() can tell if the pipeline changed it in place. the archive
+				   file's permissions are left as they are */
+				bool linked;
+				ok = n->LinkFile(files[i].absoluteFilePath(), dst, (item.linkmethod == "symlink"), linked, m);
+				if (ok && linked) {
+					item.linked << QString("%1\t%2\t%3\t%4").arg(dst).arg(files[i].absoluteFilePath()).arg(files[i].size()).arg(files[i].lastModified().toMSecsSinceEpoch());
 				}
 			}
+
+			if (ok) {
+				item.numfiles++;
+				item.numbytes += files[i].size();
+			}
+			else {
+				item.log << n->WriteLog("   Error copying [" + files[i].absoluteFilePath() + "] message [" + m + "]");
+				item.error = "Unable to copy [" + files[i].absoluteFilePath() + "]";
+			}
 		}
-		/* ======================= LEVEL 2 ======================= */
-		/* level 2 was once implemented but never used, and fell out of maintenance in the Perl
-		 * version, so it's been deprecated and removed in the C++ version of NiDB */
-		else if (p.level == 2) {
-			n->WriteLog("Level 2 (group) pipelines are not yet implemented in the compiled version of NiDB");
+		if (item.linked.size() > 0)
+			item.log << n->WriteLog(QString("   Linked [%1] of [%2] files using [%3]").arg(item.linked.size()).arg(files.size()).arg(item.linkmethod));
+	}
+
+	if (item.convert) {
+		item.log << QString("   Done copying converted imaging data from [%1] via [%2] to [%3]").arg(item.indir).arg(item.tmpdir).arg(item.outdir);
+		item.log << n->WriteLog("   Removing temp directory [" + item.tmpdir + "]");
+		if (!n->RemoveDir(item.tmpdir, m))
+			item.log << n->WriteLog("   Error: unable to remove temp directory [" + item.tmpdir + "] error [" + m + "]");
+	}
+	else
+		item.log << QString("   Done copying imaging data from [%1] to [%2]").arg(item.indir).arg(item.outdir);
+	item.log << n->WriteLog(QString("   Imaging data output directory [%1] now contains [%2] files, and is [%3] bytes in size.").arg(item.outdir).arg(item.numfiles).arg(item.numbytes));
+
+	/* copy the beh data */
+	if (item.behoutdir != "") {
+		item.log << "   Copying behavioral data";
+		if (!n->MakePath(item.behoutdir, m, false)) {
+			item.log << n->WriteLog("   Error: unable to create behavioral output directory [" + item.behoutdir + "] message [" + m + "] - F");
+			item.error = "Unable to create directory [" + item.behoutdir + "]";
 		}
-		else {
-			n->WriteLog(QString("Invalid pipeline level [%1]").arg(p.level));
+		else
+			item.log << n->WriteLog("   Created behavioral output directory [" + item.behoutdir + "] - F");
+		if (QDir(item.behindir).exists() && !n->CopyDir(item.behindir, item.behoutdir, 1, m)) {
+			item.log << n->WriteLog("   Error copying behavioral data [" + m + "]");
+			item.error = "Unable to copy behavioral data from [" + item.behindir + "]";
 		}
+		MakeWritable(item.behoutdir);
+		item.log << QString("   Done copying behavioral data from [%1] to [%2]").arg(item.behindir).arg(item.behoutdir);
 
-		n->WriteLog(QString("Done with pipeline [%1] - [%2]").arg(pipelineid).arg(p.name));
-		SetPipelineStatusMessage(pipelineid, "Finished submitting jobs");
-		SetPipelineStopped(pipelineid);
+		n->GetDirSizeAndFileCount(item.behindir, item.numbehfiles, item.numbehbytes, true);
+		item.log << n->WriteLog(QString("   Behavioral output directory now contains [%1] files, and is [%2] bytes in size.").arg(item.numbehfiles).arg(item.numbehbytes));
 	}
 
-	SetPipelineProcessStatus("complete",0,0);
+	/* give full read/write permissions to everyone. linked files share the archive's permissions, so they are skipped */
+	QSet<QString> skip;
+	for (int i=0; i<item.linked.size(); i++)
+		skip.insert(item.linked[i].section('\t', 0, 0));
+	MakeWritable(item.outdir, skip);
 
-	if (jobsWereSubmitted) {
-		n->WriteLog(QString("Done with pipeline module. [%1] total jobs were submitted. jobsWereSubmitted [%2]").arg(totalSubmitted).arg(jobsWereSubmitted));
-		return true;
+	item.log << n->WriteLog("   Done writing data to [" + item.outdir + "]");
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- MakeWritable ----------------------------------- */
+/* ---------------------------------------------------------- */
+/* same as chmod -Rf 777, without starting a shell. symlinks, */
+/* and the files in skip (inputs linked to the archive), are  */
+/* left as they are                                           */
+/* ---------------------------------------------------------- */
+void modulePipeline::MakeWritable(QString dir, const QSet<QString> &skip) {
+	QFileDevice::Permissions all = QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ExeOwner | QFileDevice::ReadUser | QFileDevice::WriteUser | QFileDevice::ExeUser | QFileDevice::ReadGroup | QFileDevice::WriteGroup | QFileDevice::ExeGroup | QFileDevice::ReadOther | QFileDevice::WriteOther | QFileDevice::ExeOther;
+	QFile::setPermissions(dir, all);
+	QDirIterator it(dir, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System, QDirIterator::Subdirectories);
+	while (it.hasNext()) {
+		it.next();
+		QFileInfo fi = it.fileInfo();
+		if (fi.isSymLink() || skip.contains(QDir::cleanPath(fi.filePath())))
+			continue;
+		QFile::setPermissions(fi.filePath(), all);
 	}
-	else
-		return false;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ReadLinkedInputs ------------------------------- */
+/* ---------------------------------------------------------- */
+/* paths of the input files that were linked to the archive   */
+/* for this analysis, from pipeline/linkedinputs.txt          */
+/* ---------------------------------------------------------- */
+QSet<QString> modulePipeline::ReadLinkedInputs(QString analysispath) {
+	QSet<QString> paths;
+	QFile f(analysispath + "/pipeline/linkedinputs.txt");
+	if (f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		QTextStream in(&f);
+		while (!in.atEnd()) {
+			QString line = in.readLine();
+			if (line.trimmed() != "")
+				paths.insert(line.section('\t', 0, 0));
+		}
+	}
+	return paths;
 }
 
 
 /* ---------------------------------------------------------- */
 /* --------- GetData ---------------------------------------- */
 /* ---------------------------------------------------------- */
-bool modulePipeline::GetData(int studyid, QString analysispath, QString uid, qint64 analysisid, int pipelineid, int pipelinedep, QString deplevel, QList<dataDefinitionStep> datadef, int &numdownloaded, QString &datalog) {
+bool modulePipeline::GetData(int studyid, QString analysispath, QString uid, qint64 analysisid, int pipelineid, int pipelinedep, QString deplevel, QList<dataDefinitionStep> datadef, int &numdownloaded, QString &datalog, std::vector<stagingItem> &items) {
 
 	numdownloaded = 0;
 	QStringList dlog;
 	datalog = "";
 
+	/* the sizes of the data directories are counted as the data is copied, instead of walking the analysis directory after each step */
+	n->RemoveFromDirSizeIndex(analysispath);
+
 	/* get pipeline information, for data copying preferences */
 	pipeline p(pipelineid, n);
 	if (!p.isValid) {
@@ -1190,94 +2180,39 @@ bool modulePipeline::GetData(int studyid, QString analysispath, QString uid, qin
 					newanalysispath += "/" + phasedir;
 				}
 
-				QString m;
-                if (!n->MakePath(newanalysispath, m)) {
-					dlog << n->WriteLog("   Error: unable to create directory [" + newanalysispath + "] message [" + m + "]");
-                    UpdateAnalysisStatus(analysisid, "error", "Unable to create directory [" + newanalysispath + "]", 0, -1, "", "", false, true, -1, -1);
-                }
-				else
-					dlog << n->WriteLog("   Created imaging data output directory [" + newanalysispath + "]");
-
-				n->SystemCommand("chmod -Rf 777 " + newanalysispath, true, true);
-
-				/* output the correct file type */
-				if ((dataformat == "dicom") || ((datatype != "dicom") && (datatype != "parrec"))) {
-					QString systemstring;
-					if (p.dataCopyMethod == "scp")
-						systemstring = QString("scp %1/* %2\\@%3:%4").arg(indir).arg(n->cfg["clusteruser"]).arg(p.submitHost).arg(newanalysispath);
-					else
-						systemstring = QString("cp -v %1/* %2").arg(indir).arg(newanalysispath);
-					n->WriteLog(n->SystemCommand(systemstring, true, true));
-
-					dlog << QString("   Done copying imaging data from [%1] to [%2]").arg(indir).arg(newanalysispath);
-
-					int c;
-					qint64 b;
-					n->GetDirSizeAndFileCount(newanalysispath, c, b, true);
-					dlog << n->WriteLog(QString("   Imaging data output directory [%1] now contains [%2] files, and is [%3] bytes in size.").arg(newanalysispath).arg(c).arg(b));
+				/* the copy (and any conversion) is done by the staging workers, so queue it up */
+				stagingItem item;
+				item.indir = indir;
+				item.outdir = newanalysispath;
+				item.convert = !((dataformat == "dicom") || ((datatype != "dicom") && (datatype != "parrec")));
+				if (item.convert) {
+					item.tmpdir = n->cfg["tmpdir"] + "/" + n->GenerateRandomString(10);
+					item.nidbdir = n->cfg["nidbdir"];
 				}
-				else {
-					QString tmpdir = n->cfg["tmpdir"] + "/" + n->GenerateRandomString(10);
-					QString m;
-                    if (!n->MakePath(tmpdir, m)) {
-						dlog << n->WriteLog("   Error: unable to create temp directory [" + tmpdir + "] message [" + m + "] for DICOM conversion");
-                        UpdateAnalysisStatus(analysisid, "error", "Unable to create directory [" + newanalysispath + "]", 0, -1, "", "", false, true, -1, -1);
-                    }
-					else
-						dlog << n->WriteLog("   Created temp directory [" + tmpdir + "] for DICOM conversion");
-					int numfilesconv(0);
-					int numfilesrenamed(0);
-					n->ConvertDicom(dataformat, indir, tmpdir, gzip, uid, QString("%1").arg(localstudynum), QString("%1").arg(seriesnum), datatype, numfilesconv, numfilesrenamed, m);
-
-					QString systemstring;
-					if (p.dataCopyMethod == "scp")
-						systemstring = QString("scp %1/* %2\\@%3:%4").arg(tmpdir).arg(n->cfg["clusteruser"]).arg(p.submitHost).arg(newanalysispath);
-					else
-						systemstring = QString("cp -v %1/* %2").arg(tmpdir).arg(newanalysispath);
-					n->WriteLog(n->SystemCommand(systemstring, true, true));
-
-					dlog << n->WriteLog("   Removing temp directory ["+tmpdir+"]");
-					if (!n->RemoveDir(tmpdir,m))
-						dlog << n->WriteLog("   Error: unable to remove temp directory [" + tmpdir + "] error [" + m + "]");
-
-					dlog << QString("   Done copying converted imaging data from [%1] via [%2] to [%3]").arg(indir).arg(tmpdir).arg(newanalysispath);
-
-					int c;
-					qint64 b;
-					n->GetDirSizeAndFileCount(newanalysispath, c, b, true);
-					dlog << n->WriteLog(QString("   Imaging output directory [%1] now contains [%2] files, and is [%3] bytes in size.").arg(newanalysispath).arg(c).arg(b));
+				item.dataformat = dataformat;
+				item.gzip = gzip;
+				item.uid = uid;
+				item.studynum = localstudynum;
+				item.seriesnum = seriesnum;
+				item.datatype = datatype;
+				if (p.dataCopyMethod == "scp") {
+					item.scpdest = QString("%1\\@%2:%3").arg(n->cfg["clusteruser"]).arg(p.submitHost).arg(newanalysispath);
+					item.sshoptions = n->SSHOptions();
 				}
-
-				RecordDataDownload(datadownloadid, analysisid, modality, 1, 1, seriesid, newanalysispath, i, "Data downloaded");
-				dlog << QString("   Data for step [%1] downloaded to [%2]").arg(i).arg(newanalysispath);
-				numdownloaded++;
-
-				/* copy the beh data */
+				else if ((p.dataCopyMethod == "hardlink") || (p.dataCopyMethod == "symlink"))
+					item.linkmethod = p.dataCopyMethod;
 				if (behformat != "behnone") {
-					dlog << "   Copying behavioral data";
-					QString m;
-                    if (!n->MakePath(behoutdir, m)) {
-						dlog << n->WriteLog("   Error: unable to create behavioral output directory [" + behoutdir + "] message [" + m + "] - F");
-                        UpdateAnalysisStatus(analysisid, "error", "Unable to create directory [" + newanalysispath + "]", 0, -1, "", "", false, true, -1, -1);
-                    }
-					else
-						dlog << n->WriteLog("   Created behavioral output directory [" + behoutdir + "] - F");
-					QString systemstring = "cp -Rv " + behindir + "/* " + behoutdir;
-					n->WriteLog(n->SystemCommand(systemstring, true, true));
-
-					n->SystemCommand("chmod -Rf 777 " + behoutdir, true, true);
-					dlog << QString("   Done copying behavioral data from [%1] to [%2]").arg(behindir).arg(behoutdir);
-
-					int c;
-					qint64 b;
-					n->GetDirSizeAndFileCount(behoutdir, c, b, true);
-					dlog << n->WriteLog(QString("   Behavioral output directory now contains [%1] files, and is [%2] bytes in size.").arg(c).arg(b));
+					item.behindir = behindir;
+					item.behoutdir = behoutdir;
 				}
+				item.datadownloadid = datadownloadid;
+				item.step = i;
+				item.seriesid = seriesid;
+				item.modality = modality;
+				items.push_back(item);
 
-				/* give full read/write permissions to everyone */
-				n->SystemCommand("chmod -Rf 777 " + newanalysispath, true, true);
-
-				dlog << n->WriteLog("   Done writing data to [" + newanalysispath + "]");
+				dlog << QString("   Data for step [%1] queued for copying to [%2]").arg(i).arg(newanalysispath);
+				numdownloaded++;
 			}
 		}
 		else {
@@ -1285,7 +2220,6 @@ bool modulePipeline::GetData(int studyid, QString analysispath, QString uid, qin
 		}
 	}
 	n->WriteLog("Leaving GetData() successfully");
-	n->InsertAnalysisEvent(analysisid, pipelineid, p.version, studyid, "analysiscopydataend", QString("Finished copying data [%1] series downloaded").arg(numdownloaded));
 
 	datalog = dlog.join("\n");
 	return true;
@@ -1320,7 +2254,7 @@ bool modulePipeline::UpdateAnalysisStatus(qint64 analysisid, QString status, QSt
 	if (currentEndDate)
 		varsToSet << "analysis_enddate = now()";
 	if (jobid >= 0)
-		varsToSet << "analysis_qsubid = :jobid";
+		varsToSet << "analysis_qsubid = :jobid" << "analysis_qsubtaskid = null";
 	if (supplementFlag >= 0)
 		varsToSet << "analysis_runsupplement = :supplementflag";
 	if (rerunFlag >= 0)
@@ -1384,44 +2318,6 @@ QString modulePipeline::GetBehPath(QString behformat, QString analysispath, QStr
 }
 
 
-/* ---------------------------------------------------------- */
-/* --------- IsQueueFilled ---------------------------------- */
-/* ---------------------------------------------------------- */
-int modulePipeline::IsQueueFilled(int pid) {
-
-	/* find out how many processes are allowed to run */
-	int numprocallowed = 0;
-	QSqlQuery q;
-	q.prepare("select pipeline_enabled, pipeline_numproc from pipelines where pipeline_id = :pid");
-	q.bindValue(":pid",pid);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	if (q.size() > 0) {
-		q.first();
-		numprocallowed = q.value("pipeline_numproc").toInt();
-	}
-
-	/* if numprocallowed is 0, the pipeline may have disappeared, or someone set the concurrent limit to 0
-	   in which case this check will never be valid, so exit the look with a return code of 2 */
-	if (numprocallowed == 0)
-		return 2;
-
-	/* find out how many processes are actually running */
-	int numprocrunning = 0;
-	q.prepare("select count(*) 'count' from analysis where pipeline_id = :pid and (analysis_status = 'processing' or analysis_status = 'started' or analysis_status = 'submitted' or analysis_status = 'pending')");
-	q.bindValue(":pid",pid);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	if (q.size() > 0) {
-		q.first();
-		numprocrunning = q.value("count").toInt();
-	}
-
-	if (numprocrunning >= numprocallowed)
-		return 1;
-	else
-		return 0;
-}
-
-
 /* ---------------------------------------------------------- */
 /* --------- GetGroupList ----------------------------------- */
 /* ---------------------------------------------------------- */
@@ -1777,6 +2673,30 @@ QString modulePipeline::FormatCommand(int pipelineid, QString clusteranalysispat
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- FinalCheckins ---------------------------------- */
+/* ---------------------------------------------------------- */
+/* the end of a job file. reconcileanalysis exits nonzero if  */
+/* the pipeline modified its linked archive inputs, and then  */
+/* the last check-in is an error instead of complete, so the  */
+/* error isn't overwritten, with or without the spool         */
+/* ---------------------------------------------------------- */
+QString modulePipeline::FinalCheckins(QString nidbpath, qint64 analysisid, bool runsupplement) {
+	QString s;
+	s += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'Updating analysis files and checking for completed files'\n").arg(nidbpath).arg(analysisid);
+	s += QString("if %1/nidb cluster -u reconcileanalysis -a %2; then\n").arg(nidbpath).arg(analysisid);
+	if (runsupplement)
+		s += QString("\t%1/nidb cluster -u pipelinecheckin -a %2 -s completesupplement -m 'Supplement processing complete'\n").arg(nidbpath).arg(analysisid);
+	else
+		s += QString("\t%1/nidb cluster -u pipelinecheckin -a %2 -s complete -m 'Cluster processing complete'\n").arg(nidbpath).arg(analysisid);
+	s += "else\n";
+	s += QString("\t%1/nidb cluster -u pipelinecheckin -a %2 -s error -m 'Linked archive inputs were modified in place, or the analysis files could not be checked'\n").arg(nidbpath).arg(analysisid);
+	s += "fi\n";
+
+	return s;
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- CreateClusterJobFile --------------------------- */
 /* ---------------------------------------------------------- */
@@ -1800,6 +2720,16 @@ bool modulePipeline::CreateClusterJobFile(QString jobfilename, QString clusterty
 	QString clusteranalysispath = analysispath;
 	QString localanalysispath = QString("%1/%2-%3").arg(tmpdir).arg(pipelinename).arg(analysisid);
 
+	/* local jobs run this server's copy of nidb */
+	QString nidbpath = n->cfg["clusternidbpath"];
+	if (clustertype == "local")
+		nidbpath = QCoreApplication::applicationDirPath();
+
+	/* if any inputs are linked to the archive, don't chmod them (or anything else with more than one link), since that would change the archive file */
+	QString chmodcmd = "chmod -Rf 777 " + analysispath;
+	if (QFile::exists(QFileInfo(jobfilename).path() + "/pipeline/linkedinputs.txt"))
+		chmodcmd = QString("find %1 ! -type l ! \\( -type f -links +1 \\) -exec chmod 777 {} + 2>/dev/null").arg(analysispath);
+
 	n->WriteLog("Cluster analysis path [" + analysispath + "]");
 	n->WriteLog("Local analysis path (temp directory) [" + localanalysispath + "]");
 
@@ -1829,8 +2759,12 @@ bool modulePipeline::CreateClusterJobFile(QString jobfilename, QString clusterty
 		return false;
 	}
 
-	/* different submission parameters for slurm */
-	if (clustertype == "slurm") {
+	/* different submission parameters for slurm, and none for jobs run locally */
+	if (clustertype == "local") {
+		jobfile += "#!/bin/bash\n";
+		jobfile += "# " + pipelinename + (runsupplement ? "-supplement" : "") + ", run by the NiDB local executor\n\n";
+	}
+	else if (clustertype == "slurm") {
 		jobfile += "#!/bin/sh\n";
 		if (runsupplement)
 			jobfile += "#$ -J "+pipelinename+"-supplement\n";
@@ -1865,24 +2799,36 @@ bool modulePipeline::CreateClusterJobFile(QString jobfilename, QString clusterty
 	}
 
 	/* add the library path SO the cluster version of the nidb executable to run, and diagnostic echos */
-	jobfile += "LD_LIBRARY_PATH=" + n->cfg["clusternidbpath"] + "/; export LD_LIBRARY_PATH;\n";
+	jobfile += "LD_LIBRARY_PATH=" + nidbpath + "/; export LD_LIBRARY_PATH;\n";
 	jobfile += "echo Hostname: `hostname`\n";
 	jobfile += "echo Username: `whoami`\n\n";
 
+	/* check-ins are written to the spool, and applied to the database in batches by the pipeline module. if the spool
+	   can't be written, it falls back to running nidb */
+	QString spool = n->cfg["clustercheckinspool"];
+	if (spool != "") {
+		jobfile += "nidbcheckin() {\n";
+		jobfile += "\tt=`date +%s%N`\n";
+		jobfile += QString("\tf=\"%1/.$t-%2-$$\"\n").arg(spool).arg(analysisid);
+		jobfile += QString("\tif printf '%s\\t%s\\t%s\\t%s\\t%s\\n' \"$t\" %1 \"$2\" \"`hostname`\" \"$4\" > \"$f\" 2>/dev/null && mv \"$f\" \"%2/$t-%1-$$.chk\"; then :\n").arg(analysisid).arg(spool);
+		jobfile += QString("\telse rm -f \"$f\"; %1/nidb cluster -a %2 -u pipelinecheckin \"$@\"; fi\n").arg(nidbpath).arg(analysisid);
+		jobfile += "}\n\n";
+	}
+
 	/* do the first checkin from the cluster */
 	if ((resultscript != "") && (rerunresults))
-		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s startedrerun -m 'Cluster processing started'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
+		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s startedrerun -m 'Cluster processing started'\n").arg(nidbpath).arg(analysisid);
 	else if (runsupplement)
-		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s startedsupplement -m 'Supplement processing started'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
+		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s startedsupplement -m 'Supplement processing started'\n").arg(nidbpath).arg(analysisid);
 	else
-		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s started -m 'Cluster processing started'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
+		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s started -m 'Cluster processing started'\n").arg(nidbpath).arg(analysisid);
 
 	jobfile += "cd "+analysispath+";\n";
 	if (usetmpdir) {
-		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s started -m 'Beginning data copy to /tmp'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
+		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s started -m 'Beginning data copy to /tmp'\n").arg(nidbpath).arg(analysisid);
 		jobfile += "mkdir -pv " + localanalysispath + "\n";
 		jobfile += "cp -Rv " + analysispath + "/* " + localanalysispath + "/\n";
-		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s started -m 'Done copying data to /tmp'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
+		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s started -m 'Done copying data to /tmp'\n").arg(nidbpath).arg(analysisid);
 	}
 
 	QDir::setCurrent(clusteranalysispath);
@@ -1943,8 +2889,8 @@ bool modulePipeline::CreateClusterJobFile(QString jobfilename, QString clusterty
 			if (checkedin) {
 				QString cleandesc = description;
 				cleandesc.replace("'","").replace("\"","");
-				jobfile += QString("\n%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'processing %3step %4 of %5'").arg(n->cfg["clusternidbpath"]).arg(analysisid).arg(supplement).arg(order).arg(size);
-				//jobfile += QString("\n%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'processing %3step %4 of %5' '%6'").arg(n->cfg["clusternidbpath"]).arg(analysisid).arg(supplement).arg(order).arg(steps.size()).arg(cleandesc);
+				jobfile += QString("\n%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'processing %3step %4 of %5'").arg(nidbpath).arg(analysisid).arg(supplement).arg(order).arg(size);
+				//jobfile += QString("\n%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'processing %3step %4 of %5' '%6'").arg(nidbpath).arg(analysisid).arg(supplement).arg(order).arg(steps.size()).arg(cleandesc);
 				jobfile += "\n# " + description + "\necho Running " + command + "\n";
 			}
 
@@ -1968,9 +2914,9 @@ bool modulePipeline::CreateClusterJobFile(QString jobfilename, QString clusterty
 		}
 	}
 	if (usetmpdir) {
-		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s started -m 'Copying data from temp dir'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
+		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s started -m 'Copying data from temp dir'\n").arg(nidbpath).arg(analysisid);
 		jobfile += "cp -Ruv " + localanalysispath + "/* " + analysispath + "/\n";
-		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s started -m 'Deleting temp dir'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
+		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s started -m 'Deleting temp dir'\n").arg(nidbpath).arg(analysisid);
 		jobfile += "rm --preserve-root -rv " + localanalysispath + "\n";
 	}
 
@@ -1978,38 +2924,28 @@ bool modulePipeline::CreateClusterJobFile(QString jobfilename, QString clusterty
 		/* add on the result script command */
 		QString resultcommand = FormatCommand(pipelineid, clusteranalysispath, resultscript, analysispath, analysisid, uid, studynum, studydatetime, pipelinename, "", "");
 		resultcommand += " > " + analysispath + "/pipeline/stepResults.log 2>&1";
-		jobfile += QString("\n%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'Processing result script'\n# Running result script\necho Running %3\n").arg(n->cfg["clusternidbpath"]).arg(analysisid).arg(resultcommand);
+		jobfile += QString("\n%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'Processing result script'\n# Running result script\necho Running %3\n").arg(nidbpath).arg(analysisid).arg(resultcommand);
 		jobfile += resultcommand + "\n";
 
-		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s completererun -m 'Results re-run complete'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
-		jobfile += "chmod -Rf 777 " + analysispath;
+		jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s completererun -m 'Results re-run complete'\n").arg(nidbpath).arg(analysisid);
+		jobfile += chmodcmd;
 	}
 	else {
 		/* run the results import script */
 		QString resultcommand = FormatCommand(pipelineid, clusteranalysispath, resultscript, analysispath, analysisid, uid, studynum, studydatetime, pipelinename, "", "");
 		resultcommand += " > " + analysispath + "/pipeline/stepResults.log 2>&1";
-		jobfile += QString("\n%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'Processing result script'\n# Running result script\necho Running %3\n").arg(n->cfg["clusternidbpath"]).arg(analysisid).arg(resultcommand);
+		jobfile += QString("\n%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'Processing result script'\n# Running result script\necho Running %3\n").arg(nidbpath).arg(analysisid).arg(resultcommand);
 		jobfile += resultcommand + "\n";
 
 		/* clean up and log everything */
-		jobfile += "chmod -Rf 777 " + analysispath + "\n";
-		if (runsupplement) {
-			jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'Updating analysis files'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
-			jobfile += QString("%1/nidb cluster -u updateanalysis -a %2\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
-			jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'Checking for completed files'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
-			jobfile += QString("%1/nidb cluster -u checkcompleteanalysis -a %2\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
-			jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s completesupplement -m 'Supplement processing complete'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
-		}
-		else {
-			jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'Updating analysis files'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
-			jobfile += QString("%1/nidb cluster -u updateanalysis -a %2\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
-			jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s processing -m 'Checking for completed files'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
-			jobfile += QString("%1/nidb cluster -u checkcompleteanalysis -a %2\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
-			jobfile += QString("%1/nidb cluster -u pipelinecheckin -a %2 -s complete -m 'Cluster processing complete'\n").arg(n->cfg["clusternidbpath"]).arg(analysisid);
-		}
-		jobfile += "chmod -Rf 777 " + analysispath;
+		jobfile += chmodcmd + "\n";
+		jobfile += FinalCheckins(nidbpath, analysisid, runsupplement);
+		jobfile += chmodcmd;
 	}
 
+	if (spool != "")
+		jobfile.replace(QString("%1/nidb cluster -u pipelinecheckin -a %2 ").arg(nidbpath).arg(analysisid), "nidbcheckin ");
+
 	/* write out the file */
 	QFile f(jobfilename);
 	if (f.open(QIODevice::WriteOnly | QIODevice::Text)) {
@@ -2069,97 +3005,166 @@ QList<int> modulePipeline::GetStudyToDoList(int pipelineid, QString modality, in
 	//n->WriteLog(QString("Found [%1] additional studies marked for supplement run.").arg(addedStudies));
 	numSupplement = addedStudies;
 
-	/* step 3 - get list of studies which do not have an entry in the analysis table for this pipeline */
-	if (depend >= 0) {
-		/* there is a dependency. need to check if ANY of the subject's studies have the dependency... */
-		n->WriteLog(QString("This pipeline [%1] depends on [%2]").arg(pipelineid).arg(depend));
+	/* step 3 - get list of studies which do not have an entry in the analysis table for this pipeline. these are kept in pipeline_candidates, which is brought up to date first */
+	UpdateCandidates(pipelineid, modality, depend);
 
-		/* step 3a) get list of studies that have completed the dependency */
-		QList<int> list;
-		QStringList studylist;
-		QSqlQuery q2;
-		q2.prepare("select a.study_id, c.uid, a.study_num from studies a left join enrollment b on a.enrollment_id = b.enrollment_id left join subjects c on b.subject_id = c.subject_id where b.subject_id in (select a.subject_id from subjects a left join enrollment b on a.subject_id = b.subject_id left join studies c on b.enrollment_id = c.enrollment_id where c.study_id in (select study_id from analysis where pipeline_id = :depend and analysis_status = 'complete' and (analysis_isbad <> 1 or analysis_isbad is null)) and (a.isactive = 1 or a.isactive is null))");
-		q2.bindValue(":depend", depend);
-		n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
-		if (q2.size() > 0) {
-			while (q2.next()) {
-				list.append(q2.value("study_id").toInt());
-				studylist << QString("%1%2").arg(q2.value("uid").toString()).arg(q2.value("study_num").toString());
+	if (n->cfg["debug"].toInt()) {
+		if (groupids != "") {
+			QStringList gids = groupids.split(",");
+			foreach (QString gid, gids) {
+				n->WriteLog(n->GetGroupListing(gid.toInt()), 250);
 			}
 		}
-		QString studyidlist = n->JoinIntArray(list, ", ");
-		QString studyliststr = studylist.join(", ");
+	}
 
-		if (studyidlist == "")
-			studyidlist = "-1";
+	/* the dependency and modality were checked when the candidates were added. the subject, age, and group are checked here, because they can change */
+	QString isactive;
+	if (depend >= 0) {
+		n->WriteLog(QString("This pipeline [%1] depends on [%2]").arg(pipelineid).arg(depend));
+		isactive = "(d.isactive = 1 or d.isactive is null)";
+	}
+	else
+		isactive = "d.isactive = 1";
 
-		if (n->cfg["debug"].toInt()) {
-			if (groupids != "") {
-				QStringList gids = groupids.split(",");
-				foreach (QString gid, gids) {
-					n->WriteLog(n->GetGroupListing(gid.toInt()), 250);
-				}
-			}
+	if (groupids == "") {
+		/* NO groupids */
+		q.prepare("select a.study_id from pipeline_candidates a join studies b on a.study_id = b.study_id left join enrollment c on b.enrollment_id = c.enrollment_id left join subjects d on c.subject_id = d.subject_id where a.pipeline_id = :pipelineid and (b.study_datetime < date_sub(now(), interval 6 hour)) and " + isactive + " order by b.study_datetime desc");
+		n->WriteLog(QString("Within GetStudyToDoList() dependency [%1]. NO groupids [%2]").arg(depend).arg(groupids));
+	}
+	else {
+		/* WITH groupids */
+		q.prepare("select a.study_id from pipeline_candidates a join studies b on a.study_id = b.study_id left join group_data e on a.study_id = e.data_id left join enrollment c on b.enrollment_id = c.enrollment_id left join subjects d on c.subject_id = d.subject_id where a.pipeline_id = :pipelineid and (b.study_datetime < date_sub(now(), interval 6 hour)) and e.group_id in (" + groupids + ") and " + isactive + " order by b.study_datetime desc");
+		n->WriteLog(QString("Within GetStudyToDoList() dependency [%1]. HAS groupids [%2]").arg(depend).arg(groupids));
+	}
+	q.bindValue(":pipelineid", pipelineid);
+
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.size() > 0) {
+		while (q.next()) {
+			list.append(q.value("study_id").toInt());
+			numInitial++;
 		}
+	}
 
-		/* step 3b) then find all studies that have completed and have not already been processed by this pipeline */
-		if (groupids == "") {
-			/* NO groupids */
-			q.prepare("select study_id from studies where study_id not in (select study_id from analysis where pipeline_id = :pipelineid) and study_id in (" + studyidlist + ") and (study_datetime < date_sub(now(), interval 6 hour)) order by study_datetime desc");
-			q.bindValue(":pipelineid", pipelineid);
-			n->WriteLog(QString("Within GetStudyToDoList() analysis HAS dependency [%1]. NO groupids [%2]. Studies that have completed the dependency [%3]").arg(depend).arg(groupids).arg(studyliststr));
+	n->WriteLog(QString("Found [%1] total studies that met criteria: [%2] initial match  [%3] rerun  [%4] supplement").arg(list.size()).arg(numInitial).arg(numRerun).arg(numSupplement));
+
+	return list;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- UpdateCandidates ------------------------------- */
+/* ---------------------------------------------------------- */
+/* bring pipeline_candidates up to date for a pipeline. only  */
+/* studies added, and dependency analyses completed, since    */
+/* the last scan are looked at. the list is rebuilt from      */
+/* scratch once a day, or if the pipeline's modality or       */
+/* dependency changed, to pick up anything else. candidates   */
+/* that have gotten an analysis are removed                   */
+/* ---------------------------------------------------------- */
+void modulePipeline::UpdateCandidates(int pipelineid, QString modality, int depend) {
+
+	QSqlQuery q;
+	QString criteria = QString("%1,%2").arg(modality).arg(depend);
+
+	bool rebuild = true;
+	qint64 laststudyid(0), lasthistoryid(0);
+	q.prepare("select scan_criteria, last_studyid, last_historyid, (last_rebuild > date_sub(now(), interval 1 day)) 'recent' from pipeline_candidatescan where pipeline_id = :pipelineid");
+	q.bindValue(":pipelineid", pipelineid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.first()) {
+		if ((q.value("scan_criteria").toString() == criteria) && (q.value("recent").toBool()))
+			rebuild = false;
+		laststudyid = q.value("last_studyid").toLongLong();
+		lasthistoryid = q.value("last_historyid").toLongLong();
+	}
+
+	/* auto increment IDs are handed out before a transaction commits, so another
+	   process can commit a study or check-in below the last high water mark after
+	   it was stored. each scan looks back this many IDs to pick those up. the
+	   candidates are insert ignore, so looking at a row again does no harm */
+	int lookback = 1000;
+	laststudyid = std::max(qint64(0), laststudyid - lookback);
+	lasthistoryid = std::max(qint64(0), lasthistoryid - lookback);
+
+	n->db.transaction();
+
+	/* get the high water marks inside the transaction, before looking for anything, so nothing added during the scan is missed */
+	qint64 maxstudyid(0), maxhistoryid(0);
+	q.prepare("select (select max(study_id) from studies) 'maxstudyid', (select max(analysishistory_id) from analysis_history) 'maxhistoryid'");
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.first()) {
+		maxstudyid = q.value("maxstudyid").toLongLong();
+		maxhistoryid = q.value("maxhistoryid").toLongLong();
+	}
+
+	if (rebuild) {
+		n->WriteLog(QString("Rebuilding the candidate studies for pipeline [%1]").arg(pipelineid));
+		q.prepare("delete from pipeline_candidates where pipeline_id = :pipelineid");
+		q.bindValue(":pipelineid", pipelineid);
+		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+
+		/* this is the only time the whole analysis history is compared against */
+		if (depend >= 0) {
+			/* every study of any subject that has completed the dependency */
+			q.prepare("insert ignore into pipeline_candidates (pipeline_id, study_id) select :pipelineid, a.study_id from studies a join enrollment b on a.enrollment_id = b.enrollment_id left join analysis c on c.pipeline_id = :pipelineid and c.study_id = a.study_id where c.analysis_id is null and b.subject_id in (select e.subject_id from analysis d join studies f on d.study_id = f.study_id join enrollment e on f.enrollment_id = e.enrollment_id where d.pipeline_id = :depend and d.analysis_status = 'complete' and (d.analysis_isbad <> 1 or d.analysis_isbad is null))");
+			q.bindValue(":depend", depend);
 		}
 		else {
-			/* with groupids */
-			q.prepare("select a.study_id from studies a left join group_data b on a.study_id = b.data_id where a.study_id not in (select study_id from analysis where pipeline_id = :pipelineid) and a.study_id in (" + studyidlist + ") and (a.study_datetime < date_sub(now(), interval 6 hour)) and b.group_id in (" + groupids + ") order by a.study_datetime desc");
-			q.bindValue(":pipelineid", pipelineid);
-			n->WriteLog(QString("Within GetStudyToDoList() analysis HAS dependency [%1]. HAS groupids [%2]. Studies that have completed the dependency [%3]").arg(depend).arg(groupids).arg(studyliststr));
+			q.prepare("insert ignore into pipeline_candidates (pipeline_id, study_id) select :pipelineid, a.study_id from studies a left join analysis c on c.pipeline_id = :pipelineid and c.study_id = a.study_id where c.analysis_id is null and a.study_modality = :modality");
+			q.bindValue(":modality", modality);
 		}
+		q.bindValue(":pipelineid", pipelineid);
+		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 	}
 	else {
-		/* NO dependency */
-		if (groupids == "") {
-			/* NO groupids */
-			q.prepare("select a.study_id from studies a left join enrollment b on a.enrollment_id = b.enrollment_id left join subjects c on b.subject_id = c.subject_id where a.study_id not in (select study_id from analysis where pipeline_id = :pipelineid) and (a.study_datetime < date_sub(now(), interval 6 hour)) and a.study_modality = :modality and c.isactive = 1 order by a.study_datetime desc");
-			q.bindValue(":pipelineid", pipelineid);
-			q.bindValue(":modality", modality);
-			n->WriteLog(QString("Within GetStudyToDoList() analysis NO dependency [%1]. NO groupids [%2]").arg(depend).arg(groupids));
+		/* studies added since the last scan, that don't have an analysis yet */
+		if (depend >= 0) {
+			q.prepare("insert ignore into pipeline_candidates (pipeline_id, study_id) select distinct :pipelineid, a.study_id from studies a join enrollment b on a.enrollment_id = b.enrollment_id join enrollment e on e.subject_id = b.subject_id join studies f on f.enrollment_id = e.enrollment_id join analysis d on d.study_id = f.study_id left join analysis c on c.pipeline_id = :pipelineid and c.study_id = a.study_id where a.study_id > :laststudyid and a.study_id <= :maxstudyid and d.pipeline_id = :depend and d.analysis_status = 'complete' and (d.analysis_isbad <> 1 or d.analysis_isbad is null) and c.analysis_id is null");
+			q.bindValue(":depend", depend);
 		}
 		else {
-			/* WITH groupids */
-			q.prepare("SELECT a.study_id FROM studies a left join group_data b on a.study_id = b.data_id left join enrollment c on a.enrollment_id = c.enrollment_id left join subjects d on c.subject_id = d.subject_id WHERE a.study_id NOT IN (SELECT study_id FROM analysis WHERE pipeline_id = :pipelineid) AND ( a.study_datetime < DATE_SUB( NOW( ) , INTERVAL 6 hour )) AND a.study_modality = :modality and b.group_id in (" + groupids + ") and d.isactive = 1 ORDER BY a.study_datetime DESC");
-			q.bindValue(":pipelineid", pipelineid);
+			q.prepare("insert ignore into pipeline_candidates (pipeline_id, study_id) select :pipelineid, a.study_id from studies a left join analysis c on c.pipeline_id = :pipelineid and c.study_id = a.study_id where a.study_id > :laststudyid and a.study_id <= :maxstudyid and a.study_modality = :modality and c.analysis_id is null");
 			q.bindValue(":modality", modality);
-			n->WriteLog(QString("Within GetStudyToDoList() analysis NO dependency [%1]. HAS groupids [%2]").arg(depend).arg(groupids));
 		}
-	}
-
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	if (q.size() > 0) {
-		while (q.next()) {
-			int studyid = q.value("study_id").toInt();
-
-			QSqlQuery q2;
-			q2.prepare("select b.study_num, c.uid from enrollment a left join studies b on a.enrollment_id = b.enrollment_id left join subjects c on a.subject_id = c.subject_id where b.study_id = :studyid and c.isactive = 1");
-			q2.bindValue(":studyid", studyid);
-			n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
-			if (q2.size() > 0) {
-				q2.first();
-				QString uidstudynum;
-				uidstudynum = QString("%1%2").arg(q2.value("uid").toString()).arg(q2.value("study_num").toInt());
-			}
-			list.append(studyid);
+		q.bindValue(":pipelineid", pipelineid);
+		q.bindValue(":laststudyid", laststudyid);
+		q.bindValue(":maxstudyid", maxstudyid);
+		n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+		int numadded = q.numRowsAffected();
 
-			numInitial++;
+		/* subjects whose dependency analysis was checked in as complete since the last scan. all of their studies become candidates */
+		if (depend >= 0) {
+			q.prepare("insert ignore into pipeline_candidates (pipeline_id, study_id) select distinct :pipelineid, a.study_id from analysis_history h join analysis d on h.analysis_id = d.analysis_id join studies f on d.study_id = f.study_id join enrollment e on f.enrollment_id = e.enrollment_id join enrollment b on b.subject_id = e.subject_id join studies a on a.enrollment_id = b.enrollment_id left join analysis c on c.pipeline_id = :pipelineid and c.study_id = a.study_id where h.analysishistory_id > :lasthistoryid and h.analysishistory_id <= :maxhistoryid and d.pipeline_id = :depend and d.analysis_status = 'complete' and (d.analysis_isbad <> 1 or d.analysis_isbad is null) and c.analysis_id is null");
+			q.bindValue(":pipelineid", pipelineid);
+			q.bindValue(":lasthistoryid", lasthistoryid);
+			q.bindValue(":maxhistoryid", maxhistoryid);
+			q.bindValue(":depend", depend);
+			n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+			numadded += q.numRowsAffected();
 		}
+		n->WriteLog(QString("Added [%1] candidate studies for pipeline [%2]").arg(numadded).arg(pipelineid));
 	}
 
-	n->WriteLog(QString("Found [%1] total studies that met criteria: [%2] initial match  [%3] rerun  [%4] supplement").arg(list.size()).arg(numInitial).arg(numRerun).arg(numSupplement));
+	/* remove the candidates that have an analysis now */
+	q.prepare("delete a from pipeline_candidates a join analysis b on b.pipeline_id = a.pipeline_id and b.study_id = a.study_id where a.pipeline_id = :pipelineid");
+	q.bindValue(":pipelineid", pipelineid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 
-	return list;
+	if (rebuild)
+		q.prepare("replace into pipeline_candidatescan (pipeline_id, scan_criteria, last_studyid, last_historyid, last_rebuild) values (:pipelineid, :criteria, :maxstudyid, :maxhistoryid, now())");
+	else
+		q.prepare("update pipeline_candidatescan set scan_criteria = :criteria, last_studyid = :maxstudyid, last_historyid = :maxhistoryid where pipeline_id = :pipelineid");
+	q.bindValue(":pipelineid", pipelineid);
+	q.bindValue(":criteria", criteria);
+	q.bindValue(":maxstudyid", maxstudyid);
+	q.bindValue(":maxhistoryid", maxhistoryid);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	n->db.commit();
 }
 
 
+
 /* ---------------------------------------------------------- */
 /* --------- RecordDataDownload ----------------------------- */
 /* ---------------------------------------------------------- */
@@ -27,6 +27,10 @@
 #include "series.h"
 #include "analysis.h"
 #include "pipeline.h"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 /* data structures used in this class */
 struct pipelineStep {
@@ -65,6 +69,92 @@ struct dataDefinitionStep {
 	qint64 datadownloadid;
 };
 
+/* an analysis whose job file has been written, waiting to be submitted as part of an array job */
+struct pendingSubmit {
+	qint64 analysisid = -1;
+	int studyid = 0;
+	int numseries = 0;
+	QString jobfile; /* cluster path */
+	QString logfile; /* cluster path */
+};
+
+/* a level 1 pipeline whose studies are being submitted. the running count is kept in memory,
+   and only read again from the analysis table when the pipeline is at its limit */
+struct pipelineRun {
+	int pipelineid = 0;
+	pipeline p;
+	QList<pipelineStep> steps;
+	QList<dataDefinitionStep> dataSteps;
+	int pipelinedep = -1;
+	QString pipelinedirectory;
+	QList<int> studyids;
+	int next = 0; /* index of the next study to check */
+	int numproc = 0;
+	int numrunning = 0;
+	int numsubmitted = 0;
+	int numstaging = 0; /* studies whose data is being copied by the staging workers */
+	bool enabled = true;
+	bool waiting = false;
+	bool done = false;
+	QString stopmsg; /* set when the pipeline should stop, once its staging studies are submitted */
+	QList<pendingSubmit> pending; /* job files waiting to be submitted together as an array job */
+	int parent = -1; /* index in runs of the pipeline this one depends on, if it's being run too */
+	QList<int> children; /* indexes in runs of the pipelines that depend on this one */
+	QSet<int> queued; /* studies in studyids */
+};
+
+/* one series to be copied into an analysis directory by a staging worker. the results are
+   filled in by the worker, and recorded in the database by the main thread */
+struct stagingItem {
+	QString indir;
+	QString outdir;
+	bool convert = false;
+	QString tmpdir;
+	QString dataformat;
+	bool gzip = false;
+	QString uid;
+	int studynum = 0;
+	int seriesnum = 0;
+	QString datatype;
+	QString scpdest; /* user@host:path if the data is copied with scp */
+	QString sshoptions; /* options for scp, read from the config by the main thread */
+	QString nidbdir; /* where dcm2niix is, read from the config by the main thread */
+	QString linkmethod; /* hardlink or symlink to the archive instead of copying */
+	QString behindir;
+	QString behoutdir;
+	qint64 datadownloadid = -1;
+	int step = 0;
+	int seriesid = 0;
+	QString modality;
+
+	/* results */
+	int numfiles = 0;
+	qint64 numbytes = 0;
+	int numbehfiles = 0;
+	qint64 numbehbytes = 0;
+	QStringList log;
+	QStringList linked; /* path, size and mtime of each file linked to the archive */
+	QString error;
+};
+
+/* a study whose data is being staged, with everything needed to submit its job afterwards */
+struct stagingStudy {
+	int pipelineid = 0;
+	study s;
+	bool rerunResults = false;
+	bool runSupplement = false;
+	qint64 analysisRowID = -1;
+	QString analysispath;
+	QStringList setuplog;
+	QString setupLogFile;
+	int studyNumNearest = 0;
+	int dependencyanalysisid = 0;
+	int numseriesdownloaded = 0;
+	QString datalog;
+	std::vector<stagingItem> items;
+	int numleft = 0; /* series not yet staged */
+};
+
 class modulePipeline
 {
 public:
@@ -74,7 +164,27 @@ public:
 
 	int Run();
 
-	int IsQueueFilled(int pid);
+	int SubmitStudy(pipelineRun &r, int sid);
+	int FinishStudy(pipelineRun &r, stagingStudy &st);
+	int SubmitPending(pipelineRun &r);
+	int UpdateRunningCounts(QList<pipelineRun> &runs);
+	bool WaitForSlots(QList<pipelineRun> &runs);
+	void BuildDependencyGraph(QList<pipelineRun> &runs);
+	int UpdateReadyStudies(QList<pipelineRun> &runs);
+	bool WaitingOnParent(const QList<pipelineRun> &runs, const pipelineRun &r);
+	void ApplyCheckins();
+	void UpdateLocalJobs(const QList<pipelineRun> &runs);
+	bool LocalSlotFree();
+	bool SubmitJob(const pipeline &p, QString jobfile, QString logfile, qint64 analysisid, QString &msg, int &jobid, QString &result);
+	void StartStaging();
+	void StopStaging();
+	void StagingWorker();
+	void QueueStaging(stagingStudy *st);
+	std::deque<stagingStudy*> TakeStagedStudies();
+	bool WaitForStaging(int ms);
+	void StageItem(stagingItem &item);
+	static void MakeWritable(QString dir, const QSet<QString> &skip = QSet<QString>());
+	static QSet<QString> ReadLinkedInputs(QString analysispath);
 	QStringList GetGroupList(int pid);
 	QList<int> GetPipelineList();
 	QString CheckDependency(int sid, int pipelinedep);
@@ -88,9 +198,11 @@ public:
 	QList<pipelineStep> GetPipelineSteps(int pipelineid, int version);
 	QList<dataDefinitionStep> GetPipelineDataDef(int pipelineid, int version);
 	QString FormatCommand(int pipelineid, QString clusteranalysispath, QString command, QString analysispath, qint64 analysisid, QString uid, int studynum, QString studydatetime, QString pipelinename, QString workingdir, QString description);
+	static QString FinalCheckins(QString nidbpath, qint64 analysisid, bool runsupplement);
 	bool CreateClusterJobFile(QString jobfilename, QString clustertype, qint64 analysisid, QString uid, int studynum, QString analysispath, bool usetmpdir, QString tmpdir, QString studydatetime, QString pipelinename, int pipelineid, QString resultscript, int maxwalltime,  QList<pipelineStep> steps, bool runsupplement = false);
 	QList<int> GetStudyToDoList(int pipelineid, QString modality, int depend, QString groupids);
-	bool GetData(int studyid, QString analysispath, QString uid, qint64 analysisid, int pipelineid, int pipelinedep, QString deplevel, QList<dataDefinitionStep> datadef, int &numdownloaded, QString &datalog);
+	void UpdateCandidates(int pipelineid, QString modality, int depend);
+	bool GetData(int studyid, QString analysispath, QString uid, qint64 analysisid, int pipelineid, int pipelinedep, QString deplevel, QList<dataDefinitionStep> datadef, int &numdownloaded, QString &datalog, std::vector<stagingItem> &items);
 	QString GetBehPath(QString behformat, QString analysispath, QString location, QString behdir, int newseriesnum);
 	bool UpdateAnalysisStatus(qint64 analysisid, QString status, QString statusmsg, int jobid, int numseries, QString datalog, QString datatable, bool currentStartDate, bool currentEndDate, int supplementFlag, int rerunFlag);
 	qint64 RecordDataDownload(qint64 id, qint64 analysisid, QString modality, int checked, int found, int seriesid, QString downloadpath, int step, QString msg);
@@ -98,6 +210,27 @@ public:
 private:
 	nidb *n;
 
+	/* staging worker pool */
+	std::deque<std::pair<stagingStudy*, int>> stagetodo; /* study and index of the series to stage */
+	std::deque<stagingStudy*> stagedone;
+	std::mutex stagemutex;
+	std::condition_variable stageready;
+	std::condition_variable stagefinished;
+	std::vector<std::thread> stageworkers;
+	bool stagestopping = false;
+
+	int arraysize = 1; /* max number of analyses submitted in one array job */
+
+	/* local executor, for pipelines with a cluster type of local. all sizes are in MB */
+	int localmaxcpus = 1;
+	qint64 localmaxmem = 0;
+	int localjobcpus = 1;
+	qint64 localjobmem = 0; /* 0 if memory isn't checked */
+	int localnumrunning = 0; /* local jobs running, plus local studies being set up */
+
+	/* dependency tracking */
+	qint64 lasthistoryid = 0; /* analysis_history that has been checked for completed parent analyses */
+	QDateTime depwaituntil; /* how long pipelines wait on their parents after running out of studies */
 };
 
 #endif // MODULEPIPELINE_H
@@ -54,63 +54,53 @@ int moduleQC::Run() {
 
 	int ret(0);
 
+	/* number of series run together, as one array job on the cluster or one shell locally */
+	int batchsize = n->cfg["moduleqcbatchsize"].toInt();
+	if (batchsize < 1)
+		batchsize = 50;
+
 	/* get list of active modules */
 	QSqlQuery q;
 	q.prepare("select * from qc_modules where qcm_isenabled = 1");
 	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 	if (q.size() > 0) {
-		int numdone = 0;
 		while (q.next()) {
 			int moduleid = q.value("qcmodule_id").toInt();
+			QString modulename = q.value("qcm_name").toString();
 			QString modality = q.value("qcm_modality").toString().toLower();
 
 			n->WriteLog(QString("*********************** Working on module [%1][%2] ***********************").arg(moduleid).arg(modality));
 
-			/* look through DB for all series (of this modality) that don't have an associated QCdata row */
-			QSqlQuery q2;
-			q2.prepare(QString("SELECT %1series_id 'seriesid' FROM %1_series where %1series_id not in (select series_id from qc_moduleseries where qcmodule_id = :moduleid) order by series_datetime desc").arg(modality));
-			q2.bindValue(":moduleid", moduleid);
-			n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__,true);
-			if (q2.size() > 0) {
-				while (q2.next()) {
-					ret = 1;
-					int seriesid = q2.value("seriesid").toInt();
-
-					n->ModuleRunningCheckIn();
-
-					/* check if this series has an mr_qa row */
-					QSqlQuery q3;
-					q3.prepare("select mrseries_id from mr_qa where mrseries_id = :seriesid");
-					q3.bindValue(":seriesid", seriesid);
-					n->SQLQuery(q3, __FUNCTION__, __FILE__, __LINE__);
-					if (q3.size() > 0) {
-						QC(moduleid, seriesid, modality);
-						numdone++;
-
-						/* check if this module should be running now or not */
-						if (!n->ModuleCheckIfActive()) {
-							n->WriteLog("Not supposed to be running right now");
-							return 0;
-						}
-
-						/* give this thing a break every so often */
-						if (numdone >= 100)
-							break;
-
-						QThread::sleep(1); // sleep for 1 sec
-					}
-					else {
-						n->WriteLog(QString("Skipping this MR series [%1] because it does not have an mr_qa row yet... QC needs the 3D/4D information from the mr_qa script first").arg(seriesid));
-					}
+			/* give this thing a break every so often. newest series are done first, so series collected since the module started get a chance */
+			int numdone(0);
+			while (numdone < std::max(100, batchsize)) {
+				n->ModuleRunningCheckIn();
+
+				QList<qcSeries> batch;
+				ClaimSeries(moduleid, modality, batchsize, batch);
+				if (batch.size() < 1)
+					break;
+
+				ret = 1;
+				if (!RunBatch(modulename, batch)) {
+					/* the batch was released, so don't claim it again until the next run */
+					n->WriteLog("Unable to run the batch. Trying this module again on the next run");
+					break;
+				}
+				numdone += batch.size();
+
+				/* check if this module should be running now or not */
+				if (!n->ModuleCheckIfActive()) {
+					n->WriteLog("Not supposed to be running right now");
+					return 0;
 				}
-				n->WriteLog("Finished checking for MR series that dont have a QC row");
 			}
-			else {
+			if (numdone > 0)
+				n->WriteLog(QString("Submitted [%1] series").arg(numdone));
+			else
 				n->WriteLog("Nothing to do");
-			}
 
 			n->WriteLog(QString("*********************** Finished module [%1][%2] ***********************").arg(moduleid).arg(modality));
-
 		}
 		n->WriteLog("Finished all modules");
 	}
@@ -123,148 +113,180 @@ int moduleQC::Run() {
 
 
 /* ---------------------------------------------------------- */
-/* --------- QC --------------------------------------------- */
+/* --------- ClaimSeries ------------------------------------ */
 /* ---------------------------------------------------------- */
-bool moduleQC::QC(int moduleid, int seriesid, QString modality) {
-
-	QElapsedTimer timer;
-
-	QString modulename;
+/* find up to max series that have finished MR QA and have no */
+/* qc_moduleseries row for this module, and insert their rows */
+/* the candidates come from one anti-join on the              */
+/* qc_moduleseries unique key, rather than a not in ()        */
+/* subquery and a lookup per series. series without a valid   */
+/* UID or study number are left out of the candidates, so     */
+/* they can't fill every batch and starve the queue           */
+/* ---------------------------------------------------------- */
+int moduleQC::ClaimSeries(int moduleid, QString modality, int max, QList<qcSeries> &batch) {
+	batch.clear();
 
 	QSqlQuery q;
-	q.prepare("select qcm_name from qc_modules where qcmodule_id = :moduleid");
-	q.bindValue(":moduleid",moduleid);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	if (q.size() > 0) {
-		q.first();
-		modulename = q.value("qcm_name").toString();
+	q.prepare(QString("select a.%1series_id 'seriesid', a.series_num, b.study_num, d.uid from %1_series a left join studies b on a.study_id = b.study_id left join enrollment c on b.enrollment_id = c.enrollment_id left join subjects d on c.subject_id = d.subject_id join mr_qa e on e.mrseries_id = a.%1series_id left join qc_moduleseries f on f.qcmodule_id = :moduleid and f.series_id = a.%1series_id and f.modality = :modality where e.status <> 'processing' and f.qcmoduleseries_id is null and trim(d.uid) <> '' and b.study_num > 0 order by a.series_datetime desc limit %2").arg(modality).arg(max));
+	q.bindValue(":moduleid", moduleid);
+	q.bindValue(":modality", modality);
+	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__, true);
+
+	QStringList failed; /* claimed, but couldn't be set up. the rows are removed so they are tried again */
+	n->db.transaction();
+	while (q.next()) {
+		qcSeries s;
+		s.seriesid = q.value("seriesid").toInt();
+		QString uid = q.value("uid").toString().trimmed();
+		int studynum = q.value("study_num").toInt();
+		int seriesnum = q.value("series_num").toInt();
+		if ((uid == "") || (studynum < 1)) {
+			n->WriteLog(QString("Series [%1] has an invalid UID [%2] or study number [%3]").arg(s.seriesid).arg(uid).arg(studynum));
+			continue;
+		}
+
+		/* the insert only succeeds for one process, because of the unique key */
+		QSqlQuery q2;
+		q2.prepare("insert ignore into qc_moduleseries (qcmodule_id, series_id, modality) values (:moduleid, :seriesid, :modality)");
+		q2.bindValue(":moduleid", moduleid);
+		q2.bindValue(":seriesid", s.seriesid);
+		q2.bindValue(":modality", modality);
+		n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
+		if (q2.numRowsAffected() < 1)
+			continue;
+		s.qcmoduleseriesid = q2.lastInsertId().toInt();
+
+		s.qcpath = QString("%1/%2/%3/%4/qa").arg(n->cfg["archivedir"]).arg(uid).arg(studynum).arg(seriesnum);
+		QString m;
+		if (!n->MakePath(s.qcpath, m)) {
+			n->WriteLog("Unable to create directory ["+s.qcpath+"] because of error ["+m+"]");
+			failed << QString::number(s.qcmoduleseriesid);
+			continue;
+		}
+		batch.append(s);
 	}
-	else
-		return false;
-
-	/* get the series info */
-	series s(seriesid, modality.toUpper(), n);
-	if (!s.isValid) {
-		n->WriteLog("Series was not valid: [" + s.msg + "]");
-		return false;
+	if (failed.size() > 0) {
+		QSqlQuery q2;
+		q2.prepare(QString("delete from qc_moduleseries where qcmoduleseries_id in (%1)").arg(failed.join(",")));
+		n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
 	}
+	n->db.commit();
 
-	int seriesnum = s.seriesnum;
-	int studynum = s.studynum;
-	QString uid = s.uid;
-	QString datatype = s.datatype;
+	return batch.size();
+}
 
-	n->WriteLog(QString("-------------- Running %1 on %2 series %3 --------------").arg(moduleid).arg(modality).arg(seriesid));
 
-	int qcmoduleseriesid(0);
+/* ---------------------------------------------------------- */
+/* --------- RunBatch --------------------------------------- */
+/* ---------------------------------------------------------- */
+/* run a QC module on a batch of series. on the cluster the   */
+/* batch is one array job with a task per series, locally it  */
+/* is one shell running the series one after another          */
+/* ---------------------------------------------------------- */
+bool moduleQC::RunBatch(QString modulename, const QList<qcSeries> &batch) {
 
-	n->WriteLog(QString("============== Working on [%1-%2-%3] ==============").arg(uid).arg(studynum).arg(seriesnum));
-	// check if this qc_moduleseries row exists
-	q.prepare("select * from qc_moduleseries where series_id = :seriesid and modality = :modality and qcmodule_id = :moduleid");
-	q.bindValue(":seriesid",seriesid);
-	q.bindValue(":modality",modality);
-	q.bindValue(":moduleid",moduleid);
-	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
-	if (q.size() > 0)
-		/* another row exists */
-		return false;
-	else {
-		/* insert a blank row for this qc_moduleseries and get the row ID */
-		QSqlQuery q2;
-		q2.prepare("insert ignore into qc_moduleseries (qcmodule_id, series_id, modality) values (:moduleid, :seriesid, :modality)");
-		q2.bindValue(":seriesid",seriesid);
-		q2.bindValue(":modality",modality);
-		q2.bindValue(":moduleid",moduleid);
-		n->SQLQuery(q2, __FUNCTION__, __FILE__, __LINE__);
-		qcmoduleseriesid = q2.lastInsertId().toInt();
-	}
+	QElapsedTimer timer;
+	timer.start();
 
-	QString qcpath = QString("%1/%2/%3/%4/qa").arg(n->cfg["archivedir"]).arg(uid).arg(studynum).arg(seriesnum);
-	QString m;
-	if (!n->MakePath(qcpath, m)) {
-		n->WriteLog("Unable to create directory ["+qcpath+"] because of error ["+m+"]");
-		return false;
-	}
-	n->WriteLog("Working on ["+qcpath+"]");
+	n->WriteLog(QString("-------------- Running %1 on %2 series --------------").arg(modulename).arg(batch.size()));
 
+	QString moduledir = QString("%1/%2").arg(n->cfg["qcmoduledir"]).arg(modulename);
+	bool ok(true);
 	if (n->cfg["usecluster"].toInt()) {
-		/* submit this module to the cluster. first create the SGE job file */
-		n->WriteLog("About to create the SGE job file");
-		QString sgebatchfile = CreateSGEJobFile(modulename, qcmoduleseriesid, qcpath);
-		n->WriteLog("Created SGE job file");
-
-		/* submit the SGE job */
-		QString systemstring = QString("ssh %1 %2 -u %3 -q %4 \"%5\"").arg(n->cfg["clustersubmithost"]).arg(n->cfg["qsubpath"]).arg(n->cfg["queueuser"]).arg(n->cfg["queuename"]).arg(sgebatchfile);
-		n->WriteLog("About to submit SGE job file");
-		n->WriteLog(n->SystemCommand(systemstring));
-		n->WriteLog("Submitted SGE job file");
+		/* submit this batch to the cluster. first create the SGE job file */
+		QString sgebatchfile = CreateSGEJobFile(modulename, batch);
+		if (sgebatchfile == "") {
+			n->WriteLog("Unable to create the SGE job file");
+			ok = false;
+		}
+		else {
+			QString m, result;
+			int jobid;
+			ok = n->SubmitClusterJob(sgebatchfile, n->cfg["clustersubmithost"], n->cfg["qsubpath"], n->cfg["queueuser"], n->cfg["queuename"], m, jobid, result);
+			n->WriteLog(QString("%1 [%2]").arg(m).arg(result));
+		}
 	}
 	else {
+		QStringList cmds;
+		cmds << "cd " + moduledir;
+		for (int i=0; i<batch.size(); i++)
+			cmds << QString("%1/./%2.sh %3").arg(moduledir).arg(modulename).arg(batch[i].qcmoduleseriesid);
 		n->WriteLog("About to run the QC module locally");
-		QDir::setCurrent(n->cfg["qcmoduledir"] + "/" + modulename);
-		QString systemstring = QString("%1/%2/./%2.sh %3").arg(n->cfg["qcmoduledir"]).arg(modulename).arg(qcmoduleseriesid);
-		n->WriteLog(n->SystemCommand(systemstring));
+		n->WriteLog(n->SystemCommand(cmds.join("; ")));
 		n->WriteLog("Finished running the QC module locally");
 	}
 
-	/* calculate the total time running */
-	qint64 cputime = timer.elapsed();
-
-	q.prepare("update qc_moduleseries set cpu_time = :cputime where qcmoduleseries_id = :qcmoduleseriesid");
-	q.bindValue(":cputime",cputime);
-	q.bindValue(":qcmoduleseriesid",qcmoduleseriesid);
+	QStringList ids;
+	for (int i=0; i<batch.size(); i++)
+		ids << QString::number(batch[i].qcmoduleseriesid);
+	QSqlQuery q;
+	if (ok) {
+		/* the time is for the whole batch, so each series gets its share */
+		q.prepare(QString("update qc_moduleseries set cpu_time = :cputime where qcmoduleseries_id in (%1)").arg(ids.join(",")));
+		q.bindValue(":cputime", double(timer.elapsed())/batch.size());
+	}
+	else {
+		/* nothing will run for the claimed series, so release them to be claimed again */
+		n->WriteLog(QString("Releasing the [%1] series in this batch").arg(batch.size()));
+		q.prepare(QString("delete from qc_moduleseries where qcmoduleseries_id in (%1)").arg(ids.join(",")));
+	}
 	n->SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
 
-	// only process 10 before exiting the script. Since the script always starts with the newest when it first runs,
-	// this will allow studies collected since the script started a chance to be QC'd
-	//numProcessed++;
+	n->WriteLog(QString("-------------- Finished %1 on %2 series --------------").arg(modulename).arg(batch.size()));
 
-	//QThread::sleep(1);
-	n->WriteLog(QString("-------------- Finished %1 on %2 series %3 --------------").arg(moduleid).arg(modality).arg(seriesid));
-
-	return true;
+	return ok;
 }
 
 
 /* ---------------------------------------------------------- */
 /* --------- CreateSGEJobFile ------------------------------- */
 /* ---------------------------------------------------------- */
-QString moduleQC::CreateSGEJobFile(QString modulename, int qcmoduleseriesid, QString qcpath) {
+/* one array job for the batch. each task looks up its        */
+/* series and writes its output to that series' qa directory  */
+/* ---------------------------------------------------------- */
+QString moduleQC::CreateSGEJobFile(QString modulename, const QList<qcSeries> &batch) {
 
 	QString jobfilename;
 
-	n->WriteLog("CreateSGEJobFile() - A");
-
 	/* check if any of the variables might be blank */
-	if ((modulename == "") || (qcmoduleseriesid < 1)) {
-		n->WriteLog("CreateSGEJobFile() - B");
+	if ((modulename == "") || (batch.size() < 1))
+		return jobfilename;
+
+	QString moduledir = QString("%1/%2").arg(n->cfg["qcmoduledir"]).arg(modulename);
+	QString jobdir = moduledir + "/jobs";
+	QString m;
+	if (!n->MakePath(jobdir, m)) {
+		n->WriteLog("Unable to create directory ["+jobdir+"] because of error ["+m+"]");
 		return jobfilename;
 	}
 
 	QString jobfile;
-	n->WriteLog("CreateSGEJobFile() - C");
-
 	jobfile += "#!/bin/sh\n";
 	jobfile += QString("#$ -N NIDB-QC-%1\n").arg(modulename);
 	jobfile += "#$ -S /bin/sh\n";
 	jobfile += "#$ -j y\n";
 	jobfile += "#$ -V\n";
-	jobfile += QString("#$ -o %1\n").arg(qcpath);
+	jobfile += QString("#$ -t 1-%1\n").arg(batch.size());
+	jobfile += QString("#$ -o %1\n").arg(jobdir);
 	jobfile += QString("#$ -u %1\n\n").arg(n->cfg["queueuser"]);
-	jobfile += QString("cd %1/%2\n").arg(n->cfg["qcmoduledir"]).arg(modulename);
-	jobfile += QString("%1/%2/./%2.sh %3\n").arg(n->cfg["qcmoduledir"]).arg(modulename).arg(qcmoduleseriesid);
-	n->WriteLog("CreateSGEJobFile() - D");
+	jobfile += QString("cd %1\n").arg(moduledir);
+	jobfile += "case $SGE_TASK_ID in\n";
+	for (int i=0; i<batch.size(); i++)
+		jobfile += QString("\t%1) %2/./%3.sh %4 > %5/QC-%3.log 2>&1 ;;\n").arg(i+1).arg(moduledir).arg(modulename).arg(batch[i].qcmoduleseriesid).arg(batch[i].qcpath);
+	jobfile += "esac\n";
 
-	jobfilename = QString("%1/sge-%2.job").arg(qcpath).arg(n->GenerateRandomString(10));
+	jobfilename = QString("%1/sge-%2.job").arg(jobdir).arg(n->GenerateRandomString(10));
 	QFile f(jobfilename);
 	if (f.open(QIODevice::WriteOnly | QIODevice::Text)) {
 		QTextStream fs(&f);
 		fs << jobfile;
 		f.close();
 	}
-	n->WriteLog("CreateSGEJobFile() - E");
-	n->WriteLog(n->SystemCommand("chmod 777 " + jobfilename));
-	n->WriteLog("CreateSGEJobFile() - F");
+	else {
+		n->WriteLog("Unable to write [" + jobfilename + "]");
+		return "";
+	}
+	f.setPermissions(f.permissions() | QFileDevice::ExeOwner | QFileDevice::ExeGroup | QFileDevice::ExeOther | QFileDevice::ReadGroup | QFileDevice::ReadOther);
 
 	return jobfilename;
 }
@@ -25,6 +25,13 @@
 #include "nidb.h"
 #include "series.h"
 
+/* one series claimed for a QC module */
+struct qcSeries {
+	int seriesid = 0;
+	int qcmoduleseriesid = 0;
+	QString qcpath;
+};
+
 class moduleQC
 {
 public:
@@ -33,8 +40,9 @@ public:
 	~moduleQC();
 
 	int Run();
-	bool QC(int moduleid, int seriesid, QString modality);
-	QString CreateSGEJobFile(QString modulename, int qcmoduleseriesid, QString qcpath);
+	int ClaimSeries(int moduleid, QString modality, int max, QList<qcSeries> &batch);
+	bool RunBatch(QString modulename, const QList<qcSeries> &batch);
+	QString CreateSGEJobFile(QString modulename, const QList<qcSeries> &batch);
 
 private:
 	nidb *n;
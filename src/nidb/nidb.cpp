@@ -21,6 +21,23 @@
   ------------------------------------------------------------------------------ */
 
 #include "nidb.h"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include <condition_variable>
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
 
 /* ---------------------------------------------------------- */
 /* --------- nidb ------------------------------------------- */
@@ -420,6 +437,76 @@ QString nidb::SQLQuery(QSqlQuery &q, QString function, QString file, int line, b
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- ResolveIDs ------------------------------------- */
+/* ---------------------------------------------------------- */
+/* look up the IDs of a set of names in a lookup table with a */
+/* unique key on the name, adding the ones that don't exist   */
+/* yet. IDs are cached by lowercase value, since the unique   */
+/* keys are case insensitive                                  */
+/* ---------------------------------------------------------- */
+void nidb::ResolveIDs(QString table, QString idcol, QString valcol, QStringList vals, QHash<QString, qint64> &cache) {
+
+	QStringList missing;
+	QSet<QString> seen;
+	foreach (QString v, vals) {
+		QString key = v.toLower();
+		if (!cache.contains(key) && !seen.contains(key)) {
+			seen.insert(key);
+			missing << v;
+		}
+	}
+	if (missing.size() < 1)
+		return;
+
+	QSqlQuery q;
+	int chunk = 500;
+	for (int pass=0; pass<2; pass++) {
+		/* second pass, insert whatever wasn't found, then look them up again */
+		if (pass == 1) {
+			for (int i=0; i<missing.size(); i+=chunk) {
+				QStringList placeholders;
+				for (int j=i; (j<i+chunk) && (j<missing.size()); j++)
+					placeholders << "(?)";
+				q.prepare(QString("insert ignore into %1 (%2) values %3").arg(table).arg(valcol).arg(placeholders.join(",")));
+				for (int j=i; (j<i+chunk) && (j<missing.size()); j++)
+					q.addBindValue(missing[j]);
+				SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+			}
+		}
+
+		for (int i=0; i<missing.size(); i+=chunk) {
+			QStringList placeholders;
+			for (int j=i; (j<i+chunk) && (j<missing.size()); j++)
+				placeholders << "?";
+			q.prepare(QString("select %1, %2 from %3 where %2 in (%4)").arg(idcol).arg(valcol).arg(table).arg(placeholders.join(",")));
+			for (int j=i; (j<i+chunk) && (j<missing.size()); j++)
+				q.addBindValue(missing[j]);
+			SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+			while (q.next())
+				cache[q.value(valcol).toString().toLower()] = q.value(idcol).toLongLong();
+		}
+
+		QStringList stillmissing;
+		foreach (QString v, missing)
+			if (!cache.contains(v.toLower()))
+				stillmissing << v;
+		missing = stillmissing;
+		if (missing.size() < 1)
+			return;
+	}
+
+	/* values the collation matches differently than toLower (accents, trailing spaces) get looked up one at a time */
+	foreach (QString v, missing) {
+		q.prepare(QString("select %1 from %2 where %3 = :val").arg(idcol).arg(table).arg(valcol));
+		q.bindValue(":val", v);
+		SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+		if (q.first())
+			cache[v.toLower()] = q.value(idcol).toLongLong();
+	}
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- ModuleCheckIfActive ---------------------------- */
 /* ---------------------------------------------------------- */
@@ -536,6 +623,18 @@ void nidb::InsertAnalysisEvent(qint64 analysisid, int pipelineid, int pipelineve
 /* this function does not work in Windows                     */
 /* ---------------------------------------------------------- */
 QString nidb::SystemCommand(QString s, bool detail, bool truncate) {
+	int exitcode;
+	return SystemCommand(s, detail, truncate, exitcode);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- SystemCommand ---------------------------------- */
+/* ---------------------------------------------------------- */
+/* same as above, and also gives the command's exit code, or  */
+/* -1 if it didn't start or didn't exit normally              */
+/* ---------------------------------------------------------- */
+QString nidb::SystemCommand(QString s, bool detail, bool truncate, int &exitcode) {
 
 	double starttime = QDateTime::currentMSecsSinceEpoch();
 	QString ret;
@@ -552,6 +651,10 @@ QString nidb::SystemCommand(QString s, bool detail, bool truncate) {
 		}
 	}
 	process.waitForFinished();
+	if ((process.error() != QProcess::FailedToStart) && (process.exitStatus() == QProcess::NormalExit))
+		exitcode = process.exitCode();
+	else
+		exitcode = -1;
 
 	double elapsedtime = (QDateTime::currentMSecsSinceEpoch() - starttime + 0.000001)/1000.0; /* add tiny decimal to avoid a divide by zero */
 
@@ -643,13 +746,87 @@ bool nidb::SandboxedSystemCommand(QString s, QString dir, QString &output, QStri
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- SandboxedSystemCommandToLog -------------------- */
+/* ---------------------------------------------------------- */
+/* run a command in a firejail sandbox with an address space  */
+/* limit and a wall/cpu time limit, appending its output to   */
+/* logfile as it arrives instead of holding it in memory. it  */
+/* doesn't change the working directory or use the database,  */
+/* so it can be called from worker threads. returns true if   */
+/* the command ran and exited on its own. whether it          */
+/* succeeded is up to the caller, from exitcode               */
+/* ---------------------------------------------------------- */
+bool nidb::SandboxedSystemCommandToLog(QString s, QString dir, QString logfile, int timeoutsec, int maxmemmb, int &exitcode, QString &msg) {
+
+	exitcode = -1;
+	QElapsedTimer timer;
+	timer.start();
+
+	QDir d(dir);
+	if (!d.exists()) {
+		msg = "Error, sandbox dir [" + dir + "] does not exist";
+		return false;
+	}
+
+	QFile log(logfile);
+	if (!log.open(QIODevice::WriteOnly | QIODevice::Append)) {
+		msg = "Error, unable to open sandbox log [" + logfile + "]";
+		return false;
+	}
+
+	QString command = "firejail --quiet --private-cwd --private=" + dir;
+	if (timeoutsec > 0) {
+		command += QString(" --timeout=%1:%2:%3").arg(timeoutsec/3600, 2, 10, QChar('0')).arg((timeoutsec%3600)/60, 2, 10, QChar('0')).arg(timeoutsec%60, 2, 10, QChar('0'));
+		command += QString(" --rlimit-cpu=%1").arg(timeoutsec);
+	}
+	if (maxmemmb > 0)
+		command += QString(" --rlimit-as=%1").arg(qint64(maxmemmb)*1024*1024);
+	command += " ./" + s;
+
+	QProcess process;
+	process.setProcessChannelMode(QProcess::MergedChannels);
+	process.setWorkingDirectory(dir);
+	process.start("sh", QStringList() << "-c" << command);
+
+	bool ret = true;
+	if (process.waitForStarted(-1)) {
+		while (process.waitForReadyRead(-1)) {
+			log.write(process.readAll());
+			log.flush();
+		}
+		process.waitForFinished(-1);
+		log.write(process.readAll());
+
+		if (process.exitStatus() == QProcess::NormalExit)
+			exitcode = process.exitCode();
+		else
+			ret = false;
+	}
+	else
+		ret = false;
+
+	if (!ret)
+		msg = QString("Executed command [%1], Error [%2], elapsed time [%3 sec]").arg(command).arg(process.errorString()).arg(timer.elapsed()/1000.0, 0, 'f', 3);
+	else
+		msg = QString("Executed command [%1], exit code [%2], elapsed time [%3 sec]").arg(command).arg(exitcode).arg(timer.elapsed()/1000.0, 0, 'f', 3);
+	log.close();
+
+	return ret;
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- WriteLog --------------------------------------- */
 /* ---------------------------------------------------------- */
 QString nidb::WriteLog(QString msg, int wrap) {
+	/* modules with worker threads log from all of them */
+	static std::mutex logmutex;
+
 	if (msg.trimmed() != "") {
 		if (wrap > 0)
 			msg = WrapText(msg, wrap);
+		std::lock_guard<std::mutex> lock(logmutex);
 		if (log.isWritable()) {
 			if (!log.write(QString("\n[%1][%2] %3").arg(CreateCurrentDateTime()).arg(pid).arg(msg).toLatin1()))
 				Print("Unable to write to log file!");
@@ -891,29 +1068,669 @@ QStringList nidb::FindAllDirs(QString dir, QString pattern, bool recursive, bool
 }
 
 
+#ifdef Q_OS_LINUX
+/* the kernel's record format for getdents64(), which glibc doesn't export */
+struct nidb_dirent64 {
+	quint64 d_ino;
+	qint64 d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+
+
+/* ---------------------------------------------------------- */
+/* --------- ScanDirectory ---------------------------------- */
+/* ---------------------------------------------------------- */
+/* read one directory with getdents64(). Only entries whose type
+   the filesystem doesn't report, and regular files (for their
+   size), are stat'd. Subdirectories are returned in subdirs, and
+   onentry, if set, is called with the path of every entry */
+static void ScanDirectory(const QByteArray &path, QList<QByteArray> &subdirs, qint64 &numfiles, qint64 &numbytes, const std::function<void(const QByteArray &)> &onentry = nullptr) {
+	int fd = ::open(path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	alignas(8) char buf[65536];
+	for (;;) {
+		long nread = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+		if (nread <= 0)
+			break;
+
+		for (long pos = 0; pos < nread; ) {
+			struct nidb_dirent64 *e = (struct nidb_dirent64 *)(buf + pos);
+			pos += e->d_reclen;
+
+			const char *name = e->d_name;
+			if ((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0))
+				continue;
+
+			unsigned char type = e->d_type;
+			qint64 size = 0;
+			if ((type == DT_UNKNOWN) || (type == DT_REG)) {
+#if defined(STATX_SIZE) && defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 28))
+				/* don't force NFS to revalidate attributes it has already cached */
+				struct statx stx;
+				if (statx(fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_TYPE | STATX_SIZE, &stx) != 0)
+					continue;
+				mode_t mode = stx.stx_mode;
+				size = qint64(stx.stx_size);
+#else
+				struct stat st;
+				if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+					continue;
+				mode_t mode = st.st_mode;
+				size = qint64(st.st_size);
+#endif
+				if (S_ISDIR(mode)) type = DT_DIR;
+				else if (S_ISREG(mode)) type = DT_REG;
+				else type = DT_LNK;
+			}
+
+			if (type == DT_DIR) {
+				subdirs << (path + "/" + name);
+			}
+			else if (type == DT_REG) {
+				numfiles++;
+				numbytes += size;
+			}
+
+			if (onentry)
+				onentry(path + "/" + name);
+		}
+	}
+	::close(fd);
+}
+#endif
+
+
 /* ---------------------------------------------------------- */
 /* --------- GetDirSizeAndFileCount ------------------------- */
 /* ---------------------------------------------------------- */
+/* count the regular files in a directory, and their total size */
 void nidb::GetDirSizeAndFileCount(QString dir, int &c, qint64 &b, bool recurse) {
+	if (recurse) {
+		QVector<bool> found;
+		GetDirSizeAndMatches(dir, QStringList(), c, b, found, true);
+		return;
+	}
+
+	/* a single directory is one read, so keep the original listing. It skips hidden files, and counts symlinks to files */
 	c = 0;
 	b = 0;
-
 	QDir d(dir);
 	QFileInfoList fl = d.entryInfoList(QDir::NoDotAndDotDot | QDir::Files);
 	c = fl.size();
-	for (int i=0; i < fl.size(); i++) {
-		const QFileInfo finfo = fl.at(i);
-		b += finfo.size();
-	}
+	for (int i=0; i < fl.size(); i++)
+		b += fl.at(i).size();
+}
 
-	if (recurse) {
-		QDirIterator it(dir, QStringList() << "*", QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks, QDirIterator::Subdirectories);
-		while (it.hasNext()) {
-			it.next();
+
+/* ---------------------------------------------------------- */
+/* --------- GetDirSizeAndMatches --------------------------- */
+/* ---------------------------------------------------------- */
+/* count the regular files in a directory, and their total size,
+   and check which of the glob patterns (relative to dir, such as
+   "stats/*.txt") match at least one file or directory, all in
+   one walk. When recursing, several threads read subdirectories
+   at once, which matters on NFS where every directory read and
+   stat is a round trip to the server */
+void nidb::GetDirSizeAndMatches(QString dir, const QStringList &patterns, int &c, qint64 &b, QVector<bool> &found, bool recurse) {
+	c = 0;
+	b = 0;
+	found.fill(false, patterns.size());
+
+	/* the patterns are compiled into one expression, so most paths are only matched once. a path
+	   that matches it is checked against each pattern not yet found */
+	QList<QRegularExpression> res;
+	QStringList alts;
+	for (int i=0; i<patterns.size(); i++) {
+		QString pattern = patterns[i].trimmed();
+		while (pattern.startsWith("./"))
+			pattern.remove(0, 2);
+		while (pattern.startsWith("/"))
+			pattern.remove(0, 1);
+		while (pattern.endsWith("/"))
+			pattern.chop(1);
+		QString rx = QRegularExpression::wildcardToRegularExpression(pattern);
+		res << QRegularExpression(rx);
+		res.last().optimize();
+		alts << "(?:" + rx + ")";
+	}
+	QRegularExpression any(alts.join("|"));
+	any.optimize();
+
+	QByteArray root = QFile::encodeName(QDir::cleanPath(dir));
+	std::mutex foundmutex;
+	std::atomic<int> numfound(0);
+	auto match = [&](const QString &relpath) {
+		if ((numfound >= patterns.size()) || (!any.match(relpath).hasMatch()))
+			return;
+		std::lock_guard<std::mutex> lock(foundmutex);
+		for (int i=0; i<res.size(); i++) {
+			if ((!found[i]) && (res[i].match(relpath).hasMatch())) {
+				found[i] = true;
+				numfound++;
+			}
+		}
+	};
+	std::function<void(const QByteArray &)> onentry;
+	if (patterns.size() > 0)
+		onentry = [&](const QByteArray &path) { match(QFile::decodeName(path.mid(root.size() + 1))); };
+
+#ifdef Q_OS_LINUX
+	std::deque<QByteArray> dirs;
+	std::mutex dirmutex;
+	std::condition_variable dircond;
+	int numactive = 0;
+	std::atomic<qint64> numfiles(0);
+	std::atomic<qint64> numbytes(0);
+	dirs.push_back(root);
+
+	/* each thread takes a directory from the queue, and queues its subdirectories. The walk is done when the queue is empty and no thread is reading a directory */
+	auto walker = [&]() {
+		for (;;) {
+			QByteArray path;
+			{
+				std::unique_lock<std::mutex> lock(dirmutex);
+				dircond.wait(lock, [&]() { return !dirs.empty() || (numactive == 0); });
+				if (dirs.empty())
+					return;
+				path = dirs.front();
+				dirs.pop_front();
+				numactive++;
+			}
+
+			QList<QByteArray> subdirs;
+			qint64 f = 0, s = 0;
+			ScanDirectory(path, subdirs, f, s, onentry);
+			numfiles += f;
+			numbytes += s;
+
+			{
+				std::lock_guard<std::mutex> lock(dirmutex);
+				if (recurse)
+					for (int i=0; i<subdirs.size(); i++)
+						dirs.push_back(subdirs[i]);
+				numactive--;
+			}
+			dircond.notify_all();
+		}
+	};
+
+	int numthreads = recurse ? 8 : 1;
+	std::vector<std::thread> threads;
+	for (int t=1; t<numthreads; t++)
+		threads.emplace_back(walker);
+	walker();
+	for (auto &t : threads)
+		t.join();
+
+	c = int(numfiles);
+	b = numbytes;
+#else
+	QDirIterator::IteratorFlags flags = recurse ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags;
+	QDirIterator it(QFile::decodeName(root), QDir::AllEntries | QDir::Hidden | QDir::NoDotAndDotDot, flags);
+	while (it.hasNext()) {
+		it.next();
+		if (onentry)
+			onentry(QFile::encodeName(it.filePath()));
+		if (it.fileInfo().isFile() && !it.fileInfo().isSymLink()) {
 			c++;
 			b += it.fileInfo().size();
 		}
 	}
+#endif
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetIndexedDirSize ------------------------------ */
+/* ---------------------------------------------------------- */
+/* get the recursive size of a directory from the dirsize_index,
+   or walk the directory and add it to the index if it's not
+   there. Modules which write to an indexed directory keep its
+   entry current with UpdateDirSizeIndex()/AddToDirSizeIndex() */
+void nidb::GetIndexedDirSize(QString dir, int &c, qint64 &b) {
+	dir = QDir::cleanPath(dir);
+
+	QSqlQuery q;
+	q.prepare("select numfiles, disksize from dirsize_index where dir_path = :path");
+	q.bindValue(":path", dir);
+	SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.size() > 0) {
+		q.first();
+		c = q.value("numfiles").toInt();
+		b = q.value("disksize").toLongLong();
+		return;
+	}
+
+	GetDirSizeAndFileCount(dir, c, b, true);
+	UpdateDirSizeIndex(dir, c, b);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- UpdateDirSizeIndex ----------------------------- */
+/* ---------------------------------------------------------- */
+/* record the size of a directory after it was fully walked */
+void nidb::UpdateDirSizeIndex(QString dir, int c, qint64 b) {
+	QSqlQuery q;
+	q.prepare("insert into dirsize_index (dir_path, numfiles, disksize, lastwalk) values (:path, :numfiles, :disksize, now()) on duplicate key update numfiles = :numfiles, disksize = :disksize, lastwalk = now()");
+	q.bindValue(":path", QDir::cleanPath(dir));
+	q.bindValue(":numfiles", c);
+	q.bindValue(":disksize", b);
+	SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- AddToDirSizeIndex ------------------------------ */
+/* ---------------------------------------------------------- */
+/* add files which were just written to a directory, without
+   walking it again. Returns the new totals in c and b */
+void nidb::AddToDirSizeIndex(QString dir, int &c, qint64 &b) {
+	dir = QDir::cleanPath(dir);
+
+	QSqlQuery q;
+	q.prepare("insert into dirsize_index (dir_path, numfiles, disksize) values (:path, :numfiles, :disksize) on duplicate key update numfiles = numfiles + :numfiles, disksize = disksize + :disksize");
+	q.bindValue(":path", dir);
+	q.bindValue(":numfiles", c);
+	q.bindValue(":disksize", b);
+	SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+
+	q.prepare("select numfiles, disksize from dirsize_index where dir_path = :path");
+	q.bindValue(":path", dir);
+	SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+	if (q.first()) {
+		c = q.value("numfiles").toInt();
+		b = q.value("disksize").toLongLong();
+	}
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- RemoveFromDirSizeIndex ------------------------- */
+/* ---------------------------------------------------------- */
+/* remove a directory, and any directories below it, from the index */
+void nidb::RemoveFromDirSizeIndex(QString dir) {
+	dir = QDir::cleanPath(dir);
+
+	QSqlQuery q;
+	q.prepare("delete from dirsize_index where dir_path = :path or dir_path like :subpath");
+	q.bindValue(":path", dir);
+	q.bindValue(":subpath", QString(dir).replace("%","\\%").replace("_","\\_") + "/%");
+	SQLQuery(q, __FUNCTION__, __FILE__, __LINE__);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- CopyFileNative --------------------------------- */
+/* ---------------------------------------------------------- */
+/* copy a single file, preserving permissions and mtime. The file
+   is reflinked if the filesystem supports it, otherwise the data
+   is copied inside the kernel with copy_file_range(), falling
+   back to read()/write() if neither is supported */
+bool nidb::CopyFileNative(QString src, QString dst, QString &msg) {
+#ifdef Q_OS_LINUX
+	QByteArray srcpath = QFile::encodeName(src);
+	QByteArray dstpath = QFile::encodeName(dst);
+
+	int in = ::open(srcpath.constData(), O_RDONLY | O_CLOEXEC);
+	if (in < 0) {
+		msg = QString("Unable to open [%1] because [%2]").arg(src).arg(strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(in, &st) != 0) {
+		msg = QString("Unable to stat [%1] because [%2]").arg(src).arg(strerror(errno));
+		::close(in);
+		return false;
+	}
+
+	int out = ::open(dstpath.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, (st.st_mode & 07777) | S_IWUSR);
+	if (out < 0) {
+		msg = QString("Unable to create [%1] because [%2]").arg(dst).arg(strerror(errno));
+		::close(in);
+		return false;
+	}
+
+	bool copied = false;
+#ifdef FICLONE
+	if (ioctl(out, FICLONE, in) == 0)
+		copied = true;
+#endif
+
+	if (!copied) {
+		off_t remaining = st.st_size;
+		bool usecopyrange = true;
+		std::vector<char> buf;
+		while (remaining > 0) {
+			ssize_t r = -1;
+#ifdef SYS_copy_file_range
+			if (usecopyrange) {
+				r = syscall(SYS_copy_file_range, in, NULL, out, NULL, (size_t)qMin(remaining, (off_t)0x40000000), 0);
+				/* not supported between these files, so copy the rest in userspace */
+				if ((r < 0) && ((errno == EXDEV) || (errno == ENOSYS) || (errno == EINVAL) || (errno == EOPNOTSUPP))) {
+					usecopyrange = false;
+					continue;
+				}
+			}
+#else
+			usecopyrange = false;
+#endif
+			if (!usecopyrange) {
+				if (buf.empty())
+					buf.resize(1048576);
+				r = ::read(in, buf.data(), buf.size());
+				for (ssize_t w = 0; (r > 0) && (w < r); ) {
+					ssize_t n = ::write(out, buf.data() + w, r - w);
+					if (n < 0) { r = -1; break; }
+					w += n;
+				}
+			}
+			if (r < 0) {
+				if (errno == EINTR) continue;
+				msg = QString("Error copying [%1] to [%2] because [%3]").arg(src).arg(dst).arg(strerror(errno));
+				::close(in);
+				::close(out);
+				return false;
+			}
+			/* the file was truncated while being copied */
+			if (r == 0)
+				break;
+			remaining -= r;
+		}
+	}
+
+	fchmod(out, st.st_mode & 07777);
+	struct timespec times[2] = { st.st_atim, st.st_mtim };
+	futimens(out, times);
+
+	::close(in);
+	if (::close(out) != 0) {
+		msg = QString("Error closing [%1] because [%2]").arg(dst).arg(strerror(errno));
+		return false;
+	}
+
+	return true;
+#else
+	QFile::remove(dst);
+	if (!QFile::copy(src, dst)) {
+		msg = QString("Unable to copy [%1] to [%2]").arg(src).arg(dst);
+		return false;
+	}
+	return true;
+#endif
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- LinkFile --------------------------------------- */
+/* ---------------------------------------------------------- */
+/* hardlink (or symlink) dst to src instead of copying it. If a
+   hardlink isn't possible, such as across filesystems, the file
+   is copied with CopyFileNative(), which reflinks if it can.
+   linked is set to true if dst shares its data with src */
+bool nidb::LinkFile(QString src, QString dst, bool symbolic, bool &linked, QString &msg) {
+	linked = false;
+#ifdef Q_OS_LINUX
+	QByteArray srcpath = QFile::encodeName(src);
+	QByteArray dstpath = QFile::encodeName(dst);
+
+	::unlink(dstpath.constData());
+	if (symbolic) {
+		if (::symlink(srcpath.constData(), dstpath.constData()) != 0) {
+			msg = QString("Unable to symlink [%1] to [%2] because [%3]").arg(dst).arg(src).arg(strerror(errno));
+			return false;
+		}
+		linked = true;
+		return true;
+	}
+
+	if (::link(srcpath.constData(), dstpath.constData()) == 0) {
+		linked = true;
+		return true;
+	}
+	/* not the same filesystem, or links aren't allowed here, so fall back to a copy */
+	if ((errno != EXDEV) && (errno != EPERM) && (errno != EMLINK) && (errno != EOPNOTSUPP)) {
+		msg = QString("Unable to link [%1] to [%2] because [%3]").arg(dst).arg(src).arg(strerror(errno));
+		return false;
+	}
+#else
+	if (symbolic) {
+		QFile::remove(dst);
+		if (!QFile::link(src, dst)) {
+			msg = QString("Unable to symlink [%1] to [%2]").arg(dst).arg(src);
+			return false;
+		}
+		linked = true;
+		return true;
+	}
+#endif
+	return CopyFileNative(src, dst, msg);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- CopyDir ---------------------------------------- */
+/* ---------------------------------------------------------- */
+/* recursively copy the contents of indir into outdir using
+   numthreads copy threads. Symlinks are recreated, not followed.
+   progress is called from this thread every few seconds with
+   the bytes copied so far and the total bytes to copy */
+bool nidb::CopyDir(QString indir, QString outdir, int numthreads, QString &msg, std::function<void(qint64, qint64)> progress) {
+
+	indir = QDir::cleanPath(indir);
+	outdir = QDir::cleanPath(outdir);
+
+	if (!QDir(indir).exists()) {
+		msg = "Source directory [" + indir + "] does not exist";
+		return false;
+	}
+	if (!MakePath(outdir, msg, false))
+		return false;
+
+	/* walk the source tree once, creating the directories and symlinks, and building the list of files to copy */
+	QStringList dirs;
+	QStringList files;
+	QList<qint64> sizes;
+	QStringList errors;
+	qint64 totalbytes = 0;
+	QDirIterator it(indir, QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+	while (it.hasNext()) {
+		it.next();
+		QFileInfo fi = it.fileInfo();
+		QString rel = it.filePath().mid(indir.size() + 1);
+
+		if (fi.isSymLink()) {
+			QString target;
+#ifdef Q_OS_LINUX
+			char linkbuf[4096];
+			ssize_t len = ::readlink(QFile::encodeName(it.filePath()).constData(), linkbuf, sizeof(linkbuf)-1);
+			if (len >= 0)
+				target = QFile::decodeName(QByteArray(linkbuf, int(len)));
+#else
+			target = fi.symLinkTarget();
+#endif
+			QFile::remove(outdir + "/" + rel);
+			if (!QFile::link(target, outdir + "/" + rel))
+				errors << "Unable to create symlink [" + outdir + "/" + rel + "]";
+		}
+		else if (fi.isDir()) {
+			dirs << rel;
+			if (!QDir().mkpath(outdir + "/" + rel))
+				errors << "Unable to create directory [" + outdir + "/" + rel + "]";
+		}
+		else if (fi.isFile()) {
+			files << rel;
+			sizes << fi.size();
+			totalbytes += fi.size();
+		}
+	}
+
+	/* copy the files. each thread takes the next file from the list until none are left */
+	numthreads = qBound(1, numthreads, qMax(1, files.size()));
+	std::atomic<int> nextfile(0);
+	std::atomic<int> numfinished(0);
+	std::atomic<qint64> bytesdone(0);
+	std::mutex errormutex;
+	std::vector<std::thread> threads;
+	for (int t=0; t<numthreads; t++) {
+		threads.emplace_back([&]() {
+			int i;
+			while ((i = nextfile++) < files.size()) {
+				QString m;
+				if (!CopyFileNative(indir + "/" + files[i], outdir + "/" + files[i], m)) {
+					std::lock_guard<std::mutex> lock(errormutex);
+					errors << m;
+				}
+				bytesdone += sizes[i];
+			}
+			numfinished++;
+		});
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	while (numfinished < numthreads) {
+		QThread::msleep(200);
+		if (progress && (timer.elapsed() > 5000)) {
+			progress(bytesdone, totalbytes);
+			timer.restart();
+		}
+	}
+	for (auto &t : threads)
+		t.join();
+	if (progress)
+		progress(bytesdone, totalbytes);
+
+	/* set directory permissions and mtimes last, deepest first, since creating the files changed them */
+#ifdef Q_OS_LINUX
+	dirs.prepend("");
+	for (int i=dirs.size()-1; i>=0; i--) {
+		QString src = dirs[i].isEmpty() ? indir : indir + "/" + dirs[i];
+		QString dst = dirs[i].isEmpty() ? outdir : outdir + "/" + dirs[i];
+		struct stat st;
+		if (::stat(QFile::encodeName(src).constData(), &st) == 0) {
+			::chmod(QFile::encodeName(dst).constData(), st.st_mode & 07777);
+			struct timespec times[2] = { st.st_atim, st.st_mtim };
+			utimensat(AT_FDCWD, QFile::encodeName(dst).constData(), times, 0);
+		}
+	}
+#endif
+
+	msg = QString("Copied [%1] files [%2 bytes] from [%3] to [%4] using [%5] threads").arg(files.size()).arg(totalbytes).arg(indir).arg(outdir).arg(numthreads);
+	if (errors.size() > 0) {
+		msg += QString(". [%1] errors: ").arg(errors.size()) + errors.mid(0,10).join(", ");
+		return false;
+	}
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- RemoveDirThrottled ----------------------------- */
+/* ---------------------------------------------------------- */
+/* remove a directory tree using numthreads threads, removing at
+   most maxrate files per second (0 is unlimited) so a very large
+   delete doesn't starve everything else using the disk. keepgoing
+   is called from this thread every few seconds, and the delete
+   stops if it returns false. Returns true if p was removed */
+bool nidb::RemoveDirThrottled(QString p, int numthreads, int maxrate, QString &msg, std::function<bool()> keepgoing) {
+
+	if ((p == "") || (p == ".") || (p == "..") || (p == "/") || (p.contains("//")) || (p.startsWith("/root")) || (p == "/home")) {
+		msg = "Path is not valid [" + p + "]";
+		return false;
+	}
+	p = QDir::cleanPath(p);
+
+	/* directories are listed before their contents, so removing them in reverse order removes the deepest first */
+	QStringList dirs;
+	QStringList files;
+	QDirIterator it(p, QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+	while (it.hasNext()) {
+		it.next();
+		if (it.fileInfo().isDir() && !it.fileInfo().isSymLink())
+			dirs << it.filePath();
+		else
+			files << it.filePath();
+	}
+
+	numthreads = qBound(1, numthreads, qMax(1, files.size()));
+	std::atomic<int> nextfile(0);
+	std::atomic<int> numfinished(0);
+	std::atomic<int> numerrors(0);
+	std::atomic<bool> stop(false);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int t=0; t<numthreads; t++) {
+		threads.emplace_back([&]() {
+			int i;
+			while (!stop && ((i = nextfile++) < files.size())) {
+				/* file i is not removed before i/maxrate seconds have passed */
+				if (maxrate > 0)
+					std::this_thread::sleep_until(start + std::chrono::milliseconds(qint64(i) * 1000 / maxrate));
+				if (!QFile::remove(files[i]) && QFileInfo::exists(files[i]))
+					numerrors++;
+			}
+			numfinished++;
+		});
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	while (numfinished < numthreads) {
+		QThread::msleep(200);
+		if (keepgoing && !stop && (timer.elapsed() > 5000)) {
+			if (!keepgoing())
+				stop = true;
+			timer.restart();
+		}
+	}
+	for (auto &t : threads)
+		t.join();
+
+	int numremoved = qMin(int(nextfile), files.size()) - numerrors;
+	if (stop) {
+		msg = QString("Stopped after removing [%1] of [%2] files from [%3]").arg(numremoved).arg(files.size()).arg(p);
+		return false;
+	}
+
+	QDir d;
+	for (int i=dirs.size()-1; i>=0; i--)
+		d.rmdir(dirs[i]);
+	d.rmdir(p);
+
+	if (d.exists(p)) {
+		msg = QString("Removed [%1] of [%2] files, but [%3] still exists").arg(numremoved).arg(files.size()).arg(p);
+		return false;
+	}
+
+	msg = QString("Removed [%1] files from [%2] using [%3] threads").arg(files.size()).arg(p).arg(numthreads);
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- IsSameFilesystem ------------------------------- */
+/* ---------------------------------------------------------- */
+/* true if both paths exist and are on the same device, so a
+   rename() between them will work */
+bool nidb::IsSameFilesystem(QString p1, QString p2) {
+#ifdef Q_OS_LINUX
+	struct stat st1, st2;
+	if (::stat(QFile::encodeName(p1).constData(), &st1) != 0)
+		return false;
+	if (::stat(QFile::encodeName(p2).constData(), &st2) != 0)
+		return false;
+
+	return (st1.st_dev == st2.st_dev);
+#else
+	return QStorageInfo(p1).rootPath() == QStorageInfo(p2).rootPath();
+#endif
 }
 
 
@@ -1011,11 +1828,13 @@ void nidb::InsertSubjectChangeLog(QString username, QString uid, QString newuid,
 /* ---------------------------------------------------------- */
 /* --------- ConvertDicom ----------------------------------- */
 /* ---------------------------------------------------------- */
-bool nidb::ConvertDicom(QString filetype, QString indir, QString outdir, bool gzip, QString uid, QString studynum, QString seriesnum, QString datatype, int &numfilesconv, int &numfilesrenamed, QString &msg) {
+bool nidb::ConvertDicom(QString filetype, QString indir, QString outdir, bool gzip, QString uid, QString studynum, QString seriesnum, QString datatype, int &numfilesconv, int &numfilesrenamed, QString &msg, QString nidbdir) {
 
 	QStringList msgs;
 
-	QString pwd = QDir::currentPath();
+	/* worker threads pass nidbdir, because they can't read cfg while the main thread uses it */
+	if (nidbdir == "")
+		nidbdir = cfg["nidbdir"];
 
 	QString gzipstr;
 	if (gzip) gzipstr = "-z y";
@@ -1030,17 +1849,17 @@ bool nidb::ConvertDicom(QString filetype, QString indir, QString outdir, bool gz
 	if (datatype == "parrec")
 		fileext = "/*.par";
 
-	/* do the conversion */
+	/* do the conversion. all paths are absolute, so the process working directory is
+	   never changed. this function is called from worker threads in modulePipeline */
 	QString systemstring;
-	QDir::setCurrent(indir);
 	if (filetype == "nifti4dme")
-        systemstring = QString("%1/bin/./dcm2niixme %2 -o '%3' %4").arg(cfg["nidbdir"]).arg(gzipstr).arg(outdir).arg(indir);
+        systemstring = QString("%1/bin/./dcm2niixme %2 -o '%3' %4").arg(nidbdir).arg(gzipstr).arg(outdir).arg(indir);
 	else if (filetype == "nifti4d")
-        systemstring = QString("%1/bin/./dcm2niix -1 -b n %2 -o '%3' %4%5").arg(cfg["nidbdir"]).arg(gzipstr).arg(outdir).arg(indir).arg(fileext);
+        systemstring = QString("%1/bin/./dcm2niix -1 -b n %2 -o '%3' %4%5").arg(nidbdir).arg(gzipstr).arg(outdir).arg(indir).arg(fileext);
 	else if (filetype == "nifti3d")
-        systemstring = QString("%1/bin/./dcm2niix -1 -b n -z 3 -o '%2' %3%4").arg(cfg["nidbdir"]).arg(outdir).arg(indir).arg(fileext);
+        systemstring = QString("%1/bin/./dcm2niix -1 -b n -z 3 -o '%2' %3%4").arg(nidbdir).arg(outdir).arg(indir).arg(fileext);
 	else if (filetype == "bids")
-        systemstring = QString("%1/bin/./dcm2niix -1 -b y -z y -o '%2' %3%4").arg(cfg["nidbdir"]).arg(outdir).arg(indir).arg(fileext);
+        systemstring = QString("%1/bin/./dcm2niix -1 -b y -z y -o '%2' %3%4").arg(nidbdir).arg(outdir).arg(indir).arg(fileext);
 	else
 		return false;
 
@@ -1075,9 +1894,6 @@ bool nidb::ConvertDicom(QString filetype, QString indir, QString outdir, bool gz
 	if (!BatchRenameFiles(outdir, seriesnum, studynum, uid, numfilesrenamed, m))
 		msgs << "Error renaming output files [" + m + "]";
 
-	/* change back to original directory before leaving */
-	QDir::setCurrent(pwd);
-
 	msg = msgs.join("\n");
 	return true;
 }
@@ -1575,20 +2391,49 @@ void nidb::AppendCustomLog(QString file, QString msg) {
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- SSHOptions ------------------------------------- */
+/* ---------------------------------------------------------- */
+/* options so that ssh and scp share one persistent connection
+   per host (ControlMaster), instead of doing a new key exchange
+   for every command. The first command starts the connection,
+   and if it has gone away the next command starts a new one.
+   Commands from several threads run over it at the same time */
+QString nidb::SSHOptions() {
+	int persist = 600;
+	if (cfg["clustersshpersist"] != "")
+		persist = cfg["clustersshpersist"].toInt();
+	if (persist < 1)
+		return "";
+
+	/* the sockets must be private to this user */
+	QString dir = cfg["tmpdir"] + "/nidbssh";
+	QDir d;
+	if (!d.exists(dir)) {
+		d.mkpath(dir);
+		QFile::setPermissions(dir, QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ExeOwner);
+	}
+
+	return QString("-o ControlMaster=auto -o ControlPath=%1/%C -o ControlPersist=%2 -o ServerAliveInterval=30").arg(dir).arg(persist);
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- SubmitClusterJob ------------------------------- */
 /* ---------------------------------------------------------- */
 bool nidb::SubmitClusterJob(QString f, QString submithost, QString qsub, QString user, QString queue, QString &msg, int &jobid, QString &result) {
 
-	/* submit the job to the cluster */
-	QString systemstring = QString("ssh %1 %2 -u %3 -q %4 \"%5\"").arg(submithost).arg(qsub).arg(user).arg(queue).arg(f);
+	/* submit the job to the cluster. localhost is run directly, which also allows testing with a fake qsub script */
+	QString systemstring = QString("%1 -u %2 -q %3 \"%4\"").arg(qsub).arg(user).arg(queue).arg(f);
+	if (submithost != "localhost")
+		systemstring = QString("ssh %1 %2 %3").arg(SSHOptions()).arg(submithost).arg(systemstring);
 	result = SystemCommand(systemstring,true).trimmed();
 
-	/* get the jobid */
+	/* get the jobid. "Your job 123 (...)", "Your job-array 123.1-10:1 (...)" or "Submitted batch job 123" */
 	jobid = -1;
-	QStringList parts = result.split(" ");
-	if (parts.size() >= 3)
-		jobid = parts[2].toInt();
+	QRegularExpressionMatch match = QRegularExpression("job(-array)? (\\d+)").match(result);
+	if (match.hasMatch())
+		jobid = match.captured(2).toInt();
 
 	/* check the return message from qsub */
 	if (result.contains("invalid option", Qt::CaseInsensitive)) {
@@ -1630,6 +2475,202 @@ bool nidb::SubmitClusterJob(QString f, QString submithost, QString qsub, QString
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- SubmitClusterArrayJob -------------------------- */
+/* ---------------------------------------------------------- */
+/* submit many job files as one array job, with one ssh and   */
+/* one qsub. a manifest, with a line per task, maps the task  */
+/* index to the caller's id and the job file to run. the      */
+/* wrapper and manifest are written to localdir, which the    */
+/* cluster sees as clusterdir                                 */
+/* ---------------------------------------------------------- */
+bool nidb::SubmitClusterArrayJob(const QList<clusterArrayTask> &tasks, QString clustertype, QString jobname, QString localdir, QString clusterdir, int maxwalltime, QString submithost, QString qsub, QString user, QString queue, QString &msg, int &jobid, QString &result) {
+
+	jobid = -1;
+	if (tasks.size() < 1) {
+		msg = "No tasks to submit";
+		return false;
+	}
+
+	QString m;
+	if (!MakePath(localdir, m)) {
+		msg = "Unable to create directory [" + localdir + "] because of error [" + m + "]";
+		return false;
+	}
+
+	QString base = QString("array-%1-%2").arg(jobname).arg(GenerateRandomString(10));
+
+	/* the manifest. task index, id, job file, log file */
+	QString manifest;
+	for (int i=0; i<tasks.size(); i++)
+		manifest += QString("%1\t%2\t%3\t%4\n").arg(i+1).arg(tasks[i].id).arg(tasks[i].jobfile).arg(tasks[i].logfile);
+
+	QFile mf(localdir + "/" + base + ".tasks");
+	if (mf.open(QIODevice::WriteOnly | QIODevice::Text)) {
+		QTextStream fs(&mf);
+		fs << manifest;
+		mf.close();
+	}
+	else {
+		msg = "Unable to write [" + mf.fileName() + "]";
+		return false;
+	}
+
+	/* the wrapper runs the task's own job file, and the scheduler only reads the wrapper's directives. the
+	   ones in the task's job file (name, shell, output, environment, user, and wall time) are replaced by
+	   the wrapper's, which are the same for every task of the array. any other directive in a task's job
+	   file, such as a memory or slot request, has no effect */
+	QString wrapper;
+	wrapper += "#!/bin/sh\n";
+	if (clustertype == "slurm") {
+		wrapper += "#SBATCH -J " + jobname + "\n";
+		wrapper += "#SBATCH -o " + clusterdir + "/" + base + "-%a.out\n";
+		wrapper += "#SBATCH --export=ALL\n";
+		wrapper += QString("#SBATCH --array=1-%1\n").arg(tasks.size());
+		if (maxwalltime > 0)
+			wrapper += QString("#SBATCH -t %1:%2:00\n").arg(maxwalltime/60).arg(maxwalltime%60, 2, 10, QChar('0'));
+	}
+	else {
+		wrapper += "#$ -N " + jobname + "\n";
+		wrapper += "#$ -S /bin/sh\n";
+		wrapper += "#$ -j y\n";
+		wrapper += "#$ -o " + clusterdir + "/\n";
+		wrapper += "#$ -V\n";
+		wrapper += "#$ -u " + user + "\n";
+		wrapper += QString("#$ -t 1-%1\n").arg(tasks.size());
+		if (maxwalltime > 0)
+			wrapper += QString("#$ -l h_rt=%1:%2:00\n").arg(maxwalltime/60).arg(maxwalltime%60, 2, 10, QChar('0'));
+	}
+	wrapper += "\nTASK=${SGE_TASK_ID:-$SLURM_ARRAY_TASK_ID}\n";
+	wrapper += QString("LINE=`sed -n \"${TASK}p\" %1/%2.tasks`\n").arg(clusterdir).arg(base);
+	wrapper += "JOBFILE=`echo \"$LINE\" | cut -f3`\n";
+	wrapper += "LOGFILE=`echo \"$LINE\" | cut -f4`\n";
+	wrapper += "echo Task $TASK running [$JOBFILE]\n";
+	wrapper += "/bin/bash \"$JOBFILE\" > \"$LOGFILE\" 2>&1\n";
+
+	QFile wf(localdir + "/" + base + ".job");
+	if (wf.open(QIODevice::WriteOnly | QIODevice::Text)) {
+		QTextStream fs(&wf);
+		fs << wrapper;
+		wf.close();
+	}
+	else {
+		msg = "Unable to write [" + wf.fileName() + "]";
+		return false;
+	}
+	wf.setPermissions(wf.permissions() | QFileDevice::ExeOwner | QFileDevice::ExeGroup | QFileDevice::ExeOther | QFileDevice::ReadGroup | QFileDevice::ReadOther);
+	mf.setPermissions(mf.permissions() | QFileDevice::ReadGroup | QFileDevice::ReadOther);
+
+	return SubmitClusterJob(clusterdir + "/" + base + ".job", submithost, qsub, user, queue, msg, jobid, result);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- SubmitLocalJob --------------------------------- */
+/* ---------------------------------------------------------- */
+/* run a job file on this server instead of submitting it to  */
+/* the cluster. the job is detached, so it keeps running      */
+/* after this process exits, and its pid is the job id.       */
+/* NIDB_JOBID in its environment lets LocalJobRunning() tell  */
+/* it apart from another process that gets the same pid. if   */
+/* cgroup is system or user, the job runs in its own systemd  */
+/* scope limited to numcpus and memmb                         */
+/* ---------------------------------------------------------- */
+bool nidb::SubmitLocalJob(QString f, QString logfile, qint64 id, int numcpus, qint64 memmb, int maxwalltime, QString cgroup, QString &msg, int &jobid, QString &result) {
+
+	jobid = -1;
+	if (!QFile::exists(f)) {
+		msg = "Job file [" + f + "] does not exist";
+		result = msg;
+		return false;
+	}
+
+	QStringList args;
+	if ((cgroup == "system") || (cgroup == "user")) {
+		args << "systemd-run" << "--scope" << "--quiet" << "--collect";
+		if (cgroup == "user")
+			args << "--user";
+		if (numcpus > 0)
+			args << "-p" << QString("CPUQuota=%1%").arg(numcpus*100);
+		if (memmb > 0)
+			args << "-p" << QString("MemoryMax=%1M").arg(memmb);
+	}
+	if (maxwalltime > 0)
+		args << "timeout" << QString("%1m").arg(maxwalltime);
+	args << "/bin/bash" << f;
+
+	/* the shell only sets up the log file, and is replaced by the job */
+	QString cmd = "exec";
+	foreach (QString a, args)
+		cmd += " '" + QString(a).replace("'", "'\\''") + "'";
+	cmd += " >> '" + QString(logfile).replace("'", "'\\''") + "' 2>&1 < /dev/null";
+
+	QProcess p;
+	p.setProgram("/bin/sh");
+	p.setArguments(QStringList() << "-c" << cmd);
+	p.setWorkingDirectory(QFileInfo(f).path());
+	QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+	env.insert("NIDB_JOBID", QString::number(id));
+	p.setProcessEnvironment(env);
+
+	qint64 pid;
+	if (!p.startDetached(&pid)) {
+		msg = "Unable to start local job [" + f + "]";
+		result = msg;
+		return false;
+	}
+
+	jobid = int(pid);
+	result = QString("Started local job %1 [%2]").arg(jobid).arg(cmd);
+	msg = "Local job started successfully";
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- LocalJobRunning -------------------------------- */
+/* ---------------------------------------------------------- */
+/* check if a job started by SubmitLocalJob() is still alive  */
+/* ---------------------------------------------------------- */
+bool nidb::LocalJobRunning(int pid, qint64 id) {
+	if (pid < 1)
+		return false;
+
+	/* a process belonging to another user can't be read, so it can't be the job */
+	QFile f(QString("/proc/%1/environ").arg(pid));
+	if (!f.open(QIODevice::ReadOnly))
+		return false;
+	QList<QByteArray> env = f.readAll().split('\0');
+	f.close();
+
+	return env.contains("NIDB_JOBID=" + QByteArray::number(id));
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetMemInfo ------------------------------------- */
+/* ---------------------------------------------------------- */
+/* get a value from /proc/meminfo, such as MemTotal or        */
+/* MemAvailable, in MB. returns -1 if it can't be read        */
+/* ---------------------------------------------------------- */
+qint64 nidb::GetMemInfo(QString key) {
+	QFile f("/proc/meminfo");
+	if (!f.open(QIODevice::ReadOnly | QIODevice::Text))
+		return -1;
+
+	QStringList lines = QString(f.readAll()).split("\n");
+	f.close();
+	foreach (QString line, lines) {
+		QStringList parts = line.split(QRegularExpression("[:\\s]+"), Qt::SkipEmptyParts);
+		if ((parts.size() >= 2) && (parts[0] == key))
+			return parts[1].toLongLong()/1024;
+	}
+
+	return -1;
+}
+
+
 /* ---------------------------------------------------------- */
 /* --------- GetSQLComparison ------------------------------- */
 /* ---------------------------------------------------------- */
@@ -1821,71 +2862,137 @@ QString nidb::WrapText(QString s, int col) {
 /* ---------------------------------------------------------- */
 /* --------- ParseCSV --------------------------------------- */
 /* ---------------------------------------------------------- */
-/* this function handles most Excel compatible .csv formats
- * but it does not handle nested quotes, and must have a header
- * row */
-bool nidb::ParseCSV(QString csv, indexedHash &table, QStringList &columns, QString &msg) {
+/* parse RFC 4180 .csv data (quoted fields, "" escapes, line  */
+/* breaks inside quotes, LF or CRLF line endings) in a single */
+/* pass over the bytes. the first non-blank row is the header */
+/* and is lowercased. unquoted values are trimmed, and blank  */
+/* lines are skipped. rows with the wrong number of columns   */
+/* are kept, padded or cut to the header, but return false    */
+/* ---------------------------------------------------------- */
+bool nidb::ParseCSV(const char *data, qint64 size, csvTable &table, QString &msg) {
 
 	QStringList m;
 	bool ret(true);
-
-	/* get header row */
-	QStringList lines = csv.trimmed().split(QRegularExpression("[\\n\\r]"));
-
-	if (lines.size() > 1) {
-		QString header = lines.takeFirst();
-		QStringList cols = header.trimmed().toLower().split(QRegularExpression("\\s*,\\s*"));
-		columns = cols;
-
-		m << QString("Found [%1] columns").arg(cols.size());
-		/* remove the last column if it was blank, because the file contained an extra trailing comma */
-		if (cols.last() == "") {
-			cols.removeLast();
-			m << QString("Last column was blank, removing").arg(cols.size());
-		}
-
-		int numcols = cols.size();
-
-		int row = 0;
-		foreach (QString line, lines) {
-			QString buffer = "";
-			int col = 0;
-			bool inQuotes = false;
-			for (int i=0; i<line.size(); i++) {
-				QChar c = line.at(i);
-
-				/* determine if we're in quotes or not */
-				if (c == """") {
-					if (inQuotes)
-						inQuotes = false;
+	table = csvTable();
+
+	const char *p = data;
+	const char *end = data + size;
+
+	/* skip a UTF-8 byte order mark */
+	if ((size >= 3) && (memcmp(p, "\xEF\xBB\xBF", 3) == 0))
+		p += 3;
+
+	QVector<QString> row;
+	QByteArray scratch;
+	bool haveheader(false);
+	qint64 line(1);
+	int numcols(0);
+	while (p < end) {
+		row.clear();
+		qint64 rowline = line;
+		bool blank(true);
+
+		/* read the fields of one row */
+		while (true) {
+			while ((p < end) && ((*p == ' ') || (*p == '\t')))
+				p++;
+
+			QString value;
+			if ((p < end) && (*p == '"')) {
+				/* quoted field. copy the runs between quotes, and turn "" into " */
+				blank = false;
+				p++;
+				scratch.clear();
+				while (true) {
+					const char *q = static_cast<const char*>(memchr(p, '"', size_t(end - p)));
+					if (q == nullptr) {
+						m << QString("Error: quoted field starting on line [%1] is not closed").arg(rowline);
+						ret = false;
+						scratch.append(p, int(end - p));
+						p = end;
+						break;
+					}
+					line += std::count(p, q, '\n');
+					scratch.append(p, int(q - p));
+					p = q + 1;
+					if ((p < end) && (*p == '"')) {
+						scratch.append('"');
+						p++;
+					}
 					else
-						inQuotes = true;
-				}
-
-				/* check if we've hit the next comma, and therefor should end the previous variable */
-				if ((c == ",") && (!inQuotes)) {
-					table[row][cols[col]] = buffer.trimmed();
-
-					buffer = "";
-					col++;
+						break;
 				}
-				else {
-					buffer = QString("%1%2").arg(buffer).arg(c); /* make sure no null terminators end up in the string */
+				/* anything between the closing quote and the delimiter is kept, rather than lost */
+				const char *q = p;
+				while ((q < end) && (*q != ',') && (*q != '\n') && (*q != '\r'))
+					q++;
+				scratch.append(QByteArray(p, int(q - p)).trimmed());
+				p = q;
+				value = QString::fromUtf8(scratch);
+			}
+			else {
+				const char *q = p;
+				while ((q < end) && (*q != ',') && (*q != '\n') && (*q != '\r'))
+					q++;
+				const char *e = q;
+				while ((e > p) && ((*(e-1) == ' ') || (*(e-1) == '\t')))
+					e--;
+				if (e > p) {
+					blank = false;
+					value = QString::fromUtf8(p, int(e - p));
 				}
+				p = q;
+			}
+			row.append(value);
+
+			if ((p < end) && (*p == ',')) {
+				blank = false;
+				p++;
+				continue;
 			}
-			/* acquire the last column */
-			table[row][cols[col]] = buffer.trimmed();
-			buffer = "";
 
-			if ((col+1) != numcols) {
-				m << QString("Error: row [%1] has [%2] columns, but expecting [%3] columns").arg(row+1).arg(col+1).arg(numcols);
-				ret = false;
+			/* end of the row */
+			if ((p < end) && (*p == '\r'))
+				p++;
+			if ((p < end) && (*p == '\n'))
+				p++;
+			line++;
+			break;
+		}
+
+		if (blank)
+			continue;
+
+		if (!haveheader) {
+			for (int i=0; i<row.size(); i++)
+				table.columns.append(row[i].toLower());
+			m << QString("Found [%1] columns").arg(table.columns.size());
+			/* remove the last column if it was blank, because the file contained an extra trailing comma */
+			if ((table.columns.size() > 1) && (table.columns.last() == "")) {
+				table.columns.removeLast();
+				m << "Last column was blank, removing";
 			}
+			numcols = table.columns.size();
+			table.data.resize(numcols);
+			haveheader = true;
+			continue;
+		}
 
-			row++;
+		/* a trailing comma on a data row is the same blank column as on the header row */
+		int rowcols = row.size();
+		if ((rowcols == numcols + 1) && (row.last() == ""))
+			rowcols--;
+		if (rowcols != numcols) {
+			m << QString("Error: row [%1] has [%2] columns, but expecting [%3] columns").arg(table.numrows+1).arg(rowcols).arg(numcols);
+			ret = false;
 		}
-		m << QString("Processed [%1] data rows").arg(row);
+		for (int c=0; c<numcols; c++)
+			table.data[c].append((c < row.size()) ? row[c] : QString());
+		table.numrows++;
 	}
+
+	if (table.numrows > 0)
+		m << QString("Processed [%1] data rows").arg(table.numrows);
 	else {
 		ret = false;
 		m << ".csv file contained only one row. The csv must contain at least one header row and one data row";
@@ -1897,6 +3004,60 @@ bool nidb::ParseCSV(QString csv, indexedHash &table, QStringList &columns, QStri
 }
 
 
+/* ---------------------------------------------------------- */
+/* --------- ParseCSVFile ----------------------------------- */
+/* ---------------------------------------------------------- */
+/* parse a .csv file straight from a memory map of the file,  */
+/* so it is never copied into a QString                       */
+/* ---------------------------------------------------------- */
+bool nidb::ParseCSVFile(QString file, csvTable &table, QString &msg) {
+
+	QFile f(file);
+	if (!f.open(QIODevice::ReadOnly)) {
+		table = csvTable();
+		msg = "Unable to open [" + file + "]";
+		return false;
+	}
+
+	/* an empty file can't be mapped */
+	qint64 size = f.size();
+	if (size < 1)
+		return ParseCSV("", 0, table, msg);
+
+	uchar *data = f.map(0, size);
+	if (data == nullptr) {
+		QByteArray contents = f.readAll();
+		return ParseCSV(contents.constData(), contents.size(), table, msg);
+	}
+
+	bool ret = ParseCSV(reinterpret_cast<const char*>(data), size, table, msg);
+	f.unmap(data);
+
+	return ret;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ParseCSV --------------------------------------- */
+/* ---------------------------------------------------------- */
+/* row-indexed version, for callers that want a hash per row  */
+/* ---------------------------------------------------------- */
+bool nidb::ParseCSV(QString csv, indexedHash &table, QStringList &columns, QString &msg) {
+
+	QByteArray data = csv.toUtf8();
+	csvTable t;
+	bool ret = ParseCSV(data.constData(), data.size(), t, msg);
+
+	columns = t.columns;
+	table.clear();
+	for (int row=0; row<t.numrows; row++)
+		for (int c=0; c<t.columns.size(); c++)
+			table[row][t.columns[c]] = t.data[c][row];
+
+	return ret;
+}
+
+
 /* ------------------------------------------------- */
 /* --------- GetFileType --------------------------- */
 /* ------------------------------------------------- */
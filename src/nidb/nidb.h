@@ -34,6 +34,7 @@
 #include <QtSql>
 #include <QHostInfo>
 #include <QDirIterator>
+#include <functional>
 #include "SmtpMime"
 #include "gdcmReader.h"
 #include "gdcmWriter.h"
@@ -43,6 +44,23 @@
 
 typedef QHash <int, QHash<QString, QString>> indexedHash;
 
+/* a parsed .csv file, stored by column. the header names are lowercase and stored once, and the values are data[column][row] */
+struct csvTable {
+	QStringList columns;
+	QVector<QVector<QString>> data;
+	int numrows = 0;
+
+	int Column(const QString &name) const { return columns.indexOf(name); }
+	QString Value(int row, const QString &name) const { int c = columns.indexOf(name); return (c < 0) ? QString() : data[c][row]; }
+};
+
+/* one task of a cluster array job */
+struct clusterArrayTask {
+	qint64 id = -1; /* the caller's id for this task, such as the analysis id */
+	QString jobfile; /* the task's job file, as seen from the cluster */
+	QString logfile; /* where the task's output goes, as seen from the cluster */
+};
+
 class nidb
 {
 public:
@@ -82,10 +100,13 @@ public:
 	QString CreateCurrentDateTime(int format=1);
 	QString CreateLogDate();
 	QString SQLQuery(QSqlQuery &q, QString function, QString file, int line, bool d=false, bool batch=false);
+	void ResolveIDs(QString table, QString idcol, QString valcol, QStringList vals, QHash<QString, qint64> &cache);
 	QString WriteLog(QString msg, int wrap=0);
 	void AppendCustomLog(QString f, QString msg);
 	QString SystemCommand(QString s, bool detail=true, bool truncate=false);
+	QString SystemCommand(QString s, bool detail, bool truncate, int &exitcode);
 	bool SandboxedSystemCommand(QString s, QString dir, QString &output, QString timeout="00:05:00", bool detail=true, bool truncate=false);
+	bool SandboxedSystemCommandToLog(QString s, QString dir, QString logfile, int timeoutsec, int maxmemmb, int &exitcode, QString &msg);
 	QString GenerateRandomString(int n);
 	void SortQStringListNaturally(QStringList &s);
 	bool SendEmail(QString to, QString subject, QString body);
@@ -95,7 +116,12 @@ public:
 	QString JoinIntArray(QList<int> a, QString glue);
 	QList<int> SplitStringArrayToInt(QStringList a);
     QList<int> SplitStringToIntArray(QString a);
+	QString SSHOptions();
 	bool SubmitClusterJob(QString f, QString submithost, QString qsub, QString user, QString queue, QString &msg, int &jobid, QString &result);
+	bool SubmitClusterArrayJob(const QList<clusterArrayTask> &tasks, QString clustertype, QString jobname, QString localdir, QString clusterdir, int maxwalltime, QString submithost, QString qsub, QString user, QString queue, QString &msg, int &jobid, QString &result);
+	bool SubmitLocalJob(QString f, QString logfile, qint64 id, int numcpus, qint64 memmb, int maxwalltime, QString cgroup, QString &msg, int &jobid, QString &result);
+	bool LocalJobRunning(int pid, qint64 id);
+	qint64 GetMemInfo(QString key);
 	bool GetSQLComparison(QString c, QString &comp, int &num);
 	QStringList ShellWords(QString s);
 	bool IsInt(QString s);
@@ -103,6 +129,8 @@ public:
 	bool IsNumber(QString s);
 	QString WrapText(QString s, int col);
 	bool ParseCSV(QString csv, indexedHash &table, QStringList &columns, QString &msg);
+	static bool ParseCSV(const char *data, qint64 size, csvTable &table, QString &msg);
+	static bool ParseCSVFile(QString file, csvTable &table, QString &msg);
 
 	/* file and directory operations */
 	bool MakePath(QString p, QString &msg, bool perm777=true);
@@ -114,13 +142,23 @@ public:
 	bool RenameFile(QString filepathorig, QString filepathnew, bool force=true);
 	bool MoveFile(QString f, QString dir);
     void GetDirSizeAndFileCount(QString dir, int &c, qint64 &b, bool recurse=false);
+    void GetDirSizeAndMatches(QString dir, const QStringList &patterns, int &c, qint64 &b, QVector<bool> &found, bool recurse=true);
+	void GetIndexedDirSize(QString dir, int &c, qint64 &b);
+	void UpdateDirSizeIndex(QString dir, int c, qint64 b);
+	void AddToDirSizeIndex(QString dir, int &c, qint64 &b);
+	void RemoveFromDirSizeIndex(QString dir);
+	bool CopyFileNative(QString src, QString dst, QString &msg);
+	bool LinkFile(QString src, QString dst, bool symbolic, bool &linked, QString &msg);
+	bool CopyDir(QString indir, QString outdir, int numthreads, QString &msg, std::function<void(qint64, qint64)> progress = nullptr);
+	bool IsSameFilesystem(QString p1, QString p2);
+	bool RemoveDirThrottled(QString p, int numthreads, int maxrate, QString &msg, std::function<bool()> keepgoing = nullptr);
     //void GetDirectoryListing(QString dir, QStringList &files, QList<int> &sizes, bool recurse=false);
     QByteArray GetFileChecksum(const QString &fileName, QCryptographicHash::Algorithm hashAlgorithm);
 	bool chmod(QString f, QString perm);
     QString UnzipDirectory(QString dir, bool recurse=false);
 
 	/* DICOM functions */
-	bool ConvertDicom(QString filetype, QString indir, QString outdir, bool gzip, QString uid, QString studynum, QString seriesnum, QString datatype, int &numfilesconv, int &numfilesrenamed, QString &msg);
+	bool ConvertDicom(QString filetype, QString indir, QString outdir, bool gzip, QString uid, QString studynum, QString seriesnum, QString datatype, int &numfilesconv, int &numfilesrenamed, QString &msg, QString nidbdir = "");
 	bool BatchRenameFiles(QString dir, QString seriesnum, QString studynum, QString uid, int &numfilesrenamed, QString &msg);
 	bool IsDICOMFile(QString f);
 	bool AnonymizeDir(QString dir, int anonlevel, QString randstr1, QString randstr2);
@@ -0,0 +1,128 @@
+# sources and libraries shared by the nidb binary and the programs in tests/
+# paths are relative to this file, so it can be included from other directories
+
+SOURCES += \
+    $$PWD/analysis.cpp \
+    $$PWD/minipipeline.cpp \
+    $$PWD/moduleCluster.cpp \
+    $$PWD/moduleExport.cpp \
+    $$PWD/moduleFileIO.cpp \
+    $$PWD/moduleImport.cpp \
+    $$PWD/moduleImportUploaded.cpp \
+    $$PWD/moduleMRIQA.cpp \
+    $$PWD/moduleManager.cpp \
+    $$PWD/moduleMiniPipeline.cpp \
+    $$PWD/modulePipeline.cpp \
+    $$PWD/moduleQC.cpp \
+    $$PWD/moduleUpload.cpp \
+    $$PWD/nidb.cpp \
+    $$PWD/nifti.cpp \
+    $$PWD/pipeline.cpp \
+    $$PWD/remotenidbconnection.cpp \
+    $$PWD/series.cpp \
+    $$PWD/study.cpp \
+    $$PWD/subject.cpp
+
+HEADERS += \
+    $$PWD/analysis.h \
+    $$PWD/minipipeline.h \
+    $$PWD/moduleCluster.h \
+    $$PWD/moduleExport.h \
+    $$PWD/moduleFileIO.h \
+    $$PWD/moduleImport.h \
+    $$PWD/moduleImportUploaded.h \
+    $$PWD/moduleMRIQA.h \
+    $$PWD/moduleManager.h \
+    $$PWD/moduleMiniPipeline.h \
+    $$PWD/modulePipeline.h \
+    $$PWD/moduleQC.h \
+    $$PWD/moduleUpload.h \
+    $$PWD/nidb.h \
+    $$PWD/nifti.h \
+    $$PWD/pipeline.h \
+    $$PWD/remotenidbconnection.h \
+    $$PWD/series.h \
+    $$PWD/study.h \
+    $$PWD/subject.h
+
+
+# gdcm
+win32: {
+    GDCMBIN = C:/gdcmbin
+    GDCMSRC = C:/gdcm/Source
+    win32:CONFIG(release, debug|release): LIBS += -L$$GDCMBIN/bin/Release/
+    else:win32:CONFIG(debug, debug|release): LIBS += -L$$GDCMBIN/bin/Debug/
+    INCLUDEPATH += $$GDCMSRC/Attribute
+    INCLUDEPATH += $$GDCMSRC/Common
+    INCLUDEPATH += $$GDCMSRC/DataDictionary
+    INCLUDEPATH += $$GDCMSRC/DataStructureAndEncodingDefinition
+    INCLUDEPATH += $$GDCMSRC/InformationObjectDefinition
+    INCLUDEPATH += $$GDCMSRC/MediaStorageAndFileFormat
+    INCLUDEPATH += $$GDCMSRC/MessageExchangeDefinition
+    INCLUDEPATH += $$GDCMBIN/Source/Common # for gdcmConfigure.h
+    HEADERS += $$GDCMBIN/Source/Common/gdcmConfigure.h
+
+    LIBS += -lgdcmMSFF \
+        -lgdcmCommon \
+        -lgdcmDICT \
+        -lgdcmDSED \
+        -lgdcmIOD \
+        -lgdcmMEXD \
+        -lgdcmcharls \
+        -lgdcmexpat \
+        -lgdcmjpeg12 \
+        -lgdcmjpeg16 \
+        -lgdcmjpeg8 \
+        -lgdcmopenjp2 \
+        -lgdcmzlib \
+        -lsocketxx
+
+    # Location of SMTP Library
+    SMTPBIN = K:/bin/smtp-win
+    LIBS += -L$$SMTPBIN/release -lSMTPEmail
+    INCLUDEPATH += K:/src/smtp
+    DEPENDPATH += $$SMTPBIN
+    *msvc* { # visual studio spec filter
+        QMAKE_CXXFLAGS += -MP
+    }
+}
+unix: {
+    # Location of SMTP Library and header
+	INCLUDEPATH += $$PWD/../smtp
+    SMTPBIN = $$PWD/../../bin/smtp
+    LIBS += -L$$SMTPBIN/ -lSMTPEmail
+    INCLUDEPATH += $$SMTPBIN
+    DEPENDPATH += $$SMTPBIN
+
+    GDCMBIN = $$PWD/../../bin/gdcm
+    GDCMSRC = $$PWD/../gdcm/Source
+    LIBS += -L$$GDCMBIN/bin/
+    INCLUDEPATH += $$GDCMSRC/Attribute
+    INCLUDEPATH += $$GDCMSRC/Common
+    INCLUDEPATH += $$GDCMSRC/DataDictionary
+    INCLUDEPATH += $$GDCMSRC/DataStructureAndEncodingDefinition
+    INCLUDEPATH += $$GDCMSRC/InformationObjectDefinition
+    INCLUDEPATH += $$GDCMSRC/MediaStorageAndFileFormat
+    INCLUDEPATH += $$GDCMSRC/MessageExchangeDefinition
+    INCLUDEPATH += $$GDCMBIN/Source/Common # for gdcmConfigure.h
+    HEADERS += $$GDCMBIN/Source/Common/gdcmConfigure.h
+
+    LIBS += -lgdcmMSFF \
+        -lgdcmCommon \
+        -lgdcmDICT \
+        -lgdcmDSED \
+        -lgdcmIOD \
+        -lgdcmMEXD \
+        -lgdcmcharls \
+        -lgdcmexpat \
+        -lgdcmjpeg12 \
+        -lgdcmjpeg16 \
+        -lgdcmjpeg8 \
+        -lgdcmopenjp2 \
+        -lgdcmuuid \
+        -lgdcmzlib \
+        -lsocketxx
+
+    # system zlib, for reading .nii.gz files. gdcmzlib is built with mangled symbol names
+    LIBS += -lz
+}
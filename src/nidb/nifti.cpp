@@ -0,0 +1,1272 @@
+/* ------------------------------------------------------------------------------
+  NIDB nifti.cpp
+  Copyright (C) 2004 - 2020
+  Gregory A Book <gregory.book@hhchealth.org> <gregory.a.book@gmail.com>
+  Olin Neuropsychiatry Research Center, Hartford Hospital
+  ------------------------------------------------------------------------------
+  GPLv3 License:
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  ------------------------------------------------------------------------------ */
+
+#include "nifti.h"
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <zlib.h>
+#include <mutex>
+#include <map>
+#include <cstdlib>
+#include "gdcmImageReader.h"
+#include "gdcmIPPSorter.h"
+#include "gdcmScanner.h"
+#include "gdcmSplitMosaicFilter.h"
+
+/* NIfTI datatype codes */
+#define NIFTI_UINT8    2
+#define NIFTI_INT16    4
+#define NIFTI_INT32    8
+#define NIFTI_FLOAT32  16
+#define NIFTI_FLOAT64  64
+#define NIFTI_INT8     256
+#define NIFTI_UINT16   512
+#define NIFTI_UINT32   768
+#define NIFTI_INT64    1024
+#define NIFTI_UINT64   1280
+
+/* number of accumulators used in the inner loops. the fixed width lets the compiler vectorize the reductions */
+#define NIFTI_LANES 8
+
+/* number of bins fslstats uses when calculating entropy */
+#define NIFTI_ENTROPY_BINS 1000
+
+/* voxels per block in the temporal statistics. small enough that a block's accumulators stay in cache */
+#define NIFTI_TEMPORAL_BLOCK 16384
+
+
+/* one DICOM file of a series, as found by the header scan */
+struct dicomFile {
+	std::string file;
+	double ipp[3] = {0.0, 0.0, 0.0};
+	double dist = 0.0; /* position along the slice normal */
+	int acqnum = 0;
+	int instnum = 0;
+	double slope = 1.0;
+	double inter = 0.0;
+	qint64 slice = 0; /* first output slice this file fills */
+};
+
+
+/* ---------------------------------------------------------- */
+/* --------- ParseDS ---------------------------------------- */
+/* ---------------------------------------------------------- */
+/* parse up to n backslash separated decimal strings. returns */
+/* the number of values found                                 */
+/* ---------------------------------------------------------- */
+static int ParseDS(const char *v, double *out, int n) {
+	int i = 0;
+	while ((v != nullptr) && (i < n)) {
+		char *end;
+		out[i] = strtod(v, &end);
+		if (end == v)
+			break;
+		i++;
+		v = strchr(end, '\\');
+		if (v != nullptr)
+			v++;
+	}
+	return i;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- SwapBytes -------------------------------------- */
+/* ---------------------------------------------------------- */
+template <typename T> static inline T SwapBytes(T v) {
+	T r;
+	const char *s = reinterpret_cast<const char*>(&v);
+	char *d = reinterpret_cast<char*>(&r);
+	for (size_t i=0; i<sizeof(T); i++)
+		d[i] = s[sizeof(T)-1-i];
+	return r;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ReadValue -------------------------------------- */
+/* ---------------------------------------------------------- */
+template <typename T> static inline T ReadValue(const char *p, bool swap) {
+	T v;
+	memcpy(&v, p, sizeof(T));
+	return swap ? SwapBytes(v) : v;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ConvertVoxels ---------------------------------- */
+/* ---------------------------------------------------------- */
+template <typename T> static void ConvertVoxels(const uchar *src, qint64 n, float *dst, bool swap) {
+	if (swap) {
+		for (qint64 i=0; i<n; i++) {
+			T v;
+			memcpy(&v, src + i*qint64(sizeof(T)), sizeof(T));
+			dst[i] = float(SwapBytes(v));
+		}
+	}
+	else {
+		for (qint64 i=0; i<n; i++) {
+			T v;
+			memcpy(&v, src + i*qint64(sizeof(T)), sizeof(T));
+			dst[i] = float(v);
+		}
+	}
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- MinMax ----------------------------------------- */
+/* ---------------------------------------------------------- */
+static void MinMax(const float *v, qint64 n, float &min, float &max) {
+	float mn[NIFTI_LANES], mx[NIFTI_LANES];
+	for (int l=0; l<NIFTI_LANES; l++)
+		mn[l] = mx[l] = v[0];
+
+	qint64 i = 0;
+	for (; i+NIFTI_LANES<=n; i+=NIFTI_LANES) {
+		for (int l=0; l<NIFTI_LANES; l++) {
+			mn[l] = std::min(mn[l], v[i+l]);
+			mx[l] = std::max(mx[l], v[i+l]);
+		}
+	}
+	for (; i<n; i++) {
+		mn[0] = std::min(mn[0], v[i]);
+		mx[0] = std::max(mx[0], v[i]);
+	}
+
+	min = mn[0];
+	max = mx[0];
+	for (int l=1; l<NIFTI_LANES; l++) {
+		min = std::min(min, mn[l]);
+		max = std::max(max, mx[l]);
+	}
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- nifti ------------------------------------------ */
+/* ---------------------------------------------------------- */
+nifti::nifti()
+{
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- nifti ------------------------------------------ */
+/* ---------------------------------------------------------- */
+nifti::nifti(QString f, bool headeronly)
+{
+	Read(f, msg, headeronly);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ~nifti ----------------------------------------- */
+/* ---------------------------------------------------------- */
+nifti::~nifti()
+{
+	Close();
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- Close ------------------------------------------ */
+/* ---------------------------------------------------------- */
+void nifti::Close() {
+	if (file.isOpen())
+		file.close(); /* also unmaps the file */
+	buffer.clear();
+	buffer.shrink_to_fit();
+	data = nullptr;
+	isValid = false;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- Read ------------------------------------------- */
+/* ---------------------------------------------------------- */
+/* read a NIfTI-1 or NIfTI-2 file. uncompressed files are     */
+/* memory mapped, .gz files are decompressed into memory.     */
+/* headeronly skips the image data                            */
+/* ---------------------------------------------------------- */
+bool nifti::Read(QString f, QString &m, bool headeronly) {
+	Close();
+	filename = f;
+
+	if (f.endsWith(".gz", Qt::CaseInsensitive)) {
+		gzFile gz = gzopen(f.toLocal8Bit().constData(), "rb");
+		if (gz == nullptr) {
+			m = "Unable to open [" + f + "]";
+			return false;
+		}
+		gzbuffer(gz, 1024*1024);
+
+		/* read enough for either header version, then size the buffer from the header */
+		char hdr[540];
+		int hdrsize = gzread(gz, hdr, sizeof(hdr));
+		if ((hdrsize < 348) || (!ParseHeader(hdr, hdrsize, m))) {
+			if (hdrsize < 348) m = "File [" + f + "] is too small to be a NIfTI file";
+			gzclose(gz);
+			return false;
+		}
+		if (headeronly) {
+			gzclose(gz);
+			BuildAffine();
+			isValid = true;
+			return true;
+		}
+
+		qint64 total = voxoffset + VoxelsPerVolume()*NumVolumes()*(bitpix/8);
+		buffer.resize(size_t(std::max(total, qint64(hdrsize))));
+		memcpy(buffer.data(), hdr, size_t(hdrsize));
+		qint64 pos = hdrsize;
+		while (pos < total) {
+			unsigned chunk = unsigned(std::min(total - pos, qint64(1) << 30));
+			int r = gzread(gz, buffer.data() + pos, chunk);
+			if (r <= 0)
+				break;
+			pos += r;
+		}
+		gzclose(gz);
+
+		if (pos < total) {
+			m = QString("File [%1] is truncated. Expected %2 bytes, read %3").arg(f).arg(total).arg(pos);
+			Close();
+			return false;
+		}
+		data = buffer.data();
+	}
+	else {
+		file.setFileName(f);
+		if (!file.open(QIODevice::ReadOnly)) {
+			m = "Unable to open [" + f + "] because of error [" + file.errorString() + "]";
+			return false;
+		}
+		qint64 size = file.size();
+		if (size < 348) {
+			m = "File [" + f + "] is too small to be a NIfTI file";
+			file.close();
+			return false;
+		}
+
+		data = file.map(0, size);
+		if (data == nullptr) {
+			/* mmap can fail on some network filesystems, so fall back to reading the whole file */
+			buffer.resize(size_t(size));
+			if (file.read(reinterpret_cast<char*>(buffer.data()), size) != size) {
+				m = "Unable to read [" + f + "] because of error [" + file.errorString() + "]";
+				Close();
+				return false;
+			}
+			data = buffer.data();
+		}
+
+		if (!ParseHeader(reinterpret_cast<const char*>(data), size, m)) {
+			Close();
+			return false;
+		}
+
+		qint64 total = voxoffset + VoxelsPerVolume()*NumVolumes()*(bitpix/8);
+		if (size < total) {
+			m = QString("File [%1] is truncated. Expected %2 bytes, found %3").arg(f).arg(total).arg(size);
+			Close();
+			return false;
+		}
+	}
+
+	BuildAffine();
+	isValid = true;
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- Write ------------------------------------------ */
+/* ---------------------------------------------------------- */
+/* write float volumes as NIfTI-1, using this image's voxel   */
+/* size and orientation. vols holds nvols volumes of          */
+/* VoxelsPerVolume() values. gzipped if f ends in .gz         */
+/* ---------------------------------------------------------- */
+bool nifti::Write(QString f, const float *vols, qint64 nvols, QString &m) const {
+	return WriteImage(f, NIFTI_FLOAT32, 32, 1.0, 0.0, vols, nvols, m);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- Write ------------------------------------------ */
+/* ---------------------------------------------------------- */
+/* write the whole image as NIfTI-1 in its own datatype. used */
+/* to hand an image assembled in memory to external programs  */
+/* ---------------------------------------------------------- */
+bool nifti::Write(QString f, QString &m) const {
+	if ((!isValid) || (data == nullptr)) {
+		m = "File [" + filename + "] has not been read";
+		return false;
+	}
+
+	/* the header is always written in native byte order, so swapped data goes out as floats */
+	if (swap) {
+		qint64 nvox = VoxelsPerVolume();
+		std::vector<float> vols(static_cast<size_t>(nvox*NumVolumes()));
+		for (qint64 t=0; t<NumVolumes(); t++)
+			if (!GetVolume(t, vols.data() + t*nvox)) {
+				m = "Unable to read image data from [" + filename + "]";
+				return false;
+			}
+		return Write(f, vols.data(), NumVolumes(), m);
+	}
+
+	return WriteImage(f, datatype, bitpix, sclslope, sclinter, data + voxoffset, NumVolumes(), m);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- WriteImage ------------------------------------- */
+/* ---------------------------------------------------------- */
+bool nifti::WriteImage(QString f, int dt, int bp, double slope, double inter, const void *vols, qint64 nvols, QString &m) const {
+	if ((dim[1] > 32767) || (dim[2] > 32767) || (dim[3] > 32767) || (nvols > 32767) || (nvols < 1)) {
+		m = QString("Unable to write [%1]. Dimensions are too large for a NIfTI-1 file").arg(f);
+		return false;
+	}
+
+	/* 348 byte header plus the 4 byte extension flag */
+	char hdr[352];
+	memset(hdr, 0, sizeof(hdr));
+	auto put = [&hdr](int offset, const void *v, size_t len) { memcpy(hdr + offset, v, len); };
+
+	qint32 sizeofhdr = 348;
+	put(0, &sizeofhdr, 4);
+	qint16 dims[8] = {qint16((nvols > 1) ? 4 : 3), qint16(dim[1]), qint16(dim[2]), qint16(dim[3]), qint16(nvols), 1, 1, 1};
+	put(40, dims, sizeof(dims));
+	qint16 dtype = qint16(dt), bpix = qint16(bp);
+	put(70, &dtype, 2);
+	put(72, &bpix, 2);
+	float pd[8];
+	for (int i=0; i<8; i++)
+		pd[i] = float(pixdim[i]);
+	pd[0] = (pixdim[0] < 0.0) ? -1.0f : 1.0f;
+	put(76, pd, sizeof(pd));
+	float vo = 352.0f, scl[2] = {float(slope), float(inter)};
+	put(108, &vo, 4);
+	put(112, scl, sizeof(scl));
+	hdr[123] = char(xyztunits & 0xFF);
+	qint16 qc = qint16(qformcode), sc = qint16(sformcode);
+	put(252, &qc, 2);
+	put(254, &sc, 2);
+	for (int i=0; i<3; i++) {
+		float q = float(quatern[i]), o = float(qoffset[i]);
+		put(256 + 4*i, &q, 4);
+		put(268 + 4*i, &o, 4);
+	}
+	for (int r=0; r<3; r++) {
+		for (int c=0; c<4; c++) {
+			float v = float(srow[r][c]);
+			put(280 + 16*r + 4*c, &v, 4);
+		}
+	}
+	memcpy(hdr + 344, "n+1", 4);
+
+	qint64 datasize = VoxelsPerVolume()*nvols*(bp/8);
+	const char *p = reinterpret_cast<const char*>(vols);
+
+	if (f.endsWith(".gz", Qt::CaseInsensitive)) {
+		gzFile gz = gzopen(f.toLocal8Bit().constData(), "wb");
+		if (gz == nullptr) {
+			m = "Unable to open [" + f + "] for writing";
+			return false;
+		}
+		gzbuffer(gz, 1024*1024);
+		bool ok = (gzwrite(gz, hdr, sizeof(hdr)) == int(sizeof(hdr)));
+		for (qint64 pos = 0; ok && (pos < datasize); ) {
+			unsigned chunk = unsigned(std::min(datasize - pos, qint64(1) << 30));
+			ok = (gzwrite(gz, p + pos, chunk) == int(chunk));
+			pos += chunk;
+		}
+		if ((gzclose(gz) != Z_OK) || (!ok)) {
+			m = "Error writing [" + f + "]";
+			return false;
+		}
+	}
+	else {
+		QFile out(f);
+		if (!out.open(QIODevice::WriteOnly)) {
+			m = "Unable to open [" + f + "] for writing because of error [" + out.errorString() + "]";
+			return false;
+		}
+		if ((out.write(hdr, sizeof(hdr)) != qint64(sizeof(hdr))) || (out.write(p, datasize) != datasize)) {
+			m = "Error writing [" + f + "] [" + out.errorString() + "]";
+			out.close();
+			return false;
+		}
+		out.close();
+	}
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ReadDicom -------------------------------------- */
+/* ---------------------------------------------------------- */
+/* assemble the image in memory from the DICOM files of one   */
+/* series, instead of converting to NIfTI and reading that    */
+/* back. slices are ordered with IPPSorter, Siemens mosaics   */
+/* are split with SplitMosaicFilter, and the files are        */
+/* decoded in parallel. 16-bit data without rescaling is kept */
+/* as is, anything else is stored as scaled floats. the       */
+/* orientation is stored in the sform, in NIfTI (RAS) space   */
+/* ---------------------------------------------------------- */
+bool nifti::ReadDicom(QStringList files, int numthreads, QString &m) {
+	Close();
+	if (files.isEmpty()) {
+		m = "No DICOM files to read";
+		return false;
+	}
+	filename = files[0].left(files[0].lastIndexOf('/'));
+
+	const gdcm::Tag timagetype(0x0008,0x0008), tthickness(0x0018,0x0050), ttr(0x0018,0x0080), tspacing(0x0018,0x0088);
+	const gdcm::Tag tacqnum(0x0020,0x0012), tinstnum(0x0020,0x0013), tipp(0x0020,0x0032), tiop(0x0020,0x0037);
+	const gdcm::Tag tsamples(0x0028,0x0002), tframes(0x0028,0x0008), trows(0x0028,0x0010), tcols(0x0028,0x0011), tpixelspacing(0x0028,0x0030);
+	const gdcm::Tag tbits(0x0028,0x0100), tpixrep(0x0028,0x0103), tintercept(0x0028,0x1052), tslope(0x0028,0x1053);
+
+	/* header scan. the scanner stops reading each file before the pixel data */
+	std::vector<std::string> filenames;
+	for (int i=0; i<files.size(); i++)
+		filenames.push_back(files[i].toStdString());
+
+	gdcm::Scanner scanner;
+	for (const gdcm::Tag &t : {timagetype, tthickness, ttr, tspacing, tacqnum, tinstnum, tipp, tiop, tsamples, tframes, trows, tcols, tpixelspacing, tbits, tpixrep, tintercept, tslope})
+		scanner.AddTag(t);
+	if (!scanner.Scan(filenames)) {
+		m = "Unable to scan the DICOM headers in [" + filename + "]";
+		return false;
+	}
+	auto value = [&scanner](const std::string &f, const gdcm::Tag &t) { return scanner.GetValue(f.c_str(), t); };
+	auto intvalue = [&value](const std::string &f, const gdcm::Tag &t, int def) { const char *v = value(f, t); return (v == nullptr) ? def : atoi(v); };
+
+	/* every image must have the same size, pixel format, and orientation */
+	std::vector<dicomFile> dcms;
+	int rows(0), cols(0), bits(0), pixrep(0);
+	double iop[6], normal[3], pixelspacing[2] = {1.0, 1.0};
+	bool mosaic(false), rescaled(false);
+	for (const std::string &f : filenames) {
+		dicomFile d;
+		double fiop[6];
+		if ((!scanner.IsKey(f.c_str())) || (ParseDS(value(f, tipp), d.ipp, 3) != 3) || (ParseDS(value(f, tiop), fiop, 6) != 6))
+			continue; /* not DICOM, or an image without geometry */
+
+		if (intvalue(f, tframes, 1) > 1) {
+			m = "Multi-frame DICOM files are not supported [" + QString::fromStdString(f) + "]";
+			return false;
+		}
+		if (intvalue(f, tsamples, 1) != 1) {
+			m = "Color DICOM files are not supported [" + QString::fromStdString(f) + "]";
+			return false;
+		}
+
+		if (dcms.empty()) {
+			rows = intvalue(f, trows, 0);
+			cols = intvalue(f, tcols, 0);
+			bits = intvalue(f, tbits, 0);
+			pixrep = intvalue(f, tpixrep, 0);
+			memcpy(iop, fiop, sizeof(iop));
+			normal[0] = iop[1]*iop[5] - iop[2]*iop[4];
+			normal[1] = iop[2]*iop[3] - iop[0]*iop[5];
+			normal[2] = iop[0]*iop[4] - iop[1]*iop[3];
+			ParseDS(value(f, tpixelspacing), pixelspacing, 2);
+			const char *imagetype = value(f, timagetype);
+			mosaic = (imagetype != nullptr) && (strstr(imagetype, "MOSAIC") != nullptr);
+		}
+		else if ((intvalue(f, trows, 0) != rows) || (intvalue(f, tcols, 0) != cols) || (intvalue(f, tbits, 0) != bits) || (intvalue(f, tpixrep, 0) != pixrep)) {
+			m = "Image size or pixel format changes within the series [" + QString::fromStdString(f) + "]";
+			return false;
+		}
+		else {
+			for (int i=0; i<6; i++)
+				if (fabs(fiop[i] - iop[i]) > 1e-4) {
+					m = "Image orientation changes within the series [" + QString::fromStdString(f) + "]";
+					return false;
+				}
+		}
+
+		/* read from the header, since gdcm ignores the rescale tags in MR images */
+		ParseDS(value(f, tslope), &d.slope, 1);
+		ParseDS(value(f, tintercept), &d.inter, 1);
+		if ((d.slope != 1.0) || (d.inter != 0.0))
+			rescaled = true;
+
+		d.file = f;
+		d.dist = normal[0]*d.ipp[0] + normal[1]*d.ipp[1] + normal[2]*d.ipp[2];
+		d.acqnum = intvalue(f, tacqnum, 0);
+		d.instnum = intvalue(f, tinstnum, 0);
+		dcms.push_back(d);
+	}
+	if ((dcms.empty()) || (rows < 1) || (cols < 1)) {
+		m = "No DICOM images found in [" + filename + "]";
+		return false;
+	}
+
+	double dx = (pixelspacing[1] > 0.0) ? pixelspacing[1] : 1.0;
+	double dy = (pixelspacing[0] > 0.0) ? pixelspacing[0] : 1.0;
+	double thickness(0.0), spacing(0.0), tr(0.0);
+	ParseDS(value(dcms[0].file, tthickness), &thickness, 1);
+	ParseDS(value(dcms[0].file, tspacing), &spacing, 1);
+	ParseDS(value(dcms[0].file, ttr), &tr, 1);
+
+	auto bytime = [](const dicomFile &a, const dicomFile &b) { return (a.acqnum != b.acqnum) ? (a.acqnum < b.acqnum) : (a.instnum < b.instnum); };
+
+	/* the files to decode */
+	std::vector<dicomFile> tasks;
+	qint64 nx(cols), ny(rows), nz(1), nt(1);
+	double dz(0.0), origin[3];
+
+	if (mosaic) {
+		/* Siemens mosaic. each file is a whole volume, so the files are the timepoints */
+		std::sort(dcms.begin(), dcms.end(), bytime);
+
+		gdcm::ImageReader reader;
+		reader.SetFileName(dcms[0].file.c_str());
+		if (!reader.Read()) {
+			m = "Unable to read [" + QString::fromStdString(dcms[0].file) + "]";
+			return false;
+		}
+		gdcm::SplitMosaicFilter filter;
+		filter.SetImage(reader.GetImage());
+		filter.SetFile(reader.GetFile());
+		unsigned int mdims[3];
+		if (!filter.ComputeMOSAICDimensions(mdims)) {
+			m = "Unable to get the mosaic dimensions from [" + QString::fromStdString(dcms[0].file) + "]";
+			return false;
+		}
+		double snv[3];
+		bool inverted(false);
+		filter.ComputeMOSAICSliceNormal(snv, inverted);
+
+		nx = mdims[0];
+		ny = mdims[1];
+		nz = mdims[2];
+		nt = qint64(dcms.size());
+		dz = (spacing > 0.0) ? spacing : thickness;
+
+		/* the mosaic position is the corner of the whole tiled image. move it to the corner of the first tile, and
+		   when the slices were acquired against the normal the split reverses them, so the first slice is the last tile */
+		for (int i=0; i<3; i++) {
+			origin[i] = dcms[0].ipp[i] + iop[i]*dx*(cols - nx)/2.0 + iop[i+3]*dy*(rows - ny)/2.0;
+			if (inverted)
+				origin[i] -= normal[i]*dz*(nz - 1);
+		}
+
+		for (qint64 t=0; t<nt; t++) {
+			tasks.push_back(dcms[size_t(t)]);
+			tasks.back().slice = t*nz;
+		}
+	}
+	else {
+		/* one slice per file. files at the same position are the timepoints of that slice */
+		std::sort(dcms.begin(), dcms.end(), [](const dicomFile &a, const dicomFile &b) { return a.dist < b.dist; });
+		std::vector<std::vector<dicomFile>> positions;
+		for (const dicomFile &d : dcms) {
+			if ((positions.empty()) || (d.dist - positions.back()[0].dist > 0.01))
+				positions.push_back(std::vector<dicomFile>());
+			positions.back().push_back(d);
+		}
+		nz = qint64(positions.size());
+		nt = qint64(positions[0].size());
+		for (auto &p : positions) {
+			if (qint64(p.size()) != nt) {
+				m = QString("Slice positions in [%1] have different numbers of images (%2 and %3). The series may be incomplete").arg(filename).arg(nt).arg(p.size());
+				return false;
+			}
+			std::sort(p.begin(), p.end(), bytime);
+		}
+
+		/* slice order and spacing, from the first timepoint of each slice */
+		std::vector<std::string> firsts;
+		std::map<std::string, size_t> slicenum;
+		for (size_t z=0; z<positions.size(); z++) {
+			firsts.push_back(positions[z][0].file);
+			slicenum[positions[z][0].file] = z;
+		}
+		gdcm::IPPSorter sorter;
+		sorter.SetComputeZSpacing(true);
+		sorter.SetZSpacingTolerance(1e-3);
+		if ((!sorter.Sort(firsts)) || (sorter.GetFilenames().size() != firsts.size())) {
+			m = "Unable to sort the slices in [" + filename + "] by position";
+			return false;
+		}
+		std::vector<std::vector<dicomFile>> sorted;
+		for (const std::string &f : sorter.GetFilenames())
+			sorted.push_back(positions[slicenum[f]]);
+		positions.swap(sorted);
+
+		/* IPPSorter leaves the spacing at 0 when it is irregular or there is only one slice */
+		dz = sorter.GetZSpacing();
+		if (dz <= 0.0)
+			dz = (nz > 1) ? (positions.back()[0].dist - positions[0][0].dist)/double(nz - 1) : ((spacing > 0.0) ? spacing : thickness);
+
+		for (int i=0; i<3; i++)
+			origin[i] = positions[0][0].ipp[i];
+
+		for (qint64 t=0; t<nt; t++)
+			for (qint64 z=0; z<nz; z++) {
+				tasks.push_back(positions[size_t(z)][size_t(t)]);
+				tasks.back().slice = t*nz + z;
+			}
+	}
+	if (dz <= 0.0)
+		dz = 1.0;
+
+	/* header */
+	version = 1;
+	dim[0] = (nt > 1) ? 4 : 3;
+	dim[1] = nx;
+	dim[2] = ny;
+	dim[3] = nz;
+	dim[4] = nt;
+	dim[5] = dim[6] = dim[7] = 1;
+	pixdim[0] = 1.0;
+	pixdim[1] = dx;
+	pixdim[2] = dy;
+	pixdim[3] = dz;
+	pixdim[4] = tr/1000.0;
+	xyztunits = 2 | 8; /* mm and seconds */
+	bool native = (bits == 16) && (!rescaled);
+	datatype = native ? (pixrep ? NIFTI_INT16 : NIFTI_UINT16) : NIFTI_FLOAT32;
+	bitpix = native ? 16 : 32;
+	voxoffset = 0;
+	sclslope = 1.0;
+	sclinter = 0.0;
+	swap = false;
+
+	/* DICOM is LPS and NIfTI is RAS, so x and y are negated */
+	qformcode = 0;
+	sformcode = 1;
+	for (int r=0; r<3; r++) {
+		double sign = (r < 2) ? -1.0 : 1.0;
+		srow[r][0] = sign*iop[r]*dx;
+		srow[r][1] = sign*iop[r+3]*dy;
+		srow[r][2] = sign*normal[r]*dz;
+		srow[r][3] = sign*origin[r];
+	}
+
+	/* decode the pixel data in parallel */
+	qint64 slicevox = nx*ny;
+	qint64 taskvox = mosaic ? slicevox*nz : slicevox;
+	qint64 bytes = bitpix/8;
+	buffer.resize(size_t(slicevox*nz*nt*bytes));
+
+	if (numthreads < 1) numthreads = 1;
+	if (size_t(numthreads) > tasks.size()) numthreads = int(tasks.size());
+
+	std::atomic<size_t> next(0);
+	std::atomic<bool> failed(false);
+	std::mutex mtx;
+	QString error;
+	auto worker = [&]() {
+		std::vector<char> pix;
+		size_t i;
+		while (((i = next++) < tasks.size()) && (!failed)) {
+			QString err;
+			gdcm::ImageReader reader;
+			gdcm::SplitMosaicFilter filter;
+			reader.SetFileName(tasks[i].file.c_str());
+			const gdcm::Image *image = nullptr;
+			if (!reader.Read())
+				err = "Unable to read";
+			else if (mosaic) {
+				filter.SetImage(reader.GetImage());
+				filter.SetFile(reader.GetFile());
+				if (filter.Split())
+					image = &filter.GetImage();
+				else
+					err = "Unable to split the mosaic in";
+			}
+			else
+				image = &reader.GetImage();
+
+			if (image != nullptr) {
+				const gdcm::PixelFormat &pf = image->GetPixelFormat();
+				unsigned long len = image->GetBufferLength();
+				uchar *dst = buffer.data() + tasks[i].slice*slicevox*bytes;
+				pix.resize(len);
+				if (qint64(len) != taskvox*qint64(pf.GetPixelSize()))
+					err = "Unexpected image size in";
+				else if (!image->GetBuffer(pix.data()))
+					err = "Unable to decode the pixel data in";
+				else if (native) {
+					if ((pf.GetScalarType() == gdcm::PixelFormat::UINT16) || (pf.GetScalarType() == gdcm::PixelFormat::INT16))
+						memcpy(dst, pix.data(), len);
+					else
+						err = "Unexpected pixel format in";
+				}
+				else {
+					const uchar *src = reinterpret_cast<const uchar*>(pix.data());
+					float *out = reinterpret_cast<float*>(dst);
+					switch (pf.GetScalarType()) {
+						case gdcm::PixelFormat::UINT8: ConvertVoxels<quint8>(src, taskvox, out, false); break;
+						case gdcm::PixelFormat::INT8: ConvertVoxels<qint8>(src, taskvox, out, false); break;
+						case gdcm::PixelFormat::UINT16: ConvertVoxels<quint16>(src, taskvox, out, false); break;
+						case gdcm::PixelFormat::INT16: ConvertVoxels<qint16>(src, taskvox, out, false); break;
+						case gdcm::PixelFormat::UINT32: ConvertVoxels<quint32>(src, taskvox, out, false); break;
+						case gdcm::PixelFormat::INT32: ConvertVoxels<qint32>(src, taskvox, out, false); break;
+						case gdcm::PixelFormat::FLOAT32: ConvertVoxels<float>(src, taskvox, out, false); break;
+						case gdcm::PixelFormat::FLOAT64: ConvertVoxels<double>(src, taskvox, out, false); break;
+						default: err = "Unsupported pixel format in";
+					}
+					double slope = tasks[i].slope, inter = tasks[i].inter;
+					if ((err.isEmpty()) && ((slope != 1.0) || (inter != 0.0)))
+						for (qint64 j=0; j<taskvox; j++)
+							out[j] = float(out[j]*slope + inter);
+				}
+			}
+
+			if (!err.isEmpty()) {
+				std::lock_guard<std::mutex> lock(mtx);
+				if (!failed)
+					error = err + " [" + QString::fromStdString(tasks[i].file) + "]";
+				failed = true;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i=1; i<numthreads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &th : threads)
+		th.join();
+
+	if (failed) {
+		m = error;
+		Close();
+		return false;
+	}
+
+	data = buffer.data();
+	BuildAffine();
+	isValid = true;
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ParseHeader ------------------------------------ */
+/* ---------------------------------------------------------- */
+bool nifti::ParseHeader(const char *hdr, qint64 size, QString &m) {
+
+	/* the header size doubles as the byte order and version check */
+	qint32 sizeofhdr = ReadValue<qint32>(hdr, false);
+	swap = false;
+	if ((sizeofhdr != 348) && (sizeofhdr != 540)) {
+		sizeofhdr = SwapBytes(sizeofhdr);
+		swap = true;
+	}
+
+	if (sizeofhdr == 348) {
+		version = 1;
+		if ((memcmp(hdr + 344, "ni1", 4) == 0)) {
+			m = "File [" + filename + "] is a .hdr/.img pair, which is not supported";
+			return false;
+		}
+		if ((memcmp(hdr + 344, "n+1", 4) != 0)) {
+			m = "File [" + filename + "] does not have a valid NIfTI-1 magic string";
+			return false;
+		}
+
+		for (int i=0; i<8; i++) {
+			dim[i] = ReadValue<qint16>(hdr + 40 + 2*i, swap);
+			pixdim[i] = ReadValue<float>(hdr + 76 + 4*i, swap);
+		}
+		datatype = ReadValue<qint16>(hdr + 70, swap);
+		bitpix = ReadValue<qint16>(hdr + 72, swap);
+		voxoffset = qint64(ReadValue<float>(hdr + 108, swap));
+		sclslope = ReadValue<float>(hdr + 112, swap);
+		sclinter = ReadValue<float>(hdr + 116, swap);
+		xyztunits = quint8(hdr[123]);
+		qformcode = ReadValue<qint16>(hdr + 252, swap);
+		sformcode = ReadValue<qint16>(hdr + 254, swap);
+		for (int i=0; i<3; i++) {
+			quatern[i] = ReadValue<float>(hdr + 256 + 4*i, swap);
+			qoffset[i] = ReadValue<float>(hdr + 268 + 4*i, swap);
+		}
+		for (int r=0; r<3; r++)
+			for (int c=0; c<4; c++)
+				srow[r][c] = ReadValue<float>(hdr + 280 + 16*r + 4*c, swap);
+	}
+	else if ((sizeofhdr == 540) && (size >= 540)) {
+		version = 2;
+		if ((memcmp(hdr + 4, "n+2", 4) != 0)) {
+			m = "File [" + filename + "] does not have a valid NIfTI-2 magic string";
+			return false;
+		}
+
+		datatype = ReadValue<qint16>(hdr + 12, swap);
+		bitpix = ReadValue<qint16>(hdr + 14, swap);
+		for (int i=0; i<8; i++) {
+			dim[i] = ReadValue<qint64>(hdr + 16 + 8*i, swap);
+			pixdim[i] = ReadValue<double>(hdr + 104 + 8*i, swap);
+		}
+		voxoffset = ReadValue<qint64>(hdr + 168, swap);
+		sclslope = ReadValue<double>(hdr + 176, swap);
+		sclinter = ReadValue<double>(hdr + 184, swap);
+		xyztunits = ReadValue<qint32>(hdr + 500, swap);
+		qformcode = ReadValue<qint32>(hdr + 344, swap);
+		sformcode = ReadValue<qint32>(hdr + 348, swap);
+		for (int i=0; i<3; i++) {
+			quatern[i] = ReadValue<double>(hdr + 352 + 8*i, swap);
+			qoffset[i] = ReadValue<double>(hdr + 376 + 8*i, swap);
+		}
+		for (int r=0; r<3; r++)
+			for (int c=0; c<4; c++)
+				srow[r][c] = ReadValue<double>(hdr + 400 + 32*r + 8*c, swap);
+	}
+	else {
+		m = "File [" + filename + "] is not a NIfTI file";
+		return false;
+	}
+
+	if ((dim[0] < 1) || (dim[0] > 7)) {
+		m = QString("File [%1] has an invalid number of dimensions [%2]").arg(filename).arg(dim[0]);
+		return false;
+	}
+	for (int i=1; i<8; i++) {
+		if (i > dim[0]) {
+			dim[i] = 1;
+			pixdim[i] = 1.0;
+		}
+		else if (dim[i] < 1) {
+			m = QString("File [%1] has an invalid dim%2 [%3]").arg(filename).arg(i).arg(dim[i]);
+			return false;
+		}
+	}
+
+	switch (datatype) {
+		case NIFTI_UINT8: case NIFTI_INT8: bitpix = 8; break;
+		case NIFTI_INT16: case NIFTI_UINT16: bitpix = 16; break;
+		case NIFTI_INT32: case NIFTI_UINT32: case NIFTI_FLOAT32: bitpix = 32; break;
+		case NIFTI_INT64: case NIFTI_UINT64: case NIFTI_FLOAT64: bitpix = 64; break;
+		default:
+			m = QString("File [%1] has unsupported datatype [%2]").arg(filename).arg(datatype);
+			return false;
+	}
+
+	/* a slope of 0 means no scaling */
+	if ((sclslope == 0.0) || (!std::isfinite(sclslope)) || (!std::isfinite(sclinter))) {
+		sclslope = 1.0;
+		sclinter = 0.0;
+	}
+
+	/* single file NIfTI data can't start inside the header */
+	if (voxoffset < sizeofhdr)
+		voxoffset = sizeofhdr;
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- BuildAffine ------------------------------------ */
+/* ---------------------------------------------------------- */
+/* voxel to mm transform. sform if set, then qform, then the  */
+/* plain voxel scaling                                        */
+/* ---------------------------------------------------------- */
+void nifti::BuildAffine() {
+	memset(affine, 0, sizeof(affine));
+
+	if (sformcode > 0) {
+		for (int r=0; r<3; r++)
+			for (int c=0; c<4; c++)
+				affine[r][c] = srow[r][c];
+	}
+	else if (qformcode > 0) {
+		double b = quatern[0], c = quatern[1], d = quatern[2];
+		double a = 1.0 - (b*b + c*c + d*d);
+		if (a < 1.e-7) {
+			a = 1.0 / sqrt(b*b + c*c + d*d);
+			b *= a; c *= a; d *= a;
+			a = 0.0;
+		}
+		else
+			a = sqrt(a);
+
+		double xd = (pixdim[1] > 0.0) ? pixdim[1] : 1.0;
+		double yd = (pixdim[2] > 0.0) ? pixdim[2] : 1.0;
+		double zd = (pixdim[3] > 0.0) ? pixdim[3] : 1.0;
+		if (pixdim[0] < 0.0) zd = -zd;
+
+		affine[0][0] = (a*a + b*b - c*c - d*d) * xd;
+		affine[0][1] = 2.0 * (b*c - a*d) * yd;
+		affine[0][2] = 2.0 * (b*d + a*c) * zd;
+		affine[1][0] = 2.0 * (b*c + a*d) * xd;
+		affine[1][1] = (a*a + c*c - b*b - d*d) * yd;
+		affine[1][2] = 2.0 * (c*d - a*b) * zd;
+		affine[2][0] = 2.0 * (b*d - a*c) * xd;
+		affine[2][1] = 2.0 * (c*d + a*b) * yd;
+		affine[2][2] = (a*a + d*d - c*c - b*b) * zd;
+		affine[0][3] = qoffset[0];
+		affine[1][3] = qoffset[1];
+		affine[2][3] = qoffset[2];
+	}
+	else {
+		affine[0][0] = pixdim[1];
+		affine[1][1] = pixdim[2];
+		affine[2][2] = pixdim[3];
+	}
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- VoxToMM ---------------------------------------- */
+/* ---------------------------------------------------------- */
+void nifti::VoxToMM(double i, double j, double k, double &x, double &y, double &z) const {
+	x = affine[0][0]*i + affine[0][1]*j + affine[0][2]*k + affine[0][3];
+	y = affine[1][0]*i + affine[1][1]*j + affine[1][2]*k + affine[1][3];
+	z = affine[2][0]*i + affine[2][1]*j + affine[2][2]*k + affine[2][3];
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetVolume -------------------------------------- */
+/* ---------------------------------------------------------- */
+/* convert one volume to scaled floats. vol must hold         */
+/* VoxelsPerVolume() values. safe to call from many threads   */
+/* ---------------------------------------------------------- */
+bool nifti::GetVolume(qint64 t, float *vol) const {
+	return GetVoxels(t, 0, VoxelsPerVolume(), vol);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetVoxels -------------------------------------- */
+/* ---------------------------------------------------------- */
+/* convert a run of voxels from volume t to scaled floats     */
+/* ---------------------------------------------------------- */
+bool nifti::GetVoxels(qint64 t, qint64 start, qint64 count, float *vox) const {
+	qint64 nvox = VoxelsPerVolume();
+	if ((!isValid) || (data == nullptr) || (t < 0) || (t >= NumVolumes()) || (start < 0) || (start + count > nvox))
+		return false;
+
+	const uchar *src = data + voxoffset + (t*nvox + start)*(bitpix/8);
+
+	switch (datatype) {
+		case NIFTI_UINT8: ConvertVoxels<quint8>(src, count, vox, swap); break;
+		case NIFTI_INT8: ConvertVoxels<qint8>(src, count, vox, swap); break;
+		case NIFTI_INT16: ConvertVoxels<qint16>(src, count, vox, swap); break;
+		case NIFTI_UINT16: ConvertVoxels<quint16>(src, count, vox, swap); break;
+		case NIFTI_INT32: ConvertVoxels<qint32>(src, count, vox, swap); break;
+		case NIFTI_UINT32: ConvertVoxels<quint32>(src, count, vox, swap); break;
+		case NIFTI_INT64: ConvertVoxels<qint64>(src, count, vox, swap); break;
+		case NIFTI_UINT64: ConvertVoxels<quint64>(src, count, vox, swap); break;
+		case NIFTI_FLOAT32: ConvertVoxels<float>(src, count, vox, swap); break;
+		case NIFTI_FLOAT64: ConvertVoxels<double>(src, count, vox, swap); break;
+		default: return false;
+	}
+
+	if ((sclslope != 1.0) || (sclinter != 0.0)) {
+		float slope = float(sclslope);
+		float inter = float(sclinter);
+		for (qint64 i=0; i<count; i++)
+			vox[i] = vox[i]*slope + inter;
+	}
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetTemporalStats ------------------------------- */
+/* ---------------------------------------------------------- */
+/* per-voxel mean and variance over time, in a single pass    */
+/* using Welford's method. the image is split into blocks of  */
+/* voxels, and each thread streams all volumes of a block.    */
+/* variance is the sample variance (n-1), like fslmaths -Tstd */
+/* ---------------------------------------------------------- */
+bool nifti::GetTemporalStats(QVector<float> &mean, QVector<float> &variance, int numthreads, QString &m) const {
+	if ((!isValid) || (data == nullptr)) {
+		m = "File [" + filename + "] has not been read";
+		return false;
+	}
+
+	qint64 nvox = VoxelsPerVolume();
+	qint64 nvol = NumVolumes();
+	qint64 nblocks = (nvox + NIFTI_TEMPORAL_BLOCK - 1)/NIFTI_TEMPORAL_BLOCK;
+	mean.resize(int(nvox));
+	variance.resize(int(nvox));
+
+	if (numthreads < 1) numthreads = 1;
+	if (numthreads > nblocks) numthreads = int(nblocks);
+
+	std::atomic<qint64> next(0);
+	std::atomic<bool> ok(true);
+	auto worker = [&]() {
+		std::vector<float> vox(NIFTI_TEMPORAL_BLOCK);
+		std::vector<double> mu(NIFTI_TEMPORAL_BLOCK), m2(NIFTI_TEMPORAL_BLOCK);
+		qint64 b;
+		while ((b = next++) < nblocks) {
+			qint64 start = b*NIFTI_TEMPORAL_BLOCK;
+			qint64 count = std::min(qint64(NIFTI_TEMPORAL_BLOCK), nvox - start);
+			std::fill(mu.begin(), mu.end(), 0.0);
+			std::fill(m2.begin(), m2.end(), 0.0);
+
+			for (qint64 t=0; t<nvol; t++) {
+				if (!GetVoxels(t, start, count, vox.data())) {
+					ok = false;
+					return;
+				}
+				/* no dependency between voxels, so this loop vectorizes */
+				const float *x = vox.data();
+				double *pmu = mu.data();
+				double *pm2 = m2.data();
+				double invn = 1.0/double(t + 1);
+				for (qint64 i=0; i<count; i++) {
+					double d = double(x[i]) - pmu[i];
+					pmu[i] += d*invn;
+					pm2[i] += d*(double(x[i]) - pmu[i]);
+				}
+			}
+
+			double denom = (nvol > 1) ? double(nvol - 1) : 1.0;
+			for (qint64 i=0; i<count; i++) {
+				mean[int(start + i)] = float(mu[size_t(i)]);
+				variance[int(start + i)] = (nvol > 1) ? float(m2[size_t(i)]/denom) : 0.0f;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i=1; i<numthreads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &th : threads)
+		th.join();
+
+	if (!ok) {
+		m = "Unable to read one or more volumes from [" + filename + "]";
+		return false;
+	}
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetVolumeStats --------------------------------- */
+/* ---------------------------------------------------------- */
+/* two passes over one volume. the first gets min/max, the    */
+/* moments, and the intensity weighted sums for the centre of */
+/* gravity, the second fills the histograms                   */
+/* ---------------------------------------------------------- */
+bool nifti::GetVolumeStats(qint64 t, int histbins, niftiStats &stats) const {
+	qint64 nx = dim[1], ny = dim[2], nz = dim[3];
+	qint64 nvox = VoxelsPerVolume();
+
+	std::vector<float> vol(static_cast<size_t>(nvox));
+	if (!GetVolume(t, vol.data()))
+		return false;
+
+	/* pass 1 */
+	float vmin, vmax;
+	MinMax(vol.data(), nvox, vmin, vmax);
+
+	double sum(0.0), sumsq(0.0), sumi(0.0), sumj(0.0), sumk(0.0);
+	for (qint64 k=0; k<nz; k++) {
+		for (qint64 j=0; j<ny; j++) {
+			const float *row = vol.data() + (k*ny + j)*nx;
+			double s[NIFTI_LANES] = {0}, ss[NIFTI_LANES] = {0}, si[NIFTI_LANES] = {0};
+			qint64 i = 0;
+			for (; i+NIFTI_LANES<=nx; i+=NIFTI_LANES) {
+				for (int l=0; l<NIFTI_LANES; l++) {
+					double v = row[i+l];
+					s[l] += v;
+					ss[l] += v*v;
+					si[l] += v*double(i+l);
+				}
+			}
+			for (; i<nx; i++) {
+				double v = row[i];
+				s[0] += v;
+				ss[0] += v*v;
+				si[0] += v*double(i);
+			}
+			double rowsum(0.0);
+			for (int l=0; l<NIFTI_LANES; l++) {
+				rowsum += s[l];
+				sumsq += ss[l];
+				sumi += si[l];
+			}
+			sum += rowsum;
+			sumj += rowsum*double(j);
+			sumk += rowsum*double(k);
+		}
+	}
+
+	stats.min = vmin;
+	stats.max = vmax;
+	stats.mean = sum/double(nvox);
+	stats.stdev = 0.0;
+	if (nvox > 1) {
+		double var = (sumsq - sum*sum/double(nvox))/double(nvox - 1);
+		stats.stdev = (var > 0.0) ? sqrt(var) : 0.0;
+	}
+
+	/* fslstats weights the centre of gravity by (intensity - min). the index sums over the whole grid are closed form, so the offset is removed afterwards */
+	double n = double(nvox);
+	double weight = sum - double(vmin)*n;
+	for (int a=0; a<3; a++) {
+		stats.cogvox[a] = 0.0;
+		stats.cogmm[a] = 0.0;
+	}
+	if (weight > 0.0) {
+		stats.cogvox[0] = (sumi - double(vmin)*n*double(nx - 1)/2.0)/weight;
+		stats.cogvox[1] = (sumj - double(vmin)*n*double(ny - 1)/2.0)/weight;
+		stats.cogvox[2] = (sumk - double(vmin)*n*double(nz - 1)/2.0)/weight;
+	}
+	VoxToMM(stats.cogvox[0], stats.cogvox[1], stats.cogvox[2], stats.cogmm[0], stats.cogmm[1], stats.cogmm[2]);
+
+	/* pass 2 */
+	if (histbins < 1) histbins = 1;
+	std::vector<qint64> hist(static_cast<size_t>(histbins), 0);
+	std::vector<qint64> ehist(NIFTI_ENTROPY_BINS, 0);
+	double range = double(vmax) - double(vmin);
+	if (range > 0.0) {
+		double hscale = double(histbins)/range;
+		double escale = double(NIFTI_ENTROPY_BINS)/range;
+		for (qint64 i=0; i<nvox; i++) {
+			double d = double(vol[size_t(i)]) - double(vmin);
+			qint64 hb = std::min(qint64(d*hscale), qint64(histbins - 1));
+			qint64 eb = std::min(qint64(d*escale), qint64(NIFTI_ENTROPY_BINS - 1));
+			hist[size_t(hb)]++;
+			ehist[size_t(eb)]++;
+		}
+	}
+	else {
+		hist[0] = nvox;
+		ehist[0] = nvox;
+	}
+
+	stats.histogram.resize(histbins);
+	for (int b=0; b<histbins; b++)
+		stats.histogram[b] = double(hist[size_t(b)]);
+
+	double entropy(0.0);
+	for (int b=0; b<NIFTI_ENTROPY_BINS; b++) {
+		if (ehist[size_t(b)] > 0) {
+			double p = double(ehist[size_t(b)])/n;
+			entropy -= p*log(p);
+		}
+	}
+	stats.entropy = entropy/log(double(NIFTI_ENTROPY_BINS));
+
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetStatsOverTime ------------------------------- */
+/* ---------------------------------------------------------- */
+/* stats for every volume, equivalent to fslstats -t. the     */
+/* volumes are independent, so they are spread across threads */
+/* ---------------------------------------------------------- */
+bool nifti::GetStatsOverTime(QVector<niftiStats> &stats, int histbins, int numthreads, QString &m) const {
+	if ((!isValid) || (data == nullptr)) {
+		m = "File [" + filename + "] has not been read";
+		return false;
+	}
+
+	qint64 nvol = NumVolumes();
+	stats.clear();
+	stats.resize(int(nvol));
+
+	if (numthreads < 1) numthreads = 1;
+	if (numthreads > nvol) numthreads = int(nvol);
+
+	std::atomic<qint64> next(0);
+	std::atomic<bool> ok(true);
+	auto worker = [&]() {
+		qint64 t;
+		while ((t = next++) < nvol) {
+			if (!GetVolumeStats(t, histbins, stats[int(t)]))
+				ok = false;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i=1; i<numthreads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &th : threads)
+		th.join();
+
+	if (!ok) {
+		m = "Unable to read one or more volumes from [" + filename + "]";
+		return false;
+	}
+	return true;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- GetRange --------------------------------------- */
+/* ---------------------------------------------------------- */
+/* min/max over the whole image, equivalent to fslstats -R    */
+/* ---------------------------------------------------------- */
+bool nifti::GetRange(double &min, double &max, int numthreads) const {
+	if ((!isValid) || (data == nullptr))
+		return false;
+
+	qint64 nvol = NumVolumes();
+	qint64 nvox = VoxelsPerVolume();
+	std::vector<float> mins(static_cast<size_t>(nvol)), maxs(static_cast<size_t>(nvol));
+
+	if (numthreads < 1) numthreads = 1;
+	if (numthreads > nvol) numthreads = int(nvol);
+
+	std::atomic<qint64> next(0);
+	std::atomic<bool> ok(true);
+	auto worker = [&]() {
+		std::vector<float> vol(static_cast<size_t>(nvox));
+		qint64 t;
+		while ((t = next++) < nvol) {
+			if (!GetVolume(t, vol.data()))
+				ok = false;
+			else
+				MinMax(vol.data(), nvox, mins[size_t(t)], maxs[size_t(t)]);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i=1; i<numthreads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &th : threads)
+		th.join();
+
+	if (!ok)
+		return false;
+
+	min = *std::min_element(mins.begin(), mins.end());
+	max = *std::max_element(maxs.begin(), maxs.end());
+	return true;
+}
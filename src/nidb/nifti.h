@@ -0,0 +1,101 @@
+/* ------------------------------------------------------------------------------
+  NIDB nifti.h
+  Copyright (C) 2004 - 2020
+  Gregory A Book <gregory.book@hhchealth.org> <gregory.a.book@gmail.com>
+  Olin Neuropsychiatry Research Center, Hartford Hospital
+  ------------------------------------------------------------------------------
+  GPLv3 License:
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  ------------------------------------------------------------------------------ */
+
+#ifndef NIFTI_H
+#define NIFTI_H
+#include <QString>
+#include <QStringList>
+#include <QFile>
+#include <QVector>
+#include <vector>
+
+/* per-volume statistics, equivalent to the fslstats -R -m -s -e -c -C -h options */
+struct niftiStats {
+	double min = 0.0;
+	double max = 0.0;
+	double mean = 0.0;
+	double stdev = 0.0;
+	double entropy = 0.0;
+	double cogvox[3] = {0.0, 0.0, 0.0};
+	double cogmm[3] = {0.0, 0.0, 0.0};
+	QVector<double> histogram;
+};
+
+class nifti
+{
+public:
+	nifti();
+	nifti(QString f, bool headeronly = false);
+	~nifti();
+
+	bool Read(QString f, QString &m, bool headeronly = false);
+	bool ReadDicom(QStringList files, int numthreads, QString &m);
+	bool Write(QString f, const float *vols, qint64 nvols, QString &m) const;
+	bool Write(QString f, QString &m) const;
+	void Close();
+
+	/* image data */
+	bool GetVolume(qint64 t, float *vol) const;
+	bool GetVoxels(qint64 t, qint64 start, qint64 count, float *vox) const;
+	bool GetTemporalStats(QVector<float> &mean, QVector<float> &variance, int numthreads, QString &m) const;
+	bool GetVolumeStats(qint64 t, int histbins, niftiStats &stats) const;
+	bool GetStatsOverTime(QVector<niftiStats> &stats, int histbins, int numthreads, QString &m) const;
+	bool GetRange(double &min, double &max, int numthreads = 1) const;
+	void VoxToMM(double i, double j, double k, double &x, double &y, double &z) const;
+
+	qint64 VoxelsPerVolume() const { return dim[1]*dim[2]*dim[3]; }
+	qint64 NumVolumes() const { return dim[4]*dim[5]*dim[6]*dim[7]; }
+
+	/* object variables */
+	QString filename;
+	QString msg;
+	bool isValid = false;
+
+	/* header variables. dims beyond dim[0] are set to 1, like fslval reports them */
+	int version = 0;
+	qint64 dim[8] = {0, 1, 1, 1, 1, 1, 1, 1};
+	double pixdim[8] = {0.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+	int datatype = 0;
+	int bitpix = 0;
+	qint64 voxoffset = 0;
+	double sclslope = 1.0;
+	double sclinter = 0.0;
+	int xyztunits = 0;
+	int qformcode = 0;
+	int sformcode = 0;
+	double quatern[3] = {0.0, 0.0, 0.0};
+	double qoffset[3] = {0.0, 0.0, 0.0};
+	double srow[3][4] = {{0.0, 0.0, 0.0, 0.0}, {0.0, 0.0, 0.0, 0.0}, {0.0, 0.0, 0.0, 0.0}};
+
+private:
+	bool ParseHeader(const char *hdr, qint64 size, QString &m);
+	void BuildAffine();
+	bool WriteImage(QString f, int dt, int bp, double slope, double inter, const void *vols, qint64 nvols, QString &m) const;
+
+	QFile file;
+	std::vector<uchar> buffer;
+	const uchar *data = nullptr;
+	bool swap = false;
+	double affine[3][4];
+};
+
+#endif // NIFTI_H
@@ -0,0 +1,251 @@
+/* ------------------------------------------------------------------------------
+  NIDB benchmarks.cpp
+  Copyright (C) 2004 - 2020
+  Gregory A Book <gregory.book@hhchealth.org> <gregory.a.book@gmail.com>
+  Olin Neuropsychiatry Research Center, Hartford Hospital
+  ------------------------------------------------------------------------------
+  GPLv3 License:
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  ------------------------------------------------------------------------------ */
+
+#include <QCoreApplication>
+#include <QProcess>
+#include "nidb.h"
+#include "moduleMRIQA.h"
+#include "nifti.h"
+#include <random>
+#include <cmath>
+#include <algorithm>
+
+/* timing and correctness checks for the nidb core, on synthetic data, so no
+   config file or database is needed. run with the names of the benchmarks to
+   run, or with none to run them all. the cluster benchmark runs an installed
+   nidb, so it only runs when it is named, with the path to that nidb:
+     nidbbenchmarks cluster /nidb/bin/nidb */
+
+
+/* ---------------------------------------------------------- */
+/* --------- BenchmarkMRIQA --------------------------------- */
+/* ---------------------------------------------------------- */
+/* time the temporal QA kernel on a synthetic 4D series and   */
+/* check it against a two-pass calculation. the series is a   */
+/* sphere of signal on a noise floor, so the SNR is known     */
+/* ---------------------------------------------------------- */
+bool BenchmarkMRIQA() {
+
+	const qint64 nx(64), ny(64), nz(36), nt(200);
+	const double signal(1000.0), floor(20.0), noisesd(10.0);
+	qint64 nvox = nx*ny*nz;
+
+	printf("Generating synthetic series [%lld x %lld x %lld x %lld]\n", nx, ny, nz, nt);
+	QVector<float> data(int(nvox*nt));
+	QVector<float> mask(int(nvox));
+	std::mt19937 rng(1);
+	std::normal_distribution<double> noise(0.0, noisesd);
+	for (qint64 k=0; k<nz; k++)
+		for (qint64 j=0; j<ny; j++)
+			for (qint64 i=0; i<nx; i++) {
+				double dx = (i - nx/2.0)/(nx/3.0), dy = (j - ny/2.0)/(ny/3.0), dz = (k - nz/2.0)/(nz/3.0);
+				mask[int((k*ny + j)*nx + i)] = ((dx*dx + dy*dy + dz*dz) < 1.0) ? 1.0f : 0.0f;
+			}
+	for (qint64 t=0; t<nt; t++)
+		for (qint64 v=0; v<nvox; v++)
+			data[int(t*nvox + v)] = float(((mask[int(v)] > 0.0f) ? signal : floor) + noise(rng));
+
+	/* two-pass reference */
+	QVector<double> refmean(int(nvox), 0.0), refvar(int(nvox), 0.0);
+	for (qint64 v=0; v<nvox; v++) {
+		double sum(0.0), ss(0.0);
+		for (qint64 t=0; t<nt; t++)
+			sum += data[int(t*nvox + v)];
+		double mu = sum/double(nt);
+		for (qint64 t=0; t<nt; t++) {
+			double d = data[int(t*nvox + v)] - mu;
+			ss += d*d;
+		}
+		refmean[int(v)] = mu;
+		refvar[int(v)] = ss/double(nt - 1);
+	}
+
+	/* write it out and read it back, so the reader is part of the timing */
+	QString m;
+	nifti img;
+	img.dim[0] = 4; img.dim[1] = nx; img.dim[2] = ny; img.dim[3] = nz; img.dim[4] = nt;
+	img.pixdim[1] = img.pixdim[2] = 3.0; img.pixdim[3] = 4.0; img.pixdim[4] = 2.0;
+	QString f = QString("%1/nidb-qabenchmark-%2.nii").arg(QDir::tempPath()).arg(QCoreApplication::applicationPid());
+	if (!img.Write(f, data.data(), nt, m)) {
+		printf("%s\n", m.toStdString().c_str());
+		return false;
+	}
+
+	bool ok = true;
+	int maxthreads = QThread::idealThreadCount();
+	for (int numthreads = 1; numthreads <= maxthreads; numthreads *= 2) {
+		QElapsedTimer timer;
+		timer.start();
+		nifti in;
+		QVector<float> mean, variance;
+		if ((!in.Read(f, m)) || (!in.GetTemporalStats(mean, variance, numthreads, m))) {
+			printf("%s\n", m.toStdString().c_str());
+			ok = false;
+			break;
+		}
+		qint64 ms = timer.elapsed();
+
+		double maxmeanerr(0.0), maxvarerr(0.0);
+		for (int v=0; v<int(nvox); v++) {
+			maxmeanerr = std::max(maxmeanerr, fabs(mean[v] - refmean[v])/fabs(refmean[v]));
+			maxvarerr = std::max(maxvarerr, fabs(variance[v] - refvar[v])/refvar[v]);
+		}
+
+		double iosnr(0.0), pvsnr(0.0);
+		moduleMRIQA::CalculateSNR(in, mean, variance, mask, true, iosnr, pvsnr);
+
+		printf("threads [%2d]  time [%5lld ms]  %6.1f Mvoxel-volumes/s  max relative error mean [%.2e] variance [%.2e]  io_snr [%.2f] (expected %.2f)  pv_snr [%.2f] (expected %.2f)\n", numthreads, ms, double(nvox*nt)/1000.0/std::max(ms, qint64(1)), maxmeanerr, maxvarerr, iosnr, signal/floor, pvsnr, signal/noisesd);
+
+		/* the script's numbers are printed with 6 significant digits, so anything below 1e-5 is a match */
+		if ((maxmeanerr > 1e-5) || (maxvarerr > 1e-5))
+			ok = false;
+	}
+
+	QFile::remove(f);
+	printf("%s\n", ok ? "PASS" : "FAIL");
+	return ok;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- BenchmarkCSV ----------------------------------- */
+/* ---------------------------------------------------------- */
+/* time the .csv parser on a synthetic 100MB file with quoted */
+/* fields, escaped quotes, line breaks in quotes, and CRLF    */
+/* line endings, and check the values it reads back           */
+/* ---------------------------------------------------------- */
+bool BenchmarkCSV() {
+
+	const qint64 targetsize(100*1024*1024);
+
+	printf("Generating synthetic .csv file [%lld MB]\n", targetsize/1024/1024);
+	QByteArray csv;
+	csv.reserve(int(targetsize + 1024));
+	csv.append("type,variablename,startdate,enddate,duration,value,units,notes,instrument\r\n");
+	int numrows(0);
+	while (csv.size() < targetsize) {
+		csv.append(QString("measure,var%1,2020-01-%2 10:%3:00,,%4,%5.%6,ms,\"note %1, with \"\"quotes\"\"\nand a line break\",task%7\r\n").arg(numrows).arg(numrows%28 + 1, 2, 10, QChar('0')).arg(numrows%60, 2, 10, QChar('0')).arg(numrows%500).arg(numrows%1000).arg(numrows%97).arg(numrows%10).toUtf8());
+		numrows++;
+	}
+
+	QString f = QString("%1/nidb-csvbenchmark-%2.csv").arg(QDir::tempPath()).arg(QCoreApplication::applicationPid());
+	QFile out(f);
+	if ((!out.open(QIODevice::WriteOnly)) || (out.write(csv) != csv.size())) {
+		printf("Unable to write [%s]\n", f.toStdString().c_str());
+		return false;
+	}
+	out.close();
+
+	bool ok(true);
+	for (int i=0; i<3; i++) {
+		QElapsedTimer timer;
+		timer.start();
+		csvTable table;
+		QString m;
+		bool parsed = nidb::ParseCSVFile(f, table, m);
+		qint64 ms = std::max(timer.elapsed(), qint64(1));
+
+		int last = numrows - 1;
+		bool correct = (parsed) && (table.numrows == numrows) && (table.columns.size() == 9)
+		    && (table.Value(last, "variablename") == QString("var%1").arg(last))
+		    && (table.Value(last, "notes") == QString("note %1, with \"quotes\"\nand a line break").arg(last))
+		    && (table.Value(last, "instrument") == QString("task%1").arg(last%10))
+		    && (table.Value(last, "enddate") == "");
+		printf("Run [%d]  rows [%d]  time [%lld ms]  throughput [%.1f MB/s]  %s\n", i+1, table.numrows, ms, (csv.size()/1024.0/1024.0)/(ms/1000.0), correct ? "values correct" : "VALUES INCORRECT");
+		if (!correct) {
+			printf("%s\n", m.toStdString().c_str());
+			ok = false;
+		}
+	}
+
+	QFile::remove(f);
+
+	return ok;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- BenchmarkClusterStartup ------------------------ */
+/* ---------------------------------------------------------- */
+/* time whole runs of nidb through the cluster startup path   */
+/* (load the config, connect, exit), which is what every      */
+/* check-in from a cluster job pays                           */
+/* ---------------------------------------------------------- */
+bool BenchmarkClusterStartup(QString exe) {
+	if (!QFileInfo(exe).isExecutable()) {
+		printf("[%s] is not an executable. Usage: nidbbenchmarks cluster <path-to-nidb>\n", exe.toStdString().c_str());
+		return false;
+	}
+
+	int numruns = 20;
+	QList<double> times;
+	for (int i=0; i<numruns; i++) {
+		QElapsedTimer t;
+		t.start();
+		QProcess::execute(exe, QStringList() << "cluster" << "-u" << "startup");
+		times.append(t.nsecsElapsed()/1000000.0);
+	}
+	std::sort(times.begin(), times.end());
+
+	double median = times[numruns/2];
+	printf("Cluster startup over [%d] runs: min [%.1f ms]  median [%.1f ms]  max [%.1f ms]\n", numruns, times.first(), median, times.last());
+	if (median < 20.0)
+		printf("Ok, the median is under 20 ms\n");
+	else
+		printf("Slow, the median is over 20 ms\n");
+
+	return (median < 20.0);
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- main ------------------------------------------- */
+/* ---------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+	QCoreApplication a(argc, argv);
+
+	QStringList names = a.arguments().mid(1);
+	QStringList all = QStringList() << "mriqa" << "csv";
+	if (names.isEmpty())
+		names = all;
+
+	bool ok = true;
+	for (int i=0; i<names.size(); i++) {
+		QString name = names[i];
+		printf("\n----- %s -----\n", name.toStdString().c_str());
+		if (name == "mriqa")
+			ok = BenchmarkMRIQA() && ok;
+		else if (name == "csv")
+			ok = BenchmarkCSV() && ok;
+		else if (name == "cluster") {
+			QString exe = (i+1 < names.size()) ? names[++i] : "";
+			ok = BenchmarkClusterStartup(exe) && ok;
+		}
+		else {
+			printf("Unknown benchmark [%s]. Available benchmarks [%s cluster]\n", name.toStdString().c_str(), all.join(" ").toStdString().c_str());
+			ok = false;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
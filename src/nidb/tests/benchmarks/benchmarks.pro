@@ -0,0 +1,16 @@
+QT -= gui
+QT += sql
+QT += network
+
+CONFIG += c++17 cmdline
+CONFIG -= app_bundle
+
+TARGET = nidbbenchmarks
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += $$PWD/../..
+
+SOURCES += \
+    benchmarks.cpp
+
+include(../../nidb.pri)
@@ -0,0 +1,82 @@
+#!/bin/bash
+# stand-in for qsub (or sbatch, when called as fakesbatch.sh) for testing cluster
+# submission without a cluster. set the pipeline's submit host to localhost and
+# qsubpath to this script. the submission is run in the background on this
+# machine, including every task of an array job, and the reply is printed in the
+# same format as the real scheduler, so nidb can read the job id from it
+#
+# usage: fakeqsub.sh [-u user] [-q queue] [other options are ignored] jobfile
+#
+# FAKEQSUB_DIR    where the job ids and the job output go (default /tmp/fakeqsub)
+# FAKEQSUB_FAIL   if set, print this message instead of submitting, to test the
+#                 submit error handling. for example "Unable to run job: unknown queue"
+
+STATEDIR=${FAKEQSUB_DIR:-/tmp/fakeqsub}
+mkdir -p "$STATEDIR" || exit 1
+
+SLURM=0
+case `basename "$0"` in
+	*sbatch*) SLURM=1 ;;
+esac
+
+# the job file is the last argument
+JOBFILE=""
+while [ $# -gt 0 ]; do
+	case "$1" in
+		-u|-q|-o|-e|-N|-J|-t|-p) shift ;;
+		-*) ;;
+		*) JOBFILE="$1" ;;
+	esac
+	shift
+done
+
+if [ "$FAKEQSUB_FAIL" != "" ]; then
+	echo "$FAKEQSUB_FAIL"
+	exit 1
+fi
+
+if [ "$JOBFILE" == "" ] || [ ! -r "$JOBFILE" ]; then
+	if [ $SLURM == 1 ]; then
+		echo "sbatch: error: Unable to open file $JOBFILE"
+	else
+		echo "Unable to read script file because of error: error opening $JOBFILE: No such file or directory"
+	fi
+	exit 1
+fi
+
+# next job id. the lock keeps ids unique when several nidb processes submit at once
+JOBID=`(
+	flock 9
+	ID=$(( $(cat "$STATEDIR/lastjobid" 2>/dev/null || echo 0) + 1 ))
+	echo $ID > "$STATEDIR/lastjobid"
+	echo $ID
+) 9>"$STATEDIR/lock"`
+
+# the array range, from the job file's directives. "#$ -t 1-10" or "#SBATCH --array=1-10"
+RANGE=`sed -n -e 's/^#\$ -t \([0-9]*-[0-9]*\).*/\1/p' -e 's/^#SBATCH --array=\([0-9]*-[0-9]*\).*/\1/p' "$JOBFILE" | head -1`
+NAME=`sed -n -e 's/^#\$ -N \(.*\)/\1/p' -e 's/^#SBATCH -J \(.*\)/\1/p' "$JOBFILE" | head -1`
+[ "$NAME" == "" ] && NAME=`basename "$JOBFILE"`
+
+if [ "$RANGE" == "" ]; then
+	( JOB_ID=$JOBID SLURM_JOB_ID=$JOBID /bin/bash "$JOBFILE" > "$STATEDIR/$JOBID.out" 2>&1 ) < /dev/null > /dev/null 2>&1 &
+	if [ $SLURM == 1 ]; then
+		echo "Submitted batch job $JOBID"
+	else
+		echo "Your job $JOBID (\"$NAME\") has been submitted"
+	fi
+else
+	FIRST=${RANGE%-*}
+	LAST=${RANGE#*-}
+	(
+		for ((TASK=FIRST; TASK<=LAST; TASK++)); do
+			JOB_ID=$JOBID SGE_TASK_ID=$TASK SLURM_JOB_ID=$JOBID SLURM_ARRAY_TASK_ID=$TASK /bin/bash "$JOBFILE" > "$STATEDIR/$JOBID.$TASK.out" 2>&1
+		done
+	) < /dev/null > /dev/null 2>&1 &
+	if [ $SLURM == 1 ]; then
+		echo "Submitted batch job $JOBID"
+	else
+		echo "Your job-array $JOBID.$FIRST-$LAST:1 (\"$NAME\") has been submitted"
+	fi
+fi
+
+exit 0
@@ -0,0 +1 @@
+fakeqsub.sh
\ No newline at end of file
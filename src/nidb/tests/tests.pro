@@ -0,0 +1,12 @@
+# benchmarks and tests for the nidb core. they build against the same sources
+# and libraries as the nidb binary (nidb.pri), so build gdcm and smtp with
+# build.sh first. for example, from the top of the repository
+#   qmake -o bin/tests/Makefile src/nidb/tests/tests.pro -spec linux-g++
+#   make -C bin/tests
+#   make -C bin/tests check
+#
+# cluster/ has a stand-in for qsub and sbatch, to test cluster submission on
+# this machine. see the comments at the top of cluster/fakeqsub.sh
+
+TEMPLATE = subdirs
+SUBDIRS += benchmarks unittests
@@ -0,0 +1,205 @@
+/* ------------------------------------------------------------------------------
+  NIDB unittests.cpp
+  Copyright (C) 2004 - 2020
+  Gregory A Book <gregory.book@hhchealth.org> <gregory.a.book@gmail.com>
+  Olin Neuropsychiatry Research Center, Hartford Hospital
+  ------------------------------------------------------------------------------
+  GPLv3 License:
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  ------------------------------------------------------------------------------ */
+
+#include <QtTest>
+#include "nidb.h"
+#include "modulePipeline.h"
+
+/* unit tests for the nidb core. they only call functions that don't need the
+   config file or database */
+
+class TestNidb : public QObject
+{
+	Q_OBJECT
+
+private:
+	bool Parse(const QByteArray &csv, csvTable &table);
+
+private slots:
+	void ParseCSVQuotedComma();
+	void ParseCSVEscapedQuotes();
+	void ParseCSVEmbeddedNewline();
+	void ParseCSVCRLF();
+	void ParseCSVTrailingEmptyField();
+	void ParseCSVWrongColumnCount();
+	void FinalCheckins_data();
+	void FinalCheckins();
+};
+
+
+/* ---------------------------------------------------------- */
+/* --------- Parse ------------------------------------------ */
+/* ---------------------------------------------------------- */
+/* parse the .csv data, and print the parser's messages if it */
+/* fails                                                      */
+/* ---------------------------------------------------------- */
+bool TestNidb::Parse(const QByteArray &csv, csvTable &table) {
+	QString m;
+	bool ret = nidb::ParseCSV(csv.constData(), csv.size(), table, m);
+	if (!ret)
+		qDebug("%s", m.toStdString().c_str());
+	return ret;
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ParseCSVQuotedComma ---------------------------- */
+/* ---------------------------------------------------------- */
+void TestNidb::ParseCSVQuotedComma() {
+	csvTable t;
+	QVERIFY(Parse("Type,Notes,Value\nmeasure,\"one, two\",3\n", t));
+	QCOMPARE(t.columns, QStringList() << "type" << "notes" << "value");
+	QCOMPARE(t.numrows, 1);
+	QCOMPARE(t.Value(0, "notes"), QString("one, two"));
+	QCOMPARE(t.Value(0, "value"), QString("3"));
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ParseCSVEscapedQuotes -------------------------- */
+/* ---------------------------------------------------------- */
+void TestNidb::ParseCSVEscapedQuotes() {
+	csvTable t;
+	QVERIFY(Parse("a,b\n\"say \"\"hi\"\"\",\"\"\"\"\n", t));
+	QCOMPARE(t.numrows, 1);
+	QCOMPARE(t.Value(0, "a"), QString("say \"hi\""));
+	QCOMPARE(t.Value(0, "b"), QString("\""));
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ParseCSVEmbeddedNewline ------------------------ */
+/* ---------------------------------------------------------- */
+void TestNidb::ParseCSVEmbeddedNewline() {
+	csvTable t;
+	QVERIFY(Parse("a,b\n\"line 1\nline 2\",x\ny,z\n", t));
+	QCOMPARE(t.numrows, 2);
+	QCOMPARE(t.Value(0, "a"), QString("line 1\nline 2"));
+	QCOMPARE(t.Value(0, "b"), QString("x"));
+	QCOMPARE(t.Value(1, "a"), QString("y"));
+	QCOMPARE(t.Value(1, "b"), QString("z"));
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ParseCSVCRLF ----------------------------------- */
+/* ---------------------------------------------------------- */
+void TestNidb::ParseCSVCRLF() {
+	csvTable t;
+	QVERIFY(Parse("a,b\r\n1,2\r\n\r\n\"3\r\n4\",5\r\n", t));
+	QCOMPARE(t.columns, QStringList() << "a" << "b");
+	QCOMPARE(t.numrows, 2);
+	QCOMPARE(t.Value(0, "a"), QString("1"));
+	QCOMPARE(t.Value(0, "b"), QString("2"));
+	/* a line break inside quotes is kept as it was written */
+	QCOMPARE(t.Value(1, "a"), QString("3\r\n4"));
+	QCOMPARE(t.Value(1, "b"), QString("5"));
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ParseCSVTrailingEmptyField --------------------- */
+/* ---------------------------------------------------------- */
+void TestNidb::ParseCSVTrailingEmptyField() {
+	/* an empty last field is a value, when the header has that column */
+	csvTable t;
+	QVERIFY(Parse("a,b,c\n1,2,\n", t));
+	QCOMPARE(t.columns.size(), 3);
+	QCOMPARE(t.numrows, 1);
+	QCOMPARE(t.Value(0, "b"), QString("2"));
+	QCOMPARE(t.Value(0, "c"), QString(""));
+
+	/* a trailing comma on every row is not a column */
+	QVERIFY(Parse("a,b,\n1,,\n3,4\n", t));
+	QCOMPARE(t.columns, QStringList() << "a" << "b");
+	QCOMPARE(t.numrows, 2);
+	QCOMPARE(t.Value(0, "b"), QString(""));
+	QCOMPARE(t.Value(1, "b"), QString("4"));
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- ParseCSVWrongColumnCount ----------------------- */
+/* ---------------------------------------------------------- */
+void TestNidb::ParseCSVWrongColumnCount() {
+	/* the row is kept, padded to the header, but the parse fails */
+	csvTable t;
+	QVERIFY(!Parse("a,b,c\n1,2\n", t));
+	QCOMPARE(t.numrows, 1);
+	QCOMPARE(t.Value(0, "c"), QString(""));
+}
+
+
+/* ---------------------------------------------------------- */
+/* --------- FinalCheckins ---------------------------------- */
+/* ---------------------------------------------------------- */
+/* run the end of a job file against a stand-in nidb that     */
+/* records the check-ins, and whose reconcileanalysis fails   */
+/* if the inputs were modified. the last check-in is the      */
+/* status the analysis is left with                           */
+/* ---------------------------------------------------------- */
+void TestNidb::FinalCheckins_data() {
+	QTest::addColumn<bool>("supplement");
+	QTest::addColumn<bool>("modified");
+	QTest::addColumn<QString>("laststatus");
+
+	QTest::newRow("unchanged") << false << false << "complete";
+	QTest::newRow("modified") << false << true << "error";
+	QTest::newRow("supplement unchanged") << true << false << "completesupplement";
+	QTest::newRow("supplement modified") << true << true << "error";
+}
+
+
+void TestNidb::FinalCheckins() {
+	QFETCH(bool, supplement);
+	QFETCH(bool, modified);
+	QFETCH(QString, laststatus);
+
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	QString log = dir.path() + "/checkins.log";
+
+	QFile nidbfile(dir.path() + "/nidb");
+	QVERIFY(nidbfile.open(QIODevice::WriteOnly | QIODevice::Text));
+	nidbfile.write(QString("#!/bin/sh\necho \"$3 $7\" >> %1\n[ \"$3\" = reconcileanalysis ] && [ -n \"$MODIFIED\" ] && exit 1\nexit 0\n").arg(log).toUtf8());
+	nidbfile.close();
+	nidbfile.setPermissions(nidbfile.permissions() | QFileDevice::ExeOwner);
+
+	QProcess p;
+	QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+	if (modified)
+		env.insert("MODIFIED", "1");
+	p.setProcessEnvironment(env);
+	p.start("/bin/sh", QStringList() << "-c" << modulePipeline::FinalCheckins(dir.path(), 123, supplement));
+	QVERIFY(p.waitForFinished());
+
+	QFile f(log);
+	QVERIFY(f.open(QIODevice::ReadOnly | QIODevice::Text));
+	QStringList calls = QString(f.readAll()).trimmed().split('\n');
+	QCOMPARE(calls.size(), 3);
+	QCOMPARE(calls[0], QString("pipelinecheckin processing"));
+	QVERIFY(calls[1].startsWith("reconcileanalysis"));
+	QCOMPARE(calls[2], "pipelinecheckin " + laststatus);
+}
+
+QTEST_GUILESS_MAIN(TestNidb)
+#include "unittests.moc"
@@ -0,0 +1,17 @@
+QT -= gui
+QT += sql
+QT += network
+QT += testlib
+
+CONFIG += c++17 cmdline testcase
+CONFIG -= app_bundle
+
+TARGET = nidbunittests
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += $$PWD/../..
+
+SOURCES += \
+    unittests.cpp
+
+include(../../nidb.pri)
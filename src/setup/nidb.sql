@@ -34,6 +34,7 @@ CREATE TABLE `analysis` (
   `pipeline_dependency` int(11) DEFAULT NULL,
   `study_id` int(11) DEFAULT NULL,
   `analysis_qsubid` bigint(20) UNSIGNED DEFAULT NULL,
+  `analysis_qsubtaskid` int(11) DEFAULT NULL COMMENT 'task of the array job analysis_qsubid, if the analysis was submitted as part of one',
   `analysis_status` enum('complete','pending','processing','error','submitted','','notcompleted','NoMatchingStudies','rerunresults','NoMatchingStudyDependency','IncompleteDependency','BadDependency','NoMatchingSeries','OddDependencyStatus') DEFAULT NULL,
   `analysis_statusmessage` varchar(255) DEFAULT NULL,
   `analysis_statusdatetime` timestamp NULL DEFAULT NULL,
@@ -738,6 +739,21 @@ CREATE TABLE `data_requests` (
 
 -- --------------------------------------------------------
 
+--
+-- Table structure for table `dirsize_index`
+--
+
+CREATE TABLE `dirsize_index` (
+  `dirsize_id` int(11) NOT NULL,
+  `dir_path` varchar(255) NOT NULL,
+  `numfiles` int(11) NOT NULL DEFAULT 0,
+  `disksize` bigint(20) NOT NULL DEFAULT 0,
+  `lastwalk` datetime DEFAULT NULL COMMENT 'last time the directory was fully walked. null if only counted incrementally',
+  `lastupdate` timestamp NOT NULL DEFAULT current_timestamp() ON UPDATE current_timestamp()
+) ENGINE=InnoDB DEFAULT CHARSET=utf8 ROW_FORMAT=DYNAMIC;
+
+-- --------------------------------------------------------
+
 --
 -- Table structure for table `drugnames`
 --
@@ -955,6 +971,9 @@ CREATE TABLE `exports` (
   `cputime` double DEFAULT NULL,
   `status` enum('submitted','pending','processing','complete','error','cancelled','') NOT NULL DEFAULT '',
   `log` text DEFAULT NULL,
+  `checkpoint_dir` varchar(255) DEFAULT NULL COMMENT 'staging/output directory reused when an interrupted export is resumed',
+  `checkpoint_hostname` varchar(255) DEFAULT NULL,
+  `checkpoint_pid` int(11) DEFAULT NULL,
   `lastupdate` timestamp NOT NULL DEFAULT current_timestamp()
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8 ROW_FORMAT=DYNAMIC;
 
@@ -973,7 +992,10 @@ CREATE TABLE `exportseries` (
   `enddate` datetime DEFAULT NULL,
   `timepoint_label` varchar(100) DEFAULT NULL,
   `status` enum('','error','processing','complete','submitted','cancelled') NOT NULL DEFAULT '',
-  `statusmessage` varchar(255) DEFAULT NULL
+  `statusmessage` varchar(255) DEFAULT NULL,
+  `checkpoint` enum('','staged','converted','anonymized','zipped') NOT NULL DEFAULT '' COMMENT 'last completed export stage for this series',
+  `checkpoint_zipoffset` bigint(20) NOT NULL DEFAULT 0 COMMENT 'size of the zip stream after this series was appended',
+  `checkpoint_date` datetime DEFAULT NULL
 ) ENGINE=InnoDB DEFAULT CHARSET=latin1 ROW_FORMAT=DYNAMIC;
 
 -- --------------------------------------------------------
@@ -1006,6 +1028,28 @@ CREATE TABLE `family_members` (
 
 -- --------------------------------------------------------
 
+--
+-- Table structure for table `fileio_deleted`
+--
+
+CREATE TABLE `fileio_deleted` (
+  `deleted_id` int(11) NOT NULL,
+  `fileiorequest_id` int(11) DEFAULT NULL,
+  `data_type` enum('analysis','subject','study','series') NOT NULL,
+  `data_id` int(11) DEFAULT NULL,
+  `original_path` varchar(255) DEFAULT NULL,
+  `deleted_path` varchar(255) NOT NULL COMMENT 'directory the data was renamed to in the first phase of the delete',
+  `reap_status` enum('pending','reaping','complete','error') NOT NULL DEFAULT 'pending',
+  `reap_pid` int(11) DEFAULT NULL,
+  `reap_hostname` varchar(255) DEFAULT NULL,
+  `reap_message` varchar(255) DEFAULT NULL,
+  `deletedate` datetime DEFAULT NULL,
+  `reap_after` datetime DEFAULT NULL COMMENT 'files are kept until this date. null keeps them indefinitely',
+  `reapdate` datetime DEFAULT NULL
+) ENGINE=InnoDB DEFAULT CHARSET=utf8 ROW_FORMAT=DYNAMIC;
+
+-- --------------------------------------------------------
+
 --
 -- Table structure for table `fileio_requests`
 --
@@ -1021,6 +1065,8 @@ CREATE TABLE `fileio_requests` (
   `anonymize_fields` text DEFAULT NULL,
   `request_status` enum('pending','complete','error','cancelled') NOT NULL DEFAULT 'pending',
   `request_message` varchar(255) DEFAULT NULL,
+  `request_bytesdone` bigint(20) NOT NULL DEFAULT 0,
+  `request_bytestotal` bigint(20) NOT NULL DEFAULT 0,
   `username` varchar(50) DEFAULT NULL,
   `requestdate` timestamp NOT NULL DEFAULT current_timestamp() ON UPDATE current_timestamp(),
   `startdate` timestamp NOT NULL DEFAULT '0000-00-00 00:00:00',
@@ -1558,6 +1604,9 @@ CREATE TABLE `mr_qa` (
   `motion_rsq` double DEFAULT NULL,
   `cputime` double DEFAULT NULL,
   `status` varchar(25) NOT NULL DEFAULT '',
+  `qa_hostname` varchar(255) DEFAULT NULL,
+  `qa_pid` int(11) DEFAULT NULL,
+  `qa_startdate` datetime DEFAULT NULL,
   `lastupdate` timestamp NULL DEFAULT current_timestamp()
 ) ENGINE=Aria DEFAULT CHARSET=utf8;
 
@@ -1844,6 +1893,31 @@ CREATE TABLE `pipelines` (
 
 -- --------------------------------------------------------
 
+--
+-- Table structure for table `pipeline_candidates`
+--
+
+CREATE TABLE `pipeline_candidates` (
+  `pipeline_id` int(11) NOT NULL,
+  `study_id` int(11) NOT NULL
+) ENGINE=InnoDB DEFAULT CHARSET=utf8 COMMENT='studies that match a pipeline and have no analysis yet';
+
+-- --------------------------------------------------------
+
+--
+-- Table structure for table `pipeline_candidatescan`
+--
+
+CREATE TABLE `pipeline_candidatescan` (
+  `pipeline_id` int(11) NOT NULL,
+  `scan_criteria` varchar(255) NOT NULL DEFAULT '',
+  `last_studyid` int(11) NOT NULL DEFAULT 0,
+  `last_historyid` bigint(20) NOT NULL DEFAULT 0,
+  `last_rebuild` datetime DEFAULT NULL
+) ENGINE=InnoDB DEFAULT CHARSET=utf8 COMMENT='how far pipeline_candidates has been filled for each pipeline';
+
+-- --------------------------------------------------------
+
 --
 -- Table structure for table `pipeline_data`
 --
@@ -3094,6 +3168,7 @@ ALTER TABLE `analysis`
   ADD KEY `analysis_status` (`analysis_status`),
   ADD KEY `pipeline_dependency` (`pipeline_dependency`),
   ADD KEY `pipeline_id` (`pipeline_id`),
+  ADD KEY `pipeline_status` (`pipeline_id`,`analysis_status`),
   ADD KEY `study_id` (`study_id`);
 
 --
@@ -3319,6 +3394,13 @@ ALTER TABLE `data_requests`
   ADD KEY `req_groupid` (`req_groupid`),
   ADD KEY `req_status` (`req_status`);
 
+--
+-- Indexes for table `dirsize_index`
+--
+ALTER TABLE `dirsize_index`
+  ADD PRIMARY KEY (`dirsize_id`),
+  ADD UNIQUE KEY `dir_path` (`dir_path`);
+
 --
 -- Indexes for table `drugnames`
 --
@@ -3399,7 +3481,8 @@ ALTER TABLE `exports`
 -- Indexes for table `exportseries`
 --
 ALTER TABLE `exportseries`
-  ADD PRIMARY KEY (`exportseries_id`);
+  ADD PRIMARY KEY (`exportseries_id`),
+  ADD KEY `export_id` (`export_id`);
 
 --
 -- Indexes for table `families`
@@ -3414,6 +3497,13 @@ ALTER TABLE `families`
 ALTER TABLE `family_members`
   ADD PRIMARY KEY (`familymember_id`);
 
+--
+-- Indexes for table `fileio_deleted`
+--
+ALTER TABLE `fileio_deleted`
+  ADD PRIMARY KEY (`deleted_id`),
+  ADD KEY `reap_status` (`reap_status`,`reap_after`);
+
 --
 -- Indexes for table `fileio_requests`
 --
@@ -3603,7 +3693,8 @@ ALTER TABLE `mostrecent`
 --
 ALTER TABLE `mr_qa`
   ADD PRIMARY KEY (`mrqa_id`),
-  ADD KEY `mriseries_id` (`mrseries_id`);
+  ADD UNIQUE KEY `mriseries_id` (`mrseries_id`),
+  ADD KEY `status` (`status`);
 
 --
 -- Indexes for table `mr_qcparams`
@@ -3629,6 +3720,7 @@ ALTER TABLE `mr_series`
   ADD KEY `series_desc` (`series_desc`),
   ADD KEY `series_protocol` (`series_protocol`),
   ADD KEY `series_tr` (`series_tr`),
+  ADD KEY `series_datetime` (`series_datetime`),
   ADD KEY `study_id` (`study_id`);
 
 --
@@ -3681,6 +3773,18 @@ ALTER TABLE `pipelines`
   ADD PRIMARY KEY (`pipeline_id`),
   ADD UNIQUE KEY `pipeline_name` (`pipeline_name`,`pipeline_version`);
 
+--
+-- Indexes for table `pipeline_candidates`
+--
+ALTER TABLE `pipeline_candidates`
+  ADD PRIMARY KEY (`pipeline_id`,`study_id`);
+
+--
+-- Indexes for table `pipeline_candidatescan`
+--
+ALTER TABLE `pipeline_candidatescan`
+  ADD PRIMARY KEY (`pipeline_id`);
+
 --
 -- Indexes for table `pipeline_data`
 --
@@ -4319,6 +4423,12 @@ ALTER TABLE `ct_series`
 ALTER TABLE `data_requests`
   MODIFY `request_id` int(11) NOT NULL AUTO_INCREMENT;
 
+--
+-- AUTO_INCREMENT for table `dirsize_index`
+--
+ALTER TABLE `dirsize_index`
+  MODIFY `dirsize_id` int(11) NOT NULL AUTO_INCREMENT;
+
 --
 -- AUTO_INCREMENT for table `drugnames`
 --
@@ -4397,6 +4507,12 @@ ALTER TABLE `families`
 ALTER TABLE `family_members`
   MODIFY `familymember_id` int(11) NOT NULL AUTO_INCREMENT;
 
+--
+-- AUTO_INCREMENT for table `fileio_deleted`
+--
+ALTER TABLE `fileio_deleted`
+  MODIFY `deleted_id` int(11) NOT NULL AUTO_INCREMENT;
+
 --
 -- AUTO_INCREMENT for table `fileio_requests`
 --
@@ -80,7 +80,7 @@
 	
 	/* determine action */
 	switch ($action) {
-		case 'viewjob': DisplayJob($id); break;
+		case 'viewjob': DisplayJob($id, GetVariable("task")); break;
 		case 'viewlists': DisplayPipelineLists($id, $listtype); break;
 		case 'viewanalyses': DisplayAnalysisList($id, $numperpage, $pagenum, $searchuid, $searchstatus, $searchsuccess, $sortby, $sortorder); break;
 		case 'viewfailedanalyses': DisplayFailedAnalysisList($id, $numperpage, $pagenum); break;
@@ -756,6 +756,7 @@
 					while ($row = mysqli_fetch_array($result, MYSQLI_ASSOC)) {
 						$analysis_id = $row['analysis_id'];
 						$analysis_qsubid = $row['analysis_qsubid'];
+						$analysis_qsubtaskid = $row['analysis_qsubtaskid'];
 						$analysis_status = $row['analysis_status'];
 						$analysis_numseries = $row['analysis_numseries'];
 						$analysis_statusmessage = $row['analysis_statusmessage'];
@@ -836,7 +837,7 @@
 						<?
 							if (($analysis_status == 'processing') && ($analysis_qsubid != 0)) {
 								?>
-								<a href="<?=$GLOBALS['cfg']['siteurl']?>/analysis.php?action=viewjob&id=<?=$analysis_qsubid?>" title="Click to view SGE status">processing</a>
+								<a href="<?=$GLOBALS['cfg']['siteurl']?>/analysis.php?action=viewjob&id=<?=$analysis_qsubid?>&task=<?=$analysis_qsubtaskid?>" title="Click to view SGE status">processing</a>
 								<!--<iframe src="ajaxapi.php?action=sgejobstatus&jobid=<?=$analysis_qsubid?>" width="25px" height="25px" style="border: 0px">No iframes available?</iframe>-->
 								<?
 							}
@@ -1633,11 +1634,17 @@
 	/* -------------------------------------------- */
 	/* ------- DisplayJob ------------------------- */
 	/* -------------------------------------------- */
-	function DisplayJob($id) {
-		if (($id == 0) || ($id == '')) {
+	function DisplayJob($id, $task) {
+		if (($id == 0) || ($id == '') || (!IsInteger($id))) {
 			echo "Invalid cluster job ID";
 		}
 		else {
+			/* analyses submitted together as an array job share the job ID. show this analysis' own task first */
+			if (($task != '') && (IsInteger($task))) {
+				$systemstring = "ssh " . $GLOBALS['cfg']['clustersubmithost'] . " \"qstat -g d | awk '\\\$1 == $id && \\\$NF == $task'\"";
+				$out = shell_exec($systemstring);
+				PrintVariable($out,"task $task of array job $id");
+			}
 			$systemstring = "ssh " . $GLOBALS['cfg']['clustersubmithost'] . " qstat -j $id";
 			$out = shell_exec($systemstring);
 			PrintVariable($out,'output');
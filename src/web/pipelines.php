@@ -837,6 +837,10 @@
 		$result = MySQLiQuery($sqlstring,__FILE__,__LINE__);
 		?><div align="center"><span class="message">Reset analyses: <?echo mysqli_affected_rows(); ?> analysis <b>data</b> rows deleted</span></div><?
 	
+		/* the studies become candidates for this pipeline again */
+		$sqlstring = "insert ignore into pipeline_candidates (pipeline_id, study_id) select pipeline_id, study_id from analysis where analysis_status in ('NoMatchingStudies', 'NoMatchingSeries') and pipeline_id = $id";
+		$result = MySQLiQuery($sqlstring,__FILE__,__LINE__);
+
 		$sqlstring = "delete from analysis where analysis_status in ('NoMatchingStudies', 'NoMatchingSeries') and pipeline_id = $id";
 		$result = MySQLiQuery($sqlstring,__FILE__,__LINE__);
 		?><div align="center"><span class="message">Reset analyses: <?echo mysqli_affected_rows(); ?> analysis rows deleted</span></div><?
@@ -1095,10 +1099,12 @@
 							<td valign="top"><textarea name="pipelinenotes" <?=$disabled?> rows="8" cols="60"><?=$pipelinenotes?></textarea></td>
 						</tr>
 						<tr>
-							<td class="label" valign="top">Data transfer method <img src="images/help.gif" title="<b>Data transfer method</b><br><br><b>NFS</b> copies via the the <tt>cp</tt> command assumes the filesystem you want to write to is mounted on this server<br><br>Copying via <b>scp</b> uses secure copy and assumes you have a passwordless login setup between this server and the one you are copying to"></td>
+							<td class="label" valign="top">Data transfer method <img src="images/help.gif" title="<b>Data transfer method</b><br><br><b>NFS</b> copies via the the <tt>cp</tt> command assumes the filesystem you want to write to is mounted on this server<br><br>Copying via <b>scp</b> uses secure copy and assumes you have a passwordless login setup between this server and the one you are copying to<br><br><b>Hardlink</b> and <b>symlink</b> link the input files to the archive instead of copying them, and require the analysis directory to be on the same storage. Linked inputs are made read-only and must not be modified by the pipeline. Hardlinks fall back to a (copy-on-write where supported) copy if the archive is on another filesystem"></td>
 							<td valign="top">
 								<input type="radio" name="pipelinedatacopymethod" id="datacopymethod1" value="nfs" <?=$disabled?> <? if (($datacopymethod == "nfs") || ($datacopymethod == "")) echo "checked"; ?>>NFS <span class="tiny">default</span><br>
 								<input type="radio" name="pipelinedatacopymethod" id="datacopymethod2" value="scp" <?=$disabled?> <? if ($datacopymethod == "scp") echo "checked"; ?>>scp <span class="tiny">requires passwordless ssh</span><br>
+								<input type="radio" name="pipelinedatacopymethod" id="datacopymethod3" value="hardlink" <?=$disabled?> <? if ($datacopymethod == "hardlink") echo "checked"; ?>>Hardlink <span class="tiny">same filesystem as the archive</span><br>
+								<input type="radio" name="pipelinedatacopymethod" id="datacopymethod4" value="symlink" <?=$disabled?> <? if ($datacopymethod == "symlink") echo "checked"; ?>>Symlink <span class="tiny">archive must be mounted on the cluster</span><br>
 							</td>
 						</tr>
 						<tr class="level1">
@@ -1109,8 +1115,9 @@
 							<datalist id="clustertypelist">
 								<option value="sge">
 								<option value="slurm">
+								<option value="local">
 							</datalist>
-							<td class="label" valign="top">Cluster type <img src="images/help.gif" title="<b>Cluster type</b><br><br>SGE (default) or slurm"></td>
+							<td class="label" valign="top">Cluster type <img src="images/help.gif" title="<b>Cluster type</b><br><br>SGE (default), slurm, or local. Local runs the jobs on the NiDB server, as many at a time as fit in its CPUs and memory"></td>
 							<td valign="top"><input type="text" name="pipelineclustertype" list="clustertypelist" <?=$disabled?> value="<?=$clustertype?>"></td>
 						</tr>
 						<tr>
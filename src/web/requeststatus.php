@@ -86,9 +86,9 @@
 	/* --------------------------------------------------- */
 	function ResetExport($exportid) {
 		if ($exportid > 0) {
-			$sqlstring = "update exports set status = 'submitted', log = '' where export_id = $exportid";
+			$sqlstring = "update exports set status = 'submitted', log = '', checkpoint_dir = null where export_id = $exportid";
 			$result = MySQLiQuery($sqlstring, __FILE__, __LINE__);
-			$sqlstring = "update exportseries set status = 'submitted' where export_id = $exportid";
+			$sqlstring = "update exportseries set status = 'submitted', checkpoint = '', checkpoint_zipoffset = 0 where export_id = $exportid";
 			$result = MySQLiQuery($sqlstring, __FILE__, __LINE__);
 			?><span class="staticmessage">Status reset for export [<?=$exportid?>]</span><?
 		}
@@ -116,9 +116,9 @@
 			$result = MySQLiQuery($sqlstring, __FILE__, __LINE__);
 		}
 		else {
-			$sqlstring = "update exports set status = 'submitted' where export_id = $exportid";
+			$sqlstring = "update exports set status = 'submitted', checkpoint_dir = null where export_id = $exportid";
 			$result = MySQLiQuery($sqlstring, __FILE__, __LINE__);
-			$sqlstring = "update exportseries set status = 'submitted' where export_id = $exportid";
+			$sqlstring = "update exportseries set status = 'submitted', checkpoint = '', checkpoint_zipoffset = 0 where export_id = $exportid";
 			$result = MySQLiQuery($sqlstring, __FILE__, __LINE__);
 		}
 		?><span class="staticmessage">Export <?=$exportid?> re-queued</span><?
@@ -72,12 +72,29 @@
     $c['mysqlclusterpassword'] = GetVariable("mysqlclusterpassword");
 
     $c['modulefileiothreads'] = GetVariable("modulefileiothreads");
+    $c['modulefileiocopythreads'] = GetVariable("modulefileiocopythreads");
+    $c['modulefileioreaprate'] = GetVariable("modulefileioreaprate");
+    $c['modulefileioreapthreads'] = GetVariable("modulefileioreapthreads");
+    $c['modulefileioretentiondays'] = GetVariable("modulefileioretentiondays");
     $c['moduleexportthreads'] = GetVariable("moduleexportthreads");
     $c['moduleimportthreads'] = GetVariable("moduleimportthreads");
+    $c['moduleminipipelineworkers'] = GetVariable("moduleminipipelineworkers");
+    $c['moduleminipipelinetimeout'] = GetVariable("moduleminipipelinetimeout");
+    $c['moduleminipipelinememory'] = GetVariable("moduleminipipelinememory");
     $c['modulemriqathreads'] = GetVariable("modulemriqathreads");
+    $c['modulemriqaworkers'] = GetVariable("modulemriqaworkers");
     $c['modulepipelinethreads'] = GetVariable("modulepipelinethreads");
+    $c['modulepipelinestagingthreads'] = GetVariable("modulepipelinestagingthreads");
+    $c['modulepipelinearraysize'] = GetVariable("modulepipelinearraysize");
+    $c['modulepipelinelocalcpus'] = GetVariable("modulepipelinelocalcpus");
+    $c['modulepipelinelocalmemory'] = GetVariable("modulepipelinelocalmemory");
+    $c['modulepipelinelocaljobcpus'] = GetVariable("modulepipelinelocaljobcpus");
+    $c['modulepipelinelocaljobmemory'] = GetVariable("modulepipelinelocaljobmemory");
+    $c['modulepipelinelocalcgroup'] = GetVariable("modulepipelinelocalcgroup");
+    $c['modulepipelinedepwait'] = GetVariable("modulepipelinedepwait");
     $c['moduleimportuploadedthreads'] = GetVariable("moduleimportuploadedthreads");
     $c['moduleqcthreads'] = GetVariable("moduleqcthreads");
+    $c['moduleqcbatchsize'] = GetVariable("moduleqcbatchsize");
 	
     $c['emaillib'] = GetVariable("emaillib");
     $c['emailusername'] = GetVariable("emailusername");
@@ -99,6 +116,8 @@
     $c['qsubpath'] = GetVariable("qsubpath");
     $c['clusteruser'] = GetVariable("clusteruser");
     $c['clusternidbpath'] = GetVariable("clusternidbpath");
+    $c['clustersshpersist'] = GetVariable("clustersshpersist");
+    $c['clustercheckinspool'] = GetVariable("clustercheckinspool");
 
     $c['version'] = GetVariable("version");
     $c['sitename'] = GetVariable("sitename");
@@ -293,12 +312,29 @@
 
 # ----- modules -----
 [modulefileiothreads] = $modulefileiothreads
+[modulefileiocopythreads] = $modulefileiocopythreads
+[modulefileioreaprate] = $modulefileioreaprate
+[modulefileioreapthreads] = $modulefileioreapthreads
+[modulefileioretentiondays] = $modulefileioretentiondays
 [moduleexportthreads] = $moduleexportthreads
 [moduleimportthreads] = $moduleimportthreads
+[moduleminipipelineworkers] = $moduleminipipelineworkers
+[moduleminipipelinetimeout] = $moduleminipipelinetimeout
+[moduleminipipelinememory] = $moduleminipipelinememory
 [modulemriqathreads] = $modulemriqathreads
+[modulemriqaworkers] = $modulemriqaworkers
 [modulepipelinethreads] = $modulepipelinethreads
+[modulepipelinestagingthreads] = $modulepipelinestagingthreads
+[modulepipelinearraysize] = $modulepipelinearraysize
+[modulepipelinelocalcpus] = $modulepipelinelocalcpus
+[modulepipelinelocalmemory] = $modulepipelinelocalmemory
+[modulepipelinelocaljobcpus] = $modulepipelinelocaljobcpus
+[modulepipelinelocaljobmemory] = $modulepipelinelocaljobmemory
+[modulepipelinelocalcgroup] = $modulepipelinelocalcgroup
+[modulepipelinedepwait] = $modulepipelinedepwait
 [moduleimportuploadedthreads] = $moduleimportuploadedthreads
 [moduleqcthreads] = $moduleqcthreads
+[moduleqcbatchsize] = $moduleqcbatchsize
 
 # ----- E-mail -----
 # emaillib options (case-sensitive): Net-SMTP-TLS (default), Email-Send-SMTP-Gmail
@@ -356,6 +392,8 @@
 [qsubpath] = $qsubpath
 [clusteruser] = $clusteruser
 [clusternidbpath] = $clusternidbpath
+[clustersshpersist] = $clustersshpersist
+[clustercheckinspool] = $clustercheckinspool
 
 # ----- CAS authentication -----
 [enablecas] = $enablecas
@@ -611,6 +649,30 @@
 				<td></td>
 				<td><b>fileio</b> module. Recommended is 2</td>
 			</tr>
+			<tr>
+				<td class="variable">modulefileiocopythreads</td>
+				<td><input type="number" name="modulefileiocopythreads" value="<?=$GLOBALS['cfg']['modulefileiocopythreads']?>"></td>
+				<td></td>
+				<td><b>fileio</b> module, parallel copy and delete threads within each process. Recommended is 4</td>
+			</tr>
+			<tr>
+				<td class="variable">modulefileioreaprate</td>
+				<td><input type="number" name="modulefileioreaprate" value="<?=$GLOBALS['cfg']['modulefileioreaprate']?>"></td>
+				<td></td>
+				<td><b>fileio</b> module, maximum files removed per second when cleaning up deleted data. 0 is unlimited</td>
+			</tr>
+			<tr>
+				<td class="variable">modulefileioreapthreads</td>
+				<td><input type="number" name="modulefileioreapthreads" value="<?=$GLOBALS['cfg']['modulefileioreapthreads']?>"></td>
+				<td></td>
+				<td><b>fileio</b> module, number of threads used to remove deleted data</td>
+			</tr>
+			<tr>
+				<td class="variable">modulefileioretentiondays</td>
+				<td><input type="number" name="modulefileioretentiondays" value="<?=$GLOBALS['cfg']['modulefileioretentiondays']?>"></td>
+				<td></td>
+				<td><b>fileio</b> module, days to keep deleted subjects, studies, and series in the deleteddir before removing them from disk. 0 keeps them indefinitely, which is the default, and requires the deleteddir to be on the same filesystem as the archive. Deleted analyses are always removed</td>
+			</tr>
 			<tr>
 				<td class="variable">moduleexportthreads</td>
 				<td><input type="number" name="moduleexportthreads" value="<?=$GLOBALS['cfg']['moduleexportthreads']?>"></td>
@@ -623,18 +685,90 @@
 				<td></td>
 				<td><b>import</b> module. Not multi-threaded.</td>
 			</tr>
+			<tr>
+				<td class="variable">moduleminipipelineworkers</td>
+				<td><input type="number" name="moduleminipipelineworkers" value="<?=$GLOBALS['cfg']['moduleminipipelineworkers']?>"></td>
+				<td></td>
+				<td>Number of mini-pipeline sandboxes run at the same time by each instance. 0 uses the CPU count divided by the number of instances</td>
+			</tr>
+			<tr>
+				<td class="variable">moduleminipipelinetimeout</td>
+				<td><input type="number" name="moduleminipipelinetimeout" value="<?=$GLOBALS['cfg']['moduleminipipelinetimeout']?>"></td>
+				<td></td>
+				<td>Time limit, in minutes, for each mini-pipeline script</td>
+			</tr>
+			<tr>
+				<td class="variable">moduleminipipelinememory</td>
+				<td><input type="number" name="moduleminipipelinememory" value="<?=$GLOBALS['cfg']['moduleminipipelinememory']?>"></td>
+				<td></td>
+				<td>Memory limit, in MB, for each mini-pipeline script. 0 for no limit</td>
+			</tr>
 			<tr>
 				<td class="variable">modulemriqathreads</td>
 				<td><input type="number" name="modulemriqathreads" value="<?=$GLOBALS['cfg']['modulemriqathreads']?>"></td>
 				<td></td>
 				<td><b>mriqa</b> module. Recommended is 4</td>
 			</tr>
+			<tr>
+				<td class="variable">modulemriqaworkers</td>
+				<td><input type="number" name="modulemriqaworkers" value="<?=$GLOBALS['cfg']['modulemriqaworkers']?>"></td>
+				<td></td>
+				<td>Number of QA workers within each mriqa instance. 0 to use one per core</td>
+			</tr>
 			<tr>
 				<td class="variable">modulepipelinethreads</td>
 				<td><input type="number" name="modulepipelinethreads" value="<?=$GLOBALS['cfg']['modulepipelinethreads']?>"></td>
 				<td></td>
 				<td><b>pipeline</b> module. Recommended is 4</td>
 			</tr>
+			<tr>
+				<td class="variable">modulepipelinestagingthreads</td>
+				<td><input type="number" name="modulepipelinestagingthreads" value="<?=$GLOBALS['cfg']['modulepipelinestagingthreads']?>"></td>
+				<td></td>
+				<td>Number of data staging workers within each pipeline instance. Recommended is 4</td>
+			</tr>
+			<tr>
+				<td class="variable">modulepipelinearraysize</td>
+				<td><input type="number" name="modulepipelinearraysize" value="<?=$GLOBALS['cfg']['modulepipelinearraysize']?>"></td>
+				<td></td>
+				<td>Number of analyses from a pipeline submitted together as one array job. 1 submits each analysis separately</td>
+			</tr>
+			<tr>
+				<td class="variable">modulepipelinelocalcpus</td>
+				<td><input type="number" name="modulepipelinelocalcpus" value="<?=$GLOBALS['cfg']['modulepipelinelocalcpus']?>"></td>
+				<td></td>
+				<td>Number of CPUs the local executor can use, for pipelines with a cluster type of local. Blank uses all of the CPUs on this server</td>
+			</tr>
+			<tr>
+				<td class="variable">modulepipelinelocalmemory</td>
+				<td><input type="number" name="modulepipelinelocalmemory" value="<?=$GLOBALS['cfg']['modulepipelinelocalmemory']?>"></td>
+				<td></td>
+				<td>Memory (MB) the local executor can use. Blank uses 90% of the memory on this server</td>
+			</tr>
+			<tr>
+				<td class="variable">modulepipelinelocaljobcpus</td>
+				<td><input type="number" name="modulepipelinelocaljobcpus" value="<?=$GLOBALS['cfg']['modulepipelinelocaljobcpus']?>"></td>
+				<td></td>
+				<td>CPUs reserved for each local pipeline job</td>
+			</tr>
+			<tr>
+				<td class="variable">modulepipelinelocaljobmemory</td>
+				<td><input type="number" name="modulepipelinelocaljobmemory" value="<?=$GLOBALS['cfg']['modulepipelinelocaljobmemory']?>"></td>
+				<td></td>
+				<td>Memory (MB) reserved for each local pipeline job. Blank does not check memory</td>
+			</tr>
+			<tr>
+				<td class="variable">modulepipelinelocalcgroup</td>
+				<td><input type="text" name="modulepipelinelocalcgroup" value="<?=$GLOBALS['cfg']['modulepipelinelocalcgroup']?>"></td>
+				<td></td>
+				<td>Run each local pipeline job in its own systemd scope limited to its CPUs and memory. Blank (no limits), system, or user</td>
+			</tr>
+			<tr>
+				<td class="variable">modulepipelinedepwait</td>
+				<td><input type="number" name="modulepipelinedepwait" value="<?=$GLOBALS['cfg']['modulepipelinedepwait']?>"></td>
+				<td></td>
+				<td>Minutes a pipeline waits for its parent pipeline's analyses to complete, after it has run out of studies, so their dependent studies are submitted in the same run. 0 does not wait</td>
+			</tr>
 			<tr>
 				<td class="variable">moduleimportuploadedthreads</td>
 				<td><input type="number" name="moduleimportuploadedthreads" value="1" disabled></td>
@@ -647,6 +781,12 @@
 				<td></td>
 				<td><b>qc</b> module. Recommended is 2</td>
 			</tr>
+			<tr>
+				<td class="variable">moduleqcbatchsize</td>
+				<td><input type="number" name="moduleqcbatchsize" value="<?=$GLOBALS['cfg']['moduleqcbatchsize']?>"></td>
+				<td></td>
+				<td>Number of series submitted together by the QC module, as one array job on the cluster</td>
+			</tr>
 
 			<tr>
 				<td class="heading"><br>Email</td>
@@ -921,6 +1061,18 @@
 				<td></td>
 				<td>Path to the directory containing the <i>nidb</i> executable (relative to the cluster itself) on the cluster</td>
 			</tr>
+			<tr>
+				<td class="variable">clustersshpersist</td>
+				<td><input type="number" name="clustersshpersist" value="<?=$GLOBALS['cfg']['clustersshpersist']?>"></td>
+				<td></td>
+				<td>Seconds an idle shared (ControlMaster) ssh connection to the submit host stays open. 0 opens a new connection for every command</td>
+			</tr>
+			<tr>
+				<td class="variable">clustercheckinspool</td>
+				<td><input type="text" name="clustercheckinspool" value="<?=$GLOBALS['cfg']['clustercheckinspool']?>"></td>
+				<td></td>
+				<td>Directory, visible to the cluster and this server, where cluster jobs write their check-ins. The pipeline module applies them in batches. Blank to have each check-in run nidb</td>
+			</tr>
 
 			<tr>
 				<td colspan="4" class="heading"><br>CAS Authentication</td>